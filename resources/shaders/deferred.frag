@@ -7,13 +7,27 @@ layout (location = 2) in vec3 worldPos;
 
 layout (set = 1, binding = 0) uniform sampler2D diffuse;
 
-layout (location = 0) out vec4 outPosition;
-layout (location = 1) out vec4 outNormal;
-layout (location = 2) out vec4 outAlbedo;
+layout (location = 0) out vec4 outNormal;
+layout (location = 1) out vec4 outAlbedo;
+#ifndef COMPACT_GBUFFER
+layout (location = 2) out vec4 outPosition;
+#endif
+
+// Octahedral mapping of a unit vector onto [-1, 1] in two components, must match phong.frag
+vec2 encodeNormal(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+
+	return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signs;
+}
 
 void main() {
-	outPosition = vec4(worldPos, 1.0);
+#ifdef COMPACT_GBUFFER
+	outNormal = vec4(encodeNormal(normalize(normal)), 0.0, 0.0);
+#else
 	outNormal = vec4(normal, 1.0);
+	outPosition = vec4(worldPos, 1.0);
+#endif
 	outAlbedo = texture(diffuse, texCoord);
 	//outAlbedo = vec4(1.0, 1.0, 1.0, 1.0);
 }
\ No newline at end of file
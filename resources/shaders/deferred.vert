@@ -15,16 +15,17 @@ layout (set = 0, binding = 0) uniform CameraBuffer {
 	mat4 viewProj;
 } cameraData;
 
-layout(push_constant) uniform constants {
-	vec4 data;
-	mat4 renderMatrix;
-} PushConstants;
+layout (std430, set = 2, binding = 0) readonly buffer InstanceBuffer {
+	mat4 instanceTransforms[];
+};
 
 void main() {
-	mat4 transformationMatrix = cameraData.viewProj *  PushConstants.renderMatrix;
+	// First instance is where the draw's transforms start
+	mat4 renderMatrix = instanceTransforms[gl_InstanceIndex];
+	mat4 transformationMatrix = cameraData.viewProj * renderMatrix;
 	
 	gl_Position = transformationMatrix * vec4(vPosition, 1.0f);
 	outUV = vUV;
 	outNormal = vNormal;
-	outWorldPosition = (PushConstants.renderMatrix *  vec4(vPosition, 1.0f)).xyz;
+	outWorldPosition = (renderMatrix * vec4(vPosition, 1.0f)).xyz;
 }
\ No newline at end of file
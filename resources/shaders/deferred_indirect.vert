@@ -0,0 +1,41 @@
+#version 460
+#extension GL_KHR_vulkan_glsl : enable
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec2 vUV;
+layout (location = 2) in vec3 vNormal;
+
+layout (location = 0) out vec2 outUV;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec3 outWorldPosition;
+
+layout (set = 0, binding = 0) uniform CameraBuffer {
+	mat4 view;
+	mat4 proj;
+	mat4 viewProj;
+} cameraData;
+
+struct DrawData {
+	mat4 transform;
+	vec4 boundingSphere;
+	uint indexCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint batchIndex;
+	uint visibilityId;
+};
+
+layout (std430, set = 2, binding = 0) readonly buffer DrawBuffer {
+	DrawData draws[];
+};
+
+void main() {
+	// The cull shader stores the draw index as the first instance
+	mat4 renderMatrix = draws[gl_InstanceIndex].transform;
+	mat4 transformationMatrix = cameraData.viewProj * renderMatrix;
+
+	gl_Position = transformationMatrix * vec4(vPosition, 1.0f);
+	outUV = vUV;
+	outNormal = vNormal;
+	outWorldPosition = (renderMatrix * vec4(vPosition, 1.0f)).xyz;
+}
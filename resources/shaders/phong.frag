@@ -1,6 +1,20 @@
 #version 460
 #extension GL_KHR_vulkan_glsl : enable
 
+layout (set = 0, binding = 0) uniform CameraBuffer {
+	mat4 view;
+	mat4 proj;
+	mat4 viewProj;
+	mat4 inverseViewProj;
+	// x: near plane, y: far plane
+	vec4 clipPlanes;
+} cameraData;
+
+// Must match LightClusters.hpp
+const uint CLUSTER_COUNT_X = 16;
+const uint CLUSTER_COUNT_Y = 9;
+const uint CLUSTER_COUNT_Z = 24;
+
 struct AttenuationFactors {
 	float constant;
 	float linear;
@@ -16,7 +30,8 @@ layout(std140, set = 0, binding = 2) readonly buffer PointLightBaseColours {
 	vec4 baseColours[];
 } pointLightBaseColours;
 
-layout(std140, set = 0, binding = 3) readonly buffer PointLightAttenuationFactors {
+// std430 so the array is tightly packed like AttenuationFactors on the CPU, std140 would pad each entry to 16 bytes
+layout(std430, set = 0, binding = 3) readonly buffer PointLightAttenuationFactors {
 	AttenuationFactors attenuationFactors[];
 } pointLightAttenuationFactors;
 
@@ -34,13 +49,37 @@ layout(std140, set = 0, binding = 6) readonly buffer LightInformation {
 	uint numberDirectionalLights;
 } lightingInfo;
 
+// Point lights reaching each cluster, as an offset and count into the index list
+layout(std430, set = 0, binding = 7) readonly buffer ClusterGrid {
+	uvec2 clusters[];
+} clusterGrid;
+
+layout(std430, set = 0, binding = 8) readonly buffer ClusterLightIndices {
+	uint lightIndices[];
+} clusterLightIndices;
+
 layout (location = 0) in vec2 texCoord;
 
 layout (location = 0) out vec4 outFragColour;
 
-layout (set = 1, binding = 0) uniform sampler2D positionTexture;
-layout (set = 1, binding = 1) uniform sampler2D normalTexture;
-layout (set = 1, binding = 2) uniform sampler2D albedoTexture;
+// G-buffer written by the previous subpass
+layout (input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput normalInput;
+layout (input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput albedoInput;
+#ifdef COMPACT_GBUFFER
+layout (input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput depthInput;
+#else
+layout (input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput positionInput;
+#endif
+
+// Inverse of the octahedral mapping in deferred.frag
+vec3 decodeNormal(vec2 encoded) {
+	vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -fold : fold;
+	n.y += n.y >= 0.0 ? -fold : fold;
+
+	return normalize(n);
+}
 
 float calculateAttenuation(uint index, vec3 pos) {
 	float len = length(pos - pointLightPositions.positions[index].xyz);
@@ -49,13 +88,28 @@ float calculateAttenuation(uint index, vec3 pos) {
 	return min(1 / (factors.constant + (factors.linear * len) + (factors.quadratic * len * len)), 1.0);
 }
 
+// Screen tile from the pixel, depth slice from its view space depth. Slices are exponential like in light_cluster.comp
+uint getClusterIndex(vec3 worldPos) {
+	float depth = -(cameraData.view * vec4(worldPos, 1.0)).z;
+	float nearPlane = cameraData.clipPlanes.x;
+	float farPlane = cameraData.clipPlanes.y;
+
+	uint slice = uint(clamp(log(max(depth, nearPlane) / nearPlane) / log(farPlane / nearPlane) * float(CLUSTER_COUNT_Z), 0.0, float(CLUSTER_COUNT_Z - 1)));
+	uvec2 tile = min(uvec2(texCoord * vec2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y)), uvec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+
+	return tile.x + (tile.y * CLUSTER_COUNT_X) + (slice * CLUSTER_COUNT_X * CLUSTER_COUNT_Y);
+}
+
+// Only the lights of the pixel's cluster are evaluated
 vec3 applyPointLights(vec3 baseColour, vec3 worldPos, vec3 normal) {
     vec3 result = vec3(0);
+	uvec2 cluster = clusterGrid.clusters[getClusterIndex(worldPos)];
 
-	for (uint i = 0; i < lightingInfo.numberPointLights; i++) {
+	for (uint j = 0; j < cluster.y; j++) {
+		uint i = clusterLightIndices.lightIndices[cluster.x + j];
 		vec3 lightPos = pointLightPositions.positions[i].xyz;
 
-		float attenuation = calculateAttenuation(i, lightPos);
+		float attenuation = calculateAttenuation(i, worldPos);
 
 		vec3 lightDir = normalize(worldPos - lightPos);
 		float diff = max(dot(normal, -lightDir), 0.0);
@@ -81,9 +135,25 @@ vec3 applyDirectionalLights(vec3 baseColour, vec3 normal) {
 }
 
 void main() {
-	vec3 colour = texture(albedoTexture, texCoord).rgb;
-	vec3 worldPos = texture(positionTexture, texCoord).rgb;
-	vec3 normal = texture(normalTexture, texCoord).rgb;
+	vec3 colour = subpassLoad(albedoInput).rgb;
+
+#ifdef COMPACT_GBUFFER
+	float depth = subpassLoad(depthInput).r;
+
+	// Nothing was drawn here
+	if (depth >= 1.0) {
+		outFragColour = vec4(colour * 0.01, 1.0f);
+		return;
+	}
+
+	// The full screen triangle's texture coordinates are the pixel's position in normalised device coordinates
+	vec4 worldPosition = cameraData.inverseViewProj * vec4((texCoord * 2.0) - 1.0, depth, 1.0);
+	vec3 worldPos = worldPosition.xyz / worldPosition.w;
+	vec3 normal = decodeNormal(subpassLoad(normalInput).xy);
+#else
+	vec3 worldPos = subpassLoad(positionInput).rgb;
+	vec3 normal = subpassLoad(normalInput).rgb;
+#endif
 
 	/*for (uint i = 0; i < lightingInfo.numberDirectionalLights; i++) {
 		vec3 lightDir = normalize(directionalLightDirections.directions[i].xyz);
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Entity index plus the generation it was created in. A handle goes stale once its entity is destroyed
+struct EntityHandle {
+	uint32_t index;
+	uint32_t generation;
+
+	bool operator==(const EntityHandle& other) const {
+		return this->index == other.index && this->generation == other.generation;
+	}
+};
+
+constexpr uint32_t INVALID_ENTITY_INDEX = UINT32_MAX;
+constexpr EntityHandle INVALID_ENTITY_HANDLE = { INVALID_ENTITY_INDEX, 0 };
+
+// Components packed densely for iteration, with a sparse entity index to dense slot lookup.
+// Removal swaps the last component into the hole so the dense array never has gaps
+template<typename T>
+class ComponentArray {
+	std::vector<T> components;
+	std::vector<uint32_t> denseToEntity;
+	std::vector<uint32_t> entityToDense;
+
+public:
+	bool has(uint32_t entityIndex) const {
+		return entityIndex < this->entityToDense.size() && this->entityToDense[entityIndex] != INVALID_ENTITY_INDEX;
+	}
+
+	T* insert(uint32_t entityIndex, const T& component) {
+		if (entityIndex >= this->entityToDense.size()) {
+			this->entityToDense.resize(entityIndex + 1, INVALID_ENTITY_INDEX);
+		}
+
+		if (this->has(entityIndex)) {
+			T* existing = &this->components[this->entityToDense[entityIndex]];
+			*existing = component;
+			return existing;
+		}
+
+		this->entityToDense[entityIndex] = static_cast<uint32_t>(this->components.size());
+		this->components.push_back(component);
+		this->denseToEntity.push_back(entityIndex);
+
+		return &this->components.back();
+	}
+
+	void remove(uint32_t entityIndex) {
+		if (!this->has(entityIndex)) {
+			return;
+		}
+
+		uint32_t slot = this->entityToDense[entityIndex];
+		uint32_t lastSlot = static_cast<uint32_t>(this->components.size() - 1);
+
+		if (slot != lastSlot) {
+			this->components[slot] = std::move(this->components[lastSlot]);
+			this->denseToEntity[slot] = this->denseToEntity[lastSlot];
+			this->entityToDense[this->denseToEntity[slot]] = slot;
+		}
+
+		this->components.pop_back();
+		this->denseToEntity.pop_back();
+		this->entityToDense[entityIndex] = INVALID_ENTITY_INDEX;
+	}
+
+	T* get(uint32_t entityIndex) {
+		return this->has(entityIndex) ? &this->components[this->entityToDense[entityIndex]] : nullptr;
+	}
+
+	const T* get(uint32_t entityIndex) const {
+		return this->has(entityIndex) ? &this->components[this->entityToDense[entityIndex]] : nullptr;
+	}
+
+	size_t size() const {
+		return this->components.size();
+	}
+
+	// Dense storage, valid until the next insert or remove
+	T* data() {
+		return this->components.data();
+	}
+
+	std::vector<T>* getComponents() {
+		return &this->components;
+	}
+
+	uint32_t getEntityIndex(size_t slot) const {
+		return this->denseToEntity[slot];
+	}
+};
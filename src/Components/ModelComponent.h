@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <memory>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -8,6 +9,8 @@
 
 #include <assimp/material.h>
 
+class MappedFile;
+
 enum TextureType {
 	Diffuse,
 	Specular,
@@ -25,10 +28,27 @@ struct ModelResource {
 	size_t modelRenderComponentId;
 	size_t modelDetailsId;
 	size_t materialGroupId;
+	// Ticket of the transfer uploading the model buffers. Buffers must not be used before it completes
+	uint64_t uploadTicket;
 	uint64_t flags;
 };
 
+// Tags entities that are drawn
+struct RenderableComponent {
+	uint8_t visible;
+};
+
+// One model instance to draw this frame
+struct RenderObject {
+	ModelResource modelResource;
+	// World transform of the entity, each mesh adds its own node transform on top
+	glm::mat4 transform;
+	// Same for the same object every frame, so the renderer can remember what was visible last frame
+	uint32_t visibilityId;
+};
+
 struct ModelDetails {
+	// Mesh space to model space, the node transforms from the mesh up to the scene root
 	std::vector<glm::mat4> meshMatrices;
 	std::string directory;
 };
@@ -46,14 +66,68 @@ typedef struct MeshComponents {
 	// std::vector<TextureID> specularTextures;
 } MeshComponents;
 
+// Location of a mesh inside the geometry pool
+struct MeshRange {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+	uint32_t vertexCount;
+};
+
+// Model space bounds of a mesh, computed when the model is loaded
+struct MeshBounds {
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+	glm::vec3 sphereCenter;
+	float sphereRadius;
+};
+
 struct ModelRenderComponents {
-	std::vector<AllocatedBuffer> VertexPositionBuffers;
-	std::vector<AllocatedBuffer> IndexBuffers;
-	std::vector<AllocatedBuffer> TextureCoordBuffers;
-	std::vector<AllocatedBuffer> NormalBuffers;
-	std::vector<AllocatedBuffer> ColourBuffers;
+	std::vector<MeshRange> meshRanges;
+	// One per mesh range
+	std::vector<MeshBounds> meshBounds;
+	// One per mesh range, mesh space to model space. Bounds stay in mesh space
+	std::vector<glm::mat4> meshTransforms;
+};
+
+// Read only view of the geometry of one mesh
+struct MeshStreamView {
+	const glm::vec3* positions;
+	const glm::vec3* normals;
+	const glm::vec2* texCoords;
+	const glm::vec3* tangents;
+	const uint32_t* indices;
+	uint32_t vertexCount;
+	uint32_t indexCount;
 };
 
 struct ModelComponent {
 	MeshComponents meshes;
+	// Set when the model was loaded from a cooked file. The geometry vectors in meshes are then empty and
+	// cookedMeshes point into the mapping, which stays alive for as long as the component does
+	std::shared_ptr<MappedFile> cookedMapping;
+	std::vector<MeshStreamView> cookedMeshes;
+	// Filled for imported and cooked models alike
+	std::vector<MeshBounds> meshBounds;
+
+	size_t meshCount() const {
+		return this->cookedMapping ? this->cookedMeshes.size() : this->meshes.vertices.size();
+	}
+
+	MeshStreamView meshStreams(size_t meshIndex) const {
+		if (this->cookedMapping) {
+			return this->cookedMeshes[meshIndex];
+		}
+
+		MeshStreamView view{};
+		view.positions = this->meshes.vertices[meshIndex].data();
+		view.normals = this->meshes.normals[meshIndex].data();
+		view.texCoords = this->meshes.texCoords[meshIndex].data();
+		view.tangents = this->meshes.tangent[meshIndex].data();
+		view.indices = this->meshes.indices[meshIndex].data();
+		view.vertexCount = static_cast<uint32_t>(this->meshes.vertices[meshIndex].size());
+		view.indexCount = static_cast<uint32_t>(this->meshes.indices[meshIndex].size());
+
+		return view;
+	}
 };
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "Camera.hpp"
 #include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
 #include <SDL_scancode.h>
 
+constexpr float CAMERA_FIELD_OF_VIEW_DEGREES = 70.0f;
+constexpr float CAMERA_NEAR_PLANE = 0.1f;
+constexpr float CAMERA_FAR_PLANE = 200.0f;
+
 void Camera::updateCamera(float deltaS, const uint8_t* currentKeyStates) {
     const float speed = 10 * deltaS;
 
@@ -33,6 +38,21 @@ glm::mat4 Camera::generateView() {
 	return glm::lookAt(this->position, this->position + this->lookAt, this->up);
 }
 
+glm::mat4 Camera::generateProjection(float aspectRatio) {
+	glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FIELD_OF_VIEW_DEGREES), aspectRatio, CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
+	projection[1][1] *= -1;
+
+	return projection;
+}
+
+float Camera::getNearPlane() {
+	return CAMERA_NEAR_PLANE;
+}
+
+float Camera::getFarPlane() {
+	return CAMERA_FAR_PLANE;
+}
+
 glm::vec3 Camera::getPosition() {
 	return this->position;
 }
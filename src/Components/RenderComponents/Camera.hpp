@@ -13,6 +13,10 @@ struct Camera {
 	void updateCamera(float deltaS, const uint8_t* currentKeyStates);
 	void updateLookDirection(float pitchChange, float yawChange);
 	glm::mat4 generateView();
+	// Vulkan clip space, with y pointing down
+	glm::mat4 generateProjection(float aspectRatio);
+	float getNearPlane();
+	float getFarPlane();
 	glm::vec3 getPosition();
 	void setPosition(glm::vec3 pos);
 };
\ No newline at end of file
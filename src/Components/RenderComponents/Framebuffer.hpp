@@ -8,13 +8,26 @@ struct FramebufferAttachment {
 	VkImageAspectFlags aspectMask;
 };
 
+// Attachments one subpass writes and reads
+struct FramebufferSubpass {
+	std::vector<VkAttachmentReference> colourAttachmentReferences;
+	std::vector<VkAttachmentReference> inputAttachmentReferences;
+	bool useDepth;
+};
+
 struct Framebuffer {
 	uint32_t width, height;
+	// One per frame in flight and image of the external attachment, at frame * imageCount + image
 	std::vector<VkFramebuffer> framebuffer;
+	// Attachments created elsewhere (ie. Swapchain images) have an image per swapchain image rather than per frame
+	std::vector<uint32_t> externalAttachments;
+	size_t imageCount = 1;
 	std::vector<std::vector<FramebufferAttachment>> framebufferAttachments;
 	std::vector<VkAttachmentDescription> framebufferAttachmentDescriptions;
 	std::vector<VkAttachmentReference> framebufferAttachmentReferences;
 	VkAttachmentReference depthAttachmentReference;
+	// Empty for render passes with a single subpass writing every attachment
+	std::vector<FramebufferSubpass> subpasses;
 	VkRenderPass renderPass;
 	VkSampler attachmentSampler;
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "VulkanPipeline.hpp"
 #include "VulkanPipeline.hpp"
 #include "VulkanPipeline.hpp"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <fstream>
@@ -45,10 +46,14 @@ std::vector<char> PipelineBuilder::readCompiledFile(const char* filepath) {
 	return buffer;
 }
 
-std::vector<uint32_t> PipelineBuilder::compileShader(const std::string& name, shaderc_shader_kind kind, const std::string& source, bool optimise) {
+std::vector<uint32_t> PipelineBuilder::compileShader(const std::string& name, shaderc_shader_kind kind, const std::string& source, const std::vector<std::string>& definitions, bool optimise) {
 	shaderc::Compiler compiler;
 	shaderc::CompileOptions options;
 
+	for (auto& definition : definitions) {
+		options.AddMacroDefinition(definition);
+	}
+
 	if (optimise) {
 		options.SetOptimizationLevel(shaderc_optimization_level_performance);
 	}
@@ -64,8 +69,8 @@ std::vector<uint32_t> PipelineBuilder::compileShader(const std::string& name, sh
 }
 
 
-VkShaderModule PipelineBuilder::createShaderModule(VkDevice device, std::string name, shaderc_shader_kind kind, std::string code, std::string path) {
-	auto spirv = this->compileShader(name, kind, code, false);
+VkShaderModule PipelineBuilder::createShaderModule(VkDevice device, std::string name, shaderc_shader_kind kind, std::string code, const std::vector<std::string>& definitions, std::string path) {
+	auto spirv = this->compileShader(name, kind, code, definitions, false);
 
 	// As compiling again, delete old file and save new one
 	std::ofstream file(path, std::ios::trunc | std::ios::binary);
@@ -129,7 +134,7 @@ void PipelineBuilder::setupFramebuffer(FramebufferSetupData framebufferSetupData
 	this->framebuffer.height = framebufferSetupData.height;
 }
 
-void PipelineBuilder::addFramebufferAttachment(VkDevice device, VmaAllocator allocator, VkFormat format, VkImageUsageFlagBits usage, VkExtent3D extent, size_t frameOverlaps) {
+void PipelineBuilder::addFramebufferAttachment(VkDevice device, VmaAllocator allocator, VkFormat format, VkImageUsageFlags usage, VkExtent3D extent, size_t frameOverlaps) {
 	FramebufferAttachment attachment{};
 	
 	VkImageAspectFlags aspectMask = 0;
@@ -140,26 +145,42 @@ void PipelineBuilder::addFramebufferAttachment(VkDevice device, VmaAllocator all
 		aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	} else if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) {
-		aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+		// Depth only views can also be read as input attachments
+		bool hasStencil = format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+		aspectMask = hasStencil ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT;
 		imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	}
 
 	assert(aspectMask > 0);
 
-	VkImageCreateInfo framebufferAttachmentImageInfo = VulkanUtility::imageCreateInfo(format, usage | VK_IMAGE_USAGE_SAMPLED_BIT, extent);
+	// Transient images can only be used as attachments
+	bool transient = usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+	VkImageCreateInfo framebufferAttachmentImageInfo = VulkanUtility::imageCreateInfo(format, transient ? usage : usage | VK_IMAGE_USAGE_SAMPLED_BIT, extent);
 	VmaAllocationCreateInfo vmaAllocInfo{};
-	vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	vmaAllocInfo.usage = transient ? VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED : VMA_MEMORY_USAGE_GPU_ONLY;
 	vmaAllocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
 	std::vector<FramebufferAttachment> newFramebufferAttachments{};
 	newFramebufferAttachments.resize(frameOverlaps);
 
 	for (auto i = 0; i < frameOverlaps; i++) {
-		vmaCreateImage(allocator, &framebufferAttachmentImageInfo, &vmaAllocInfo, &newFramebufferAttachments[i].image.image, &newFramebufferAttachments[i].image.allocation, nullptr);
+		VkResult result = vmaCreateImage(allocator, &framebufferAttachmentImageInfo, &vmaAllocInfo, &newFramebufferAttachments[i].image.image, &newFramebufferAttachments[i].image.allocation, nullptr);
+
+		// Most desktop GPUs have no lazily allocated memory
+		if (result == VK_ERROR_FEATURE_NOT_PRESENT && transient) {
+			vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			result = vmaCreateImage(allocator, &framebufferAttachmentImageInfo, &vmaAllocInfo, &newFramebufferAttachments[i].image.image, &newFramebufferAttachments[i].image.allocation, nullptr);
+		}
+
+		if (result) {
+			std::cout << "Detected Vulkan error while creating framebuffer attachment image: " << result << std::endl;
+			abort();
+		}
 
 		VkImageViewCreateInfo framebufferAttachmentImageInfo = VulkanUtility::imageViewCreateInfo(format, newFramebufferAttachments[i].image.image, aspectMask);
 		
-		VkResult result = vkCreateImageView(device, &framebufferAttachmentImageInfo, nullptr, &newFramebufferAttachments[i].image.imageView);
+		result = vkCreateImageView(device, &framebufferAttachmentImageInfo, nullptr, &newFramebufferAttachments[i].image.imageView);
 
 		if (result) {
 			std::cout << "Detected Vulkan error while creating image view for framebuffer attachment: " << result << std::endl;
@@ -175,19 +196,20 @@ void PipelineBuilder::addFramebufferAttachment(VkDevice device, VmaAllocator all
 	VkAttachmentDescription framebufferAttachmentDescription{};
 	framebufferAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
 	framebufferAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	framebufferAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	framebufferAttachmentDescription.storeOp = transient ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
 	framebufferAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	framebufferAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
+	uint32_t attachmentIndex = static_cast<uint32_t>(this->framebuffer.framebufferAttachmentDescriptions.size());
+
 	if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) {
 		framebufferAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		framebufferAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		this->framebuffer.framebufferAttachmentReferences.push_back({ static_cast<uint32_t>(this->framebuffer.framebufferAttachmentReferences.size()), imageLayout });
+		this->framebuffer.framebufferAttachmentReferences.push_back({ attachmentIndex, imageLayout });
 	} else if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) {
 		framebufferAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		framebufferAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-		// ASSUMES DEPTH ATTACHMENT IS THE LAST ATTACHMENT ADDED AS THIS HAS TO BE THE CASE
-		this->framebuffer.depthAttachmentReference = { static_cast<uint32_t>(this->framebuffer.framebufferAttachmentReferences.size()), imageLayout };
+		this->framebuffer.depthAttachmentReference = { attachmentIndex, imageLayout };
 	}
 
 	framebufferAttachmentDescription.format = format;
@@ -195,52 +217,50 @@ void PipelineBuilder::addFramebufferAttachment(VkDevice device, VmaAllocator all
 	this->framebuffer.framebufferAttachmentDescriptions.push_back(framebufferAttachmentDescription);
 }
 
+void PipelineBuilder::addShaderStage(VkDevice device, const char* path, const std::vector<std::string>& definitions, VkShaderStageFlagBits stage, shaderc_shader_kind kind, const char* stageName) {
+	std::string shaderPath = path;
+	auto shaderCompiledPath = shaderPath;
+	VkShaderModule shaderModule;
+
+	for (auto& definition : definitions) {
+		shaderCompiledPath += "." + definition;
+	}
+
+	shaderCompiledPath += ".spv";
+
+	if (!std::filesystem::exists(shaderCompiledPath) || std::filesystem::last_write_time(path) > std::filesystem::last_write_time(shaderCompiledPath)) {
+		// Need to compile
+		std::cout << "Compiling " << stageName << " shader: " << shaderPath << std::endl;
+		auto code = this->readFile(path);
+		shaderModule = this->createShaderModule(device, std::string(stageName) + "Shader", kind, code, definitions, shaderCompiledPath);
+	} else {
+		std::cout << "Reading compiled " << stageName << " shader: " << shaderCompiledPath << std::endl;
+		auto code = this->readCompiledFile(shaderCompiledPath.c_str());
+		shaderModule = this->createShaderModule(device, std::string(stageName) + "Shader", kind, std::move(code));
+	}
+
+	auto shaderStageCreateInfo = VulkanUtility::pipelineShaderStageCreateInfo(stage, shaderModule);
+	this->shaderStages.push_back(shaderStageCreateInfo);
+}
+
 void PipelineBuilder::addShaders(VkDevice device, ShaderInfo* shaderInfo) {
 	this->shaderStages.clear();
 
 	if (shaderInfo->flags & VkShaderStageFlagBits::VK_SHADER_STAGE_VERTEX_BIT) {
-		std::string shaderVertexPath = shaderInfo->vertexShaderPath;
-		auto shaderCompiledPath = shaderVertexPath + ".spv";
-
-		if (!std::filesystem::exists(shaderCompiledPath) || std::filesystem::last_write_time(shaderInfo->vertexShaderPath) > std::filesystem::last_write_time(shaderCompiledPath)) {
-			// Need to compile
-			std::cout << "Compiling vertex shader: " << shaderVertexPath << std::endl;
-			auto vertexCode = this->readFile(shaderInfo->vertexShaderPath);
-
-			auto vertexShaderModule = this->createShaderModule(device, "vertexShader", shaderc_vertex_shader, vertexCode, shaderCompiledPath);
-			auto shaderStageCreateInfo = VulkanUtility::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vertexShaderModule);
-			this->shaderStages.push_back(shaderStageCreateInfo);
-		} else {
-			std::cout << "Reading compiled vertex shader: " << shaderCompiledPath << std::endl;
-			auto vertexCode = this->readCompiledFile(shaderCompiledPath.c_str());
-			auto vertexShaderModule = this->createShaderModule(device, "vertexShader", shaderc_vertex_shader, std::move(vertexCode));
-			auto shaderStageCreateInfo = VulkanUtility::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, vertexShaderModule);
-			this->shaderStages.push_back(shaderStageCreateInfo);
-		}
+		this->addShaderStage(device, shaderInfo->vertexShaderPath, shaderInfo->definitions, VK_SHADER_STAGE_VERTEX_BIT, shaderc_vertex_shader, "vertex");
 	}
 
 	if (shaderInfo->flags & VkShaderStageFlagBits::VK_SHADER_STAGE_FRAGMENT_BIT) {
-		std::string shaderFragmentPath = shaderInfo->fragmentShaderPath;
-		auto shaderCompiledPath = shaderFragmentPath + ".spv";
-
-		if (!std::filesystem::exists(shaderCompiledPath) || std::filesystem::last_write_time(shaderInfo->fragmentShaderPath) > std::filesystem::last_write_time(shaderCompiledPath)) {
-			std::cout << "Compiling fragment shader: " << shaderFragmentPath << std::endl;
-			auto fragmentCode = this->readFile(shaderInfo->fragmentShaderPath);
-			auto fragmentShaderModule = this->createShaderModule(device, "fragmentShader", shaderc_fragment_shader, fragmentCode, shaderCompiledPath);
-			auto shaderStageCreateInfo = VulkanUtility::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShaderModule);
-			this->shaderStages.push_back(shaderStageCreateInfo);
-		} else {
-			std::cout << "Reading compiled fragment shader: " << shaderCompiledPath << std::endl;
-			auto fragmentCode = this->readCompiledFile(shaderCompiledPath.c_str());
-			auto fragmentShaderModule = this->createShaderModule(device, "fragmentShader", shaderc_fragment_shader, std::move(fragmentCode));
-			auto shaderStageCreateInfo = VulkanUtility::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShaderModule);
-			this->shaderStages.push_back(shaderStageCreateInfo);
-		}
+		this->addShaderStage(device, shaderInfo->fragmentShaderPath, shaderInfo->definitions, VK_SHADER_STAGE_FRAGMENT_BIT, shaderc_fragment_shader, "fragment");
+	}
+
+	if (shaderInfo->flags & VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT) {
+		this->addShaderStage(device, shaderInfo->computeShaderPath, shaderInfo->definitions, VK_SHADER_STAGE_COMPUTE_BIT, shaderc_compute_shader, "compute");
 	}
 }
 
 
-void PipelineBuilder::addFramebufferAttachment(VkDevice device, std::vector<VkImageView> attachmentImageViews, VkFormat format, VkImageUsageFlagBits usage, VkExtent3D extent, size_t frameOverlaps) {
+void PipelineBuilder::addFramebufferAttachment(VkDevice device, std::vector<VkImageView> attachmentImageViews, VkFormat format, VkImageUsageFlagBits usage, VkExtent3D extent) {
 	FramebufferAttachment attachment{};
 
 	VkImageAspectFlags aspectMask = 0;
@@ -261,15 +281,20 @@ void PipelineBuilder::addFramebufferAttachment(VkDevice device, std::vector<VkIm
 	vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 	vmaAllocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
+	// Only one set of external images is supported
+	assert(this->framebuffer.externalAttachments.empty());
+
 	std::vector<FramebufferAttachment> newFramebufferAttachments{};
-	newFramebufferAttachments.resize(frameOverlaps);
+	newFramebufferAttachments.resize(attachmentImageViews.size());
 
-	for (auto i = 0; i < frameOverlaps; i++) {
+	for (auto i = 0; i < attachmentImageViews.size(); i++) {
 		newFramebufferAttachments[i].image.imageView = attachmentImageViews[i];
 		newFramebufferAttachments[i].format = format;
 		newFramebufferAttachments[i].aspectMask = aspectMask;
 	}
 
+	this->framebuffer.externalAttachments.push_back(static_cast<uint32_t>(this->framebuffer.framebufferAttachments.size()));
+	this->framebuffer.imageCount = attachmentImageViews.size();
 	this->framebuffer.framebufferAttachments.push_back(newFramebufferAttachments);
 
 	VkAttachmentDescription framebufferAttachmentDescription{};
@@ -282,7 +307,7 @@ void PipelineBuilder::addFramebufferAttachment(VkDevice device, std::vector<VkIm
 	// TODO: Make flags for what type of initial and final layouts are going to be used. Maybe use templates.
 	framebufferAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	framebufferAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-	this->framebuffer.framebufferAttachmentReferences.push_back({ static_cast<uint32_t>(this->framebuffer.framebufferAttachmentReferences.size()), imageLayout });
+	this->framebuffer.framebufferAttachmentReferences.push_back({ static_cast<uint32_t>(this->framebuffer.framebufferAttachmentDescriptions.size()), imageLayout });
 
 	framebufferAttachmentDescription.format = format;
 
@@ -317,32 +342,54 @@ VkDescriptorSetLayout PipelineBuilder::createPipelineSetLayout(VkDevice device,
 	return this->pipelineSetLayout;
 }
 
+void PipelineBuilder::addSubpass(const std::vector<uint32_t>& colourAttachments, const std::vector<uint32_t>& inputAttachments, bool useDepth) {
+	FramebufferSubpass subpass{};
+	subpass.useDepth = useDepth;
+
+	for (auto attachment : colourAttachments) {
+		subpass.colourAttachmentReferences.push_back({ attachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+	}
+
+	for (auto attachment : inputAttachments) {
+		bool depth = (this->framebuffer.framebufferAttachments[attachment][0].aspectMask & VK_IMAGE_ASPECT_DEPTH_BIT) != 0;
+		subpass.inputAttachmentReferences.push_back({ attachment, depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+	}
+
+	this->framebuffer.subpasses.push_back(std::move(subpass));
+}
+
 // TODO: Write and update descriptor sets
 
-Pipeline PipelineBuilder::buildPipeline(VkDevice device, PipelineUsage pipelineUsage, size_t frameOverlap) {
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.pNext = nullptr;
+VkRenderPass PipelineBuilder::createRenderPass(VkDevice device, const Framebuffer* framebuffer, const std::vector<VkAttachmentDescription>* attachmentDescriptions) {
+	// Build render subpasses
+	std::vector<VkSubpassDescription> subpasses{};
 
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &this->viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &this->scissor;
+	if (framebuffer->subpasses.empty()) {
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.pColorAttachments = framebuffer->framebufferAttachmentReferences.data();
+		subpass.colorAttachmentCount = framebuffer->framebufferAttachmentReferences.size();
+		subpass.pDepthStencilAttachment = &framebuffer->depthAttachmentReference;
+
+		subpasses.push_back(subpass);
+	}
+
+	for (auto& framebufferSubpass : framebuffer->subpasses) {
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.pColorAttachments = framebufferSubpass.colourAttachmentReferences.data();
+		subpass.colorAttachmentCount = framebufferSubpass.colourAttachmentReferences.size();
+		subpass.pInputAttachments = framebufferSubpass.inputAttachmentReferences.data();
+		subpass.inputAttachmentCount = framebufferSubpass.inputAttachmentReferences.size();
+		subpass.pDepthStencilAttachment = framebufferSubpass.useDepth ? &framebuffer->depthAttachmentReference : nullptr;
 
-	// Setup dummy blending. Dont have transparent objects yet
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.pNext = nullptr;
+		subpasses.push_back(subpass);
+	}
 
-	// Build render subpass
-	VkSubpassDescription subpass{};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.pColorAttachments = this->framebuffer.framebufferAttachmentReferences.data();
-	subpass.colorAttachmentCount = this->framebuffer.framebufferAttachmentReferences.size();
-	subpass.pDepthStencilAttachment = &this->framebuffer.depthAttachmentReference;
+	uint32_t lastSubpass = static_cast<uint32_t>(subpasses.size() - 1);
 
 	// Subpass dependencies
-	std::array<VkSubpassDependency, 2> dependencies{};
+	std::vector<VkSubpassDependency> dependencies(subpasses.size() + 1);
 	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependencies[0].dstSubpass = 0;
 	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
@@ -351,81 +398,75 @@ Pipeline PipelineBuilder::buildPipeline(VkDevice device, PipelineUsage pipelineU
 	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 	dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-	dependencies[1].dstSubpass = 0;
-	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	// Each subpass reads what the one before it wrote at the same pixel, so the attachments can stay in tile memory
+	for (uint32_t i = 0; i < lastSubpass; i++) {
+		VkSubpassDependency* dependency = &dependencies[i + 1];
+		dependency->srcSubpass = i;
+		dependency->dstSubpass = i + 1;
+		dependency->srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		dependency->dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependency->srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		dependency->dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+		dependency->dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	}
+
+	VkSubpassDependency* exitDependency = &dependencies.back();
+	exitDependency->srcSubpass = lastSubpass;
+	exitDependency->dstSubpass = VK_SUBPASS_EXTERNAL;
+	exitDependency->srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	exitDependency->dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	exitDependency->srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	exitDependency->dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	exitDependency->dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
 	VkRenderPassCreateInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassInfo.pNext = nullptr;
-	renderPassInfo.attachmentCount = this->framebuffer.framebufferAttachmentDescriptions.size();
-	renderPassInfo.pAttachments = this->framebuffer.framebufferAttachmentDescriptions.data();
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.attachmentCount = attachmentDescriptions->size();
+	renderPassInfo.pAttachments = attachmentDescriptions->data();
+	renderPassInfo.subpassCount = subpasses.size();
+	renderPassInfo.pSubpasses = subpasses.data();
 	renderPassInfo.dependencyCount = dependencies.size();
 	renderPassInfo.pDependencies = dependencies.data();
 
-	auto result = vkCreateRenderPass(device, &renderPassInfo, nullptr, &this->framebuffer.renderPass);
+	VkRenderPass renderPass;
+	auto result = vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
 
 	if (result) {
 		std::cout << "Failed to create deferred render pass: " << result << std::endl;
 		abort();
 	}
 
-	for (auto i = 0; i < frameOverlap; i++) {
-		size_t numberAttachments = this->framebuffer.framebufferAttachments.size();
-
-		std::vector<VkImageView> attachments{};
-		attachments.resize(numberAttachments);
-
-		for (auto j = 0; j < numberAttachments; j++) {
-			attachments[j] = this->framebuffer.framebufferAttachments[j][i].image.imageView;
-		}
-
-		VkFramebufferCreateInfo fbCreateInfo{};
-		fbCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		fbCreateInfo.pNext = nullptr;
-		fbCreateInfo.renderPass = this->framebuffer.renderPass;
-		fbCreateInfo.attachmentCount = attachments.size();
-		fbCreateInfo.pAttachments = attachments.data();
-		fbCreateInfo.width = this->framebuffer.width;
-		fbCreateInfo.height = this->framebuffer.height;
-		fbCreateInfo.layers = 1;
-
-		VkFramebuffer newFramebuffer;
-		auto result = vkCreateFramebuffer(device, &fbCreateInfo, nullptr, &newFramebuffer);
+	return renderPass;
+}
 
-		if (result) {
-			std::cout << "Failed to create framebuffer: " << result << std::endl;
-			abort();
-		}
+VkRenderPass PipelineBuilder::buildRenderPass(VkDevice device, const Pipeline* basePipeline, const std::vector<VkAttachmentDescription>* attachmentDescriptions) {
+	return this->createRenderPass(device, &basePipeline->framebuffer, attachmentDescriptions);
+}
 
-		this->framebuffer.framebuffer.push_back(newFramebuffer);
-	}
+VkPipeline PipelineBuilder::createGraphicsPipeline(VkDevice device, VkRenderPass renderPass, size_t colourAttachmentCount) {
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.pNext = nullptr;
 
-	if (result) {
-		std::cout << "Failed to create sampler: " << result << std::endl;
-		abort();
-	}
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &this->viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &this->scissor;
 
 	// Colour blend states for attachments
 	std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates{};
-	size_t numberColourAttachments = this->framebuffer.framebufferAttachmentReferences.size();
-	blendAttachmentStates.resize(numberColourAttachments);
+	blendAttachmentStates.resize(colourAttachmentCount);
 
 	// ASSUMES IF THERE IS A DEPTH ATTACHMENT AT END AND ONLY ONE DEPTH ATTACHMENT
-	for (auto i = 0; i < numberColourAttachments; i++) {
+	for (auto i = 0; i < colourAttachmentCount; i++) {
 		blendAttachmentStates[i] = VulkanUtility::pipelineColorBlendAttachmentState(0xF, VK_FALSE);
 	}
 
 	VkPipelineColorBlendStateCreateInfo colorBlendStateCreateInfo{};
 	colorBlendStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	colorBlendStateCreateInfo.pNext = nullptr;
-	colorBlendStateCreateInfo.attachmentCount = numberColourAttachments;
+	colorBlendStateCreateInfo.attachmentCount = colourAttachmentCount;
 	colorBlendStateCreateInfo.pAttachments = blendAttachmentStates.data();
 
 	// Build the pipeline
@@ -442,17 +483,13 @@ Pipeline PipelineBuilder::buildPipeline(VkDevice device, PipelineUsage pipelineU
 	pipelineInfo.pMultisampleState = &this->multisampling;
 	pipelineInfo.pColorBlendState = &colorBlendStateCreateInfo;
 	pipelineInfo.layout = this->pipelineLayout;
-	pipelineInfo.renderPass = this->framebuffer.renderPass;
-	pipelineInfo.subpass = 0;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = this->subpass;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.pDepthStencilState = &this->depthStencil;
 
-	Pipeline pipeline;
-	pipeline.name = "test";
-	pipeline.readPipelineCacheFile(device);
-	pipeline.pipelineSetLayout = this->pipelineSetLayout;
-
-	result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline.pipeline);
+	VkPipeline pipeline;
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
 	if (result != VK_SUCCESS) {
 		std::cout << "Failed to create pipeline: " << result << std::endl;
 		abort();
@@ -463,6 +500,100 @@ Pipeline PipelineBuilder::buildPipeline(VkDevice device, PipelineUsage pipelineU
 		vkDestroyShaderModule(device, stage.module, nullptr);
 	}
 
+	return pipeline;
+}
+
+size_t PipelineBuilder::getColourAttachmentCount(const Framebuffer* framebuffer) {
+	if (framebuffer->subpasses.empty()) {
+		return framebuffer->framebufferAttachmentReferences.size();
+	}
+
+	return framebuffer->subpasses[this->subpass].colourAttachmentReferences.size();
+}
+
+VkPipeline PipelineBuilder::buildPipelineForRenderPass(VkDevice device, const Pipeline* basePipeline) {
+	return this->createGraphicsPipeline(device, basePipeline->framebuffer.renderPass, this->getColourAttachmentCount(&basePipeline->framebuffer));
+}
+
+Pipeline PipelineBuilder::buildSubpassPipeline(VkDevice device, const Pipeline* basePipeline) {
+	Pipeline pipeline;
+	pipeline.cache = VK_NULL_HANDLE;
+	pipeline.pipelineSetLayout = this->pipelineSetLayout;
+	pipeline.pipeline = this->createGraphicsPipeline(device, basePipeline->framebuffer.renderPass, this->getColourAttachmentCount(&basePipeline->framebuffer));
+
+	pipeline.pipelineSetLayoutBindings = std::move(this->pipelineSetLayoutBindings);
+	pipeline.pipelineSetLayoutBuffers = std::move(this->pipelineSetLayoutBuffers);
+	pipeline.pipelineDescriptors = this->pipelineDescriptors;
+	return pipeline;
+}
+
+VkPipeline PipelineBuilder::buildComputePipeline(VkDevice device) {
+	assert(this->shaderStages.size() == 1 && this->shaderStages[0].stage == VK_SHADER_STAGE_COMPUTE_BIT);
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.stage = this->shaderStages[0];
+	pipelineInfo.layout = this->pipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+	if (result != VK_SUCCESS) {
+		std::cout << "Failed to create compute pipeline: " << result << std::endl;
+		abort();
+	}
+
+	vkDestroyShaderModule(device, this->shaderStages[0].module, nullptr);
+
+	return pipeline;
+}
+
+Pipeline PipelineBuilder::buildPipeline(VkDevice device, PipelineUsage pipelineUsage, size_t frameOverlap) {
+	this->framebuffer.renderPass = this->createRenderPass(device, &this->framebuffer, &this->framebuffer.framebufferAttachmentDescriptions);
+
+	size_t numberAttachments = this->framebuffer.framebufferAttachments.size();
+
+	for (size_t framebufferIndex = 0; framebufferIndex < frameOverlap * this->framebuffer.imageCount; framebufferIndex++) {
+		size_t i = framebufferIndex / this->framebuffer.imageCount;
+		size_t image = framebufferIndex % this->framebuffer.imageCount;
+
+		std::vector<VkImageView> attachments{};
+		attachments.resize(numberAttachments);
+
+		for (auto j = 0; j < numberAttachments; j++) {
+			auto& external = this->framebuffer.externalAttachments;
+			bool isExternal = std::find(external.begin(), external.end(), j) != external.end();
+			attachments[j] = this->framebuffer.framebufferAttachments[j][isExternal ? image : i].image.imageView;
+		}
+
+		VkFramebufferCreateInfo fbCreateInfo{};
+		fbCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbCreateInfo.pNext = nullptr;
+		fbCreateInfo.renderPass = this->framebuffer.renderPass;
+		fbCreateInfo.attachmentCount = attachments.size();
+		fbCreateInfo.pAttachments = attachments.data();
+		fbCreateInfo.width = this->framebuffer.width;
+		fbCreateInfo.height = this->framebuffer.height;
+		fbCreateInfo.layers = 1;
+
+		VkFramebuffer newFramebuffer;
+		auto result = vkCreateFramebuffer(device, &fbCreateInfo, nullptr, &newFramebuffer);
+
+		if (result) {
+			std::cout << "Failed to create framebuffer: " << result << std::endl;
+			abort();
+		}
+
+		this->framebuffer.framebuffer.push_back(newFramebuffer);
+	}
+
+	Pipeline pipeline;
+	pipeline.name = "test";
+	pipeline.readPipelineCacheFile(device);
+	pipeline.pipelineSetLayout = this->pipelineSetLayout;
+	pipeline.pipeline = this->createGraphicsPipeline(device, this->framebuffer.renderPass, this->getColourAttachmentCount(&this->framebuffer));
+
 	pipeline.pipelineSetLayoutBindings = std::move(this->pipelineSetLayoutBindings);
 	pipeline.pipelineSetLayoutBuffers = std::move(this->pipelineSetLayoutBuffers);
 	pipeline.framebuffer = std::move(this->framebuffer);
@@ -15,6 +15,9 @@ struct ShaderInfo {
 	VkShaderStageFlags flags;
 	const char* vertexShaderPath;
 	const char* fragmentShaderPath;
+	const char* computeShaderPath;
+	// Preprocessor macros defined for every stage, each set of them is compiled and cached separately
+	std::vector<std::string> definitions;
 };
 
 enum PipelineUsage {
@@ -46,11 +49,18 @@ class PipelineBuilder {
 private:
 	std::string readFile(const char* filepath);
 	std::vector<char> readCompiledFile(const char* filepath);
-	std::vector<uint32_t> compileShader(const std::string& name, shaderc_shader_kind kind, const std::string& source, bool optimise);
+	std::vector<uint32_t> compileShader(const std::string& name, shaderc_shader_kind kind, const std::string& source, const std::vector<std::string>& definitions, bool optimise);
 	std::array<VkDescriptorSet, 3> pipelineDescriptors;
 	//std::vector<FramebufferAttachment> pipelineAttachments;
-	VkShaderModule createShaderModule(VkDevice device, std::string name, shaderc_shader_kind kind, std::string code, std::string path);
+	VkShaderModule createShaderModule(VkDevice device, std::string name, shaderc_shader_kind kind, std::string code, const std::vector<std::string>& definitions, std::string path);
 	VkShaderModule createShaderModule(VkDevice device, std::string name, shaderc_shader_kind kind, std::vector<char>&& spirv);
+	// Compiles the stage if its cached SPIR-V is missing or older than the source
+	void addShaderStage(VkDevice device, const char* path, const std::vector<std::string>& definitions, VkShaderStageFlagBits stage, shaderc_shader_kind kind, const char* stageName);
+	VkRenderPass createRenderPass(VkDevice device, const Framebuffer* framebuffer, const std::vector<VkAttachmentDescription>* attachmentDescriptions);
+	// Creates the pipeline from the builder state and destroys the shader modules
+	VkPipeline createGraphicsPipeline(VkDevice device, VkRenderPass renderPass, size_t colourAttachmentCount);
+	// Colour attachments of the subpass pipelines are built for
+	size_t getColourAttachmentCount(const Framebuffer* framebuffer);
 
 	// Framebuffer infomation
 	Framebuffer framebuffer;
@@ -69,21 +79,37 @@ public:
 	VkPipelineDepthStencilStateCreateInfo depthStencil;
 	VkPipelineLayout pipelineLayout;
 	VkDescriptorSetLayout pipelineSetLayout;
+	// Subpass of the render pass the pipelines are built for
+	uint32_t subpass = 0;
 
 	// Descriptor Set Layout bindings for specific layout
 	std::vector<VkDescriptorSetLayoutBinding> pipelineSetLayoutBindings;
 	std::vector<std::vector<AllocatedBuffer>> pipelineSetLayoutBuffers;
 
 	Pipeline buildPipeline(VkDevice device, PipelineUsage pipelineUsage, size_t frameOverlap);
+	// Another pipeline for the render pass and framebuffers of an already built one. The framebuffer of this builder is not used
+	VkPipeline buildPipelineForRenderPass(VkDevice device, const Pipeline* basePipeline);
+	// Like buildPipelineForRenderPass, usually for another subpass, but with the descriptor sets of this builder
+	Pipeline buildSubpassPipeline(VkDevice device, const Pipeline* basePipeline);
+	// Render pass compatible with the framebuffers of an already built pipeline, with other load and store operations or layouts
+	VkRenderPass buildRenderPass(VkDevice device, const Pipeline* basePipeline, const std::vector<VkAttachmentDescription>* attachmentDescriptions);
+	// Uses the compute shader and pipeline layout only
+	VkPipeline buildComputePipeline(VkDevice device);
 	void addShaders(VkDevice device, ShaderInfo* shaderInfo);
 	void addPipelineDescriptorBinding(VkDescriptorType type, VkShaderStageFlagBits shaderStage);
 	//void addPipelineDescriptorFramebufferImage(VkDevice device, size_t binding, const std::vector<VkImageView> imageViews, VkFormat format, VkSampler sampler);
 	void allocatePipelineDescriptorUniformBuffer(VkDevice device, size_t binding, const std::vector<AllocatedBuffer> buffers, uint32_t frameOverlap);
 	void setupFramebuffer(FramebufferSetupData framebufferSetupData);
-	// If you add a depth buffer attachment, IT MUST BE THE LAST ATTACHMENT ADDED
-	void addFramebufferAttachment(VkDevice device, VmaAllocator allocator, VkFormat format, VkImageUsageFlagBits usage, VkExtent3D extent, size_t frameOverlaps);
+	// Only one depth attachment can be added. Attachments with the transient usage are not stored or sampled and live in
+	// lazily allocated memory where the device has it, for attachments only read by later subpasses
+	void addFramebufferAttachment(VkDevice device, VmaAllocator allocator, VkFormat format, VkImageUsageFlags usage, VkExtent3D extent, size_t frameOverlaps);
 	// Used when framebuffer targets are already created (ie. Swapchain images)
-	// Allocation of the image is the responsibility of the originator of this call
-	void addFramebufferAttachment(VkDevice device, std::vector<VkImageView> attachmentImageViews, VkFormat format, VkImageUsageFlagBits usage, VkExtent3D extent, size_t frameOverlaps);
+	// Allocation of the image is the responsibility of the originator of this call. Any frame can render into any of
+	// the images, so a framebuffer is built for every pair of frame and image
+	void addFramebufferAttachment(VkDevice device, std::vector<VkImageView> attachmentImageViews, VkFormat format, VkImageUsageFlagBits usage, VkExtent3D extent);
+	// Subpasses are added in order. Attachments are indices into the framebuffer attachments, input attachments are
+	// read in the shader read only layout, or the depth stencil read only one for the depth attachment. Without any
+	// the render pass has one subpass writing every attachment
+	void addSubpass(const std::vector<uint32_t>& colourAttachments, const std::vector<uint32_t>& inputAttachments, bool useDepth);
 	VkDescriptorSetLayout createPipelineSetLayout(VkDevice device, uint32_t frameOverlap, VkDescriptorPool descriptorPool);
 };
@@ -0,0 +1,9 @@
+#pragma once
+#include "../Core/DynamicBVH.hpp"
+
+// Entity registered in the world spatial index
+struct SpatialComponent {
+	// Model space bounds, moved into world space by the entity transform
+	AABB localBounds;
+	int32_t proxy;
+};
@@ -0,0 +1,12 @@
+#pragma once
+#include <glm/vec3.hpp>
+#include <cstdint>
+
+// Node of the entity in the world transform hierarchy, which holds its local and world transforms
+struct TransformComponent {
+	uint32_t node;
+};
+
+struct VelocityComponent {
+	glm::vec3 linear;
+};
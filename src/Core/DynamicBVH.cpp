@@ -0,0 +1,368 @@
+#include "DynamicBVH.hpp"
+#include <algorithm>
+#include <limits>
+
+// A leaf that escapes its fat bounds is grown in place when that grows it by no more than this factor of surface area
+constexpr float BVH_REFIT_GROWTH_LIMIT = 1.5f;
+// Rebuild once the cost per leaf is this many times what it was after the last rebuild
+constexpr float BVH_REBUILD_COST_RATIO = 1.5f;
+
+DynamicBVH::DynamicBVH(float fatMargin) : fatMargin(fatMargin) {
+}
+
+AABB DynamicBVH::fatten(const AABB& bounds) const {
+	glm::vec3 margin{ this->fatMargin };
+	return { bounds.min - margin, bounds.max + margin };
+}
+
+int32_t DynamicBVH::allocateNode() {
+	int32_t node;
+
+	if (this->freeList != BVH_NULL_NODE) {
+		node = this->freeList;
+		this->freeList = this->nodes[node].parent;
+	} else {
+		node = static_cast<int32_t>(this->nodes.size());
+		this->nodes.push_back({});
+	}
+
+	Node* allocated = &this->nodes[node];
+	allocated->parent = BVH_NULL_NODE;
+	allocated->left = BVH_NULL_NODE;
+	allocated->right = BVH_NULL_NODE;
+	allocated->height = 0;
+	allocated->userData = 0;
+
+	return node;
+}
+
+void DynamicBVH::freeNode(int32_t node) {
+	this->nodes[node].parent = this->freeList;
+	this->nodes[node].height = -1;
+	this->freeList = node;
+}
+
+int32_t DynamicBVH::insert(const AABB& bounds, uint64_t userData) {
+	int32_t proxy = this->allocateNode();
+
+	Node* leaf = &this->nodes[proxy];
+	leaf->bounds = this->fatten(bounds);
+	leaf->objectBounds = bounds;
+	leaf->userData = userData;
+
+	this->insertLeaf(proxy);
+	this->leafCount++;
+
+	return proxy;
+}
+
+void DynamicBVH::remove(int32_t proxy) {
+	this->removeLeaf(proxy);
+	this->freeNode(proxy);
+	this->leafCount--;
+}
+
+bool DynamicBVH::update(int32_t proxy, const AABB& bounds) {
+	Node* leaf = &this->nodes[proxy];
+	leaf->objectBounds = bounds;
+
+	if (leaf->bounds.contains(bounds)) {
+		return false;
+	}
+
+	// Slow movers sweep their fat bounds along, which keeps the tree shape and only touches the ancestors
+	AABB grown = this->fatten(AABB::merge(leaf->bounds, bounds));
+
+	if (grown.surfaceArea() <= leaf->bounds.surfaceArea() * BVH_REFIT_GROWTH_LIMIT) {
+		leaf->bounds = grown;
+		this->refitAncestors(leaf->parent);
+		return false;
+	}
+
+	this->removeLeaf(proxy);
+	this->nodes[proxy].bounds = this->fatten(bounds);
+	this->insertLeaf(proxy);
+
+	return true;
+}
+
+void DynamicBVH::insertLeaf(int32_t leaf) {
+	if (this->root == BVH_NULL_NODE) {
+		this->root = leaf;
+		this->nodes[leaf].parent = BVH_NULL_NODE;
+		return;
+	}
+
+	// Walk down towards the sibling that adds the least surface area to the tree
+	AABB leafBounds = this->nodes[leaf].bounds;
+	int32_t index = this->root;
+
+	while (!this->nodes[index].isLeaf()) {
+		const Node* node = &this->nodes[index];
+
+		float area = node->bounds.surfaceArea();
+		float combinedArea = AABB::merge(node->bounds, leafBounds).surfaceArea();
+
+		// Cost of pairing with this node, and the cost every child pays for the node growing
+		float cost = 2.0f * combinedArea;
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		auto descendCost = [&](int32_t child) {
+			const Node* childNode = &this->nodes[child];
+			float mergedArea = AABB::merge(childNode->bounds, leafBounds).surfaceArea();
+
+			if (childNode->isLeaf()) {
+				return mergedArea + inheritanceCost;
+			}
+
+			return (mergedArea - childNode->bounds.surfaceArea()) + inheritanceCost;
+		};
+
+		float leftCost = descendCost(node->left);
+		float rightCost = descendCost(node->right);
+
+		if (cost < leftCost && cost < rightCost) {
+			break;
+		}
+
+		index = leftCost < rightCost ? node->left : node->right;
+	}
+
+	int32_t sibling = index;
+	int32_t oldParent = this->nodes[sibling].parent;
+	int32_t newParent = this->allocateNode();
+
+	Node* parent = &this->nodes[newParent];
+	parent->parent = oldParent;
+	parent->left = sibling;
+	parent->right = leaf;
+
+	this->nodes[sibling].parent = newParent;
+	this->nodes[leaf].parent = newParent;
+
+	if (oldParent == BVH_NULL_NODE) {
+		this->root = newParent;
+	} else if (this->nodes[oldParent].left == sibling) {
+		this->nodes[oldParent].left = newParent;
+	} else {
+		this->nodes[oldParent].right = newParent;
+	}
+
+	this->refitAncestors(newParent);
+}
+
+void DynamicBVH::removeLeaf(int32_t leaf) {
+	if (leaf == this->root) {
+		this->root = BVH_NULL_NODE;
+		return;
+	}
+
+	int32_t parent = this->nodes[leaf].parent;
+	int32_t grandParent = this->nodes[parent].parent;
+	int32_t sibling = this->nodes[parent].left == leaf ? this->nodes[parent].right : this->nodes[parent].left;
+
+	// The sibling takes the parent's place
+	if (grandParent == BVH_NULL_NODE) {
+		this->root = sibling;
+		this->nodes[sibling].parent = BVH_NULL_NODE;
+	} else {
+		if (this->nodes[grandParent].left == parent) {
+			this->nodes[grandParent].left = sibling;
+		} else {
+			this->nodes[grandParent].right = sibling;
+		}
+
+		this->nodes[sibling].parent = grandParent;
+		this->refitAncestors(grandParent);
+	}
+
+	this->freeNode(parent);
+	this->nodes[leaf].parent = BVH_NULL_NODE;
+}
+
+void DynamicBVH::refitAncestors(int32_t node) {
+	while (node != BVH_NULL_NODE) {
+		Node* current = &this->nodes[node];
+		const Node* left = &this->nodes[current->left];
+		const Node* right = &this->nodes[current->right];
+
+		current->bounds = AABB::merge(left->bounds, right->bounds);
+		current->height = 1 + std::max(left->height, right->height);
+
+		node = current->parent;
+	}
+}
+
+void DynamicBVH::rebuild() {
+	std::vector<int32_t> leaves;
+	leaves.reserve(this->leafCount);
+
+	for (int32_t i = 0; i < static_cast<int32_t>(this->nodes.size()); i++) {
+		Node* node = &this->nodes[i];
+
+		if (node->height < 0) {
+			continue;
+		}
+
+		if (node->isLeaf()) {
+			leaves.push_back(i);
+		} else {
+			this->freeNode(i);
+		}
+	}
+
+	this->root = leaves.empty() ? BVH_NULL_NODE : this->buildRange(&leaves, 0, leaves.size(), BVH_NULL_NODE);
+	this->rebuiltCostPerLeaf = this->leafCount > 0 ? this->getCost() / static_cast<float>(this->leafCount) : 0.0f;
+}
+
+int32_t DynamicBVH::buildRange(std::vector<int32_t>* leaves, size_t begin, size_t end, int32_t parent) {
+	if (end - begin == 1) {
+		int32_t leaf = leaves->at(begin);
+		this->nodes[leaf].parent = parent;
+		return leaf;
+	}
+
+	// Split at the median centre along the axis the centres spread most on
+	glm::vec3 centerMin{ std::numeric_limits<float>::max() };
+	glm::vec3 centerMax{ std::numeric_limits<float>::lowest() };
+
+	for (size_t i = begin; i < end; i++) {
+		glm::vec3 center = this->nodes[leaves->at(i)].bounds.center();
+		centerMin = glm::min(centerMin, center);
+		centerMax = glm::max(centerMax, center);
+	}
+
+	glm::vec3 spread = centerMax - centerMin;
+	int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+	size_t middle = begin + ((end - begin) / 2);
+
+	std::nth_element(leaves->begin() + begin, leaves->begin() + middle, leaves->begin() + end, [this, axis](int32_t a, int32_t b) {
+		return this->nodes[a].bounds.center()[axis] < this->nodes[b].bounds.center()[axis];
+	});
+
+	int32_t node = this->allocateNode();
+	int32_t left = this->buildRange(leaves, begin, middle, node);
+	int32_t right = this->buildRange(leaves, middle, end, node);
+
+	// Building the children may have reallocated the nodes
+	Node* built = &this->nodes[node];
+	built->parent = parent;
+	built->left = left;
+	built->right = right;
+	built->bounds = AABB::merge(this->nodes[left].bounds, this->nodes[right].bounds);
+	built->height = 1 + std::max(this->nodes[left].height, this->nodes[right].height);
+
+	return node;
+}
+
+bool DynamicBVH::optimise() {
+	if (this->leafCount < 2) {
+		return false;
+	}
+
+	float costPerLeaf = this->getCost() / static_cast<float>(this->leafCount);
+
+	if (this->rebuiltCostPerLeaf > 0.0f && costPerLeaf <= this->rebuiltCostPerLeaf * BVH_REBUILD_COST_RATIO) {
+		return false;
+	}
+
+	this->rebuild();
+
+	return true;
+}
+
+void DynamicBVH::clear() {
+	this->nodes.clear();
+	this->root = BVH_NULL_NODE;
+	this->freeList = BVH_NULL_NODE;
+	this->leafCount = 0;
+	this->rebuiltCostPerLeaf = 0.0f;
+}
+
+float DynamicBVH::getCost() const {
+	float cost = 0.0f;
+
+	for (auto& node : this->nodes) {
+		if (node.height > 0) {
+			cost += node.bounds.surfaceArea();
+		}
+	}
+
+	return cost;
+}
+
+int32_t DynamicBVH::getHeight() const {
+	return this->root == BVH_NULL_NODE ? 0 : this->nodes[this->root].height;
+}
+
+size_t DynamicBVH::size() const {
+	return this->leafCount;
+}
+
+uint64_t DynamicBVH::getUserData(int32_t proxy) const {
+	return this->nodes[proxy].userData;
+}
+
+const AABB& DynamicBVH::getBounds(int32_t proxy) const {
+	return this->nodes[proxy].objectBounds;
+}
+
+// Slab test, returns the entry distance or a negative value on a miss
+static float intersectRay(const AABB& bounds, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) {
+	glm::vec3 t0 = (bounds.min - origin) * inverseDirection;
+	glm::vec3 t1 = (bounds.max - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float entry = std::max({ tNear.x, tNear.y, tNear.z, 0.0f });
+	float exit = std::min({ tFar.x, tFar.y, tFar.z, maxDistance });
+
+	return entry <= exit ? entry : -1.0f;
+}
+
+bool DynamicBVH::raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, BVHRayHit* hit) const {
+	if (this->root == BVH_NULL_NODE) {
+		return false;
+	}
+
+	// Division by zero gives infinities, which the slab test handles
+	glm::vec3 inverseDirection = 1.0f / direction;
+	float closest = maxDistance;
+	bool found = false;
+
+	BVHTraversalStack stack;
+	stack.push(this->root);
+
+	while (!stack.empty()) {
+		const Node* node = &this->nodes[stack.pop()];
+
+		if (node->isLeaf()) {
+			float distance = intersectRay(node->objectBounds, origin, inverseDirection, closest);
+
+			if (distance >= 0.0f) {
+				closest = distance;
+				hit->userData = node->userData;
+				hit->distance = distance;
+				found = true;
+			}
+
+			continue;
+		}
+
+		float leftDistance = intersectRay(this->nodes[node->left].bounds, origin, inverseDirection, closest);
+		float rightDistance = intersectRay(this->nodes[node->right].bounds, origin, inverseDirection, closest);
+
+		// Push the nearer child last so it is visited first and shrinks the search for the other
+		if (leftDistance >= 0.0f && rightDistance >= 0.0f) {
+			bool leftNearer = leftDistance <= rightDistance;
+			stack.push(leftNearer ? node->right : node->left);
+			stack.push(leftNearer ? node->left : node->right);
+		} else if (leftDistance >= 0.0f) {
+			stack.push(node->left);
+		} else if (rightDistance >= 0.0f) {
+			stack.push(node->right);
+		}
+	}
+
+	return found;
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vector_relational.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+constexpr int32_t BVH_NULL_NODE = -1;
+// Leaves are stored enlarged by this much on every side so small movements leave the tree alone
+constexpr float BVH_DEFAULT_FAT_MARGIN = 0.5f;
+// Nodes a query can hold before its traversal stack moves to the heap
+constexpr size_t BVH_INLINE_STACK_SIZE = 64;
+
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	static AABB merge(const AABB& a, const AABB& b) {
+		return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+	}
+
+	bool contains(const AABB& other) const {
+		return glm::all(glm::lessThanEqual(this->min, other.min)) && glm::all(glm::greaterThanEqual(this->max, other.max));
+	}
+
+	bool overlaps(const AABB& other) const {
+		return glm::all(glm::lessThanEqual(this->min, other.max)) && glm::all(glm::greaterThanEqual(this->max, other.min));
+	}
+
+	bool overlapsSphere(glm::vec3 center, float radius) const {
+		glm::vec3 closest = glm::clamp(center, this->min, this->max) - center;
+		return (closest.x * closest.x) + (closest.y * closest.y) + (closest.z * closest.z) <= radius * radius;
+	}
+
+	float surfaceArea() const {
+		glm::vec3 extent = this->max - this->min;
+		return 2.0f * ((extent.x * extent.y) + (extent.y * extent.z) + (extent.z * extent.x));
+	}
+
+	glm::vec3 center() const {
+		return (this->min + this->max) * 0.5f;
+	}
+};
+
+struct BVHRayHit {
+	uint64_t userData;
+	float distance;
+};
+
+// Traversal stack that only allocates for unusually deep trees
+class BVHTraversalStack {
+	std::array<int32_t, BVH_INLINE_STACK_SIZE> inlineNodes;
+	std::vector<int32_t> overflowNodes;
+	size_t count = 0;
+
+public:
+	void push(int32_t node) {
+		if (this->count < BVH_INLINE_STACK_SIZE) {
+			this->inlineNodes[this->count] = node;
+		} else {
+			this->overflowNodes.push_back(node);
+		}
+
+		this->count++;
+	}
+
+	int32_t pop() {
+		this->count--;
+
+		if (this->count < BVH_INLINE_STACK_SIZE) {
+			return this->inlineNodes[this->count];
+		}
+
+		int32_t node = this->overflowNodes.back();
+		this->overflowNodes.pop_back();
+
+		return node;
+	}
+
+	bool empty() const {
+		return this->count == 0;
+	}
+};
+
+// Dynamic AABB tree over anything with bounds. Proxies keep their id for as long as they exist, however the tree is
+// restructured. Moving a proxy inside its fat bounds costs nothing, small escapes grow the leaf and refit its
+// ancestors, large ones reinsert it. optimise rebuilds the whole tree once refitting has made it too loose.
+// Queries are const and can run concurrently, changes need exclusive access
+class DynamicBVH {
+	struct Node {
+		// Fattened for leaves
+		AABB bounds;
+		// Exact bounds of the proxy, leaves only
+		AABB objectBounds;
+		uint64_t userData;
+		// Next free node while on the free list
+		int32_t parent;
+		int32_t left;
+		int32_t right;
+		// Leaves are 0, free nodes -1
+		int32_t height;
+
+		bool isLeaf() const {
+			return this->left == BVH_NULL_NODE;
+		}
+	};
+
+	std::vector<Node> nodes;
+	int32_t root = BVH_NULL_NODE;
+	int32_t freeList = BVH_NULL_NODE;
+	size_t leafCount = 0;
+	float fatMargin;
+	// Cost per leaf straight after the last rebuild, zero until the first one
+	float rebuiltCostPerLeaf = 0.0f;
+
+	int32_t allocateNode();
+	void freeNode(int32_t node);
+	void insertLeaf(int32_t leaf);
+	void removeLeaf(int32_t leaf);
+	// Recomputes bounds and heights from node up to the root
+	void refitAncestors(int32_t node);
+	int32_t buildRange(std::vector<int32_t>* leaves, size_t begin, size_t end, int32_t parent);
+	AABB fatten(const AABB& bounds) const;
+
+public:
+	explicit DynamicBVH(float fatMargin = BVH_DEFAULT_FAT_MARGIN);
+
+	// Returns the proxy id
+	int32_t insert(const AABB& bounds, uint64_t userData);
+	void remove(int32_t proxy);
+	// Returns true if the tree changed shape
+	bool update(int32_t proxy, const AABB& bounds);
+	// Top down rebuild splitting at the median of the widest axis
+	void rebuild();
+	// Rebuilds if the tree has become too loose since the last rebuild. Returns true if it rebuilt
+	bool optimise();
+	void clear();
+
+	// Sum of the internal node surface areas, the expected cost of a query
+	float getCost() const;
+	int32_t getHeight() const;
+	size_t size() const;
+	uint64_t getUserData(int32_t proxy) const;
+	const AABB& getBounds(int32_t proxy) const;
+
+	// Closest proxy whose bounds the ray hits within maxDistance. The direction does not need to be normalised,
+	// distances are in multiples of it
+	bool raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, BVHRayHit* hit) const;
+
+	// Calls callback(userData) for every proxy overlapping the bounds
+	template<typename F>
+	void queryAABB(const AABB& bounds, F&& callback) const {
+		this->traverse([&bounds](const AABB& nodeBounds) {
+			return nodeBounds.overlaps(bounds);
+		}, callback);
+	}
+
+	// Calls callback(userData) for every proxy overlapping the sphere
+	template<typename F>
+	void querySphere(glm::vec3 center, float radius, F&& callback) const {
+		this->traverse([center, radius](const AABB& nodeBounds) {
+			return nodeBounds.overlapsSphere(center, radius);
+		}, callback);
+	}
+
+	// Calls callback(userData) for every proxy touching the volume bounded by the planes. Planes point inwards.
+	// Subtrees entirely inside are reported without testing their leaves
+	template<typename F>
+	void queryFrustum(const glm::vec4* planes, size_t planeCount, F&& callback) const {
+		if (this->root == BVH_NULL_NODE) {
+			return;
+		}
+
+		BVHTraversalStack stack;
+		stack.push(this->root);
+
+		while (!stack.empty()) {
+			int32_t nodeIndex = stack.pop();
+			const Node* node = &this->nodes[nodeIndex];
+			const AABB* bounds = node->isLeaf() ? &node->objectBounds : &node->bounds;
+
+			bool inside = true;
+			bool outside = false;
+
+			for (size_t p = 0; p < planeCount && !outside; p++) {
+				glm::vec3 normal = glm::vec3(planes[p]);
+				// Corners furthest along and against the plane normal
+				glm::vec3 positive = glm::mix(bounds->min, bounds->max, glm::greaterThanEqual(normal, glm::vec3(0.0f)));
+				glm::vec3 negative = glm::mix(bounds->max, bounds->min, glm::greaterThanEqual(normal, glm::vec3(0.0f)));
+
+				outside = glm::dot(normal, positive) + planes[p].w < 0.0f;
+				inside = inside && glm::dot(normal, negative) + planes[p].w >= 0.0f;
+			}
+
+			if (outside) {
+				continue;
+			}
+
+			if (node->isLeaf()) {
+				callback(node->userData);
+			} else if (inside) {
+				this->reportSubtree(nodeIndex, callback);
+			} else {
+				stack.push(node->left);
+				stack.push(node->right);
+			}
+		}
+	}
+
+private:
+	template<typename Test, typename F>
+	void traverse(Test&& test, F& callback) const {
+		if (this->root == BVH_NULL_NODE) {
+			return;
+		}
+
+		BVHTraversalStack stack;
+		stack.push(this->root);
+
+		while (!stack.empty()) {
+			const Node* node = &this->nodes[stack.pop()];
+
+			if (node->isLeaf()) {
+				if (test(node->objectBounds)) {
+					callback(node->userData);
+				}
+			} else if (test(node->bounds)) {
+				stack.push(node->left);
+				stack.push(node->right);
+			}
+		}
+	}
+
+	template<typename F>
+	void reportSubtree(int32_t subtreeRoot, F& callback) const {
+		BVHTraversalStack stack;
+		stack.push(subtreeRoot);
+
+		while (!stack.empty()) {
+			const Node* node = &this->nodes[stack.pop()];
+
+			if (node->isLeaf()) {
+				callback(node->userData);
+			} else {
+				stack.push(node->left);
+				stack.push(node->right);
+			}
+		}
+	}
+};
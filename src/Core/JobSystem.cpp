@@ -0,0 +1,192 @@
+#include "JobSystem.hpp"
+
+// Number of empty searches before a worker goes to sleep
+constexpr uint32_t JOB_SEARCH_SPINS = 64;
+constexpr size_t NO_DEQUE = SIZE_MAX;
+
+static thread_local const JobSystem* currentJobSystem = nullptr;
+static thread_local size_t currentDequeIndex = NO_DEQUE;
+
+JobSystem::JobSystem(size_t workerCount) {
+	if (workerCount == 0) {
+		size_t hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (size_t i = 0; i < workerCount + 1; i++) {
+		this->deques.push_back(std::make_unique<WorkStealingDeque<Job*, JOB_DEQUE_CAPACITY>>());
+	}
+
+	currentJobSystem = this;
+	currentDequeIndex = 0;
+
+	this->workers.reserve(workerCount);
+
+	for (size_t i = 0; i < workerCount; i++) {
+		this->workers.emplace_back(&JobSystem::workerLoop, this, i + 1);
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(this->sleepMutex);
+		this->stopping = true;
+	}
+
+	this->sleepCondition.notify_all();
+
+	for (auto& worker : this->workers) {
+		worker.join();
+	}
+
+	// Anything left over was never waited on
+	Job* job = nullptr;
+
+	while ((job = this->findJob()) != nullptr) {
+		this->execute(job);
+	}
+
+	if (currentJobSystem == this) {
+		currentJobSystem = nullptr;
+		currentDequeIndex = NO_DEQUE;
+	}
+}
+
+size_t JobSystem::getWorkerCount() const {
+	return this->workers.size();
+}
+
+void JobSystem::setMainThreadParticipation(bool participate) {
+	this->mainThreadParticipates = participate;
+}
+
+void JobSystem::run(std::function<void()> function, JobCounter* counter) {
+	if (counter != nullptr) {
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	Job* job = new Job{ std::move(function), counter };
+	this->push(job);
+}
+
+void JobSystem::push(Job* job) {
+	this->queuedJobs.fetch_add(1);
+
+	bool pushed = false;
+
+	if (currentJobSystem == this) {
+		pushed = this->deques[currentDequeIndex]->push(job);
+	}
+
+	// Threads without a deque, or with a full one, go through the injection queue
+	if (!pushed) {
+		std::lock_guard<std::mutex> lock(this->injectionMutex);
+		this->injectionQueue.push_back(job);
+	}
+
+	if (this->sleepingWorkers.load() > 0) {
+		std::lock_guard<std::mutex> lock(this->sleepMutex);
+		this->sleepCondition.notify_one();
+	}
+}
+
+JobSystem::Job* JobSystem::findJob() {
+	Job* job = nullptr;
+	size_t ownDeque = currentJobSystem == this ? currentDequeIndex : NO_DEQUE;
+
+	if (ownDeque != NO_DEQUE && this->deques[ownDeque]->pop(&job)) {
+		this->queuedJobs.fetch_sub(1);
+		return job;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->injectionMutex);
+
+		if (!this->injectionQueue.empty()) {
+			job = this->injectionQueue.front();
+			this->injectionQueue.pop_front();
+			this->queuedJobs.fetch_sub(1);
+			return job;
+		}
+	}
+
+	// Start stealing after our own deque so thieves spread over different victims
+	size_t dequeCount = this->deques.size();
+	size_t start = ownDeque != NO_DEQUE ? ownDeque + 1 : 0;
+
+	for (size_t i = 0; i < dequeCount; i++) {
+		size_t victim = (start + i) % dequeCount;
+
+		if (victim != ownDeque && this->deques[victim]->steal(&job)) {
+			this->queuedJobs.fetch_sub(1);
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+void JobSystem::execute(Job* job) {
+	job->function();
+
+	if (job->counter != nullptr) {
+		job->counter->pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	delete job;
+}
+
+bool JobSystem::runPendingJob() {
+	Job* job = this->findJob();
+
+	if (job == nullptr) {
+		return false;
+	}
+
+	this->execute(job);
+
+	return true;
+}
+
+void JobSystem::wait(JobCounter* counter) {
+	bool isMainThread = currentJobSystem == this && currentDequeIndex == 0;
+	bool helps = !isMainThread || this->mainThreadParticipates;
+
+	while (!counter->isDone()) {
+		if (!helps || !this->runPendingJob()) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::workerLoop(size_t dequeIndex) {
+	currentJobSystem = this;
+	currentDequeIndex = dequeIndex;
+
+	uint32_t emptySearches = 0;
+
+	while (true) {
+		if (this->runPendingJob()) {
+			emptySearches = 0;
+			continue;
+		}
+
+		if (++emptySearches < JOB_SEARCH_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		emptySearches = 0;
+
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
+		this->sleepingWorkers++;
+		this->sleepCondition.wait(lock, [this]() {
+			return this->stopping || this->queuedJobs.load() > 0;
+		});
+		this->sleepingWorkers--;
+
+		if (this->stopping) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "WorkStealingDeque.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr size_t JOB_DEQUE_CAPACITY = 4096;
+
+// Number of unfinished jobs attached to it. Jobs can be waited on as a group through their counter
+struct JobCounter {
+	std::atomic<uint32_t> pending = 0;
+
+	bool isDone() const {
+		return this->pending.load(std::memory_order_acquire) == 0;
+	}
+};
+
+// Engine wide worker threads. Each worker owns a Chase-Lev deque, runs its own newest jobs first and steals the oldest
+// jobs of other threads when it runs dry. The thread that creates the job system owns a deque as well and can help
+// while waiting. Any other thread submits through a shared injection queue
+class JobSystem {
+	struct Job {
+		std::function<void()> function;
+		JobCounter* counter;
+	};
+
+	std::vector<std::thread> workers;
+	// Deque 0 belongs to the thread that created the job system, worker i owns deque i + 1
+	std::vector<std::unique_ptr<WorkStealingDeque<Job*, JOB_DEQUE_CAPACITY>>> deques;
+
+	std::mutex injectionMutex;
+	std::deque<Job*> injectionQueue;
+
+	std::atomic<size_t> queuedJobs = 0;
+	std::atomic<size_t> sleepingWorkers = 0;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	std::atomic<bool> stopping = false;
+
+	std::atomic<bool> mainThreadParticipates = true;
+
+	void workerLoop(size_t dequeIndex);
+	void push(Job* job);
+	Job* findJob();
+	void execute(Job* job);
+
+public:
+	// Zero uses one worker per hardware thread, leaving one for the creating thread
+	explicit JobSystem(size_t workerCount = 0);
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+	~JobSystem();
+
+	size_t getWorkerCount() const;
+
+	// The counter, if given, must outlive the job
+	void run(std::function<void()> function, JobCounter* counter);
+	// Runs one queued job on the calling thread. Returns false if no job could be found
+	bool runPendingJob();
+	// Waits for every job attached to the counter. Workers always help while waiting, the creating thread only helps
+	// when main thread participation is enabled
+	void wait(JobCounter* counter);
+	// Disable to keep the creating thread free of long jobs, it then only yields while waiting
+	void setMainThreadParticipation(bool participate);
+
+	// Calls function(begin, end) over [0, count) split into ranges of grainSize and waits for all of them
+	template<typename F>
+	void parallelFor(size_t count, size_t grainSize, F&& function) {
+		if (count == 0) {
+			return;
+		}
+
+		grainSize = std::max<size_t>(grainSize, 1);
+
+		JobCounter counter{};
+
+		// The calling thread takes the first range itself
+		for (size_t begin = grainSize; begin < count; begin += grainSize) {
+			size_t end = std::min(begin + grainSize, count);
+
+			this->run([&function, begin, end]() {
+				function(begin, end);
+			}, &counter);
+		}
+
+		function(0, std::min(grainSize, count));
+
+		this->wait(&counter);
+	}
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+// Append only container whose elements never move. Elements live in fixed size pages that are allocated on demand,
+// so references stay valid while other threads append. Indexing never takes a lock
+template<typename T, size_t PageSize = 64, size_t MaxPages = 1024>
+class PagedVector {
+	std::array<std::atomic<T*>, MaxPages> pages{};
+	std::atomic<size_t> count = 0;
+	std::mutex pageMutex;
+
+	void ensurePage(size_t pageIndex) {
+		if (pageIndex >= MaxPages) {
+			throw std::length_error("PagedVector is full");
+		}
+
+		if (this->pages[pageIndex].load(std::memory_order_acquire) != nullptr) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(this->pageMutex);
+
+		if (this->pages[pageIndex].load(std::memory_order_relaxed) == nullptr) {
+			this->pages[pageIndex].store(new T[PageSize], std::memory_order_release);
+		}
+	}
+
+public:
+	PagedVector() = default;
+	PagedVector(const PagedVector&) = delete;
+	PagedVector& operator=(const PagedVector&) = delete;
+
+	~PagedVector() {
+		for (auto& page : this->pages) {
+			delete[] page.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Reserves a default constructed slot and returns its index. Safe to call from multiple threads
+	size_t reserve() {
+		size_t index = this->count.fetch_add(1, std::memory_order_acq_rel);
+		this->ensurePage(index / PageSize);
+		return index;
+	}
+
+	size_t push_back(T&& value) {
+		size_t index = this->reserve();
+		(*this)[index] = std::move(value);
+		return index;
+	}
+
+	size_t size() const {
+		return this->count.load(std::memory_order_acquire);
+	}
+
+	T& operator[](size_t index) {
+		return this->pages[index / PageSize].load(std::memory_order_acquire)[index % PageSize];
+	}
+
+	const T& operator[](size_t index) const {
+		return this->pages[index / PageSize].load(std::memory_order_acquire)[index % PageSize];
+	}
+
+	T& at(size_t index) {
+		if (index >= this->size()) {
+			throw std::out_of_range("PagedVector index out of range");
+		}
+
+		return (*this)[index];
+	}
+
+	const T& at(size_t index) const {
+		if (index >= this->size()) {
+			throw std::out_of_range("PagedVector index out of range");
+		}
+
+		return (*this)[index];
+	}
+};
@@ -0,0 +1,140 @@
+#include "SystemScheduler.hpp"
+#include <chrono>
+
+constexpr double TIMING_AVERAGE_WEIGHT = 0.05;
+
+SystemScheduler::SystemScheduler(JobSystem* jobSystem) : jobSystem(jobSystem) {
+}
+
+size_t SystemScheduler::addSystem(SystemDescription description) {
+	size_t index = this->systems.size();
+
+	SystemTiming timing{};
+	timing.name = description.name;
+
+	this->systems.push_back(std::move(description));
+	this->timings.push_back(timing);
+
+	return index;
+}
+
+void SystemScheduler::buildGraph() {
+	size_t systemCount = this->systems.size();
+
+	this->dependents.assign(systemCount, {});
+	this->remainingDependencies = std::make_unique<std::atomic<uint32_t>[]>(systemCount);
+
+	for (size_t j = 0; j < systemCount; j++) {
+		SystemDescription* later = &this->systems[j];
+		uint32_t dependencyCount = 0;
+
+		// Every earlier system that conflicts has to finish first
+		for (size_t i = 0; i < j; i++) {
+			SystemDescription* earlier = &this->systems[i];
+
+			bool conflicts = (earlier->writes & (later->reads | later->writes)) != 0 || (later->writes & earlier->reads) != 0;
+
+			if (conflicts) {
+				this->dependents[i].push_back(j);
+				dependencyCount++;
+			}
+		}
+
+		this->remainingDependencies[j].store(dependencyCount);
+	}
+}
+
+void SystemScheduler::dispatch(size_t systemIndex) {
+	if (this->systems[systemIndex].mainThread) {
+		{
+			std::lock_guard<std::mutex> lock(this->readyMutex);
+			this->readyMainThreadSystems.push_back(systemIndex);
+		}
+
+		this->readyCondition.notify_all();
+		return;
+	}
+
+	this->jobSystem->run([this, systemIndex]() {
+		this->execute(systemIndex, this->frameDeltaS);
+	}, nullptr);
+}
+
+void SystemScheduler::execute(size_t systemIndex, float deltaS) {
+	auto start = std::chrono::steady_clock::now();
+	this->systems[systemIndex].update(deltaS);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	SystemTiming* timing = &this->timings[systemIndex];
+	timing->lastMilliseconds = milliseconds;
+	timing->averageMilliseconds += (milliseconds - timing->averageMilliseconds) * TIMING_AVERAGE_WEIGHT;
+
+	for (size_t dependent : this->dependents[systemIndex]) {
+		if (this->remainingDependencies[dependent].fetch_sub(1) == 1) {
+			this->dispatch(dependent);
+		}
+	}
+
+	// Notify under the lock, run may return and the scheduler be destroyed as soon as the count reaches zero
+	std::lock_guard<std::mutex> lock(this->readyMutex);
+	this->remainingSystems--;
+	this->readyCondition.notify_all();
+}
+
+void SystemScheduler::run(float deltaS) {
+	if (this->systems.empty()) {
+		return;
+	}
+
+	this->frameDeltaS = deltaS;
+	this->buildGraph();
+	this->remainingSystems = this->systems.size();
+
+	// Find the roots before dispatching anything, a dispatched root can release its dependents straight away
+	std::vector<size_t> roots;
+
+	for (size_t i = 0; i < this->systems.size(); i++) {
+		if (this->remainingDependencies[i].load() == 0) {
+			roots.push_back(i);
+		}
+	}
+
+	for (size_t root : roots) {
+		this->dispatch(root);
+	}
+
+	while (this->remainingSystems > 0) {
+		size_t mainThreadSystem = 0;
+		bool hasMainThreadSystem = false;
+
+		{
+			std::lock_guard<std::mutex> lock(this->readyMutex);
+
+			if (!this->readyMainThreadSystems.empty()) {
+				mainThreadSystem = this->readyMainThreadSystems.back();
+				this->readyMainThreadSystems.pop_back();
+				hasMainThreadSystem = true;
+			}
+		}
+
+		if (hasMainThreadSystem) {
+			this->execute(mainThreadSystem, deltaS);
+			continue;
+		}
+
+		// Help the workers rather than idle, then sleep until something changes
+		if (!this->jobSystem->runPendingJob()) {
+			std::unique_lock<std::mutex> lock(this->readyMutex);
+			this->readyCondition.wait_for(lock, std::chrono::microseconds(200), [this]() {
+				return this->remainingSystems == 0 || !this->readyMainThreadSystems.empty();
+			});
+		}
+	}
+
+	// The last system may still be notifying
+	std::lock_guard<std::mutex> lock(this->readyMutex);
+}
+
+const std::vector<SystemTiming>* SystemScheduler::getTimings() {
+	return &this->timings;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "JobSystem.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One bit per component or shared resource a system touches
+using SystemAccessMask = uint64_t;
+
+struct SystemDescription {
+	std::string name;
+	SystemAccessMask reads;
+	SystemAccessMask writes;
+	std::function<void(float deltaS)> update;
+	// Systems that must run on the thread calling run, such as anything touching SDL or submitting to Vulkan
+	bool mainThread;
+};
+
+struct SystemTiming {
+	std::string name;
+	double lastMilliseconds;
+	// Exponential moving average so single spikes do not hide the trend
+	double averageMilliseconds;
+};
+
+// Runs the registered systems once per frame. Two systems conflict when either writes something the other reads or
+// writes. Conflicting systems run in registration order, everything else runs concurrently on the job system
+class SystemScheduler {
+	JobSystem* jobSystem;
+	std::vector<SystemDescription> systems;
+	std::vector<SystemTiming> timings;
+
+	// Rebuilt every frame
+	std::vector<std::vector<size_t>> dependents;
+	std::unique_ptr<std::atomic<uint32_t>[]> remainingDependencies;
+	std::atomic<size_t> remainingSystems = 0;
+
+	std::mutex readyMutex;
+	std::condition_variable readyCondition;
+	std::vector<size_t> readyMainThreadSystems;
+
+	void buildGraph();
+	void dispatch(size_t systemIndex);
+	void execute(size_t systemIndex, float deltaS);
+	float frameDeltaS = 0.0f;
+
+public:
+	explicit SystemScheduler(JobSystem* jobSystem);
+
+	size_t addSystem(SystemDescription description);
+	// Blocks until every system has run. The calling thread runs main thread systems and helps with other jobs
+	void run(float deltaS);
+	const std::vector<SystemTiming>* getTimings();
+};
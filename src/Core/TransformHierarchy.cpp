@@ -0,0 +1,277 @@
+#include "TransformHierarchy.hpp"
+
+// Upper three rows of a local matrix, the last row is always 0 0 0 1
+constexpr size_t LOCAL_MATRIX_FLOATS = 12;
+
+uint32_t TransformHierarchy::create(glm::vec3 position, glm::quat rotation, glm::vec3 scale, uint32_t parent) {
+	uint32_t node;
+
+	if (!this->freeNodes.empty()) {
+		node = this->freeNodes.back();
+		this->freeNodes.pop_back();
+	} else {
+		node = static_cast<uint32_t>(this->parents.size());
+
+		this->positionX.push_back(0.0f);
+		this->positionY.push_back(0.0f);
+		this->positionZ.push_back(0.0f);
+		this->rotationX.push_back(0.0f);
+		this->rotationY.push_back(0.0f);
+		this->rotationZ.push_back(0.0f);
+		this->rotationW.push_back(1.0f);
+		this->scaleX.push_back(1.0f);
+		this->scaleY.push_back(1.0f);
+		this->scaleZ.push_back(1.0f);
+		this->parents.push_back(TRANSFORM_NO_PARENT);
+		this->worldMatrices.push_back(glm::mat4{ 1.0f });
+		this->dirty.push_back(0);
+		this->changed.push_back(0);
+		this->alive.push_back(0);
+	}
+
+	this->alive[node] = 1;
+	this->parents[node] = parent;
+	this->setPosition(node, position);
+	this->setRotation(node, rotation);
+	this->setScale(node, scale);
+	this->updateOrderStale = true;
+
+	return node;
+}
+
+void TransformHierarchy::destroy(uint32_t node) {
+	for (uint32_t child = 0; child < this->parents.size(); child++) {
+		if (this->alive[child] && this->parents[child] == node) {
+			this->parents[child] = TRANSFORM_NO_PARENT;
+			this->dirty[child] = 1;
+		}
+	}
+
+	this->alive[node] = 0;
+	this->dirty[node] = 0;
+	this->changed[node] = 0;
+	this->parents[node] = TRANSFORM_NO_PARENT;
+	this->freeNodes.push_back(node);
+	this->updateOrderStale = true;
+}
+
+void TransformHierarchy::setParent(uint32_t node, uint32_t parent) {
+	for (uint32_t ancestor = parent; ancestor != TRANSFORM_NO_PARENT; ancestor = this->parents[ancestor]) {
+		if (ancestor == node) {
+			return;
+		}
+	}
+
+	this->parents[node] = parent;
+	this->dirty[node] = 1;
+	this->updateOrderStale = true;
+}
+
+void TransformHierarchy::setPosition(uint32_t node, glm::vec3 position) {
+	this->positionX[node] = position.x;
+	this->positionY[node] = position.y;
+	this->positionZ[node] = position.z;
+	this->dirty[node] = 1;
+}
+
+void TransformHierarchy::translate(uint32_t node, glm::vec3 offset) {
+	this->positionX[node] += offset.x;
+	this->positionY[node] += offset.y;
+	this->positionZ[node] += offset.z;
+	this->dirty[node] = 1;
+}
+
+void TransformHierarchy::setRotation(uint32_t node, glm::quat rotation) {
+	this->rotationX[node] = rotation.x;
+	this->rotationY[node] = rotation.y;
+	this->rotationZ[node] = rotation.z;
+	this->rotationW[node] = rotation.w;
+	this->dirty[node] = 1;
+}
+
+void TransformHierarchy::setScale(uint32_t node, glm::vec3 scale) {
+	this->scaleX[node] = scale.x;
+	this->scaleY[node] = scale.y;
+	this->scaleZ[node] = scale.z;
+	this->dirty[node] = 1;
+}
+
+glm::vec3 TransformHierarchy::getPosition(uint32_t node) const {
+	return { this->positionX[node], this->positionY[node], this->positionZ[node] };
+}
+
+uint32_t TransformHierarchy::getParent(uint32_t node) const {
+	return this->parents[node];
+}
+
+const glm::mat4& TransformHierarchy::getWorldMatrix(uint32_t node) const {
+	return this->worldMatrices[node];
+}
+
+bool TransformHierarchy::hasChanged(uint32_t node) const {
+	return this->changed[node] != 0;
+}
+
+size_t TransformHierarchy::size() const {
+	return this->parents.size() - this->freeNodes.size();
+}
+
+void TransformHierarchy::rebuildUpdateOrder() {
+	size_t nodeCount = this->parents.size();
+
+	// Counting sort by depth keeps parents ahead of their children
+	std::vector<uint32_t> depths(nodeCount, 0);
+	uint32_t maxDepth = 0;
+
+	for (uint32_t node = 0; node < nodeCount; node++) {
+		if (!this->alive[node]) {
+			continue;
+		}
+
+		uint32_t depth = 0;
+
+		for (uint32_t ancestor = this->parents[node]; ancestor != TRANSFORM_NO_PARENT; ancestor = this->parents[ancestor]) {
+			depth++;
+		}
+
+		depths[node] = depth;
+		maxDepth = std::max(maxDepth, depth);
+	}
+
+	std::vector<uint32_t> depthOffsets(maxDepth + 2, 0);
+
+	for (uint32_t node = 0; node < nodeCount; node++) {
+		if (this->alive[node]) {
+			depthOffsets[depths[node] + 1]++;
+		}
+	}
+
+	for (size_t depth = 1; depth < depthOffsets.size(); depth++) {
+		depthOffsets[depth] += depthOffsets[depth - 1];
+	}
+
+	this->updateOrder.resize(depthOffsets.back());
+
+	for (uint32_t node = 0; node < nodeCount; node++) {
+		if (this->alive[node]) {
+			this->updateOrder[depthOffsets[depths[node]]++] = node;
+		}
+	}
+
+	this->updateOrderStale = false;
+}
+
+void TransformHierarchy::computeLocalMatrices() {
+	size_t count = this->updateNodes.size();
+	this->localRows.resize(count * LOCAL_MATRIX_FLOATS);
+
+	// Gather into contiguous streams first so the conversion below is a straight loop the compiler can vectorise
+	std::vector<float> gathered(count * 10);
+	float* px = gathered.data();
+	float* py = px + count;
+	float* pz = py + count;
+	float* qx = pz + count;
+	float* qy = qx + count;
+	float* qz = qy + count;
+	float* qw = qz + count;
+	float* sx = qw + count;
+	float* sy = sx + count;
+	float* sz = sy + count;
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t node = this->updateNodes[i];
+		px[i] = this->positionX[node];
+		py[i] = this->positionY[node];
+		pz[i] = this->positionZ[node];
+		qx[i] = this->rotationX[node];
+		qy[i] = this->rotationY[node];
+		qz[i] = this->rotationZ[node];
+		qw[i] = this->rotationW[node];
+		sx[i] = this->scaleX[node];
+		sy[i] = this->scaleY[node];
+		sz[i] = this->scaleZ[node];
+	}
+
+	// One stream per matrix element, translate * rotate * scale written out by hand
+	float* rows = this->localRows.data();
+	float* m00 = rows;
+	float* m01 = m00 + count;
+	float* m02 = m01 + count;
+	float* m03 = m02 + count;
+	float* m10 = m03 + count;
+	float* m11 = m10 + count;
+	float* m12 = m11 + count;
+	float* m13 = m12 + count;
+	float* m20 = m13 + count;
+	float* m21 = m20 + count;
+	float* m22 = m21 + count;
+	float* m23 = m22 + count;
+
+	for (size_t i = 0; i < count; i++) {
+		float xx = qx[i] * qx[i];
+		float yy = qy[i] * qy[i];
+		float zz = qz[i] * qz[i];
+		float xy = qx[i] * qy[i];
+		float xz = qx[i] * qz[i];
+		float yz = qy[i] * qz[i];
+		float wx = qw[i] * qx[i];
+		float wy = qw[i] * qy[i];
+		float wz = qw[i] * qz[i];
+
+		// Row r, column c
+		m00[i] = (1.0f - 2.0f * (yy + zz)) * sx[i];
+		m01[i] = (2.0f * (xy - wz)) * sy[i];
+		m02[i] = (2.0f * (xz + wy)) * sz[i];
+		m03[i] = px[i];
+		m10[i] = (2.0f * (xy + wz)) * sx[i];
+		m11[i] = (1.0f - 2.0f * (xx + zz)) * sy[i];
+		m12[i] = (2.0f * (yz - wx)) * sz[i];
+		m13[i] = py[i];
+		m20[i] = (2.0f * (xz - wy)) * sx[i];
+		m21[i] = (2.0f * (yz + wx)) * sy[i];
+		m22[i] = (1.0f - 2.0f * (xx + yy)) * sz[i];
+		m23[i] = pz[i];
+	}
+}
+
+size_t TransformHierarchy::update() {
+	if (this->updateOrderStale) {
+		this->rebuildUpdateOrder();
+	}
+
+	std::fill(this->changed.begin(), this->changed.end(), 0);
+	this->updateNodes.clear();
+
+	// Parents come first, so a dirty parent has already marked the node by the time it is reached
+	for (uint32_t node : this->updateOrder) {
+		uint32_t parent = this->parents[node];
+
+		if (this->dirty[node] || (parent != TRANSFORM_NO_PARENT && this->changed[parent])) {
+			this->changed[node] = 1;
+			this->updateNodes.push_back(node);
+		}
+	}
+
+	this->computeLocalMatrices();
+
+	size_t count = this->updateNodes.size();
+	const float* rows = this->localRows.data();
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t node = this->updateNodes[i];
+
+		// glm is column major
+		glm::mat4 local{
+			rows[i], rows[4 * count + i], rows[8 * count + i], 0.0f,
+			rows[count + i], rows[5 * count + i], rows[9 * count + i], 0.0f,
+			rows[2 * count + i], rows[6 * count + i], rows[10 * count + i], 0.0f,
+			rows[3 * count + i], rows[7 * count + i], rows[11 * count + i], 1.0f
+		};
+
+		uint32_t parent = this->parents[node];
+		this->worldMatrices[node] = parent == TRANSFORM_NO_PARENT ? local : this->worldMatrices[parent] * local;
+		this->dirty[node] = 0;
+	}
+
+	return count;
+}
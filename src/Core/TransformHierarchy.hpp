@@ -0,0 +1,67 @@
+#pragma once
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+constexpr uint32_t TRANSFORM_NO_PARENT = UINT32_MAX;
+
+// Local translation, rotation and scale of every node with its cached world matrix. Local values are stored as
+// separate streams so dirty nodes are converted to matrices in straight loops. update walks the nodes parents first,
+// so a dirty node marks its whole subtree and untouched subtrees keep their cached matrices.
+// Nodes keep their id until destroyed. Changes and updates need exclusive access, reads of world matrices do not
+class TransformHierarchy {
+	std::vector<float> positionX;
+	std::vector<float> positionY;
+	std::vector<float> positionZ;
+	std::vector<float> rotationX;
+	std::vector<float> rotationY;
+	std::vector<float> rotationZ;
+	std::vector<float> rotationW;
+	std::vector<float> scaleX;
+	std::vector<float> scaleY;
+	std::vector<float> scaleZ;
+	std::vector<uint32_t> parents;
+	std::vector<glm::mat4> worldMatrices;
+	// Local values changed since the last update
+	std::vector<uint8_t> dirty;
+	// World matrix was recomputed by the last update
+	std::vector<uint8_t> changed;
+	std::vector<uint8_t> alive;
+	std::vector<uint32_t> freeNodes;
+
+	// Live nodes with every parent before its children, rebuilt when the shape of the hierarchy changes
+	std::vector<uint32_t> updateOrder;
+	bool updateOrderStale = false;
+
+	// Dirty nodes gathered in update order, with their local matrices as rows of 12 floats per stream
+	std::vector<uint32_t> updateNodes;
+	std::vector<float> localRows;
+
+	void rebuildUpdateOrder();
+	void computeLocalMatrices();
+
+public:
+	uint32_t create(glm::vec3 position, glm::quat rotation, glm::vec3 scale, uint32_t parent = TRANSFORM_NO_PARENT);
+	// Children of the node become roots and keep their local values
+	void destroy(uint32_t node);
+	// Local values are kept, so the node moves with its new parent. Parenting a node under its own subtree is ignored
+	void setParent(uint32_t node, uint32_t parent);
+
+	void setPosition(uint32_t node, glm::vec3 position);
+	void translate(uint32_t node, glm::vec3 offset);
+	void setRotation(uint32_t node, glm::quat rotation);
+	void setScale(uint32_t node, glm::vec3 scale);
+
+	glm::vec3 getPosition(uint32_t node) const;
+	uint32_t getParent(uint32_t node) const;
+	const glm::mat4& getWorldMatrix(uint32_t node) const;
+	// True if the last update moved the node
+	bool hasChanged(uint32_t node) const;
+
+	// Recomputes the world matrices of dirty nodes and their descendants. Returns the number recomputed
+	size_t update();
+	size_t size() const;
+};
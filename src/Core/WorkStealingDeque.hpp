@@ -0,0 +1,77 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed capacity Chase-Lev deque. Only the owning thread may push and pop, at the bottom.
+// Any thread may steal from the top. Capacity must be a power of two
+template<typename T, size_t Capacity>
+class WorkStealingDeque {
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	alignas(64) std::atomic<int64_t> top = 0;
+	alignas(64) std::atomic<int64_t> bottom = 0;
+	std::array<std::atomic<T>, Capacity> buffer;
+
+public:
+	// Returns false when the deque is full
+	bool push(T item) {
+		int64_t b = this->bottom.load(std::memory_order_relaxed);
+		int64_t t = this->top.load(std::memory_order_acquire);
+
+		if (b - t >= static_cast<int64_t>(Capacity)) {
+			return false;
+		}
+
+		this->buffer[b & (Capacity - 1)].store(item, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	bool pop(T* item) {
+		int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+		this->bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = this->top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			// Empty
+			this->bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		*item = this->buffer[b & (Capacity - 1)].load(std::memory_order_relaxed);
+
+		if (t == b) {
+			// Last item, race the thieves for it
+			bool won = this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			this->bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+
+		return true;
+	}
+
+	bool steal(T* item) {
+		int64_t t = this->top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = this->bottom.load(std::memory_order_acquire);
+
+		if (t >= b) {
+			return false;
+		}
+
+		T stolen = this->buffer[t & (Capacity - 1)].load(std::memory_order_relaxed);
+
+		if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return false;
+		}
+
+		*item = stolen;
+
+		return true;
+	}
+};
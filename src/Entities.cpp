@@ -1,24 +1,153 @@
 #include "Entities.hpp"
 
-size_t Entities::addEntity(AddEntityInfo* info) {
-    size_t id = 0;
+EntityHandle Entities::allocateHandle() {
+    EntityHandle handle{};
 
     if (!this->reusableIds.empty()) {
-        id = this->reusableIds.front();
+        handle.index = this->reusableIds.front();
         this->reusableIds.pop();
     } else {
-        id = this->usedIds.size();
-        // Resize data structures to match new size
-        this->modelResources.resize(id + 1);
+        handle.index = static_cast<uint32_t>(this->generations.size());
+        this->generations.push_back(0);
+        this->aliveIds.push_back(false);
+        this->locations.push_back({});
     }
 
-    this->usedIds.push_back(id);
+    handle.generation = this->generations[handle.index];
+    this->aliveIds[handle.index] = true;
 
-    this->modelResources.at(id) = info->modelResource;
+    return handle;
+}
+
+bool Entities::destroyEntity(EntityHandle handle) {
+    if (!this->isAlive(handle)) {
+        return false;
+    }
+
+    this->removeRow(this->locations[handle.index]);
+
+    // Any handle still holding the old generation is now stale
+    this->generations[handle.index]++;
+    this->aliveIds[handle.index] = false;
+    this->reusableIds.push(handle.index);
+
+    return true;
+}
+
+bool Entities::isAlive(EntityHandle handle) const {
+    return handle.index < this->generations.size() && this->aliveIds[handle.index] && this->generations[handle.index] == handle.generation;
+}
+
+uint32_t Entities::findOrCreateArchetype(ComponentMask mask) {
+    auto existing = this->maskToArchetype.find(mask);
+
+    if (existing != this->maskToArchetype.end()) {
+        return existing->second;
+    }
+
+    Archetype archetype{};
+    archetype.mask = mask;
+    archetype.columnOffsets.fill(MISSING_COLUMN);
+
+    size_t bytesPerEntity = sizeof(EntityHandle);
+    size_t columnCount = 1;
+
+    for (uint32_t id = 0; id < MAX_COMPONENT_TYPES; id++) {
+        if (mask & (ComponentMask{ 1 } << id)) {
+            bytesPerEntity += this->componentTypes[id].size;
+            columnCount++;
+        }
+    }
+
+    // Leave room for the padding between cache line aligned columns
+    size_t usableBytes = ARCHETYPE_CHUNK_SIZE - (columnCount * ARCHETYPE_COLUMN_ALIGNMENT);
+    archetype.chunkCapacity = static_cast<uint32_t>(usableBytes / bytesPerEntity);
+
+    // The entity handle column sits at the start of the chunk, component columns follow
+    size_t offset = archetype.chunkCapacity * sizeof(EntityHandle);
+
+    for (uint32_t id = 0; id < MAX_COMPONENT_TYPES; id++) {
+        if (mask & (ComponentMask{ 1 } << id)) {
+            offset = (offset + ARCHETYPE_COLUMN_ALIGNMENT - 1) & ~(ARCHETYPE_COLUMN_ALIGNMENT - 1);
+            archetype.columnOffsets[id] = static_cast<uint32_t>(offset);
+            offset += archetype.chunkCapacity * this->componentTypes[id].size;
+        }
+    }
+
+    uint32_t index = static_cast<uint32_t>(this->archetypes.size());
+    this->archetypes.push_back(std::move(archetype));
+    this->maskToArchetype[mask] = index;
+
+    return index;
+}
+
+EntityLocation Entities::allocateRow(uint32_t archetypeIndex) {
+    Archetype* archetype = &this->archetypes[archetypeIndex];
+
+    if (archetype->chunks.empty() || archetype->chunks.back().count == archetype->chunkCapacity) {
+        ArchetypeChunk chunk{};
+        chunk.memory.reset(static_cast<uint8_t*>(::operator new[](ARCHETYPE_CHUNK_SIZE, std::align_val_t(ARCHETYPE_COLUMN_ALIGNMENT))));
+        chunk.count = 0;
+        archetype->chunks.push_back(std::move(chunk));
+    }
+
+    EntityLocation location{};
+    location.archetype = archetypeIndex;
+    location.chunk = static_cast<uint32_t>(archetype->chunks.size() - 1);
+    location.row = archetype->chunks.back().count++;
+
+    return location;
+}
+
+void Entities::removeRow(EntityLocation location) {
+    Archetype* archetype = &this->archetypes[location.archetype];
+    uint32_t lastChunk = static_cast<uint32_t>(archetype->chunks.size() - 1);
+    uint32_t lastRow = archetype->chunks[lastChunk].count - 1;
+
+    // Fill the hole with the last entity of the archetype so chunks stay packed
+    if (location.chunk != lastChunk || location.row != lastRow) {
+        EntityHandle moved = this->getEntityColumn(archetype, lastChunk)[lastRow];
+        this->getEntityColumn(archetype, location.chunk)[location.row] = moved;
+
+        for (uint32_t id = 0; id < MAX_COMPONENT_TYPES; id++) {
+            if (archetype->columnOffsets[id] == MISSING_COLUMN) {
+                continue;
+            }
+
+            size_t size = this->componentTypes[id].size;
+            memcpy(this->getColumn(archetype, location.chunk, id) + (location.row * size), this->getColumn(archetype, lastChunk, id) + (lastRow * size), size);
+        }
 
-    return id;
+        this->locations[moved.index] = location;
+    }
+
+    archetype->chunks[lastChunk].count--;
+
+    if (archetype->chunks[lastChunk].count == 0) {
+        archetype->chunks.pop_back();
+    }
 }
 
-std::vector<ModelResource>* Entities::getModelResourceIds() {
-    return &this->modelResources;
-}
\ No newline at end of file
+void Entities::moveToArchetype(EntityHandle handle, ComponentMask mask) {
+    EntityLocation oldLocation = this->locations[handle.index];
+    EntityLocation newLocation = this->allocateRow(this->findOrCreateArchetype(mask));
+
+    // Creating an archetype can reallocate the archetype list, so look both up afterwards
+    Archetype* oldArchetype = &this->archetypes[oldLocation.archetype];
+    Archetype* newArchetype = &this->archetypes[newLocation.archetype];
+
+    this->getEntityColumn(newArchetype, newLocation.chunk)[newLocation.row] = handle;
+
+    // Copy the components both archetypes share, new components are left for the caller to write
+    for (uint32_t id = 0; id < MAX_COMPONENT_TYPES; id++) {
+        if (oldArchetype->columnOffsets[id] == MISSING_COLUMN || newArchetype->columnOffsets[id] == MISSING_COLUMN) {
+            continue;
+        }
+
+        size_t size = this->componentTypes[id].size;
+        memcpy(this->getColumn(newArchetype, newLocation.chunk, id) + (newLocation.row * size), this->getColumn(oldArchetype, oldLocation.chunk, id) + (oldLocation.row * size), size);
+    }
+
+    this->removeRow(oldLocation);
+    this->locations[handle.index] = newLocation;
+}
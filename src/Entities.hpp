@@ -1,22 +1,214 @@
 #pragma once
 #include <vector>
-#include "Components/ModelComponent.h"
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
 #include <queue>
+#include <iostream>
+#include <cstdlib>
+#include "Components/ComponentArray.hpp"
 
-struct AddEntityInfo {
-	ModelResource modelResource;
+using ComponentMask = uint64_t;
+
+constexpr size_t MAX_COMPONENT_TYPES = 64;
+constexpr size_t ARCHETYPE_CHUNK_SIZE = 16 * 1024;
+// Every component column in a chunk starts on its own cache line
+constexpr size_t ARCHETYPE_COLUMN_ALIGNMENT = 64;
+constexpr uint32_t MISSING_COLUMN = UINT32_MAX;
+
+struct ComponentTypeInfo {
+	size_t size;
+	size_t alignment;
+};
+
+inline uint32_t nextComponentTypeId() {
+	static std::atomic<uint32_t> counter = 0;
+	return counter.fetch_add(1);
+}
+
+// Each component type gets a bit in ComponentMask the first time it is used
+template<typename T>
+uint32_t componentTypeId() {
+	static const uint32_t id = nextComponentTypeId();
+	return id;
+}
+
+template<typename... Ts>
+ComponentMask componentMask() {
+	return (ComponentMask{ 0 } | ... | (ComponentMask{ 1 } << componentTypeId<Ts>()));
+}
+
+struct ChunkDeleter {
+	void operator()(uint8_t* memory) const {
+		::operator delete[](memory, std::align_val_t(ARCHETYPE_COLUMN_ALIGNMENT));
+	}
+};
+
+// Fixed size block holding up to chunkCapacity entities of one archetype, one column per component
+struct ArchetypeChunk {
+	std::unique_ptr<uint8_t[], ChunkDeleter> memory;
+	uint32_t count;
+};
+
+// All entities with exactly the same set of components. Only the last chunk can be partially filled
+struct Archetype {
+	ComponentMask mask;
+	uint32_t chunkCapacity;
+	// Byte offset of each component column inside a chunk, MISSING_COLUMN if the archetype lacks the component
+	std::array<uint32_t, MAX_COMPONENT_TYPES> columnOffsets;
+	std::vector<ArchetypeChunk> chunks;
 };
 
+struct EntityLocation {
+	uint32_t archetype;
+	uint32_t chunk;
+	uint32_t row;
+};
+
+// Archetype based entity storage. Components are stored SoA in chunks shared by every entity with the same component set.
+// Components must be trivially copyable since rows are moved with memcpy. Entities must not be created, destroyed or
+// change components while a query is running
 class Entities {
 	// ID stuff
-	std::queue<size_t> reusableIds;
-	std::vector<size_t> usedIds;
+	std::queue<uint32_t> reusableIds;
+	// Generation of each entity index, bumped whenever the index is destroyed
+	std::vector<uint32_t> generations;
+	std::vector<bool> aliveIds;
+	std::vector<EntityLocation> locations;
 
 	// Components
-	std::vector<ModelResource> modelResources;
-	
+	std::array<ComponentTypeInfo, MAX_COMPONENT_TYPES> componentTypes{};
+	std::vector<Archetype> archetypes;
+	std::unordered_map<ComponentMask, uint32_t> maskToArchetype;
+
+	template<typename T>
+	ComponentMask registerComponent() {
+		static_assert(std::is_trivially_copyable_v<T>, "Components are moved between chunks with memcpy");
+
+		uint32_t id = componentTypeId<T>();
+
+		if (id >= MAX_COMPONENT_TYPES) {
+			std::cout << "Too many component types registered" << std::endl;
+			abort();
+		}
+
+		this->componentTypes[id] = { sizeof(T), alignof(T) };
+
+		return ComponentMask{ 1 } << id;
+	}
+
+	uint32_t findOrCreateArchetype(ComponentMask mask);
+	EntityLocation allocateRow(uint32_t archetypeIndex);
+	void removeRow(EntityLocation location);
+	void moveToArchetype(EntityHandle handle, ComponentMask mask);
+	EntityHandle allocateHandle();
+
+	uint8_t* getColumn(const Archetype* archetype, uint32_t chunk, uint32_t typeId) {
+		return archetype->chunks[chunk].memory.get() + archetype->columnOffsets[typeId];
+	}
+
+	EntityHandle* getEntityColumn(const Archetype* archetype, uint32_t chunk) {
+		return reinterpret_cast<EntityHandle*>(archetype->chunks[chunk].memory.get());
+	}
+
+	template<typename T>
+	T* getTypedColumn(const Archetype* archetype, uint32_t chunk) {
+		return reinterpret_cast<T*>(this->getColumn(archetype, chunk, componentTypeId<T>()));
+	}
+
 public:
-	size_t addEntity(AddEntityInfo* info);
+	template<typename... Ts>
+	EntityHandle createEntity(const Ts&... components) {
+		ComponentMask mask = (ComponentMask{ 0 } | ... | this->registerComponent<Ts>());
+
+		EntityHandle handle = this->allocateHandle();
+		EntityLocation location = this->allocateRow(this->findOrCreateArchetype(mask));
+		this->locations[handle.index] = location;
+
+		Archetype* archetype = &this->archetypes[location.archetype];
+		this->getEntityColumn(archetype, location.chunk)[location.row] = handle;
+		((this->getTypedColumn<Ts>(archetype, location.chunk)[location.row] = components), ...);
+
+		return handle;
+	}
+
+	// Returns false if the handle is stale
+	bool destroyEntity(EntityHandle handle);
+	bool isAlive(EntityHandle handle) const;
+
+	template<typename T>
+	bool hasComponent(EntityHandle handle) const {
+		if (!this->isAlive(handle)) {
+			return false;
+		}
+
+		return (this->archetypes[this->locations[handle.index].archetype].mask & (ComponentMask{ 1 } << componentTypeId<T>())) != 0;
+	}
+
+	// Valid until the entity changes archetype or a row is moved by a destroy
+	template<typename T>
+	T* getComponent(EntityHandle handle) {
+		if (!this->hasComponent<T>(handle)) {
+			return nullptr;
+		}
+
+		EntityLocation location = this->locations[handle.index];
+		return &this->getTypedColumn<T>(&this->archetypes[location.archetype], location.chunk)[location.row];
+	}
 
-	std::vector<ModelResource>* getModelResourceIds();
-};
\ No newline at end of file
+	template<typename T>
+	void addComponent(EntityHandle handle, const T& component) {
+		if (!this->isAlive(handle)) {
+			return;
+		}
+
+		ComponentMask componentBit = this->registerComponent<T>();
+		ComponentMask mask = this->archetypes[this->locations[handle.index].archetype].mask;
+
+		if ((mask & componentBit) == 0) {
+			this->moveToArchetype(handle, mask | componentBit);
+		}
+
+		*this->getComponent<T>(handle) = component;
+	}
+
+	template<typename T>
+	void removeComponent(EntityHandle handle) {
+		if (!this->hasComponent<T>(handle)) {
+			return;
+		}
+
+		ComponentMask mask = this->archetypes[this->locations[handle.index].archetype].mask;
+		this->moveToArchetype(handle, mask & ~(ComponentMask{ 1 } << componentTypeId<T>()));
+	}
+
+	// Calls function(count, entities, columns...) once per chunk of every archetype holding all of Ts
+	template<typename... Ts, typename F>
+	void forEachChunk(F&& function) {
+		ComponentMask required = componentMask<Ts...>();
+
+		for (auto& archetype : this->archetypes) {
+			if ((archetype.mask & required) != required) {
+				continue;
+			}
+
+			for (uint32_t chunk = 0; chunk < archetype.chunks.size(); chunk++) {
+				function(archetype.chunks[chunk].count, this->getEntityColumn(&archetype, chunk), this->getTypedColumn<Ts>(&archetype, chunk)...);
+			}
+		}
+	}
+
+	// Calls function(entity, components...) for every entity holding all of Ts
+	template<typename... Ts, typename F>
+	void forEach(F&& function) {
+		this->forEachChunk<Ts...>([&function](uint32_t count, EntityHandle* entities, Ts*... columns) {
+			for (uint32_t i = 0; i < count; i++) {
+				function(entities[i], columns[i]...);
+			}
+		});
+	}
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+
+// Binary layout of a cooked model. The cooked file sits next to the source model with COOKED_MODEL_EXTENSION appended
+constexpr uint32_t COOKED_MODEL_MAGIC = 0x4B4F4F43;
+constexpr uint32_t COOKED_MODEL_VERSION = 3;
+constexpr const char* COOKED_MODEL_EXTENSION = ".cooked";
+// Streams are aligned so they can be read in place from the mapping
+constexpr uint64_t COOKED_MODEL_STREAM_ALIGNMENT = 16;
+
+struct CookedModelHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Source file size, write time and import flags the model was cooked from. A mismatch means the cooked file is stale
+	uint64_t sourceSize;
+	int64_t sourceWriteTime;
+	uint32_t importFlags;
+	uint32_t meshCount;
+};
+
+// Stream offsets are from the start of the file
+struct CookedMeshHeader {
+	float meshMatrix[16];
+	float aabbMin[3];
+	float aabbMax[3];
+	float sphereCenter[3];
+	float sphereRadius;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint64_t positionsOffset;
+	uint64_t normalsOffset;
+	uint64_t texCoordsOffset;
+	uint64_t tangentsOffset;
+	uint64_t indicesOffset;
+	uint64_t diffusePathOffset;
+	uint64_t diffusePathLength;
+};
@@ -0,0 +1,120 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	this->close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path) {
+	this->close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize{};
+
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	this->fileHandle = file;
+	this->mappingHandle = mapping;
+	this->mappedData = static_cast<const uint8_t*>(view);
+	this->mappedSize = static_cast<size_t>(fileSize.QuadPart);
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (this->mappedData != nullptr) {
+		UnmapViewOfFile(this->mappedData);
+	}
+
+	if (this->mappingHandle != nullptr) {
+		CloseHandle(this->mappingHandle);
+	}
+
+	if (this->fileHandle != nullptr) {
+		CloseHandle(this->fileHandle);
+	}
+
+	this->mappedData = nullptr;
+	this->mappedSize = 0;
+	this->mappingHandle = nullptr;
+	this->fileHandle = nullptr;
+}
+#else
+bool MappedFile::open(const std::string& path) {
+	this->close();
+
+	int file = ::open(path.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat fileStat{};
+
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+		::close(file);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+	if (view == MAP_FAILED) {
+		::close(file);
+		return false;
+	}
+
+	this->fileDescriptor = file;
+	this->mappedData = static_cast<const uint8_t*>(view);
+	this->mappedSize = static_cast<size_t>(fileStat.st_size);
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (this->mappedData != nullptr) {
+		munmap(const_cast<uint8_t*>(this->mappedData), this->mappedSize);
+	}
+
+	if (this->fileDescriptor >= 0) {
+		::close(this->fileDescriptor);
+	}
+
+	this->mappedData = nullptr;
+	this->mappedSize = 0;
+	this->fileDescriptor = -1;
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+// Read only memory mapping of a whole file. The mapping is released when the object is destroyed
+class MappedFile {
+	const uint8_t* mappedData = nullptr;
+	size_t mappedSize = 0;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	bool open(const std::string& path);
+	void close();
+
+	const uint8_t* data() const {
+		return this->mappedData;
+	}
+
+	size_t size() const {
+		return this->mappedSize;
+	}
+};
@@ -1,69 +1,463 @@
 #include "ModelManager.hpp"
+#include "CookedModel.hpp"
+#include "MappedFile.hpp"
 
 #include <array>
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
 #include <stb_image.h>
 
+constexpr uint32_t MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+struct SourceFileStamp {
+	uint64_t size;
+	int64_t writeTime;
+	bool valid;
+};
+
+static SourceFileStamp getSourceFileStamp(const std::string& path) {
+	SourceFileStamp stamp{};
+	std::error_code error;
+
+	stamp.size = std::filesystem::file_size(path, error);
+
+	if (error) {
+		return stamp;
+	}
+
+	auto writeTime = std::filesystem::last_write_time(path, error);
+
+	if (error) {
+		return stamp;
+	}
+
+	stamp.writeTime = static_cast<int64_t>(writeTime.time_since_epoch().count());
+	stamp.valid = true;
+
+	return stamp;
+}
+
+static uint64_t alignStreamOffset(uint64_t offset) {
+	return (offset + COOKED_MODEL_STREAM_ALIGNMENT - 1) & ~(COOKED_MODEL_STREAM_ALIGNMENT - 1);
+}
+
+static bool streamInBounds(uint64_t offset, uint64_t size, size_t fileSize) {
+	return offset <= fileSize && size <= fileSize - offset;
+}
+
+// The sphere is centred on the AABB rather than being minimal, which is close enough for culling
+static MeshBounds computeMeshBounds(const glm::vec3* positions, size_t vertexCount) {
+	MeshBounds bounds{};
+
+	if (vertexCount == 0) {
+		return bounds;
+	}
+
+	bounds.aabbMin = positions[0];
+	bounds.aabbMax = positions[0];
+
+	for (size_t i = 1; i < vertexCount; i++) {
+		bounds.aabbMin = glm::min(bounds.aabbMin, positions[i]);
+		bounds.aabbMax = glm::max(bounds.aabbMax, positions[i]);
+	}
+
+	bounds.sphereCenter = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+	float radiusSquared = 0.0f;
+
+	for (size_t i = 0; i < vertexCount; i++) {
+		glm::vec3 offset = positions[i] - bounds.sphereCenter;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+
+	bounds.sphereRadius = std::sqrt(radiusSquared);
+
+	return bounds;
+}
+
 LoadModelResults ModelManager::loadModel(const std::string& directory, const std::string& modelFileName, const std::string& identifier) {
 	LoadModelResults result{};
+	std::promise<uint64_t> loadPromise;
+	std::shared_future<uint64_t> loadStatus;
+	bool alreadyReserved = false;
+
+	// Reserve the slots before importing so concurrent requests for the same model share one import
+	{
+		std::lock_guard<std::mutex> lock(this->modelMutex);
+		auto existing = this->nameToModelComponentId.find(identifier);
+
+		if (existing != this->nameToModelComponentId.end()) {
+			result.id = existing->second;
+			loadStatus = this->modelLoadStatus[result.id];
+			alreadyReserved = true;
+		} else {
+			result.id = this->loadedModels.reserve();
+			this->modelDetails.reserve();
+			this->modelLoadStatus.reserve();
 
-	if (this->nameToModelComponentId.find(identifier) != this->nameToModelComponentId.end()) {
-		result.id = this->nameToModelComponentId[identifier];
-		result.flags = LoadModelResultFlags::AlreadyLoaded;
-	} else {
-		Assimp::Importer importer;
-		std::string modelFilepath = directory;
-		modelFilepath = modelFilepath.append("/").append(modelFileName);
+			loadStatus = loadPromise.get_future().share();
+			this->modelLoadStatus[result.id] = loadStatus;
+			this->nameToModelComponentId[identifier] = result.id;
+		}
+	}
+
+	if (alreadyReserved) {
+		// Wait for the thread that owns the import so the caller never sees a half loaded model
+		result.flags = LoadModelResultFlags::AlreadyLoaded | loadStatus.get();
+		return result;
+	}
 
-		const aiScene* scene = importer.ReadFile(modelFilepath, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+	result.flags = this->importModel(directory, modelFileName, &this->loadedModels[result.id], &this->modelDetails[result.id]);
+	loadPromise.set_value(result.flags);
 
-		ModelComponent modelComponent;
-		ModelDetails modelDetails;
+	return result;
+}
 
-		modelDetails.directory = directory;
+void ModelManager::loadModelsAsync(const std::vector<ModelLoadRequest>& requests, std::vector<LoadModelResults>* results, JobCounter* counter) {
+	results->assign(requests.size(), {});
+
+	// Requests repeating a model this batch imports, listed under the request that owns the import
+	std::vector<std::vector<size_t>> batchDuplicates(requests.size());
+	// Shared so the promise can live in a copyable job
+	std::vector<std::shared_ptr<std::promise<uint64_t>>> loadPromises(requests.size());
+	std::vector<size_t> otherImportRequests;
+	std::vector<std::shared_future<uint64_t>> otherImports;
+
+	// Reserve every slot before any job starts, so no job ever waits on another import. A job that reached an import
+	// further down its own stack by helping would wait forever
+	{
+		std::lock_guard<std::mutex> lock(this->modelMutex);
+		std::map<std::string, size_t> batchOwners;
+
+		for (size_t i = 0; i < requests.size(); i++) {
+			const std::string& identifier = requests[i].identifier;
+			LoadModelResults* result = &results->at(i);
+			auto batchOwner = batchOwners.find(identifier);
+
+			if (batchOwner != batchOwners.end()) {
+				result->id = results->at(batchOwner->second).id;
+				batchDuplicates[batchOwner->second].push_back(i);
+				continue;
+			}
+
+			auto existing = this->nameToModelComponentId.find(identifier);
+
+			if (existing != this->nameToModelComponentId.end()) {
+				result->id = existing->second;
+				otherImportRequests.push_back(i);
+				otherImports.push_back(this->modelLoadStatus[result->id]);
+				continue;
+			}
+
+			result->id = this->loadedModels.reserve();
+			this->modelDetails.reserve();
+			this->modelLoadStatus.reserve();
+
+			loadPromises[i] = std::make_shared<std::promise<uint64_t>>();
+			this->modelLoadStatus[result->id] = loadPromises[i]->get_future().share();
+			this->nameToModelComponentId[identifier] = result->id;
+			batchOwners[identifier] = i;
+		}
+	}
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		if (!loadPromises[i]) {
+			continue;
+		}
+
+		this->jobSystem->run([this, request = requests[i], results, i, loadPromise = loadPromises[i], duplicates = std::move(batchDuplicates[i])]() {
+			LoadModelResults* result = &results->at(i);
+			result->flags = this->importModel(request.directory, request.modelFileName, &this->loadedModels[result->id], &this->modelDetails[result->id]);
+			loadPromise->set_value(result->flags);
+
+			for (size_t duplicate : duplicates) {
+				results->at(duplicate).flags = LoadModelResultFlags::AlreadyLoaded | result->flags;
+			}
+		}, counter);
+	}
+
+	// Models already loaded or being imported for another caller. Their jobs do not depend on this thread
+	for (size_t i = 0; i < otherImports.size(); i++) {
+		results->at(otherImportRequests[i]).flags = LoadModelResultFlags::AlreadyLoaded | otherImports[i].get();
+	}
+}
+
+uint64_t ModelManager::importModel(const std::string& directory, const std::string& modelFileName, ModelComponent* modelComponent, ModelDetails* modelDetails) {
+	uint64_t flags = 0;
+
+	std::string modelFilepath = directory;
+	modelFilepath = modelFilepath.append("/").append(modelFileName);
+	std::string cookedFilepath = modelFilepath + COOKED_MODEL_EXTENSION;
+
+	modelDetails->directory = directory;
+
+	// Only fall back to assimp when there is no up to date cooked model
+	if (!this->loadCookedModel(cookedFilepath, modelFilepath, modelComponent, modelDetails)) {
+		// Importers are not thread safe. Each import owns one, since a worker waiting on the mesh jobs
+		// below can pick up another model's import while this scene is still being read
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(modelFilepath, MODEL_IMPORT_FLAGS);
 
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 			std::cerr << "Error : Assimp : " << importer.GetErrorString() << "\n";
-			result.flags = LoadModelResultFlags::ErrorLoading;
+			flags = LoadModelResultFlags::ErrorLoading;
+		} else {
+			//std::map<std::string, GLuint> loadedTextures;
+
+			this->processNode(scene->mRootNode, scene, modelComponent, directory, modelDetails);
+			this->cookModel(cookedFilepath, modelFilepath, modelComponent, modelDetails);
 		}
 
-		//std::map<std::string, GLuint> loadedTextures;
+		importer.FreeScene();
+	}
+
+	return flags;
+}
+
+bool ModelManager::loadCookedModel(const std::string& cookedFilepath, const std::string& modelFilepath, ModelComponent* modelComponent, ModelDetails* details) {
+	SourceFileStamp stamp = getSourceFileStamp(modelFilepath);
 
-		this->processNode(scene->mRootNode, scene, &modelComponent, directory, &modelDetails);
+	if (!stamp.valid) {
+		return false;
+	}
 
-		size_t id = this->loadedModels.size();
-		this->loadedModels.push_back(modelComponent);
-		this->nameToModelComponentId[identifier] = id;
+	auto mapping = std::make_shared<MappedFile>();
 
-		result.id = id;
+	if (!mapping->open(cookedFilepath)) {
+		return false;
 	}
 
-	return result;
+	const uint8_t* data = mapping->data();
+	size_t fileSize = mapping->size();
+
+	if (fileSize < sizeof(CookedModelHeader)) {
+		return false;
+	}
+
+	CookedModelHeader header{};
+	memcpy(&header, data, sizeof(CookedModelHeader));
+
+	if (header.magic != COOKED_MODEL_MAGIC || header.version != COOKED_MODEL_VERSION) {
+		return false;
+	}
+
+	if (header.sourceSize != stamp.size || header.sourceWriteTime != stamp.writeTime || header.importFlags != MODEL_IMPORT_FLAGS) {
+		std::cout << "Cooked model is stale, reimporting: " << modelFilepath << std::endl;
+		return false;
+	}
+
+	if (!streamInBounds(sizeof(CookedModelHeader), static_cast<uint64_t>(header.meshCount) * sizeof(CookedMeshHeader), fileSize)) {
+		return false;
+	}
+
+	std::vector<MeshStreamView> meshes(header.meshCount);
+	std::vector<MaterialInfo> materials(header.meshCount);
+	std::vector<glm::mat4> meshMatrices(header.meshCount);
+	std::vector<MeshBounds> meshBounds(header.meshCount);
+
+	for (uint32_t i = 0; i < header.meshCount; i++) {
+		CookedMeshHeader meshHeader{};
+		memcpy(&meshHeader, data + sizeof(CookedModelHeader) + (i * sizeof(CookedMeshHeader)), sizeof(CookedMeshHeader));
+
+		uint64_t vec3StreamSize = static_cast<uint64_t>(meshHeader.vertexCount) * sizeof(glm::vec3);
+		uint64_t vec2StreamSize = static_cast<uint64_t>(meshHeader.vertexCount) * sizeof(glm::vec2);
+		uint64_t indexStreamSize = static_cast<uint64_t>(meshHeader.indexCount) * sizeof(uint32_t);
+
+		bool inBounds = streamInBounds(meshHeader.positionsOffset, vec3StreamSize, fileSize)
+			&& streamInBounds(meshHeader.normalsOffset, vec3StreamSize, fileSize)
+			&& streamInBounds(meshHeader.texCoordsOffset, vec2StreamSize, fileSize)
+			&& streamInBounds(meshHeader.tangentsOffset, vec3StreamSize, fileSize)
+			&& streamInBounds(meshHeader.indicesOffset, indexStreamSize, fileSize)
+			&& streamInBounds(meshHeader.diffusePathOffset, meshHeader.diffusePathLength, fileSize);
+
+		if (!inBounds) {
+			std::cout << "Cooked model is corrupt, reimporting: " << modelFilepath << std::endl;
+			return false;
+		}
+
+		// The streams are used in place, nothing is copied out of the mapping
+		MeshStreamView* view = &meshes[i];
+		view->positions = reinterpret_cast<const glm::vec3*>(data + meshHeader.positionsOffset);
+		view->normals = reinterpret_cast<const glm::vec3*>(data + meshHeader.normalsOffset);
+		view->texCoords = reinterpret_cast<const glm::vec2*>(data + meshHeader.texCoordsOffset);
+		view->tangents = reinterpret_cast<const glm::vec3*>(data + meshHeader.tangentsOffset);
+		view->indices = reinterpret_cast<const uint32_t*>(data + meshHeader.indicesOffset);
+		view->vertexCount = meshHeader.vertexCount;
+		view->indexCount = meshHeader.indexCount;
+
+		materials[i].diffusePath.assign(reinterpret_cast<const char*>(data + meshHeader.diffusePathOffset), meshHeader.diffusePathLength);
+		memcpy(&meshMatrices[i], meshHeader.meshMatrix, sizeof(glm::mat4));
+
+		MeshBounds* bounds = &meshBounds[i];
+		bounds->aabbMin = { meshHeader.aabbMin[0], meshHeader.aabbMin[1], meshHeader.aabbMin[2] };
+		bounds->aabbMax = { meshHeader.aabbMax[0], meshHeader.aabbMax[1], meshHeader.aabbMax[2] };
+		bounds->sphereCenter = { meshHeader.sphereCenter[0], meshHeader.sphereCenter[1], meshHeader.sphereCenter[2] };
+		bounds->sphereRadius = meshHeader.sphereRadius;
+	}
+
+	modelComponent->cookedMapping = std::move(mapping);
+	modelComponent->cookedMeshes = std::move(meshes);
+	modelComponent->meshes.materials = std::move(materials);
+	modelComponent->meshBounds = std::move(meshBounds);
+	details->meshMatrices = std::move(meshMatrices);
+
+	return true;
 }
 
-std::vector<ModelComponent>* ModelManager::getModelComponents() {
+void ModelManager::cookModel(const std::string& cookedFilepath, const std::string& modelFilepath, ModelComponent* modelComponent, ModelDetails* details) {
+	SourceFileStamp stamp = getSourceFileStamp(modelFilepath);
+
+	if (!stamp.valid) {
+		return;
+	}
+
+	MeshComponents* meshes = &modelComponent->meshes;
+	uint32_t meshCount = static_cast<uint32_t>(modelComponent->meshCount());
+
+	CookedModelHeader header{};
+	header.magic = COOKED_MODEL_MAGIC;
+	header.version = COOKED_MODEL_VERSION;
+	header.sourceSize = stamp.size;
+	header.sourceWriteTime = stamp.writeTime;
+	header.importFlags = MODEL_IMPORT_FLAGS;
+	header.meshCount = meshCount;
+
+	// Lay out every stream after the headers
+	std::vector<CookedMeshHeader> meshHeaders(meshCount);
+	uint64_t offset = sizeof(CookedModelHeader) + (static_cast<uint64_t>(meshCount) * sizeof(CookedMeshHeader));
+
+	for (uint32_t i = 0; i < meshCount; i++) {
+		CookedMeshHeader* meshHeader = &meshHeaders[i];
+		meshHeader->vertexCount = static_cast<uint32_t>(meshes->vertices[i].size());
+		meshHeader->indexCount = static_cast<uint32_t>(meshes->indices[i].size());
+
+		uint64_t vec3StreamSize = static_cast<uint64_t>(meshHeader->vertexCount) * sizeof(glm::vec3);
+
+		meshHeader->positionsOffset = alignStreamOffset(offset);
+		meshHeader->normalsOffset = alignStreamOffset(meshHeader->positionsOffset + vec3StreamSize);
+		meshHeader->texCoordsOffset = alignStreamOffset(meshHeader->normalsOffset + vec3StreamSize);
+		meshHeader->tangentsOffset = alignStreamOffset(meshHeader->texCoordsOffset + (static_cast<uint64_t>(meshHeader->vertexCount) * sizeof(glm::vec2)));
+		meshHeader->indicesOffset = alignStreamOffset(meshHeader->tangentsOffset + vec3StreamSize);
+		meshHeader->diffusePathOffset = meshHeader->indicesOffset + (static_cast<uint64_t>(meshHeader->indexCount) * sizeof(uint32_t));
+		meshHeader->diffusePathLength = meshes->materials[i].diffusePath.size();
+
+		glm::mat4 meshMatrix = i < details->meshMatrices.size() ? details->meshMatrices[i] : glm::mat4{ 1.0f };
+		memcpy(meshHeader->meshMatrix, &meshMatrix, sizeof(glm::mat4));
+
+		const MeshBounds* bounds = &modelComponent->meshBounds[i];
+		memcpy(meshHeader->aabbMin, &bounds->aabbMin, sizeof(meshHeader->aabbMin));
+		memcpy(meshHeader->aabbMax, &bounds->aabbMax, sizeof(meshHeader->aabbMax));
+		memcpy(meshHeader->sphereCenter, &bounds->sphereCenter, sizeof(meshHeader->sphereCenter));
+		meshHeader->sphereRadius = bounds->sphereRadius;
+
+		offset = meshHeader->diffusePathOffset + meshHeader->diffusePathLength;
+	}
+
+	// Write to a temporary file first so a failed cook never leaves a truncated file behind
+	std::string temporaryFilepath = cookedFilepath + ".tmp";
+	std::ofstream file(temporaryFilepath, std::ios::binary | std::ios::trunc);
+
+	if (!file.is_open()) {
+		std::cout << "Could not write cooked model: " << cookedFilepath << std::endl;
+		return;
+	}
+
+	auto writeAt = [&file](uint64_t position, const void* data, size_t size) {
+		file.seekp(static_cast<std::streamoff>(position));
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	};
+
+	writeAt(0, &header, sizeof(CookedModelHeader));
+	writeAt(sizeof(CookedModelHeader), meshHeaders.data(), meshHeaders.size() * sizeof(CookedMeshHeader));
+
+	for (uint32_t i = 0; i < meshCount; i++) {
+		CookedMeshHeader* meshHeader = &meshHeaders[i];
+
+		writeAt(meshHeader->positionsOffset, meshes->vertices[i].data(), meshes->vertices[i].size() * sizeof(glm::vec3));
+		writeAt(meshHeader->normalsOffset, meshes->normals[i].data(), meshes->normals[i].size() * sizeof(glm::vec3));
+		writeAt(meshHeader->texCoordsOffset, meshes->texCoords[i].data(), meshes->texCoords[i].size() * sizeof(glm::vec2));
+		writeAt(meshHeader->tangentsOffset, meshes->tangent[i].data(), meshes->tangent[i].size() * sizeof(glm::vec3));
+		writeAt(meshHeader->indicesOffset, meshes->indices[i].data(), meshes->indices[i].size() * sizeof(uint32_t));
+		writeAt(meshHeader->diffusePathOffset, meshes->materials[i].diffusePath.data(), meshHeader->diffusePathLength);
+	}
+
+	file.close();
+
+	if (!file) {
+		std::cout << "Could not write cooked model: " << cookedFilepath << std::endl;
+		std::filesystem::remove(temporaryFilepath);
+		return;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporaryFilepath, cookedFilepath, error);
+
+	if (error) {
+		std::cout << "Could not write cooked model: " << cookedFilepath << std::endl;
+		std::filesystem::remove(temporaryFilepath, error);
+	}
+}
+
+PagedVector<ModelComponent>* ModelManager::getModelComponents() {
 	return &this->loadedModels;
 }
 
-std::vector<ModelDetails>* ModelManager::getModelDetails() {
+PagedVector<ModelDetails>* ModelManager::getModelDetails() {
 	return &this->modelDetails;
 }
 
 void ModelManager::processNode(aiNode* node, const aiScene* scene, ModelComponent* modelComponent, const std::string& directory, ModelDetails* details) {
-	for (auto i = 0; i < node->mNumMeshes; i++) {
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		this->processMesh(mesh, node, scene, modelComponent, details);
-	}
+	// Flatten the tree into a work list. Children are pushed in reverse so meshes keep the recursive pre-order. Node
+	// transforms are accumulated on the way down so every mesh gets its full transform into model space
+	std::vector<MeshWorkItem> workItems;
+	std::vector<std::pair<const aiNode*, aiMatrix4x4>> nodeStack = { { node, node->mTransformation } };
 
-	for (auto i = 0; i < node->mNumChildren; i++) {
-		this->processNode(node->mChildren[i], scene, modelComponent, directory, details);
+	while (!nodeStack.empty()) {
+		auto [current, modelTransform] = nodeStack.back();
+		nodeStack.pop_back();
+
+		for (unsigned int i = 0; i < current->mNumMeshes; i++) {
+			workItems.push_back({ scene->mMeshes[current->mMeshes[i]], modelTransform });
+		}
+
+		for (unsigned int i = current->mNumChildren; i > 0; i--) {
+			const aiNode* child = current->mChildren[i - 1];
+			nodeStack.push_back({ child, modelTransform * child->mTransformation });
+		}
 	}
+
+	// Every mesh writes to its own slot so the output order does not depend on which task finishes first
+	size_t firstMesh = modelComponent->meshes.vertices.size();
+	size_t meshCount = firstMesh + workItems.size();
+
+	modelComponent->meshes.vertices.resize(meshCount);
+	modelComponent->meshes.normals.resize(meshCount);
+	modelComponent->meshes.tangent.resize(meshCount);
+	modelComponent->meshes.texCoords.resize(meshCount);
+	modelComponent->meshes.indices.resize(meshCount);
+	modelComponent->meshes.materials.resize(meshCount);
+	modelComponent->meshBounds.resize(meshCount);
+	details->meshMatrices.resize(meshCount);
+
+	// One mesh per job, meshes vary too much in size for bigger ranges to balance. Waiting helps with other jobs
+	this->jobSystem->parallelFor(workItems.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			this->processMesh(workItems[i].mesh, workItems[i].modelTransform, scene, modelComponent, details, firstMesh + i);
+		}
+	});
 }
 
-void ModelManager::processMesh(aiMesh* mesh, const aiNode* node, const aiScene* scene, ModelComponent* modelComponent, ModelDetails* details) {
+void ModelManager::processMesh(aiMesh* mesh, const aiMatrix4x4& modelTransform, const aiScene* scene, ModelComponent* modelComponent, ModelDetails* details, size_t meshIndex) {
+	static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "aiVector3D must match glm::vec3 for bulk copies");
+
 	std::vector<glm::vec3> vertices;
 	std::vector<glm::vec3> normals;
 	std::vector<glm::vec3> tangents;
@@ -71,40 +465,44 @@ void ModelManager::processMesh(aiMesh* mesh, const aiNode* node, const aiScene*
 	//std::vector<glm::vec3> colours;
 	std::vector<uint32_t> indices;
 
-	vertices.resize(mesh->mNumVertices);
-	normals.resize(mesh->mNumVertices);
-	tangents.resize(mesh->mNumVertices);
-	texCoords.resize(mesh->mNumVertices);
+	size_t vertexCount = mesh->mNumVertices;
+
+	vertices.resize(vertexCount);
+	normals.resize(vertexCount);
+	tangents.resize(vertexCount);
+	texCoords.resize(vertexCount);
 	//colours.resize(mesh->mNumVertices);
 	// ASSUME: each face is a triangle
 	indices.resize(3 * mesh->mNumFaces);
 
-	for (auto i = 0; i < mesh->mNumVertices; i++) {
-		glm::vec3 vertex = { mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z };
-		glm::vec3 normal = { mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z };
-		glm::vec3 tangent = { mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z };
-		//glm::vec3 colour = { mesh->mColors[i]->r, mesh->mColors[i]->g, mesh->mColors[i]->b };
-		// 1 - for vulkan
-		glm::vec2 texCoord = { mesh->mTextureCoords[0][i].x, 1 - mesh->mTextureCoords[0][i].y };
+	// The vec3 streams share the aiVector3D layout and are copied in bulk. Missing streams are left zeroed
+	memcpy(vertices.data(), mesh->mVertices, vertexCount * sizeof(glm::vec3));
+
+	if (mesh->mNormals != nullptr) {
+		memcpy(normals.data(), mesh->mNormals, vertexCount * sizeof(glm::vec3));
+	}
 
-		// TODO: Texcoords
-		vertices[i] = std::move(vertex);
-		normals[i] = std::move(normal);
-		tangents[i] = std::move(tangent);
-		texCoords[i] = std::move(texCoord);
-		//colours[i] = std::move(colour);
+	if (mesh->mTangents != nullptr) {
+		memcpy(tangents.data(), mesh->mTangents, vertexCount * sizeof(glm::vec3));
 	}
 
-	for (auto i = 0; i < mesh->mNumFaces; i++) {
-		aiFace face = mesh->mFaces[i];
+	const aiVector3D* sourceTexCoords = mesh->mTextureCoords[0];
 
-		for (auto j = 0; j < face.mNumIndices; j++) {
-			auto index = (3 * i) + j;
-			indices[index] = face.mIndices[j];
+	if (sourceTexCoords != nullptr) {
+		for (size_t i = 0; i < vertexCount; i++) {
+			// 1 - for vulkan
+			texCoords[i] = { sourceTexCoords[i].x, 1 - sourceTexCoords[i].y };
 		}
 	}
 
-	size_t id = modelComponent->meshes.vertices.size();
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+		const aiFace& face = mesh->mFaces[i];
+		uint32_t* faceIndices = &indices[3 * i];
+
+		for (unsigned int j = 0; j < face.mNumIndices && j < 3; j++) {
+			faceIndices[j] = face.mIndices[j];
+		}
+	}
 
 	auto* material = scene->mMaterials[mesh->mMaterialIndex];
 
@@ -114,12 +512,14 @@ void ModelManager::processMesh(aiMesh* mesh, const aiNode* node, const aiScene*
 	MaterialInfo materialInfo{};
 	materialInfo.diffusePath = "./" + details->directory + '/' + a.C_Str();
 
-	modelComponent->meshes.indices.push_back(std::move(indices));
-	modelComponent->meshes.vertices.push_back(std::move(vertices));
-	modelComponent->meshes.normals.push_back(std::move(normals));
-	modelComponent->meshes.tangent.push_back(std::move(tangents));
-	modelComponent->meshes.texCoords.push_back(std::move(texCoords));
-	modelComponent->meshes.materials.push_back(materialInfo);
+	modelComponent->meshBounds[meshIndex] = computeMeshBounds(vertices.data(), vertexCount);
+
+	modelComponent->meshes.indices[meshIndex] = std::move(indices);
+	modelComponent->meshes.vertices[meshIndex] = std::move(vertices);
+	modelComponent->meshes.normals[meshIndex] = std::move(normals);
+	modelComponent->meshes.tangent[meshIndex] = std::move(tangents);
+	modelComponent->meshes.texCoords[meshIndex] = std::move(texCoords);
+	modelComponent->meshes.materials[meshIndex] = std::move(materialInfo);
 	//modelComponent->meshes.colours.push_back(std::move(colours));
 
 	// Material processing
@@ -154,7 +554,7 @@ void ModelManager::processMesh(aiMesh* mesh, const aiNode* node, const aiScene*
 	//this->processTexture(modelComponent, path, TextureType::Specular, directory, loadedTextures);
 
 	// Store model matrix
-	auto mat = node->mTransformation;
+	auto mat = modelTransform;
 
 	glm::mat4 matrix = {
 		mat.a1, mat.a2, mat.a3, mat.a4,
@@ -174,7 +574,7 @@ void ModelManager::processMesh(aiMesh* mesh, const aiNode* node, const aiScene*
 	//scene->mMetaData->Get("OriginalUnitScaleFactor", factor);
 
 	//modelComponent->meshes.modelMatrixes.push_back(matrix);
-	details->meshMatrices.push_back(matrix);
+	details->meshMatrices[meshIndex] = matrix;
 }
 
 /*void ModelSystem::processTexture(ModelComponent* modelComponent, aiString path, TextureType type, const std::string& directory, std::map<std::string, GLuint>* loadedTextures) {
@@ -231,7 +631,7 @@ void ModelManager::processMesh(aiMesh* mesh, const aiNode* node, const aiScene*
 	
 }*/
 
-ModelManager::ModelManager() {
+ModelManager::ModelManager(JobSystem* jobSystem) : jobSystem(jobSystem) {
 	//stbi_set_flip_vertically_on_load(true);
 }
 
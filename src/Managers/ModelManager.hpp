@@ -5,11 +5,15 @@
 #include <assimp/scene.h>
 #include "../Systems/RenderSystem/VulkanTypes.hpp"
 #include "../Components/RenderComponents/Material.hpp"
+#include "../Core/PagedVector.hpp"
+#include "../Core/JobSystem.hpp"
 
 #include <iostream>
 #include <vector>
 #include <map>
 #include <string>
+#include <future>
+#include <mutex>
 
 enum LoadModelResultFlags {
 	AlreadyLoaded = 1 << 0,
@@ -22,23 +26,51 @@ struct LoadModelResults {
 	std::string diffuseMaterial;
 };
 
+struct MeshWorkItem {
+	aiMesh* mesh;
+	// Node transforms from the mesh up to the scene root
+	aiMatrix4x4 modelTransform;
+};
+
+struct ModelLoadRequest {
+	std::string directory;
+	std::string modelFileName;
+	std::string identifier;
+};
+
 class ModelManager {
+	// Guards nameToModelComponentId and slot reservation
+	std::mutex modelMutex;
 	std::map<std::string, size_t> nameToModelComponentId;
 	std::map<std::string, size_t> nameToRenderComponentId;
 
-	// TODO: Have these as shared pointers to enable multithreading with no race condition when vector is reallocatedz
-	std::vector<ModelComponent> loadedModels;
-	std::vector<ModelDetails> modelDetails;
+	// Paged so models being imported on workers never move when another slot is reserved
+	PagedVector<ModelComponent> loadedModels;
+	PagedVector<ModelDetails> modelDetails;
+	// Resolves to the load flags once the import owning the slot has finished
+	PagedVector<std::shared_future<uint64_t>> modelLoadStatus;
+
+	JobSystem* jobSystem;
+
+	uint64_t importModel(const std::string& directory, const std::string& modelFileName, ModelComponent* modelComponent, ModelDetails* modelDetails);
 
 	void processNode(aiNode* node, const aiScene* scene, ModelComponent* modelComponent, const std::string& directory, ModelDetails* details);
-	void processMesh(aiMesh* mesh, const aiNode* node, const aiScene* scene, ModelComponent* modelComponent, ModelDetails* details);
+	void processMesh(aiMesh* mesh, const aiMatrix4x4& modelTransform, const aiScene* scene, ModelComponent* modelComponent, ModelDetails* details, size_t meshIndex);
 	void processTexture(ModelComponent* modelComponent, aiString textureFile, TextureType type, const std::string& directory);
 	void createBuffers(ModelRenderComponents* modelRenderComponents, ModelComponent* modelComponents);
 
+	// Cooked models skip the assimp import. Loading fails if the cooked file is missing, corrupt or older than the source
+	bool loadCookedModel(const std::string& cookedFilepath, const std::string& modelFilepath, ModelComponent* modelComponent, ModelDetails* details);
+	void cookModel(const std::string& cookedFilepath, const std::string& modelFilepath, ModelComponent* modelComponent, ModelDetails* details);
+
 public:
-	ModelManager();
+	explicit ModelManager(JobSystem* jobSystem);
 
+	// Thread safe. A model requested while another thread is importing it waits for that import
 	LoadModelResults loadModel(const std::string& directory, const std::string& modelFileName, const std::string& identifier);
-	std::vector<ModelComponent>* getModelComponents();
-	std::vector<ModelDetails>* getModelDetails();
+	// Imports every model on the job system. Results are in request order and are valid once the counter is done.
+	// Both must outlive the jobs
+	void loadModelsAsync(const std::vector<ModelLoadRequest>& requests, std::vector<LoadModelResults>* results, JobCounter* counter);
+	PagedVector<ModelComponent>* getModelComponents();
+	PagedVector<ModelDetails>* getModelDetails();
 };
\ No newline at end of file
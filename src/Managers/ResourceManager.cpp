@@ -2,26 +2,57 @@
 #include <string>
 #include <sdl2/SDL_video.h>
 
-ResourceManager::ResourceManager() {
-	this->modelManager = std::make_unique<ModelManager>();
+ResourceManager::ResourceManager(JobSystem* jobSystem) : jobSystem(jobSystem) {
+	this->modelManager = std::make_unique<ModelManager>(jobSystem);
 	this->vulkanResourceManager = std::make_unique<VulkanResourceManager>();
 }
 
-ModelResource ResourceManager::loadModel(std::string& directory, std::string& modelFileName) {
-	std::string identifier = directory;
-	identifier = identifier.append("/").append(modelFileName);
-	
-	ModelResource resource{};
+std::vector<ModelResource> ResourceManager::loadModels(std::vector<ModelLoadRequest>* requests) {
+	for (auto& request : *requests) {
+		request.identifier = request.directory;
+		request.identifier = request.identifier.append("/").append(request.modelFileName);
+	}
+
+	std::vector<LoadModelResults> loadResults;
+	JobCounter loadCounter{};
+	this->modelManager->loadModelsAsync(*requests, &loadResults, &loadCounter);
+	this->jobSystem->wait(&loadCounter);
+
+	std::vector<ModelResource> resources(requests->size());
+
+	// Imports run on the job system, buffer creation stays on this thread
+	for (size_t i = 0; i < requests->size(); i++) {
+		resources[i] = this->createModelResource(requests->at(i).identifier, &loadResults[i]);
+	}
 
-	LoadModelResults loadResult = this->modelManager->loadModel(directory, modelFileName, identifier);
-	resource.modelComponentId = loadResult.id;
+	return resources;
+}
+
+ModelResource ResourceManager::createModelResource(const std::string& identifier, LoadModelResults* loadResult) {
+	auto existing = this->modelResources.find(loadResult->id);
+
+	if (existing != this->modelResources.end()) {
+		return existing->second;
+	}
+
+	ModelResource resource{};
+	resource.modelComponentId = loadResult->id;
+	resource.modelDetailsId = loadResult->id;
 	
-	if ((loadResult.flags & LoadModelResultFlags::ErrorLoading) == 0) {
-		resource.modelRenderComponentId = this->vulkanResourceManager->loadModelComponentBuffers(identifier, this->modelManager->getModelComponents(), loadResult.id);
+	if ((loadResult->flags & LoadModelResultFlags::ErrorLoading) == 0) {
+		LoadModelBuffersResults buffersResult = this->vulkanResourceManager->loadModelComponentBuffers(identifier, this->modelManager->getModelComponents(), this->modelManager->getModelDetails(), loadResult->id);
+		resource.modelRenderComponentId = buffersResult.id;
+		resource.uploadTicket = buffersResult.uploadTicket;
+
+		if (buffersResult.flags & LoadModelBuffersResultFlags::GeometryPoolFull) {
+			resource.flags |= ModelResourceFlags::ErrorCreatingBuffers;
+		}
 	} else {
 		resource.flags |= ModelResourceFlags::ErrorLoadingModel;
 	}
 
+	this->modelResources[loadResult->id] = resource;
+
 	return resource;
 }
 
@@ -29,6 +60,22 @@ void ResourceManager::initialise(SDL_Window* window) {
 	this->vulkanResourceManager->initialiseVulkan(window);
 }
 
+void ResourceManager::retireCompletedUploads() {
+	this->vulkanResourceManager->retireCompletedUploads();
+}
+
+bool ResourceManager::isUploadComplete(uint64_t uploadTicket) {
+	return this->vulkanResourceManager->isUploadComplete(uploadTicket);
+}
+
+void ResourceManager::waitForUpload(uint64_t uploadTicket) {
+	this->vulkanResourceManager->waitForUpload(uploadTicket);
+}
+
+void ResourceManager::waitForUploads() {
+	this->vulkanResourceManager->waitForAllUploads();
+}
+
 void ResourceManager::cleanup() {
 	this->vulkanResourceManager->cleanupVulkanResources();
 }
@@ -37,10 +84,18 @@ std::vector<ModelRenderComponents>* ResourceManager::getModelRenderBuffers() {
 	return this->vulkanResourceManager->getModelRenderBuffers();
 }
 
-std::vector<ModelComponent>* ResourceManager::getModelComponents() {
+const GeometryPool* ResourceManager::getGeometryPool() {
+	return this->vulkanResourceManager->getGeometryPool();
+}
+
+PagedVector<ModelComponent>* ResourceManager::getModelComponents() {
 	return this->modelManager->getModelComponents();
 }
 
+PagedVector<ModelDetails>* ResourceManager::getModelDetails() {
+	return this->modelManager->getModelDetails();
+}
+
 const VulkanDetails* ResourceManager::getVulkanDetails() {
 	return this->vulkanResourceManager->getVulkanDetails();
 }
@@ -6,23 +6,38 @@
 #include "../Systems/RenderSystem/VulkanTypes.hpp"
 #include <memory>
 #include <vector>
+#include <map>
 #include "../Components/RenderComponents/Material.hpp"
 
 class ResourceManager {
 private:
 	std::unique_ptr<VulkanResourceManager> vulkanResourceManager;
 	std::unique_ptr<ModelManager> modelManager;
+	JobSystem* jobSystem;
+
+	// Resources already created for a model component, so a model used by several entities is only uploaded once
+	std::map<size_t, ModelResource> modelResources;
+
+	ModelResource createModelResource(const std::string& identifier, LoadModelResults* loadResult);
 
 public:
-	ResourceManager();
+	explicit ResourceManager(JobSystem* jobSystem);
 
-	ModelResource loadModel(std::string& directory, std::string& modelFileName);
+	// Imports the models in parallel, then uploads them. Results are in request order
+	std::vector<ModelResource> loadModels(std::vector<ModelLoadRequest>* requests);
 
 	void initialise(SDL_Window* window);
+	void retireCompletedUploads();
+	// Model buffers may only be drawn once the upload of their ticket has completed
+	bool isUploadComplete(uint64_t uploadTicket);
+	void waitForUpload(uint64_t uploadTicket);
+	void waitForUploads();
 	void cleanup();
 
 	std::vector<ModelRenderComponents>* getModelRenderBuffers();
-	std::vector<ModelComponent>* getModelComponents();
+	const GeometryPool* getGeometryPool();
+	PagedVector<ModelComponent>* getModelComponents();
+	PagedVector<ModelDetails>* getModelDetails();
 	const VulkanDetails* getVulkanDetails();
 	QueueDetails createGraphicsQueue();
 	QueueDetails createTransferQueue();
@@ -2,6 +2,12 @@
 #include "VulkanResourceManager.hpp"
 #include "VulkanResourceManager.hpp"
 #include <sdl2/SDL_vulkan.h>
+#include <array>
+#include <cstring>
+
+// Capacity of the shared geometry pool, in vertices and indices
+constexpr uint32_t GEOMETRY_POOL_VERTEX_CAPACITY = 2 * 1024 * 1024;
+constexpr uint32_t GEOMETRY_POOL_INDEX_CAPACITY = 6 * 1024 * 1024;
 
 void VulkanResourceManager::initialiseVulkan(SDL_Window* window) {
 	vkb::InstanceBuilder instanceBuilder{};
@@ -24,9 +30,20 @@ void VulkanResourceManager::initialiseVulkan(SDL_Window* window) {
 	vkb::PhysicalDevice vkbPhysicalDevice = selector
 		.set_minimum_version(1, 1)
 		.set_surface(this->vulkanDetails.surface)
+		.add_desired_extension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)
 		.select()
 		.value();
 
+	// Indirect drawing features are optional, enable whichever the GPU has
+	VkPhysicalDeviceFeatures supportedFeatures{};
+	vkGetPhysicalDeviceFeatures(vkbPhysicalDevice.physical_device, &supportedFeatures);
+	vkbPhysicalDevice.features.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	vkbPhysicalDevice.features.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+
+	this->vulkanDetails.multiDrawIndirect = supportedFeatures.multiDrawIndirect == VK_TRUE;
+	this->vulkanDetails.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+	this->vulkanDetails.drawIndirectCount = this->isDeviceExtensionSupported(vkbPhysicalDevice.physical_device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
 	// Create final device to be used
 	vkb::DeviceBuilder vkbDeviceBuilder{ vkbPhysicalDevice };
 	vkb::Device vkbDevice = vkbDeviceBuilder.build().value();
@@ -45,146 +62,325 @@ void VulkanResourceManager::initialiseVulkan(SDL_Window* window) {
 
 	vkGetPhysicalDeviceProperties(this->vulkanDetails.chosenGPU, &this->vulkanDetails.gpuProperties);
 
-	VkFenceCreateInfo fenceCreateInfo{};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.pNext = nullptr;
+	// Upload command buffers are freed individually as their tickets retire
+	auto commandPoolCreateInfo = VulkanUtility::commandPoolCreateInfo(this->transferQueueFamily);
 
-	VkResult result = vkCreateFence(this->vkbDevice.device, &fenceCreateInfo, nullptr, &this->uploadContext.uploadFence);
+	VkResult result = vkCreateCommandPool(this->vkbDevice.device, &commandPoolCreateInfo, nullptr, &this->uploadContext.commandPool);
 
 	if (result) {
-		std::cout << "Error creating upload context fence: " << result << std::endl;
+		std::cout << "Error creating upload context command pool: " << result << std::endl;
 		abort();
 	}
 
-	auto commandPoolCreateInfo = VulkanUtility::commandPoolCreateInfo(this->transferQueueFamily);
+	this->initialiseGeometryPool();
+}
 
-	result = vkCreateCommandPool(this->vkbDevice.device, &commandPoolCreateInfo, nullptr, &this->uploadContext.commandPool);
+bool VulkanResourceManager::isDeviceExtensionSupported(VkPhysicalDevice physicalDevice, const char* extension) {
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
 
-	if (result) {
-		std::cout << "Error creating upload context command pool: " << result << std::endl;
-		abort();
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+	for (auto& properties : extensions) {
+		if (strcmp(properties.extensionName, extension) == 0) {
+			return true;
+		}
 	}
+
+	return false;
+}
+
+void VulkanResourceManager::initialiseGeometryPool() {
+	this->geometryPool.vertexCapacity = GEOMETRY_POOL_VERTEX_CAPACITY;
+	this->geometryPool.indexCapacity = GEOMETRY_POOL_INDEX_CAPACITY;
+	this->geometryPool.vertexCount = 0;
+	this->geometryPool.indexCount = 0;
+
+	this->geometryPool.vertexBuffer = this->createDeviceBuffer(GEOMETRY_POOL_VERTEX_CAPACITY * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	this->geometryPool.vertexBuffer.size = GEOMETRY_POOL_VERTEX_CAPACITY;
+	this->geometryPool.indexBuffer = this->createDeviceBuffer(GEOMETRY_POOL_INDEX_CAPACITY * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	this->geometryPool.indexBuffer.size = GEOMETRY_POOL_INDEX_CAPACITY;
 }
 
 void VulkanResourceManager::cleanupModelBuffers() {
-	for (auto& model : this->modelRenderBuffers) {
-		for (auto& vertexPositionBuffer : model.VertexPositionBuffers) {
-			vmaDestroyBuffer(this->vulkanDetails.allocator, vertexPositionBuffer.buffer, vertexPositionBuffer.allocation);
-		}
+	this->waitForAllUploads();
 
-		for (auto& texCoordBuffer : model.TextureCoordBuffers) {
-			vmaDestroyBuffer(this->vulkanDetails.allocator, texCoordBuffer.buffer, texCoordBuffer.allocation);
-		}
+	vmaDestroyBuffer(this->vulkanDetails.allocator, this->geometryPool.vertexBuffer.buffer, this->geometryPool.vertexBuffer.allocation);
+	vmaDestroyBuffer(this->vulkanDetails.allocator, this->geometryPool.indexBuffer.buffer, this->geometryPool.indexBuffer.allocation);
+	this->modelRenderBuffers.clear();
+
+	for (auto fence : this->freeUploadFences) {
+		vkDestroyFence(this->vulkanDetails.device, fence, nullptr);
 	}
 
+	this->freeUploadFences.clear();
+
 	vkDestroyCommandPool(this->vulkanDetails.device, this->uploadContext.commandPool, nullptr);
-	vkDestroyFence(this->vulkanDetails.device, this->uploadContext.uploadFence, nullptr);
 }
 
 void VulkanResourceManager::cleanupVulkanResources() {
 	this->cleanupModelBuffers();
 }
 
-size_t VulkanResourceManager::loadModelComponentBuffers(std::string identifier, std::vector<ModelComponent>* modelComponents, size_t modelId) {
-	size_t bufferId = this->modelRenderBuffers.size();
-	ModelRenderComponents modelRenderComponents{};
-	MeshComponents* meshComponents = &modelComponents->at(modelId).meshes;
+AllocatedBuffer VulkanResourceManager::createDeviceBuffer(size_t size, VkBufferUsageFlags usageFlags) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
 
-	size_t numberOfMeshes = meshComponents->vertices.size();
-	modelRenderComponents.VertexPositionBuffers.resize(numberOfMeshes);
-	//modelRenderComponents.ColourBuffers.resize(numberOfMeshes);
-	modelRenderComponents.IndexBuffers.resize(numberOfMeshes);
-	modelRenderComponents.TextureCoordBuffers.resize(numberOfMeshes);
-	modelRenderComponents.NormalBuffers.resize(numberOfMeshes);
+	bufferInfo.size = size;
+	bufferInfo.usage = usageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-	auto* meshVertices = &meshComponents->vertices;
-	
-	for (auto i = 0; i < numberOfMeshes; i++) {
-		auto* vertices = &meshVertices->at(i);
+	VmaAllocationCreateInfo vmaAllocInfo{};
+	vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-		AllocatedBuffer newBuffer = this->generateNewVertexBuffer(vertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	AllocatedBuffer buffer{};
+	VkResult result = vmaCreateBuffer(this->vulkanDetails.allocator, &bufferInfo, &vmaAllocInfo, &buffer.buffer, &buffer.allocation, nullptr);
 
-		modelRenderComponents.VertexPositionBuffers.at(i) = newBuffer;
+	if (result) {
+		std::cout << "Couldn't create device buffer: " << result << std::endl;
+		abort();
 	}
 
-	auto* meshTexCoords = &meshComponents->texCoords;
+	return buffer;
+}
+
+LoadModelBuffersResults VulkanResourceManager::loadModelComponentBuffers(std::string identifier, PagedVector<ModelComponent>* modelComponents, PagedVector<ModelDetails>* modelDetails, size_t modelId) {
+	LoadModelBuffersResults results{};
+	results.id = this->modelRenderBuffers.size();
 
-	for (auto i = 0; i < numberOfMeshes; i++) {
-		auto* texCoords = &meshTexCoords->at(i);
-		AllocatedBuffer newBuffer = this->generateNewVertexBuffer(texCoords, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-		modelRenderComponents.TextureCoordBuffers.at(i) = newBuffer;
+	ModelRenderComponents modelRenderComponents{};
+	ModelComponent* modelComponent = &modelComponents->at(modelId);
+
+	// Streams come either from the imported vectors or straight from a cooked file mapping
+	size_t numberOfMeshes = modelComponent->meshCount();
+	std::vector<MeshStreamView> meshStreams(numberOfMeshes);
+	modelRenderComponents.meshRanges.resize(numberOfMeshes);
+	modelRenderComponents.meshBounds = modelComponent->meshBounds;
+
+	// Models without a matrix per mesh are drawn untransformed
+	const std::vector<glm::mat4>* meshMatrices = &modelDetails->at(modelId).meshMatrices;
+
+	if (meshMatrices->size() == numberOfMeshes) {
+		modelRenderComponents.meshTransforms = *meshMatrices;
+	} else {
+		modelRenderComponents.meshTransforms.assign(numberOfMeshes, glm::mat4{ 1.0f });
 	}
 
-	auto* meshNormals = &meshComponents->normals;
+	// Every mesh of the model is placed in one contiguous range of the pool
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
 
-	for (auto i = 0; i < numberOfMeshes; i++) {
-		auto* normals = &meshNormals->at(i);
-		AllocatedBuffer newBuffer = this->generateNewVertexBuffer(normals, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-		modelRenderComponents.NormalBuffers.at(i) = newBuffer;
+	for (size_t i = 0; i < numberOfMeshes; i++) {
+		meshStreams[i] = modelComponent->meshStreams(i);
+		vertexCount += meshStreams[i].vertexCount;
+		indexCount += meshStreams[i].indexCount;
 	}
 
-	auto* meshIndices = &meshComponents->indices;
+	GeometryPool* pool = &this->geometryPool;
 
-	for (auto i = 0; i < numberOfMeshes; i++) {
-		auto* indices = &meshIndices->at(i);
-		AllocatedBuffer newBuffer = this->generateNewVertexBuffer(indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-		modelRenderComponents.IndexBuffers.at(i) = newBuffer;
+	if (pool->vertexCount + vertexCount > pool->vertexCapacity || pool->indexCount + indexCount > pool->indexCapacity) {
+		std::cout << "Geometry pool is full, could not upload model: " << identifier << std::endl;
+		results.flags |= LoadModelBuffersResultFlags::GeometryPoolFull;
+		return results;
 	}
 
-	modelRenderBuffers.push_back(modelRenderComponents);
+	size_t vertexDataSize = vertexCount * sizeof(Vertex);
+	size_t stagingSize = vertexDataSize + (indexCount * sizeof(uint32_t));
 
-	return bufferId;
-}
+	UploadTicket ticket{};
+	ticket.id = this->nextUploadTicketId++;
+	ticket.stagingBuffer = VulkanUtility::createBuffer(this->vulkanDetails.allocator, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	ticket.stagingBuffer.size = stagingSize;
+	ticket.fence = this->acquireUploadFence();
 
-void VulkanResourceManager::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function) {
 	VkCommandBufferAllocateInfo cmdAllocInfo = VulkanUtility::commandBufferAllocateInfo(this->uploadContext.commandPool, 1);
-	VkCommandBuffer cmd;
-
-	VkResult result = vkAllocateCommandBuffers(this->vulkanDetails.device, &cmdAllocInfo, &cmd);
+	VkResult result = vkAllocateCommandBuffers(this->vulkanDetails.device, &cmdAllocInfo, &ticket.commandBuffer);
 
 	if (result) {
-		std::cout << "Detected Vulkan error while allocating immedaite submit command buffer: " << result << std::endl;
+		std::cout << "Detected Vulkan error while allocating model upload command buffer: " << result << std::endl;
 		abort();
 	}
 
 	VkCommandBufferBeginInfo cmdBeginInfo = VulkanUtility::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-
-	result = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+	result = vkBeginCommandBuffer(ticket.commandBuffer, &cmdBeginInfo);
 
 	if (result) {
-		std::cout << "Detected Vulkan error while beginning immedaite submit command buffer: " << result << std::endl;
+		std::cout << "Detected Vulkan error while beginning model upload command buffer: " << result << std::endl;
 		abort();
 	}
 
-	// execute function
-	function(cmd);
+	void* stagingMemory{};
+	vmaMapMemory(this->vulkanDetails.allocator, ticket.stagingBuffer.allocation, &stagingMemory);
+	// Vertices are interleaved at the start of the staging buffer, indices follow them
+	Vertex* stagingVertices = static_cast<Vertex*>(stagingMemory);
+	uint32_t* stagingIndices = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(stagingMemory) + vertexDataSize);
+
+	uint32_t firstVertex = pool->vertexCount;
+	uint32_t firstIndex = pool->indexCount;
+	size_t vertexCursor = 0;
+	size_t indexCursor = 0;
+
+	for (size_t i = 0; i < numberOfMeshes; i++) {
+		MeshStreamView* streams = &meshStreams[i];
+
+		MeshRange* range = &modelRenderComponents.meshRanges[i];
+		range->firstIndex = firstIndex + static_cast<uint32_t>(indexCursor);
+		range->indexCount = streams->indexCount;
+		range->vertexOffset = static_cast<int32_t>(firstVertex + vertexCursor);
+		range->vertexCount = streams->vertexCount;
+
+		for (size_t j = 0; j < streams->vertexCount; j++) {
+			Vertex* vertex = &stagingVertices[vertexCursor + j];
+			vertex->position = streams->positions[j];
+			vertex->texCoord = streams->texCoords[j];
+			vertex->normal = streams->normals[j];
+		}
+
+		// Indices stay relative to the mesh, vertexOffset is applied when drawing
+		memcpy(stagingIndices + indexCursor, streams->indices, streams->indexCount * sizeof(uint32_t));
+
+		vertexCursor += streams->vertexCount;
+		indexCursor += streams->indexCount;
+	}
+
+	vmaUnmapMemory(this->vulkanDetails.allocator, ticket.stagingBuffer.allocation);
+
+	std::array<VkBufferCopy, 2> copies{};
+	copies[0].srcOffset = 0;
+	copies[0].dstOffset = firstVertex * sizeof(Vertex);
+	copies[0].size = vertexDataSize;
+	copies[1].srcOffset = vertexDataSize;
+	copies[1].dstOffset = firstIndex * sizeof(uint32_t);
+	copies[1].size = indexCount * sizeof(uint32_t);
+
+	if (copies[0].size > 0) {
+		vkCmdCopyBuffer(ticket.commandBuffer, ticket.stagingBuffer.buffer, pool->vertexBuffer.buffer, 1, &copies[0]);
+	}
+
+	if (copies[1].size > 0) {
+		vkCmdCopyBuffer(ticket.commandBuffer, ticket.stagingBuffer.buffer, pool->indexBuffer.buffer, 1, &copies[1]);
+	}
+
+	result = vkEndCommandBuffer(ticket.commandBuffer);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while ending model upload command buffer: " << result << std::endl;
+		abort();
+	}
 
-	result = vkEndCommandBuffer(cmd);
+	// One submission for the whole model. The CPU does not wait here, the ticket is retired later
+	VkSubmitInfo submit = VulkanUtility::submitInfo(&ticket.commandBuffer);
+	result = vkQueueSubmit(this->transferQueue, 1, &submit, ticket.fence);
 
 	if (result) {
-		std::cout << "Detected Vulkan error while ending immedaite submit command buffer: " << result << std::endl;
+		std::cout << "Detected Vulkan error while submitting model upload command buffer: " << result << std::endl;
 		abort();
 	}
 
-	VkSubmitInfo submit = VulkanUtility::submitInfo(&cmd);
+	pool->vertexCount += static_cast<uint32_t>(vertexCount);
+	pool->indexCount += static_cast<uint32_t>(indexCount);
+
+	this->pendingUploads.push_back(ticket);
+	this->modelRenderBuffers.push_back(modelRenderComponents);
+
+	results.uploadTicket = ticket.id;
+
+	return results;
+}
+
+VkFence VulkanResourceManager::acquireUploadFence() {
+	if (!this->freeUploadFences.empty()) {
+		VkFence fence = this->freeUploadFences.back();
+		this->freeUploadFences.pop_back();
+		return fence;
+	}
+
+	VkFenceCreateInfo fenceCreateInfo{};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceCreateInfo.pNext = nullptr;
 
-	result = vkQueueSubmit(this->transferQueue, 1, &submit, this->uploadContext.uploadFence);
+	VkFence fence;
+	VkResult result = vkCreateFence(this->vulkanDetails.device, &fenceCreateInfo, nullptr, &fence);
 
 	if (result) {
-		std::cout << "Detected Vulkan error while beginning immedaite submit command buffer: " << result << std::endl;
+		std::cout << "Error creating upload fence: " << result << std::endl;
 		abort();
 	}
 
-	vkWaitForFences(this->vulkanDetails.device, 1, &this->uploadContext.uploadFence, true, 9999999999);
-	vkResetFences(this->vulkanDetails.device, 1, &this->uploadContext.uploadFence);
+	return fence;
+}
+
+void VulkanResourceManager::releaseUploadTicket(UploadTicket* ticket) {
+	vmaDestroyBuffer(this->vulkanDetails.allocator, ticket->stagingBuffer.buffer, ticket->stagingBuffer.allocation);
+	vkFreeCommandBuffers(this->vulkanDetails.device, this->uploadContext.commandPool, 1, &ticket->commandBuffer);
+
+	vkResetFences(this->vulkanDetails.device, 1, &ticket->fence);
+	this->freeUploadFences.push_back(ticket->fence);
+}
+
+UploadTicket* VulkanResourceManager::findPendingUpload(uint64_t ticketId) {
+	for (auto& ticket : this->pendingUploads) {
+		if (ticket.id == ticketId) {
+			return &ticket;
+		}
+	}
+
+	return nullptr;
+}
+
+bool VulkanResourceManager::isUploadComplete(uint64_t ticketId) {
+	UploadTicket* ticket = this->findPendingUpload(ticketId);
+
+	// Tickets are removed once retired
+	if (ticket == nullptr) {
+		return true;
+	}
+
+	return vkGetFenceStatus(this->vulkanDetails.device, ticket->fence) == VK_SUCCESS;
+}
+
+void VulkanResourceManager::waitForUpload(uint64_t ticketId) {
+	UploadTicket* ticket = this->findPendingUpload(ticketId);
+
+	if (ticket == nullptr) {
+		return;
+	}
+
+	vkWaitForFences(this->vulkanDetails.device, 1, &ticket->fence, true, UINT64_MAX);
+	this->retireCompletedUploads();
+}
+
+void VulkanResourceManager::waitForAllUploads() {
+	for (auto& ticket : this->pendingUploads) {
+		vkWaitForFences(this->vulkanDetails.device, 1, &ticket.fence, true, UINT64_MAX);
+	}
 
-	vkResetCommandPool(this->vulkanDetails.device, this->uploadContext.commandPool, 0);
+	this->retireCompletedUploads();
+}
+
+void VulkanResourceManager::retireCompletedUploads() {
+	for (size_t i = 0; i < this->pendingUploads.size();) {
+		auto& ticket = this->pendingUploads[i];
+
+		if (vkGetFenceStatus(this->vulkanDetails.device, ticket.fence) == VK_SUCCESS) {
+			this->releaseUploadTicket(&ticket);
+			this->pendingUploads[i] = this->pendingUploads.back();
+			this->pendingUploads.pop_back();
+		} else {
+			i++;
+		}
+	}
 }
 
 std::vector<ModelRenderComponents>* VulkanResourceManager::getModelRenderBuffers() {
 	return &this->modelRenderBuffers;
 }
 
+const GeometryPool* VulkanResourceManager::getGeometryPool() {
+	return &this->geometryPool;
+}
+
 const VulkanDetails* VulkanResourceManager::getVulkanDetails() {
 	return &this->vulkanDetails;
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include <vk_mem_alloc.h>
 #include "../Components/ModelComponent.h"
+#include "../Core/PagedVector.hpp"
 #include "../Systems/RenderSystem/VulkanTypes.hpp"
 #include "../Systems/RenderSystem/VulkanUtility.hpp"
 #include "../Systems/RenderSystem/VkBootstrap.h"
@@ -8,8 +9,19 @@
 #include <vector>
 #include <sdl2/SDL_video.h>
 
+enum LoadModelBuffersResultFlags {
+	GeometryPoolFull = 1 << 0
+};
+
+struct LoadModelBuffersResults {
+	size_t id;
+	uint64_t uploadTicket;
+	uint64_t flags;
+};
+
 class VulkanResourceManager {
 	std::vector<ModelRenderComponents> modelRenderBuffers;
+	GeometryPool geometryPool;
 
 	// VMA is threadsafe
 	VulkanDetails vulkanDetails;
@@ -19,80 +31,32 @@ class VulkanResourceManager {
 	VkQueue transferQueue;
 	uint32_t transferQueueFamily;
 
-	template<typename T>
-	AllocatedBuffer generateNewVertexBuffer(std::vector<T>* buffer, VkBufferUsageFlags usageFlags) {
-		AllocatedBuffer allocatedBuffer{};
-		AllocatedBuffer stagingBuffer{};
-		size_t bufferSize = buffer->size() * sizeof(T);
-
-		VkBufferCreateInfo stagingBufferInfo{};
-		stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		stagingBufferInfo.pNext = nullptr;
-
-		stagingBufferInfo.size = bufferSize;
-		stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-
-		// Let VMA know this data should be in CPU RAM
-		VmaAllocationCreateInfo vmaAllocInfo{};
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-
-		VkResult result = vmaCreateBuffer(this->vulkanDetails.allocator, &stagingBufferInfo, &vmaAllocInfo, &stagingBuffer.buffer, &stagingBuffer.allocation, nullptr);
-
-		if (result) {
-			std::cout << "Couldn't create staging buffer: " << result << std::endl;
-			abort();
-		}
-
-		this->copyToVertexBuffer<T>(&stagingBuffer, buffer);
-		
-		VkBufferCreateInfo vertexBufferInfo{};
-		vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		vertexBufferInfo.pNext = nullptr;
-
-		vertexBufferInfo.size = bufferSize;
-		vertexBufferInfo.usage = usageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-		result = vmaCreateBuffer(this->vulkanDetails.allocator, &vertexBufferInfo, &vmaAllocInfo, &allocatedBuffer.buffer, &allocatedBuffer.allocation, nullptr);
-
-		if (result) {
-			std::cout << "Couldn't create vertex buffer: " << result << std::endl;
-			abort();
-		}
-
-		this->immediateSubmit([=](VkCommandBuffer cmd) {
-			VkBufferCopy copy{};
-			copy.dstOffset = 0;
-			copy.srcOffset = 0;
-			copy.size = bufferSize;
-			vkCmdCopyBuffer(cmd, stagingBuffer.buffer, allocatedBuffer.buffer, 1, &copy);
-		});
-
-		vmaDestroyBuffer(this->vulkanDetails.allocator, stagingBuffer.buffer, stagingBuffer.allocation);
-
-		allocatedBuffer.size = buffer->size();
-
-		return allocatedBuffer;
-	}
+	// Uploads that have been submitted to the transfer queue but not yet retired
+	std::vector<UploadTicket> pendingUploads;
+	std::vector<VkFence> freeUploadFences;
+	uint64_t nextUploadTicketId = 1;
 
-	template<typename T>
-	void copyToVertexBuffer(AllocatedBuffer* buffer, std::vector<T>* data) {
-		void* memoryPointer{};
-		vmaMapMemory(this->vulkanDetails.allocator, buffer->allocation, &memoryPointer);
-		memcpy(memoryPointer, data->data(), data->size() * sizeof(T));
-		vmaUnmapMemory(this->vulkanDetails.allocator, buffer->allocation);
-	}
+	AllocatedBuffer createDeviceBuffer(size_t size, VkBufferUsageFlags usageFlags);
+	void initialiseGeometryPool();
+	bool isDeviceExtensionSupported(VkPhysicalDevice physicalDevice, const char* extension);
+	VkFence acquireUploadFence();
+	void releaseUploadTicket(UploadTicket* ticket);
+	UploadTicket* findPendingUpload(uint64_t ticketId);
 
 	void cleanupModelBuffers();
-	void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 
 public:
 	void initialiseVulkan(SDL_Window* window);
 	
 	void cleanupVulkanResources();
-	size_t loadModelComponentBuffers(std::string identifier, std::vector<ModelComponent>* modelComponents, size_t modelId);
+	// Interleaves every mesh of the model into the geometry pool through one staging allocation and one submission. The returned ticket can be polled or waited on
+	LoadModelBuffersResults loadModelComponentBuffers(std::string identifier, PagedVector<ModelComponent>* modelComponents, PagedVector<ModelDetails>* modelDetails, size_t modelId);
+	bool isUploadComplete(uint64_t ticketId);
+	void waitForUpload(uint64_t ticketId);
+	void waitForAllUploads();
+	void retireCompletedUploads();
 	std::vector<ModelRenderComponents>* getModelRenderBuffers();
+	const GeometryPool* getGeometryPool();
 	const VulkanDetails* getVulkanDetails();
 	QueueDetails createGraphicsQueue();
 	QueueDetails createTransferQueue();
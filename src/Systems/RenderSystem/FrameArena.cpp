@@ -0,0 +1,84 @@
+#include "FrameArena.hpp"
+#include <algorithm>
+#include <iostream>
+
+void FrameArena::initialise(VmaAllocator allocator, FrameArenaCreateInfo createInfo) {
+	this->capacity = createInfo.sizePerFrame;
+	this->alignment = static_cast<size_t>(std::max<VkDeviceSize>({ createInfo.minUniformBufferOffsetAlignment, createInfo.minStorageBufferOffsetAlignment, 16 }));
+	this->buffers.resize(createInfo.frameOverlap);
+	this->mappedData.resize(createInfo.frameOverlap);
+
+	for (size_t i = 0; i < createInfo.frameOverlap; i++) {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.pNext = nullptr;
+
+		bufferInfo.size = this->capacity;
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+		// Keep the buffer mapped for its whole lifetime
+		VmaAllocationCreateInfo vmaAllocInfo{};
+		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		VmaAllocationInfo allocationInfo{};
+		VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo, &this->buffers[i].buffer, &this->buffers[i].allocation, &allocationInfo);
+
+		if (result) {
+			std::cout << "Couldn't create frame arena buffer: " << result << std::endl;
+			abort();
+		}
+
+		this->buffers[i].size = this->capacity;
+		this->mappedData[i] = static_cast<uint8_t*>(allocationInfo.pMappedData);
+	}
+}
+
+void FrameArena::cleanup(VmaAllocator allocator) {
+	for (auto& buffer : this->buffers) {
+		vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+	}
+
+	this->mappedData.clear();
+}
+
+void FrameArena::beginFrame(size_t frameIndex) {
+	this->stats.highWaterMark = std::max(this->stats.highWaterMark, this->head);
+
+	// The GPU has finished the last frame that used this index, so its whole buffer is free again
+	this->currentFrame = frameIndex;
+	this->head = 0;
+}
+
+bool FrameArena::allocate(size_t size, FrameArenaAllocation* allocation) {
+	size_t offset = (this->head + this->alignment - 1) & ~(this->alignment - 1);
+
+	if (offset + size > this->capacity) {
+		this->stats.overflows += 1;
+		return false;
+	}
+
+	this->head = offset + size;
+
+	allocation->data = this->mappedData[this->currentFrame] + offset;
+	allocation->offset = static_cast<uint32_t>(offset);
+
+	return true;
+}
+
+void FrameArena::flush(VmaAllocator allocator) {
+	if (this->head == 0) {
+		return;
+	}
+
+	// Does nothing if the memory turned out to be coherent
+	vmaFlushAllocation(allocator, this->buffers[this->currentFrame].allocation, 0, this->head);
+}
+
+VkBuffer FrameArena::getBuffer(size_t frameIndex) const {
+	return this->buffers[frameIndex].buffer;
+}
+
+const FrameArenaStats* FrameArena::getStats() {
+	return &this->stats;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <vk_mem_alloc.h>
+#include <vector>
+#include "VulkanTypes.hpp"
+
+struct FrameArenaCreateInfo {
+	// Bytes each frame in flight can allocate
+	size_t sizePerFrame;
+	size_t frameOverlap;
+	// Device limits, allocations are aligned to the larger of the two so they can be bound either way
+	VkDeviceSize minUniformBufferOffsetAlignment;
+	VkDeviceSize minStorageBufferOffsetAlignment;
+};
+
+struct FrameArenaAllocation {
+	void* data;
+	// Dynamic offset to bind the allocation with
+	uint32_t offset;
+};
+
+struct FrameArenaStats {
+	// Most bytes used by a single frame
+	size_t highWaterMark;
+	// Allocations refused because the frame was full
+	uint64_t overflows;
+};
+
+// Persistently mapped uniform and storage memory, one buffer per frame in flight. Allocating is a bump of the frame's
+// head and the data is bound through dynamic offsets, so per-pass and per-draw constants need no map calls or
+// descriptor updates. Everything a frame allocated is released at once when its index comes around again
+class FrameArena {
+	std::vector<AllocatedBuffer> buffers;
+	std::vector<uint8_t*> mappedData;
+	size_t capacity = 0;
+	size_t alignment = 0;
+
+	size_t head = 0;
+	size_t currentFrame = 0;
+
+	FrameArenaStats stats{};
+
+public:
+	void initialise(VmaAllocator allocator, FrameArenaCreateInfo createInfo);
+	void cleanup(VmaAllocator allocator);
+
+	// Must be called after the fence of the frame has been waited on
+	void beginFrame(size_t frameIndex);
+	// Returns false if the frame has no room left
+	bool allocate(size_t size, FrameArenaAllocation* allocation);
+	// Makes everything the frame wrote visible to the GPU, the memory is not guaranteed to be host coherent.
+	// Must be called once all allocations of the frame are written and before it is submitted
+	void flush(VmaAllocator allocator);
+
+	// Descriptors point at the start of the buffer, allocations are selected with their dynamic offset
+	VkBuffer getBuffer(size_t frameIndex) const;
+	const FrameArenaStats* getStats();
+};
@@ -0,0 +1,114 @@
+#include "FrustumCulling.hpp"
+#include <glm/geometric.hpp>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_CULLING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+void CullSpheres::clear() {
+	this->centerX.clear();
+	this->centerY.clear();
+	this->centerZ.clear();
+	this->radius.clear();
+}
+
+void CullSpheres::push_back(glm::vec3 center, float sphereRadius) {
+	this->centerX.push_back(center.x);
+	this->centerY.push_back(center.y);
+	this->centerZ.push_back(center.z);
+	this->radius.push_back(sphereRadius);
+}
+
+size_t CullSpheres::size() const {
+	return this->radius.size();
+}
+
+Frustum FrustumCulling::extractPlanes(const glm::mat4& viewProj) {
+	// glm is column major, so row i is viewProj[c][i]
+	auto row = [&viewProj](int i) {
+		return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	};
+
+	glm::vec4 row0 = row(0);
+	glm::vec4 row1 = row(1);
+	glm::vec4 row2 = row(2);
+	glm::vec4 row3 = row(3);
+
+	Frustum frustum{};
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+
+	for (auto& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+size_t FrustumCulling::cullSpheres(const Frustum* frustum, const CullSpheres* spheres, size_t begin, size_t end, uint32_t* visibleIndices) {
+	const float* centerX = spheres->centerX.data();
+	const float* centerY = spheres->centerY.data();
+	const float* centerZ = spheres->centerZ.data();
+	const float* radius = spheres->radius.data();
+
+	size_t visibleCount = 0;
+	size_t i = begin;
+
+	// Indices are written unconditionally and the count only advances for visible spheres, which keeps the loop
+	// free of unpredictable branches
+#ifdef FRUSTUM_CULLING_SSE
+	__m128 planeX[FRUSTUM_PLANE_COUNT];
+	__m128 planeY[FRUSTUM_PLANE_COUNT];
+	__m128 planeZ[FRUSTUM_PLANE_COUNT];
+	__m128 planeW[FRUSTUM_PLANE_COUNT];
+
+	for (size_t p = 0; p < FRUSTUM_PLANE_COUNT; p++) {
+		planeX[p] = _mm_set1_ps(frustum->planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum->planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum->planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum->planes[p].w);
+	}
+
+	__m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(centerX + i);
+		__m128 y = _mm_loadu_ps(centerY + i);
+		__m128 z = _mm_loadu_ps(centerZ + i);
+		__m128 negativeRadius = _mm_sub_ps(zero, _mm_loadu_ps(radius + i));
+
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+
+		for (size_t p = 0; p < FRUSTUM_PLANE_COUNT; p++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])), _mm_add_ps(_mm_mul_ps(z, planeZ[p]), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			visibleIndices[visibleCount] = static_cast<uint32_t>(i + lane);
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		bool inside = true;
+
+		for (auto& plane : frustum->planes) {
+			float distance = (centerX[i] * plane.x) + (centerY[i] * plane.y) + (centerZ[i] * plane.z) + plane.w;
+			inside &= distance >= -radius[i];
+		}
+
+		visibleIndices[visibleCount] = static_cast<uint32_t>(i);
+		visibleCount += inside ? 1 : 0;
+	}
+
+	return visibleCount;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+constexpr size_t FRUSTUM_PLANE_COUNT = 6;
+
+// Planes point inwards and are normalised, so plane.w is the signed distance of the origin
+struct Frustum {
+	std::array<glm::vec4, FRUSTUM_PLANE_COUNT> planes;
+};
+
+// World space bounding spheres as separate streams so four are tested at once
+struct CullSpheres {
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+
+	void clear();
+	void push_back(glm::vec3 center, float sphereRadius);
+	size_t size() const;
+};
+
+struct RenderStats {
+	uint32_t drawsSubmitted;
+	uint32_t drawsCulled;
+	// Inside the frustum but hidden behind the depth pyramid, also counted as culled
+	uint32_t drawsOccluded;
+	// Draw commands recorded, each instanced draw counts once
+	uint32_t drawCalls;
+	// Material descriptor binds recorded, and the ones skipped because the previous draw had already bound them
+	uint32_t materialBinds;
+	uint32_t materialBindsAvoided;
+	// Deferred attachment memory per frame in flight as allocated for the G-buffer layout in use
+	uint64_t gBufferBytes;
+	// GPU time of the G-buffer passes, both occlusion phases on the GPU driven path, and of the lighting subpass
+	float gBufferMilliseconds;
+	float lightingMilliseconds;
+	// Light references in the cluster lists and lights dropped from full clusters, only counted when lights are binned
+	// on the CPU
+	uint32_t clusterLightIndices;
+	uint32_t clusterLightsDropped;
+	// Point lights inside the frustum, and outside it so left out of the light buffers
+	uint32_t pointLightsVisible;
+	uint32_t pointLightsCulled;
+};
+
+namespace FrustumCulling {
+	// Gribb-Hartmann extraction for a projection with a -1 to 1 depth range, as produced by glm::perspective
+	Frustum extractPlanes(const glm::mat4& viewProj);
+	// Writes the indices of the spheres in [begin, end) that touch the frustum, in order. visibleIndices needs room
+	// for end - begin indices. Returns the number written
+	size_t cullSpheres(const Frustum* frustum, const CullSpheres* spheres, size_t begin, size_t end, uint32_t* visibleIndices);
+}
@@ -0,0 +1,224 @@
+#include "LightClusters.hpp"
+#include "VulkanUtility.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+constexpr uint32_t CLUSTER_GRID_BINDING = 7;
+constexpr uint32_t CLUSTER_LIGHT_INDEX_BINDING = 8;
+
+constexpr size_t CLUSTER_GRID_SIZE = CLUSTER_COUNT * sizeof(glm::uvec2);
+// Room for every cluster to be full, which the compute path relies on as it gives each cluster a fixed range
+constexpr size_t CLUSTER_LIGHT_INDEX_SIZE = CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(uint32_t);
+constexpr size_t CLUSTER_STAGING_ALIGNMENT = 16;
+
+void LightClusters::buildClusterBounds(const glm::mat4& projection, float nearPlane, float farPlane) {
+	glm::vec4 key = { projection[0][0], projection[1][1], nearPlane, farPlane };
+
+	if (key == this->boundsKey) {
+		return;
+	}
+
+	this->boundsKey = key;
+	this->clusterBounds.resize(CLUSTER_COUNT);
+
+	for (uint32_t z = 0; z < CLUSTER_COUNT_Z; z++) {
+		float depths[2] = {
+			nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(z) / CLUSTER_COUNT_Z),
+			nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(z + 1) / CLUSTER_COUNT_Z)
+		};
+
+		for (uint32_t y = 0; y < CLUSTER_COUNT_Y; y++) {
+			for (uint32_t x = 0; x < CLUSTER_COUNT_X; x++) {
+				glm::vec2 ndcMin = (glm::vec2(x, y) / glm::vec2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y) * 2.0f) - 1.0f;
+				glm::vec2 ndcMax = (glm::vec2(x + 1, y + 1) / glm::vec2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y) * 2.0f) - 1.0f;
+
+				AABB bounds = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+
+				// Corners of the tile on the slice's near and far depths, unprojected into view space
+				for (uint32_t corner = 0; corner < 8; corner++) {
+					glm::vec2 ndc = { (corner & 1) ? ndcMax.x : ndcMin.x, (corner & 2) ? ndcMax.y : ndcMin.y };
+					float depth = depths[(corner & 4) ? 1 : 0];
+					glm::vec3 point = { ndc.x * depth / projection[0][0], ndc.y * depth / projection[1][1], -depth };
+
+					bounds.min = glm::min(bounds.min, point);
+					bounds.max = glm::max(bounds.max, point);
+				}
+
+				this->clusterBounds[x + (y * CLUSTER_COUNT_X) + (z * CLUSTER_COUNT_X * CLUSTER_COUNT_Y)] = bounds;
+			}
+		}
+	}
+}
+
+void LightClusters::initialise(VmaAllocator allocator, size_t frameOverlap) {
+	this->gridBuffers.resize(frameOverlap);
+	this->lightIndexBuffers.resize(frameOverlap);
+	this->pendingUploads.resize(frameOverlap);
+
+	for (size_t i = 0; i < frameOverlap; i++) {
+		// Written by the compute shader or copied from staging, then read by the lighting subpass
+		this->gridBuffers[i] = VulkanUtility::createBuffer(allocator, CLUSTER_GRID_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		this->gridBuffers[i].size = CLUSTER_GRID_SIZE;
+		this->lightIndexBuffers[i] = VulkanUtility::createBuffer(allocator, CLUSTER_LIGHT_INDEX_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		this->lightIndexBuffers[i].size = CLUSTER_LIGHT_INDEX_SIZE;
+	}
+}
+
+void LightClusters::cleanup(VmaAllocator allocator) {
+	for (size_t i = 0; i < this->gridBuffers.size(); i++) {
+		vmaDestroyBuffer(allocator, this->gridBuffers[i].buffer, this->gridBuffers[i].allocation);
+		vmaDestroyBuffer(allocator, this->lightIndexBuffers[i].buffer, this->lightIndexBuffers[i].allocation);
+	}
+
+	this->gridBuffers.clear();
+	this->lightIndexBuffers.clear();
+}
+
+void LightClusters::addLightClustersToDescriptorSet(std::vector<VkDescriptorSetLayoutBinding>* bindings) {
+	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, CLUSTER_GRID_BINDING));
+	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, CLUSTER_LIGHT_INDEX_BINDING));
+}
+
+void LightClusters::writeDescriptors(VkDevice device, size_t frameIndex, VkDescriptorSet descriptor) {
+	VkDescriptorBufferInfo gridBufferInfo{};
+	gridBufferInfo.buffer = this->gridBuffers[frameIndex].buffer;
+	gridBufferInfo.offset = 0;
+	gridBufferInfo.range = CLUSTER_GRID_SIZE;
+
+	VkDescriptorBufferInfo lightIndexBufferInfo{};
+	lightIndexBufferInfo.buffer = this->lightIndexBuffers[frameIndex].buffer;
+	lightIndexBufferInfo.offset = 0;
+	lightIndexBufferInfo.range = CLUSTER_LIGHT_INDEX_SIZE;
+
+	std::array<VkWriteDescriptorSet, 2> writes = {
+		VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &gridBufferInfo, CLUSTER_GRID_BINDING),
+		VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &lightIndexBufferInfo, CLUSTER_LIGHT_INDEX_BINDING)
+	};
+
+	vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+}
+
+bool LightClusters::assignLights(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, const glm::vec4* positions, uint32_t count,
+								 StagingRingBuffer* stagingRingBuffer, size_t frameIndex) {
+	this->buildClusterBounds(projection, nearPlane, farPlane);
+
+	this->lightClusterPairs.clear();
+	this->clusterCounts.assign(CLUSTER_COUNT, 0);
+	this->stats = {};
+
+	for (uint32_t light = 0; light < count; light++) {
+		glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(positions[light]), 1.0f));
+		float radius = positions[light].w;
+		bool bounded = radius > 0.0f;
+
+		uint32_t firstSlice = 0;
+		uint32_t lastSlice = CLUSTER_COUNT_Z - 1;
+
+		// Only the slices the sphere's depth range covers are tested
+		if (bounded) {
+			float depth = -center.z;
+
+			if (depth + radius < nearPlane || depth - radius > farPlane) {
+				continue;
+			}
+
+			firstSlice = LightClusters::getDepthSlice(depth - radius, nearPlane, farPlane);
+			lastSlice = LightClusters::getDepthSlice(depth + radius, nearPlane, farPlane);
+		}
+
+		for (uint32_t slice = firstSlice; slice <= lastSlice; slice++) {
+			for (uint32_t tile = 0; tile < CLUSTER_COUNT_X * CLUSTER_COUNT_Y; tile++) {
+				uint32_t cluster = tile + (slice * CLUSTER_COUNT_X * CLUSTER_COUNT_Y);
+
+				if (bounded && !this->clusterBounds[cluster].overlapsSphere(center, radius)) {
+					continue;
+				}
+
+				if (this->clusterCounts[cluster] == MAX_LIGHTS_PER_CLUSTER) {
+					this->stats.droppedLights += 1;
+					continue;
+				}
+
+				this->clusterCounts[cluster] += 1;
+				this->lightClusterPairs.push_back({ cluster, light });
+			}
+		}
+	}
+
+	size_t indexBytes = this->lightClusterPairs.size() * sizeof(uint32_t);
+	StagingAllocation allocation{};
+
+	if (!stagingRingBuffer->allocate(CLUSTER_GRID_SIZE + indexBytes, CLUSTER_STAGING_ALIGNMENT, &allocation)) {
+		return false;
+	}
+
+	glm::uvec2* grid = static_cast<glm::uvec2*>(allocation.data);
+	uint32_t* indices = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(allocation.data) + CLUSTER_GRID_SIZE);
+	uint32_t offset = 0;
+
+	// Counting sort of the pairs by cluster, the counts become each cluster's write cursor
+	for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+		grid[cluster] = { offset, this->clusterCounts[cluster] };
+		this->clusterCounts[cluster] = offset;
+		offset += grid[cluster].y;
+	}
+
+	for (auto& pair : this->lightClusterPairs) {
+		indices[this->clusterCounts[pair.x]] = pair.y;
+		this->clusterCounts[pair.x] += 1;
+	}
+
+	this->stats.lightIndices = offset;
+
+	PendingUpload* upload = &this->pendingUploads[frameIndex];
+	upload->stagingBuffer = allocation.buffer;
+	upload->gridOffset = allocation.offset;
+	upload->indexOffset = allocation.offset + CLUSTER_GRID_SIZE;
+	upload->indexBytes = indexBytes;
+
+	return true;
+}
+
+void LightClusters::recordUpload(VkCommandBuffer cmd, size_t frameIndex) {
+	PendingUpload* upload = &this->pendingUploads[frameIndex];
+
+	VkBufferCopy gridCopy{};
+	gridCopy.srcOffset = upload->gridOffset;
+	gridCopy.dstOffset = 0;
+	gridCopy.size = CLUSTER_GRID_SIZE;
+	vkCmdCopyBuffer(cmd, upload->stagingBuffer, this->gridBuffers[frameIndex].buffer, 1, &gridCopy);
+
+	// No cluster has any lights
+	if (upload->indexBytes == 0) {
+		return;
+	}
+
+	VkBufferCopy indexCopy{};
+	indexCopy.srcOffset = upload->indexOffset;
+	indexCopy.dstOffset = 0;
+	indexCopy.size = upload->indexBytes;
+	vkCmdCopyBuffer(cmd, upload->stagingBuffer, this->lightIndexBuffers[frameIndex].buffer, 1, &indexCopy);
+}
+
+VkBuffer LightClusters::getGridBuffer(size_t frameIndex) const {
+	return this->gridBuffers[frameIndex].buffer;
+}
+
+VkBuffer LightClusters::getLightIndexBuffer(size_t frameIndex) const {
+	return this->lightIndexBuffers[frameIndex].buffer;
+}
+
+const LightClusterStats* LightClusters::getStats() {
+	return &this->stats;
+}
+
+uint32_t LightClusters::getDepthSlice(float depth, float nearPlane, float farPlane) {
+	if (depth <= nearPlane) {
+		return 0;
+	}
+
+	float slice = std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * CLUSTER_COUNT_Z;
+
+	return std::min(static_cast<uint32_t>(slice), CLUSTER_COUNT_Z - 1);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <vk_mem_alloc.h>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <cstdint>
+#include <vector>
+#include "VulkanTypes.hpp"
+#include "StagingRingBuffer.hpp"
+#include "../../Core/DynamicBVH.hpp"
+
+// Froxel grid over the view frustum, screen tiles by depth slices. Must match light_cluster.comp and phong.frag
+constexpr uint32_t CLUSTER_COUNT_X = 16;
+constexpr uint32_t CLUSTER_COUNT_Y = 9;
+constexpr uint32_t CLUSTER_COUNT_Z = 24;
+constexpr uint32_t CLUSTER_COUNT = CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z;
+// Lights past this in a single cluster are dropped
+constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+
+struct LightClusterStats {
+	// Light references in the cluster lists, and the ones dropped because their cluster was full. CPU assignment only
+	uint32_t lightIndices;
+	uint32_t droppedLights;
+};
+
+// Per cluster lists of the point lights reaching it, so the lighting shader only loops over the lights near each
+// pixel. Clusters are sliced exponentially in depth between the near and far planes. Lights are assigned either by
+// light_cluster.comp or on the CPU, both write the same buffers: an (offset, count) pair per cluster into a list of
+// light indices. Point light ranges are read from position.w, lights with no range reach every cluster
+class LightClusters {
+	struct PendingUpload {
+		VkBuffer stagingBuffer;
+		VkDeviceSize gridOffset;
+		VkDeviceSize indexOffset;
+		VkDeviceSize indexBytes;
+	};
+
+	std::vector<AllocatedBuffer> gridBuffers;
+	std::vector<AllocatedBuffer> lightIndexBuffers;
+	std::vector<PendingUpload> pendingUploads;
+
+	// View space bounds of every cluster for the projection they were built from
+	std::vector<AABB> clusterBounds;
+	glm::vec4 boundsKey{ 0.0f };
+
+	// Kept between frames to reuse the allocations
+	std::vector<glm::uvec2> lightClusterPairs;
+	std::vector<uint32_t> clusterCounts;
+
+	LightClusterStats stats{};
+
+	void buildClusterBounds(const glm::mat4& projection, float nearPlane, float farPlane);
+
+public:
+	void initialise(VmaAllocator allocator, size_t frameOverlap);
+	void cleanup(VmaAllocator allocator);
+
+	void addLightClustersToDescriptorSet(std::vector<VkDescriptorSetLayoutBinding>* bindings);
+	void writeDescriptors(VkDevice device, size_t frameIndex, VkDescriptorSet descriptor);
+
+	// Reference assignment. Bins the lights into the clusters and stages the lists for recordUpload. Returns false if
+	// the staging ring is out of space, in which case nothing is staged
+	bool assignLights(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane, const glm::vec4* positions, uint32_t count,
+					  StagingRingBuffer* stagingRingBuffer, size_t frameIndex);
+	// Copies the lists staged by assignLights into the buffers of the frame
+	void recordUpload(VkCommandBuffer cmd, size_t frameIndex);
+
+	VkBuffer getGridBuffer(size_t frameIndex) const;
+	VkBuffer getLightIndexBuffer(size_t frameIndex) const;
+	const LightClusterStats* getStats();
+
+	// Slice holding a view space depth, clamped to the grid
+	static uint32_t getDepthSlice(float depth, float nearPlane, float farPlane);
+};
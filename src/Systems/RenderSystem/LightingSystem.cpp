@@ -1,6 +1,10 @@
 #include "LightingSystem.hpp"
 #include "VulkanUtility.hpp"
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
 
 constexpr uint32_t POINT_LIGHT_POSITION_BINDING = 1;
 constexpr uint32_t POINT_LIGHT_BASE_COLOUR_BINDING = 2;
@@ -9,217 +13,182 @@ constexpr uint32_t DIRECTIONAL_LIGHT_DIRECTION_BINDING = 4;
 constexpr uint32_t DIRECTIONAL_LIGHT_COLOUR_BINDING = 5;
 constexpr uint32_t LIGHTING_INFO_BINDING = 6;
 
-void LightingSystem::checkForFlagUpdates() {
-	auto numberOfFrameOverlaps = this->bufferFlags.size();
+// Elements every light buffer starts with, so there is always a buffer to bind even without lights
+constexpr size_t LIGHT_BUFFER_INITIAL_CAPACITY = 64;
 
-	// Check point light flags for updates
-	if (this->updateFlags & LightingSystemFlags::UpdatePointLightAttenuationFactorBuffer) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::UpdatePointLightAttenuationFactorBuffer;
-		}
-	}
+// Point lights are cut off where they fall below one step of an 8 bit channel
+constexpr float POINT_LIGHT_INTENSITY_THRESHOLD = 1.0f / 256.0f;
 
-	if (this->updateFlags & LightingSystemFlags::UpdatePointLightColourBuffer) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::UpdatePointLightColourBuffer;
-		}
-	}
+// Distance at which the brightest channel of the light attenuates to the threshold. Returns 0 if the light never
+// falls below it and a negative radius if it never reaches it
+static float calculatePointLightRadius(const PointLightCreateInfo& pointLightCreateInfo) {
+	float intensity = std::max({ pointLightCreateInfo.baseColour.r, pointLightCreateInfo.baseColour.g, pointLightCreateInfo.baseColour.b });
+	const AttenuationFactors& factors = pointLightCreateInfo.attenuationFactors;
 
-	if (this->updateFlags & LightingSystemFlags::UpdatePointLightPositionBuffer) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::UpdatePointLightPositionBuffer;
-		}
+	// Solve constant + linear * d + quadratic * d^2 = intensity / threshold
+	float denominator = intensity / POINT_LIGHT_INTENSITY_THRESHOLD;
+
+	if (factors.constant >= denominator) {
+		return -1.0f;
 	}
 
-	if (this->updateFlags & LightingSystemFlags::PointLightBufferResize) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::PointLightBufferResize;
-		}
+	if (factors.quadratic > 0.0f) {
+		float discriminant = (factors.linear * factors.linear) + (4.0f * factors.quadratic * (denominator - factors.constant));
+		return (std::sqrt(discriminant) - factors.linear) / (2.0f * factors.quadratic);
 	}
 
-	// Check for updates to directional Lights
-	if (this->updateFlags & LightingSystemFlags::UpdateDirectionalLightColourBuffer) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::UpdateDirectionalLightColourBuffer;
-		}
+	if (factors.linear > 0.0f) {
+		return (denominator - factors.constant) / factors.linear;
 	}
 
-	if (this->updateFlags & LightingSystemFlags::UpdateDirectionalLightDirectionBuffer) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::UpdateDirectionalLightDirectionBuffer;
-		}
+	return 0.0f;
+}
+
+void LightBuffer::initialise(size_t frameOverlap, size_t elementSize) {
+	this->elementSize = elementSize;
+	this->frames.resize(frameOverlap);
+
+	for (auto& frame : this->frames) {
+		frame.buffer = {};
+		frame.mappedData = nullptr;
+		frame.capacity = 0;
+		frame.dirtyBegin = 0;
+		frame.dirtyEnd = 0;
 	}
+}
 
-	if (this->updateFlags & LightingSystemFlags::DirectionalLightBufferResize) {
-		for (auto i = 0; i < numberOfFrameOverlaps; i++) {
-			this->bufferFlags[i] |= LightingSystemFlags::DirectionalLightBufferResize;
+void LightBuffer::cleanup(VmaAllocator allocator) {
+	for (auto& frame : this->frames) {
+		if (frame.buffer.buffer != VK_NULL_HANDLE) {
+			vmaDestroyBuffer(allocator, frame.buffer.buffer, frame.buffer.allocation);
 		}
 	}
 
-	this->updateFlags = 0;
+	this->frames.clear();
 }
 
-void LightingSystem::updatePointLightBuffers(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator vmaAllocator, size_t currentFrameIndex, VkDescriptorSet descriptor) {
-	/*if (this->lightingInformation.numberPointLights == 0) {
-		// Program will crash if a buffer of size zero is created
+void LightBuffer::markDirty(size_t begin, size_t end) {
+	if (begin >= end) {
 		return;
-	}*/
-	
-	// Resize buffers if flagged
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::PointLightBufferResize) {
-		if (this->lightingInformation.numberPointLights == 0) {
-			// Program will crash if a buffer of size zero is created therefore fill with dummy data
-			this->pointLights.attenuationFactors.push_back({ 0, 0, 0 });
-			this->pointLights.baseColours.push_back({ 0, 0, 0, 0 });
-			this->pointLights.positions.push_back({0, 0, 0, 0});
-		}
-
-		// Destroy old buffers
-		vmaDestroyBuffer(vmaAllocator, this->pointLightAttenuationBuffers[currentFrameIndex].buffer, this->pointLightAttenuationBuffers[currentFrameIndex].allocation);
-		vmaDestroyBuffer(vmaAllocator, this->pointLightColourBuffers[currentFrameIndex].buffer, this->pointLightColourBuffers[currentFrameIndex].allocation);
-		vmaDestroyBuffer(vmaAllocator, this->pointLightPositionBuffers[currentFrameIndex].buffer, this->pointLightPositionBuffers[currentFrameIndex].allocation);
-
-		size_t attenuationFactorSize = sizeof(AttenuationFactors) * this->pointLights.attenuationFactors.size();
-		size_t positionSize = sizeof(glm::vec4) * this->pointLights.positions.size();
-		size_t baseColourSize = sizeof(glm::vec4) * this->pointLights.baseColours.size();
-
-		// Fill new buffers
-		this->pointLightAttenuationBuffers[currentFrameIndex] = VulkanUtility::allocateGPUOnlyBuffer(device, graphicsQueue, uploadContext, vmaAllocator, this->pointLights.attenuationFactors.data(), attenuationFactorSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-		this->pointLightColourBuffers[currentFrameIndex] = VulkanUtility::allocateGPUOnlyBuffer(device, graphicsQueue, uploadContext, vmaAllocator, this->pointLights.baseColours.data(), baseColourSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-		this->pointLightPositionBuffers[currentFrameIndex] = VulkanUtility::allocateGPUOnlyBuffer(device, graphicsQueue, uploadContext, vmaAllocator, this->pointLights.positions.data(), positionSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-
-		this->bufferFlags[currentFrameIndex] &= ~(LightingSystemFlags::PointLightBufferResize);
 	}
-	
-	std::vector<VkWriteDescriptorSet> descriptorSetWrites{};
-
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::UpdatePointLightAttenuationFactorBuffer) {
-		size_t size = sizeof(AttenuationFactors) * this->pointLights.attenuationFactors.size();
 
-		VkDescriptorBufferInfo attenuationFactorBufferInfo{};
-		attenuationFactorBufferInfo.buffer = this->pointLightAttenuationBuffers[currentFrameIndex].buffer;
-		attenuationFactorBufferInfo.offset = 0;
-		attenuationFactorBufferInfo.range = size;
-
-		VkWriteDescriptorSet attenuationFactorBufferWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &attenuationFactorBufferInfo, POINT_LIGHT_ATTENUATION_FACTORS_BINDING);
-		descriptorSetWrites.push_back(attenuationFactorBufferWrite);
-		
-		this->bufferFlags[currentFrameIndex] &= ~LightingSystemFlags::UpdatePointLightAttenuationFactorBuffer;
+	for (auto& frame : this->frames) {
+		if (frame.dirtyBegin >= frame.dirtyEnd) {
+			frame.dirtyBegin = begin;
+			frame.dirtyEnd = end;
+		} else {
+			frame.dirtyBegin = std::min(frame.dirtyBegin, begin);
+			frame.dirtyEnd = std::max(frame.dirtyEnd, end);
+		}
 	}
+}
 
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::UpdatePointLightColourBuffer) {
-		size_t size = sizeof(glm::vec4) * this->pointLights.baseColours.size();
-
-		VkDescriptorBufferInfo colourBufferInfo{};
-		colourBufferInfo.buffer = this->pointLightColourBuffers[currentFrameIndex].buffer;
-		colourBufferInfo.offset = 0;
-		colourBufferInfo.range = size;
-
-		VkWriteDescriptorSet colourBufferWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &colourBufferInfo, POINT_LIGHT_BASE_COLOUR_BINDING);
-		descriptorSetWrites.push_back(colourBufferWrite);
+size_t LightBuffer::update(VmaAllocator allocator, size_t frameIndex, const void* data, size_t count, bool* recreated) {
+	Frame* frame = &this->frames[frameIndex];
+	*recreated = false;
 
-		this->bufferFlags[currentFrameIndex] &= ~LightingSystemFlags::UpdatePointLightColourBuffer;
-	}
+	if (frame->buffer.buffer == VK_NULL_HANDLE || count > frame->capacity) {
+		// The GPU is done with this frame's buffer, so it can go straight away
+		if (frame->buffer.buffer != VK_NULL_HANDLE) {
+			vmaDestroyBuffer(allocator, frame->buffer.buffer, frame->buffer.allocation);
+		}
 
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::UpdatePointLightPositionBuffer) {
-		size_t size = sizeof(glm::vec4) * this->pointLights.positions.size();
+		size_t capacity = std::max({ frame->capacity * 2, count, LIGHT_BUFFER_INITIAL_CAPACITY });
 
-		VkDescriptorBufferInfo positionBufferInfo{};
-		positionBufferInfo.buffer = this->pointLightPositionBuffers[currentFrameIndex].buffer;
-		positionBufferInfo.offset = 0;
-		positionBufferInfo.range = size;
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.pNext = nullptr;
 
-		VkWriteDescriptorSet positionBufferWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &positionBufferInfo, POINT_LIGHT_POSITION_BINDING);
-		descriptorSetWrites.push_back(positionBufferWrite);
+		bufferInfo.size = capacity * this->elementSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 
-		this->bufferFlags[currentFrameIndex] &= ~LightingSystemFlags::UpdatePointLightPositionBuffer;
-	}
+		// Keep the buffer mapped for its whole lifetime
+		VmaAllocationCreateInfo vmaAllocInfo{};
+		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
-	vkUpdateDescriptorSets(device, descriptorSetWrites.size(), descriptorSetWrites.data(), 0, nullptr);
-}
+		VmaAllocationInfo allocationInfo{};
+		VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo, &frame->buffer.buffer, &frame->buffer.allocation, &allocationInfo);
 
-void LightingSystem::updateDirectionalLightBuffers(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator vmaAllocator, size_t currentFrameIndex, VkDescriptorSet descriptor) {
-	// Resize buffers if flagged
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::DirectionalLightBufferResize) {
-		if (this->lightingInformation.numberDirectionalLights == 0) {
-			// Program will crash if a buffer of size zero is created therefore fill with dummy data
-			this->directionalLights.baseColours.push_back({0, 0, 0, 0});
-			this->directionalLights.directions.push_back({ 0, 0, 0, 0 });
+		if (result) {
+			std::cout << "Couldn't create light buffer: " << result << std::endl;
+			abort();
 		}
 
-		// Destroy old buffers
-		vmaDestroyBuffer(vmaAllocator, this->directionalLightColourBuffers[currentFrameIndex].buffer, this->directionalLightColourBuffers[currentFrameIndex].allocation);
-		vmaDestroyBuffer(vmaAllocator, this->directionalLightDirectionBuffers[currentFrameIndex].buffer, this->directionalLightDirectionBuffers[currentFrameIndex].allocation);
-
-		size_t directionSize = sizeof(glm::vec4) * this->directionalLights.directions.size();
-		size_t baseColourSize = sizeof(glm::vec4) * this->directionalLights.baseColours.size();
-
-		// Fill new buffers
-		this->directionalLightColourBuffers[currentFrameIndex] = VulkanUtility::allocateGPUOnlyBuffer(device, graphicsQueue, uploadContext, vmaAllocator, this->directionalLights.baseColours.data(), baseColourSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-		this->directionalLightDirectionBuffers[currentFrameIndex] = VulkanUtility::allocateGPUOnlyBuffer(device, graphicsQueue, uploadContext, vmaAllocator, this->directionalLights.directions.data(), directionSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-		
-		this->bufferFlags[currentFrameIndex] &= ~(LightingSystemFlags::DirectionalLightBufferResize);
+		frame->buffer.size = bufferInfo.size;
+		frame->mappedData = static_cast<uint8_t*>(allocationInfo.pMappedData);
+		frame->capacity = capacity;
+		// A new buffer holds none of the old contents
+		frame->dirtyBegin = 0;
+		frame->dirtyEnd = count;
+		*recreated = true;
 	}
 
-	std::vector<VkWriteDescriptorSet> descriptorSetWrites{};
-
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::UpdateDirectionalLightColourBuffer) {
-		size_t size = sizeof(glm::vec4) * this->directionalLights.baseColours.size();
-
-		VkDescriptorBufferInfo baseColourBufferInfo{};
-		baseColourBufferInfo.buffer = this->directionalLightColourBuffers[currentFrameIndex].buffer;
-		baseColourBufferInfo.offset = 0;
-		baseColourBufferInfo.range = size;
-
-		VkWriteDescriptorSet baseColourBufferWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &baseColourBufferInfo, DIRECTIONAL_LIGHT_COLOUR_BINDING);
-		descriptorSetWrites.push_back(baseColourBufferWrite);
+	size_t begin = frame->dirtyBegin;
+	size_t end = std::min(frame->dirtyEnd, count);
+	size_t bytes = 0;
 
-		this->bufferFlags[currentFrameIndex] &= ~LightingSystemFlags::UpdateDirectionalLightColourBuffer;
+	if (begin < end) {
+		bytes = (end - begin) * this->elementSize;
+		memcpy(frame->mappedData + (begin * this->elementSize), static_cast<const uint8_t*>(data) + (begin * this->elementSize), bytes);
+		vmaFlushAllocation(allocator, frame->buffer.allocation, begin * this->elementSize, bytes);
 	}
 
-	if (this->bufferFlags[currentFrameIndex] & LightingSystemFlags::UpdateDirectionalLightDirectionBuffer) {
-		size_t size = sizeof(glm::vec4) * this->directionalLights.directions.size();
+	frame->dirtyBegin = 0;
+	frame->dirtyEnd = 0;
 
-		VkDescriptorBufferInfo directionBufferInfo{};
-		directionBufferInfo.buffer = this->directionalLightDirectionBuffers[currentFrameIndex].buffer;
-		directionBufferInfo.offset = 0;
-		directionBufferInfo.range = size;
-
-		VkWriteDescriptorSet directionBufferWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &directionBufferInfo, DIRECTIONAL_LIGHT_DIRECTION_BINDING);
-		descriptorSetWrites.push_back(directionBufferWrite);
+	return bytes;
+}
 
-		this->bufferFlags[currentFrameIndex] &= ~LightingSystemFlags::UpdateDirectionalLightDirectionBuffer;
-	}
+VkDescriptorBufferInfo LightBuffer::getDescriptorInfo(size_t frameIndex) const {
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = this->frames[frameIndex].buffer.buffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = this->frames[frameIndex].buffer.size;
 
-	vkUpdateDescriptorSets(device, descriptorSetWrites.size(), descriptorSetWrites.data(), 0, nullptr);
+	return bufferInfo;
 }
 
 void LightingSystem::initialise(size_t frameOverlaps) {
-	this->bufferFlags.resize(frameOverlaps);
-
-	this->pointLightAttenuationBuffers.resize(frameOverlaps);
-	this->pointLightColourBuffers.resize(frameOverlaps);
-	this->pointLightPositionBuffers.resize(frameOverlaps);
-	this->directionalLightColourBuffers.resize(frameOverlaps);
-	this->directionalLightDirectionBuffers.resize(frameOverlaps);
-	this->lightingInfoBuffers.resize(frameOverlaps);
+	this->pointLightPositionBuffer.initialise(frameOverlaps, sizeof(glm::vec4));
+	this->pointLightColourBuffer.initialise(frameOverlaps, sizeof(glm::vec4));
+	this->pointLightAttenuationBuffer.initialise(frameOverlaps, sizeof(AttenuationFactors));
+	this->directionalLightColourBuffer.initialise(frameOverlaps, sizeof(glm::vec4));
+	this->directionalLightDirectionBuffer.initialise(frameOverlaps, sizeof(glm::vec4));
+	this->lightingInfoBuffer.initialise(frameOverlaps, sizeof(LightingInformation));
+
+	// The counts are always bound, even before any light is added
+	this->lightingInfoBuffer.markDirty(0, 1);
+}
+
+void LightingSystem::cleanup(VmaAllocator vmaAllocator) {
+	this->pointLightPositionBuffer.cleanup(vmaAllocator);
+	this->pointLightColourBuffer.cleanup(vmaAllocator);
+	this->pointLightAttenuationBuffer.cleanup(vmaAllocator);
+	this->directionalLightColourBuffer.cleanup(vmaAllocator);
+	this->directionalLightDirectionBuffer.cleanup(vmaAllocator);
+	this->lightingInfoBuffer.cleanup(vmaAllocator);
 }
 
 size_t LightingSystem::addPointLight(PointLightCreateInfo pointLightCreateInfo) {
-	size_t id = this->lightingInformation.numberPointLights;
+	size_t id = this->pointLights.positions.size();
 	this->pointLights.positions.resize(id + 1);
 	this->pointLights.attenuationFactors.resize(id + 1);
 	this->pointLights.baseColours.resize(id + 1);
 
-	this->pointLights.positions[id] = pointLightCreateInfo.position;
+	float radius = calculatePointLightRadius(pointLightCreateInfo);
+
+	// The range travels with the position, the light cluster shaders read it from w
+	this->pointLights.positions[id] = glm::vec4(glm::vec3(pointLightCreateInfo.position), std::max(radius, 0.0f));
 	this->pointLights.attenuationFactors[id] = pointLightCreateInfo.attenuationFactors;
 	this->pointLights.baseColours[id] = pointLightCreateInfo.baseColour;
 
-	this->lightingInformation.numberPointLights += 1;
-
-	this->updateFlags |= LightingSystemFlags::PointLightBufferResize | LightingSystemFlags::UpdatePointLightAttenuationFactorBuffer
-		| LightingSystemFlags::UpdatePointLightColourBuffer | LightingSystemFlags::UpdatePointLightPositionBuffer;
+	// Infinite radii keep unbounded lights inside every frustum and lights too dim to see outside all of them
+	float cullRadius = radius > 0.0f ? radius : (radius == 0.0f ? INFINITY : -INFINITY);
+	this->pointLightSpheres.push_back(glm::vec3(pointLightCreateInfo.position), cullRadius);
+	this->pointLightSlots.push_back(UINT32_MAX);
 
+	// The GPU buffers change once the light turns out to be visible
 	return id;
 }
 
@@ -233,45 +202,123 @@ size_t LightingSystem::addDirectionLight(DirectionalLightCreateInfo directionalL
 
 	this->lightingInformation.numberDirectionalLights += 1;
 
-	this->updateFlags |= LightingSystemFlags::DirectionalLightBufferResize | LightingSystemFlags::UpdateDirectionalLightColourBuffer 
-		| LightingSystemFlags::UpdateDirectionalLightDirectionBuffer;
+	this->directionalLightDirectionBuffer.markDirty(id, id + 1);
+	this->directionalLightColourBuffer.markDirty(id, id + 1);
+	this->lightingInfoBuffer.markDirty(0, 1);
 
 	return id;
 }
 
+void LightingSystem::setPointLightPosition(size_t id, glm::vec3 position) {
+	this->pointLights.positions[id] = glm::vec4(position, this->pointLights.positions[id].w);
+	this->pointLightSpheres.centerX[id] = position.x;
+	this->pointLightSpheres.centerY[id] = position.y;
+	this->pointLightSpheres.centerZ[id] = position.z;
+
+	uint32_t slot = this->pointLightSlots[id];
+
+	if (slot != UINT32_MAX) {
+		this->visiblePointLights.positions[slot] = this->pointLights.positions[id];
+		this->pointLightPositionBuffer.markDirty(slot, slot + 1);
+	}
+}
+
+void LightingSystem::cullPointLights(const glm::mat4& viewProj) {
+	Frustum frustum = FrustumCulling::extractPlanes(viewProj);
+	size_t lightCount = this->pointLightSpheres.size();
+
+	this->culledPointLights.resize(lightCount);
+	size_t visibleCount = FrustumCulling::cullSpheres(&frustum, &this->pointLightSpheres, 0, lightCount, this->culledPointLights.data());
+	this->culledPointLights.resize(visibleCount);
+
+	this->stats.visiblePointLights = static_cast<uint32_t>(visibleCount);
+	this->stats.culledPointLights = static_cast<uint32_t>(lightCount - visibleCount);
+
+	// Nothing to upload while the same lights stay visible
+	if (this->culledPointLights == this->visiblePointLightIndices) {
+		return;
+	}
+
+	// Lights keep their order, so slots before the first difference already hold the right lights
+	size_t firstChanged = std::mismatch(this->culledPointLights.begin(), this->culledPointLights.end(), this->visiblePointLightIndices.begin(), this->visiblePointLightIndices.end()).first - this->culledPointLights.begin();
+
+	for (size_t slot = firstChanged; slot < this->visiblePointLightIndices.size(); slot++) {
+		this->pointLightSlots[this->visiblePointLightIndices[slot]] = UINT32_MAX;
+	}
+
+	this->visiblePointLightIndices.swap(this->culledPointLights);
+
+	this->visiblePointLights.positions.resize(visibleCount);
+	this->visiblePointLights.baseColours.resize(visibleCount);
+	this->visiblePointLights.attenuationFactors.resize(visibleCount);
+
+	for (size_t slot = firstChanged; slot < visibleCount; slot++) {
+		uint32_t light = this->visiblePointLightIndices[slot];
+
+		this->visiblePointLights.positions[slot] = this->pointLights.positions[light];
+		this->visiblePointLights.baseColours[slot] = this->pointLights.baseColours[light];
+		this->visiblePointLights.attenuationFactors[slot] = this->pointLights.attenuationFactors[light];
+		this->pointLightSlots[light] = static_cast<uint32_t>(slot);
+	}
+
+	this->pointLightPositionBuffer.markDirty(firstChanged, visibleCount);
+	this->pointLightColourBuffer.markDirty(firstChanged, visibleCount);
+	this->pointLightAttenuationBuffer.markDirty(firstChanged, visibleCount);
+
+	if (this->lightingInformation.numberPointLights != visibleCount) {
+		this->lightingInformation.numberPointLights = static_cast<uint32_t>(visibleCount);
+		this->lightingInfoBuffer.markDirty(0, 1);
+	}
+}
+
+const glm::vec4* LightingSystem::getPointLightPositions() {
+	return this->visiblePointLights.positions.data();
+}
+
+uint32_t LightingSystem::getPointLightCount() {
+	return this->lightingInformation.numberPointLights;
+}
+
+const LightingStats* LightingSystem::getStats() {
+	return &this->stats;
+}
+
 void LightingSystem::addLightingSystemToDescriptorSet(std::vector<VkDescriptorSetLayoutBinding>* bindings) {
-	// Point Lights
+	// Point Lights. Positions and counts are also read by the light cluster compute shader
 	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, POINT_LIGHT_ATTENUATION_FACTORS_BINDING));
 	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, POINT_LIGHT_BASE_COLOUR_BINDING));
-	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, POINT_LIGHT_POSITION_BINDING));
+	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, POINT_LIGHT_POSITION_BINDING));
 	// Directional Lights
 	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, DIRECTIONAL_LIGHT_COLOUR_BINDING));
 	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, DIRECTIONAL_LIGHT_DIRECTION_BINDING));
-	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, LIGHTING_INFO_BINDING));
+	bindings->push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, LIGHTING_INFO_BINDING));
 }
 
-void LightingSystem::updateLightingSystemBuffers(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator vmaAllocator, size_t currentFrameIndex,
-												 VkDescriptorSet descriptor) {
-	this->checkForFlagUpdates();
-
-	// Check if either light has been resized. Resized = change in number of lights
-	if (this->bufferFlags[currentFrameIndex] & (LightingSystemFlags::DirectionalLightBufferResize | LightingSystemFlags::PointLightBufferResize)) {
-		// Change in number of lights
-		vmaDestroyBuffer(vmaAllocator, this->lightingInfoBuffers[currentFrameIndex].buffer, this->lightingInfoBuffers[currentFrameIndex].allocation);
-		size_t size = sizeof(LightingInformation);
-		this->lightingInfoBuffers[currentFrameIndex] = VulkanUtility::allocateGPUOnlyBuffer(device, graphicsQueue, uploadContext, vmaAllocator, &this->lightingInformation, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-		
-		VkDescriptorBufferInfo lightingInfoBufferInfo{};
-		lightingInfoBufferInfo.buffer = this->lightingInfoBuffers[currentFrameIndex].buffer;
-		lightingInfoBufferInfo.offset = 0;
-		lightingInfoBufferInfo.range = size;
-
-		VkWriteDescriptorSet lightingInfoWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &lightingInfoBufferInfo, LIGHTING_INFO_BINDING);
-		vkUpdateDescriptorSets(device, 1, &lightingInfoWrite, 0, nullptr);
-	}
+void LightingSystem::updateLightingSystemBuffers(VkDevice device, VmaAllocator vmaAllocator, size_t currentFrameIndex, VkDescriptorSet descriptor) {
+	std::array<VkDescriptorBufferInfo, 6> bufferInfos{};
+	std::vector<VkWriteDescriptorSet> descriptorSetWrites{};
+
+	this->stats.bytesWritten = 0;
+
+	auto updateBuffer = [&](LightBuffer* buffer, const void* data, size_t count, uint32_t binding) {
+		bool recreated = false;
+		this->stats.bytesWritten += buffer->update(vmaAllocator, currentFrameIndex, data, count, &recreated);
 
-	// Update point light buffers
-	this->updatePointLightBuffers(device, graphicsQueue, uploadContext, vmaAllocator, currentFrameIndex, descriptor);
-	// Update directional light buffers
-	this->updateDirectionalLightBuffers(device, graphicsQueue, uploadContext, vmaAllocator, currentFrameIndex, descriptor);
+		// Buffers that kept their capacity are still bound
+		if (recreated) {
+			bufferInfos[descriptorSetWrites.size()] = buffer->getDescriptorInfo(currentFrameIndex);
+			descriptorSetWrites.push_back(VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, descriptor, &bufferInfos[descriptorSetWrites.size()], binding));
+		}
+	};
+
+	updateBuffer(&this->pointLightPositionBuffer, this->visiblePointLights.positions.data(), this->visiblePointLights.positions.size(), POINT_LIGHT_POSITION_BINDING);
+	updateBuffer(&this->pointLightColourBuffer, this->visiblePointLights.baseColours.data(), this->visiblePointLights.baseColours.size(), POINT_LIGHT_BASE_COLOUR_BINDING);
+	updateBuffer(&this->pointLightAttenuationBuffer, this->visiblePointLights.attenuationFactors.data(), this->visiblePointLights.attenuationFactors.size(), POINT_LIGHT_ATTENUATION_FACTORS_BINDING);
+	updateBuffer(&this->directionalLightDirectionBuffer, this->directionalLights.directions.data(), this->directionalLights.directions.size(), DIRECTIONAL_LIGHT_DIRECTION_BINDING);
+	updateBuffer(&this->directionalLightColourBuffer, this->directionalLights.baseColours.data(), this->directionalLights.baseColours.size(), DIRECTIONAL_LIGHT_COLOUR_BINDING);
+	updateBuffer(&this->lightingInfoBuffer, &this->lightingInformation, 1, LIGHTING_INFO_BINDING);
+
+	if (!descriptorSetWrites.empty()) {
+		vkUpdateDescriptorSets(device, descriptorSetWrites.size(), descriptorSetWrites.data(), 0, nullptr);
+	}
 }
@@ -3,46 +3,84 @@
 #include <glm/vec3.hpp>
 #include "../../Components/RenderComponents/LightComponent.hpp"
 #include <vulkan/vulkan_core.h>
+#include <vk_mem_alloc.h>
 #include "VulkanTypes.hpp"
+#include "FrustumCulling.hpp"
 
-enum LightingSystemFlags {
-	UpdatePointLightPositionBuffer = 1 << 0,
-	UpdatePointLightColourBuffer = 1 << 1,
-	UpdatePointLightAttenuationFactorBuffer = 1 << 2,
-	UpdateDirectionalLightColourBuffer = 1 << 3,
-	UpdateDirectionalLightDirectionBuffer = 1 << 4,
-	PointLightBufferResize = 1 << 5,
-	DirectionalLightBufferResize = 1 << 6
+struct LightingStats {
+	// Point lights inside the frustum in the last cull, only these are uploaded
+	uint32_t visiblePointLights;
+	uint32_t culledPointLights;
+	// Bytes written into the light buffers by the last update
+	uint64_t bytesWritten;
+};
+
+// Storage buffer of light data with a persistently mapped copy per frame in flight. Changes are recorded as a range
+// of dirty elements for every frame, and a frame's copy is brought up to date when its index comes round again, so
+// the GPU never reads memory being written. Capacity doubles when outgrown
+class LightBuffer {
+	struct Frame {
+		AllocatedBuffer buffer;
+		uint8_t* mappedData;
+		size_t capacity;
+		size_t dirtyBegin;
+		size_t dirtyEnd;
+	};
+
+	std::vector<Frame> frames;
+	size_t elementSize = 0;
+
+public:
+	void initialise(size_t frameOverlap, size_t elementSize);
+	void cleanup(VmaAllocator allocator);
+
+	void markDirty(size_t begin, size_t end);
+	// Writes the elements of the frame that changed since it was last updated. Returns the bytes written, and sets
+	// recreated if the buffer had to grow, in which case its descriptor has to be written again
+	size_t update(VmaAllocator allocator, size_t frameIndex, const void* data, size_t count, bool* recreated);
+	VkDescriptorBufferInfo getDescriptorInfo(size_t frameIndex) const;
 };
 
 class LightingSystem {
 private:
+	// Every point light, the GPU buffers only hold the visible ones packed into visiblePointLights
 	PointLights pointLights;
+	PointLights visiblePointLights;
+	// Bounds of every point light, the radius is infinite for lights that never fade out
+	CullSpheres pointLightSpheres;
+	// Indices into pointLights of the packed lights, and the scratch the next cull writes into
+	std::vector<uint32_t> visiblePointLightIndices;
+	std::vector<uint32_t> culledPointLights;
+	// Packed slot of every point light, UINT32_MAX while it is culled
+	std::vector<uint32_t> pointLightSlots;
+	LightingStats stats{};
 	DirectionalLights directionalLights;
 	LightingInformation lightingInformation;
-	// Default to updating first
-	uint64_t updateFlags = LightingSystemFlags::UpdatePointLightPositionBuffer | LightingSystemFlags::UpdatePointLightColourBuffer 
-		| LightingSystemFlags::UpdatePointLightAttenuationFactorBuffer | LightingSystemFlags::UpdateDirectionalLightColourBuffer
-		| LightingSystemFlags::UpdateDirectionalLightDirectionBuffer | LightingSystemFlags::PointLightBufferResize | LightingSystemFlags::DirectionalLightBufferResize;
-	std::vector<uint64_t> bufferFlags;
-	std::vector<AllocatedBuffer> pointLightPositionBuffers;
-	std::vector<AllocatedBuffer> pointLightColourBuffers;
-	std::vector<AllocatedBuffer> pointLightAttenuationBuffers;
-	std::vector<AllocatedBuffer> directionalLightColourBuffers;
-	std::vector<AllocatedBuffer> directionalLightDirectionBuffers;
-	std::vector<AllocatedBuffer> lightingInfoBuffers;
-
-	void checkForFlagUpdates();
-	void updatePointLightBuffers(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator vmaAllocator, size_t currentFrameIndex,
-								 VkDescriptorSet descriptor);
-	void updateDirectionalLightBuffers(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator vmaAllocator, size_t currentFrameIndex,
-									   VkDescriptorSet descriptor);
+
+	LightBuffer pointLightPositionBuffer;
+	LightBuffer pointLightColourBuffer;
+	LightBuffer pointLightAttenuationBuffer;
+	LightBuffer directionalLightColourBuffer;
+	LightBuffer directionalLightDirectionBuffer;
+	LightBuffer lightingInfoBuffer;
+
 public:
 	void initialise(size_t frameOverlaps);
+	void cleanup(VmaAllocator vmaAllocator);
+	// position.w is ignored, the radius is derived from the attenuation factors and stored there instead
 	size_t addPointLight(PointLightCreateInfo pointLightCreateInfo);
 	size_t addDirectionLight(DirectionalLightCreateInfo directionalLightCreateInfo);
+	// Only the light's own element is rewritten, whether it is visible is decided by the next cull
+	void setPointLightPosition(size_t id, glm::vec3 position);
+
+	// Packs the point lights touching the frustum for the next buffer update. Call before updateLightingSystemBuffers
+	void cullPointLights(const glm::mat4& viewProj);
+	// Visible point lights, in buffer order
+	const glm::vec4* getPointLightPositions();
+	uint32_t getPointLightCount();
+	const LightingStats* getStats();
 
 	void addLightingSystemToDescriptorSet(std::vector<VkDescriptorSetLayoutBinding>* bindings);
-	void updateLightingSystemBuffers(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator vmaAllocator, size_t currentFrameIndex,
-									 VkDescriptorSet descriptor);
-};
\ No newline at end of file
+	// Must be called after the fence of the frame has been waited on. Descriptors are only written when a buffer grows
+	void updateLightingSystemBuffers(VkDevice device, VmaAllocator vmaAllocator, size_t currentFrameIndex, VkDescriptorSet descriptor);
+};
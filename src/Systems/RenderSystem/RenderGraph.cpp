@@ -0,0 +1,543 @@
+#include "RenderGraph.hpp"
+#include "VulkanUtility.hpp"
+#include <algorithm>
+#include <iostream>
+
+constexpr uint32_t RENDER_GRAPH_NOT_TRANSIENT = UINT32_MAX;
+constexpr uint32_t RENDER_GRAPH_UNUSED_PASS = UINT32_MAX;
+constexpr VkAccessFlags RENDER_GRAPH_WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+static bool sameImageInfo(const RenderGraphImageInfo& a, const RenderGraphImageInfo& b) {
+	return a.format == b.format && a.extent.width == b.extent.width && a.extent.height == b.extent.height && a.extent.depth == b.extent.depth && a.mipLevels == b.mipLevels && a.usage == b.usage && a.aspectMask == b.aspectMask;
+}
+
+void RenderGraph::initialise(VkDevice device, VmaAllocator allocator, size_t frameOverlap) {
+	this->device = device;
+	this->allocator = allocator;
+	this->transientCaches.resize(frameOverlap);
+}
+
+void RenderGraph::cleanup() {
+	for (auto& cache : this->transientCaches) {
+		this->destroyTransientCache(&cache);
+	}
+}
+
+void RenderGraph::reset(size_t frameIndex) {
+	this->frameIndex = frameIndex;
+	this->resources.clear();
+	this->passes.clear();
+	this->transientImages.clear();
+	this->passBarriers.clear();
+}
+
+RenderGraphResource RenderGraph::importImage(VkImage image, VkImageAspectFlags aspectMask, uint32_t mipLevels, VkImageLayout currentLayout) {
+	Resource resource{};
+	resource.image = image;
+	resource.aspectMask = aspectMask;
+	resource.mipLevels = mipLevels;
+	resource.initialLayout = currentLayout;
+	resource.transient = RENDER_GRAPH_NOT_TRANSIENT;
+
+	this->resources.push_back(resource);
+
+	return static_cast<RenderGraphResource>(this->resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::importBuffer(VkBuffer buffer) {
+	Resource resource{};
+	resource.buffer = buffer;
+	resource.transient = RENDER_GRAPH_NOT_TRANSIENT;
+
+	this->resources.push_back(resource);
+
+	return static_cast<RenderGraphResource>(this->resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::createImage(const RenderGraphImageInfo& info) {
+	Resource resource{};
+	resource.aspectMask = info.aspectMask;
+	resource.mipLevels = info.mipLevels;
+	resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	resource.transient = static_cast<uint32_t>(this->transientImages.size());
+
+	this->resources.push_back(resource);
+
+	RenderGraphResource handle = static_cast<RenderGraphResource>(this->resources.size() - 1);
+	this->transientImages.push_back({ info, handle, RENDER_GRAPH_UNUSED_PASS, RENDER_GRAPH_UNUSED_PASS });
+
+	return handle;
+}
+
+void RenderGraph::exportResource(RenderGraphResource resource) {
+	this->resources[resource].exported = true;
+}
+
+uint32_t RenderGraph::addPass(const char* name, std::function<void(VkCommandBuffer)>&& execute) {
+	Pass pass{};
+	pass.name = name;
+	pass.execute = std::move(execute);
+
+	this->passes.push_back(std::move(pass));
+
+	return static_cast<uint32_t>(this->passes.size() - 1);
+}
+
+void RenderGraph::read(uint32_t pass, RenderGraphResource resource, RenderGraphAccess access) {
+	this->passes[pass].usages.push_back({ resource, access, false });
+}
+
+void RenderGraph::write(uint32_t pass, RenderGraphResource resource, RenderGraphAccess access) {
+	this->passes[pass].usages.push_back({ resource, access, true });
+}
+
+void RenderGraph::setSideEffects(uint32_t pass) {
+	this->passes[pass].sideEffects = true;
+}
+
+void RenderGraph::compile() {
+	this->cullPasses();
+
+	// Lifetimes of the transient images over the passes left
+	for (uint32_t passIndex = 0; passIndex < this->passes.size(); passIndex++) {
+		if (this->passes[passIndex].culled) {
+			continue;
+		}
+
+		for (auto& usage : this->passes[passIndex].usages) {
+			uint32_t transient = this->resources[usage.resource].transient;
+
+			if (transient != RENDER_GRAPH_NOT_TRANSIENT) {
+				TransientImage* image = &this->transientImages[transient];
+				image->firstPass = std::min(image->firstPass, passIndex);
+				image->lastPass = image->lastPass == RENDER_GRAPH_UNUSED_PASS ? passIndex : std::max(image->lastPass, passIndex);
+			}
+		}
+	}
+
+	this->realiseTransientImages();
+	this->buildBarriers();
+}
+
+void RenderGraph::cullPasses() {
+	// Walk back from what leaves the graph, a pass is needed if it writes something a needed pass or the outside reads
+	std::vector<uint8_t> needed(this->resources.size(), 0);
+
+	for (size_t i = 0; i < this->resources.size(); i++) {
+		needed[i] = this->resources[i].exported ? 1 : 0;
+	}
+
+	this->stats.passesCulled = 0;
+	this->stats.passesExecuted = 0;
+
+	for (size_t passIndex = this->passes.size(); passIndex > 0; passIndex--) {
+		Pass* pass = &this->passes[passIndex - 1];
+		bool keep = pass->sideEffects;
+
+		for (auto& usage : pass->usages) {
+			keep = keep || (usage.write && needed[usage.resource]);
+		}
+
+		pass->culled = !keep;
+
+		if (!keep) {
+			this->stats.passesCulled++;
+			continue;
+		}
+
+		this->stats.passesExecuted++;
+
+		// Writes that keep part of the old contents depend on earlier writers as much as reads do
+		for (auto& usage : pass->usages) {
+			if (!usage.write || !usage.access.discard) {
+				needed[usage.resource] = 1;
+			}
+		}
+	}
+}
+
+void RenderGraph::destroyTransientCache(TransientCache* cache) {
+	for (auto& image : cache->images) {
+		if (image.image != VK_NULL_HANDLE) {
+			for (auto levelView : image.levelViews) {
+				vkDestroyImageView(this->device, levelView, nullptr);
+			}
+
+			vkDestroyImageView(this->device, image.imageView, nullptr);
+			vkDestroyImage(this->device, image.image, nullptr);
+		}
+	}
+
+	for (auto& heap : cache->heaps) {
+		vmaFreeMemory(this->allocator, heap.allocation);
+	}
+
+	cache->images.clear();
+	cache->heaps.clear();
+}
+
+void RenderGraph::realiseTransientImages() {
+	TransientCache* cache = &this->transientCaches[this->frameIndex];
+
+	// Graphs are usually the same every frame, so the images of the last one with this frame index are reused
+	bool reuse = cache->images.size() == this->transientImages.size();
+
+	for (size_t i = 0; reuse && i < this->transientImages.size(); i++) {
+		const TransientImage* wanted = &this->transientImages[i];
+		const PlacedImage* cached = &cache->images[i];
+		reuse = sameImageInfo(wanted->info, cached->info) && wanted->firstPass == cached->firstPass && wanted->lastPass == cached->lastPass;
+	}
+
+	this->transientImagesRecreated = !reuse;
+
+	if (!reuse) {
+		this->destroyTransientCache(cache);
+		cache->images.resize(this->transientImages.size());
+
+		std::vector<VkMemoryRequirements> requirements(this->transientImages.size());
+		std::vector<uint32_t> placementOrder;
+
+		for (uint32_t i = 0; i < this->transientImages.size(); i++) {
+			const TransientImage* transient = &this->transientImages[i];
+			PlacedImage* placed = &cache->images[i];
+
+			placed->info = transient->info;
+			placed->firstPass = transient->firstPass;
+			placed->lastPass = transient->lastPass;
+			placed->image = VK_NULL_HANDLE;
+			placed->imageView = VK_NULL_HANDLE;
+			placed->levelViews.clear();
+			placed->heap = UINT32_MAX;
+			placed->offset = VK_WHOLE_SIZE;
+			placed->size = 0;
+
+			// Culled along with every pass using it
+			if (transient->firstPass == RENDER_GRAPH_UNUSED_PASS) {
+				continue;
+			}
+
+			VkImageCreateInfo imageInfo = VulkanUtility::imageCreateInfo(transient->info.format, transient->info.usage, transient->info.extent);
+			imageInfo.mipLevels = transient->info.mipLevels;
+
+			VkResult result = vkCreateImage(this->device, &imageInfo, nullptr, &placed->image);
+
+			if (result) {
+				std::cout << "Detected Vulkan error while creating transient render graph image: " << result << std::endl;
+				abort();
+			}
+
+			vkGetImageMemoryRequirements(this->device, placed->image, &requirements[i]);
+			placed->size = requirements[i].size;
+			placementOrder.push_back(i);
+		}
+
+		// Largest first, each at the lowest offset clear of the images alive at the same time
+		std::sort(placementOrder.begin(), placementOrder.end(), [&requirements](uint32_t a, uint32_t b) {
+			return requirements[a].size > requirements[b].size;
+		});
+
+		for (uint32_t imageIndex : placementOrder) {
+			PlacedImage* placed = &cache->images[imageIndex];
+			const VkMemoryRequirements* requirement = &requirements[imageIndex];
+
+			// Images needing memory types no heap offers get a heap of their own
+			uint32_t heapIndex = 0;
+
+			while (heapIndex < cache->heaps.size() && (cache->heaps[heapIndex].memoryTypeBits & requirement->memoryTypeBits) == 0) {
+				heapIndex++;
+			}
+
+			if (heapIndex == cache->heaps.size()) {
+				cache->heaps.push_back({ requirement->memoryTypeBits, 0, 1, VK_NULL_HANDLE });
+			}
+
+			TransientHeap* heap = &cache->heaps[heapIndex];
+			heap->memoryTypeBits &= requirement->memoryTypeBits;
+			heap->alignment = std::max(heap->alignment, requirement->alignment);
+
+			std::vector<VkDeviceSize> candidates = { 0 };
+
+			for (auto& other : cache->images) {
+				if (&other != placed && other.heap == heapIndex && other.offset != VK_WHOLE_SIZE) {
+					candidates.push_back(other.offset + other.size);
+				}
+			}
+
+			VkDeviceSize bestOffset = VK_WHOLE_SIZE;
+
+			for (VkDeviceSize candidate : candidates) {
+				VkDeviceSize offset = (candidate + requirement->alignment - 1) / requirement->alignment * requirement->alignment;
+				bool clear = offset < bestOffset;
+
+				for (auto& other : cache->images) {
+					if (!clear) {
+						break;
+					}
+
+					bool placedBefore = &other != placed && other.heap == heapIndex && other.offset != VK_WHOLE_SIZE;
+					bool livesTogether = !(other.lastPass < placed->firstPass || placed->lastPass < other.firstPass);
+					bool overlaps = offset < other.offset + other.size && other.offset < offset + requirement->size;
+
+					clear = !(placedBefore && livesTogether && overlaps);
+				}
+
+				if (clear) {
+					bestOffset = offset;
+				}
+			}
+
+			placed->heap = heapIndex;
+			placed->offset = bestOffset;
+			heap->size = std::max(heap->size, bestOffset + requirement->size);
+		}
+
+		for (auto& heap : cache->heaps) {
+			VkMemoryRequirements heapRequirements{};
+			heapRequirements.size = heap.size;
+			heapRequirements.alignment = heap.alignment;
+			heapRequirements.memoryTypeBits = heap.memoryTypeBits;
+
+			VmaAllocationCreateInfo vmaAllocInfo{};
+			vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			vmaAllocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+			VkResult result = vmaAllocateMemory(this->allocator, &heapRequirements, &vmaAllocInfo, &heap.allocation, nullptr);
+
+			if (result) {
+				std::cout << "Detected Vulkan error while allocating render graph transient memory: " << result << std::endl;
+				abort();
+			}
+		}
+
+		for (auto& placed : cache->images) {
+			if (placed.image == VK_NULL_HANDLE) {
+				continue;
+			}
+
+			VkResult result = vmaBindImageMemory2(this->allocator, cache->heaps[placed.heap].allocation, placed.offset, placed.image, nullptr);
+
+			if (result) {
+				std::cout << "Detected Vulkan error while binding render graph transient image: " << result << std::endl;
+				abort();
+			}
+
+			VkImageViewCreateInfo viewInfo = VulkanUtility::imageViewCreateInfo(placed.info.format, placed.image, placed.info.aspectMask);
+			viewInfo.subresourceRange.levelCount = placed.info.mipLevels;
+
+			result = vkCreateImageView(this->device, &viewInfo, nullptr, &placed.imageView);
+
+			if (result) {
+				std::cout << "Detected Vulkan error while creating render graph transient image view: " << result << std::endl;
+				abort();
+			}
+
+			placed.levelViews.resize(placed.info.mipLevels);
+
+			for (uint32_t level = 0; level < placed.info.mipLevels; level++) {
+				viewInfo.subresourceRange.baseMipLevel = level;
+				viewInfo.subresourceRange.levelCount = 1;
+
+				result = vkCreateImageView(this->device, &viewInfo, nullptr, &placed.levelViews[level]);
+
+				if (result) {
+					std::cout << "Detected Vulkan error while creating render graph transient image level view: " << result << std::endl;
+					abort();
+				}
+			}
+		}
+	}
+
+	this->stats.transientBytes = 0;
+	this->stats.transientBytesUnaliased = 0;
+
+	for (auto& heap : cache->heaps) {
+		this->stats.transientBytes += heap.size;
+	}
+
+	for (size_t i = 0; i < this->transientImages.size(); i++) {
+		Resource* resource = &this->resources[this->transientImages[i].resource];
+		resource->image = cache->images[i].image;
+		resource->imageView = cache->images[i].imageView;
+
+		if (cache->images[i].image != VK_NULL_HANDLE) {
+			this->stats.transientBytesUnaliased += cache->images[i].size;
+		}
+	}
+}
+
+void RenderGraph::buildBarriers() {
+	const TransientCache* cache = &this->transientCaches[this->frameIndex];
+	std::vector<ResourceState> states(this->resources.size());
+
+	for (size_t i = 0; i < this->resources.size(); i++) {
+		states[i] = {};
+		states[i].layout = this->resources[i].initialLayout;
+	}
+
+	this->passBarriers.resize(this->passes.size());
+	this->stats.barriers = 0;
+
+	for (uint32_t passIndex = 0; passIndex < this->passes.size(); passIndex++) {
+		PassBarriers* barriers = &this->passBarriers[passIndex];
+		*barriers = {};
+		barriers->memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barriers->memoryBarrier.pNext = nullptr;
+
+		if (this->passes[passIndex].culled) {
+			continue;
+		}
+
+		for (auto& usage : this->passes[passIndex].usages) {
+			const Resource* resource = &this->resources[usage.resource];
+			ResourceState* state = &states[usage.resource];
+			const RenderGraphAccess* access = &usage.access;
+
+			VkPipelineStageFlags srcStages = 0;
+			VkAccessFlags srcAccess = 0;
+
+			// Memory shared with transient images used earlier in the frame has to be finished with first
+			if (resource->transient != RENDER_GRAPH_NOT_TRANSIENT && this->transientImages[resource->transient].firstPass == passIndex) {
+				const PlacedImage* placed = &cache->images[resource->transient];
+
+				for (size_t other = 0; other < cache->images.size(); other++) {
+					const PlacedImage* alias = &cache->images[other];
+
+					if (other == resource->transient || alias->image == VK_NULL_HANDLE || alias->heap != placed->heap || alias->lastPass >= passIndex) {
+						continue;
+					}
+
+					if (placed->offset < alias->offset + alias->size && alias->offset < placed->offset + placed->size) {
+						const ResourceState* aliasState = &states[this->transientImages[other].resource];
+						srcStages |= aliasState->writeStages | aliasState->readStages;
+						srcAccess |= aliasState->writeAccess;
+					}
+				}
+			}
+
+			bool isImage = resource->image != VK_NULL_HANDLE;
+			bool transition = isImage && access->layout != VK_IMAGE_LAYOUT_UNDEFINED && state->layout != access->layout;
+
+			if (usage.write || transition) {
+				// Writes and layout changes wait for every earlier access
+				srcStages |= state->writeStages | state->readStages;
+				srcAccess |= state->writeAccess;
+			} else if ((access->stages & ~state->visibleStages) != 0 || (access->access & ~state->visibleAccess) != 0) {
+				srcStages |= state->writeStages;
+				srcAccess |= state->writeAccess;
+			}
+
+			if (transition) {
+				VkImageMemoryBarrier imageBarrier{};
+				imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				imageBarrier.pNext = nullptr;
+				imageBarrier.srcAccessMask = srcAccess;
+				imageBarrier.dstAccessMask = access->access;
+				imageBarrier.oldLayout = access->discard ? VK_IMAGE_LAYOUT_UNDEFINED : state->layout;
+				imageBarrier.newLayout = access->layout;
+				imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.image = resource->image;
+				imageBarrier.subresourceRange.aspectMask = resource->aspectMask;
+				imageBarrier.subresourceRange.baseMipLevel = 0;
+				imageBarrier.subresourceRange.levelCount = resource->mipLevels;
+				imageBarrier.subresourceRange.baseArrayLayer = 0;
+				imageBarrier.subresourceRange.layerCount = 1;
+
+				barriers->imageBarriers.push_back(imageBarrier);
+			} else if (srcAccess != 0 && resource->buffer != VK_NULL_HANDLE) {
+				VkBufferMemoryBarrier bufferBarrier{};
+				bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+				bufferBarrier.pNext = nullptr;
+				bufferBarrier.srcAccessMask = srcAccess;
+				bufferBarrier.dstAccessMask = access->access;
+				bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				bufferBarrier.buffer = resource->buffer;
+				bufferBarrier.offset = 0;
+				bufferBarrier.size = VK_WHOLE_SIZE;
+
+				barriers->bufferBarriers.push_back(bufferBarrier);
+			} else if (srcAccess != 0) {
+				barriers->memoryBarrier.srcAccessMask |= srcAccess;
+				barriers->memoryBarrier.dstAccessMask |= access->access;
+			}
+
+			// Write after read only needs the readers to have finished, which the stages alone cover
+			if (srcStages != 0 || transition) {
+				barriers->srcStages |= srcStages;
+				barriers->dstStages |= access->stages;
+			}
+
+			if (isImage) {
+				if (access->finalLayout != VK_IMAGE_LAYOUT_UNDEFINED) {
+					state->layout = access->finalLayout;
+				} else if (access->layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+					state->layout = access->layout;
+				}
+			}
+
+			if (usage.write) {
+				state->writeStages = access->stages;
+				state->writeAccess = access->access & RENDER_GRAPH_WRITE_ACCESS;
+				state->readStages = 0;
+				state->visibleStages = 0;
+				state->visibleAccess = 0;
+			} else {
+				state->readStages |= access->stages;
+
+				if (srcStages != 0 || transition) {
+					state->visibleStages |= access->stages;
+					state->visibleAccess |= access->access;
+				}
+			}
+		}
+
+		if (barriers->dstStages != 0) {
+			// Transitions of images nothing touched yet this frame have nothing to wait for
+			if (barriers->srcStages == 0) {
+				barriers->srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+			}
+
+			this->stats.barriers += static_cast<uint32_t>(barriers->imageBarriers.size() + barriers->bufferBarriers.size()) + (barriers->memoryBarrier.srcAccessMask != 0 ? 1 : 0);
+		}
+	}
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd) {
+	for (size_t passIndex = 0; passIndex < this->passes.size(); passIndex++) {
+		Pass* pass = &this->passes[passIndex];
+
+		if (pass->culled) {
+			continue;
+		}
+
+		PassBarriers* barriers = &this->passBarriers[passIndex];
+
+		if (barriers->dstStages != 0) {
+			uint32_t memoryBarrierCount = barriers->memoryBarrier.srcAccessMask != 0 ? 1 : 0;
+			vkCmdPipelineBarrier(cmd, barriers->srcStages, barriers->dstStages, 0, memoryBarrierCount, &barriers->memoryBarrier, static_cast<uint32_t>(barriers->bufferBarriers.size()), barriers->bufferBarriers.data(), static_cast<uint32_t>(barriers->imageBarriers.size()), barriers->imageBarriers.data());
+		}
+
+		pass->execute(cmd);
+	}
+}
+
+VkImage RenderGraph::getImage(RenderGraphResource resource) const {
+	return this->resources[resource].image;
+}
+
+VkImageView RenderGraph::getImageView(RenderGraphResource resource) const {
+	return this->resources[resource].imageView;
+}
+
+VkImageView RenderGraph::getImageLevelView(RenderGraphResource resource, uint32_t level) const {
+	return this->transientCaches[this->frameIndex].images[this->resources[resource].transient].levelViews[level];
+}
+
+bool RenderGraph::recreatedTransientImages() const {
+	return this->transientImagesRecreated;
+}
+
+const RenderGraphStats* RenderGraph::getStats() {
+	return &this->stats;
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <vk_mem_alloc.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+typedef uint32_t RenderGraphResource;
+
+// How a pass uses a resource
+struct RenderGraphAccess {
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	// Images only. Layout the pass needs the image in, UNDEFINED if the pass transitions it itself (render passes)
+	VkImageLayout layout;
+	// Images only. Layout the pass leaves the image in if it is not layout, as render passes do with their final layout
+	VkImageLayout finalLayout;
+	// Previous contents are not needed, so the transition starts from UNDEFINED
+	bool discard;
+};
+
+struct RenderGraphImageInfo {
+	VkFormat format;
+	VkExtent3D extent;
+	uint32_t mipLevels;
+	VkImageUsageFlags usage;
+	VkImageAspectFlags aspectMask;
+};
+
+struct RenderGraphStats {
+	uint32_t passesExecuted;
+	uint32_t passesCulled;
+	uint32_t barriers;
+	// Memory backing the transient images of the last compile and what it would take without aliasing
+	VkDeviceSize transientBytes;
+	VkDeviceSize transientBytesUnaliased;
+};
+
+// Frame graph rebuilt every frame. Passes declare the images and buffers they read and write, then compile culls
+// passes nothing depends on, places transient images with disjoint lifetimes in the same memory and works out the
+// barriers and layout transitions between passes. execute records every pass into one command buffer.
+// Transient images are kept per frame in flight and only recreated when the graph asks for different ones
+class RenderGraph {
+	struct Resource {
+		VkImage image;
+		VkImageView imageView;
+		VkBuffer buffer;
+		VkImageAspectFlags aspectMask;
+		uint32_t mipLevels;
+		VkImageLayout initialLayout;
+		// Kept alive past the graph, passes writing it are never culled
+		bool exported;
+		// Index into transientImages, UINT32_MAX for imported resources
+		uint32_t transient;
+	};
+
+	struct Usage {
+		RenderGraphResource resource;
+		RenderGraphAccess access;
+		bool write;
+	};
+
+	struct Pass {
+		const char* name;
+		std::function<void(VkCommandBuffer)> execute;
+		std::vector<Usage> usages;
+		bool sideEffects;
+		bool culled;
+	};
+
+	struct TransientImage {
+		RenderGraphImageInfo info;
+		RenderGraphResource resource;
+		uint32_t firstPass;
+		uint32_t lastPass;
+	};
+
+	// Transient images backed by one allocation, for one frame in flight
+	struct TransientHeap {
+		uint32_t memoryTypeBits;
+		VkDeviceSize size;
+		VkDeviceSize alignment;
+		VmaAllocation allocation;
+	};
+
+	struct PlacedImage {
+		RenderGraphImageInfo info;
+		uint32_t firstPass;
+		uint32_t lastPass;
+		VkImage image;
+		VkImageView imageView;
+		// One per mip level, for passes writing the levels one at a time
+		std::vector<VkImageView> levelViews;
+		uint32_t heap;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+	};
+
+	struct TransientCache {
+		std::vector<TransientHeap> heaps;
+		std::vector<PlacedImage> images;
+	};
+
+	struct ResourceState {
+		VkImageLayout layout;
+		VkPipelineStageFlags writeStages;
+		VkAccessFlags writeAccess;
+		// Stages reading since the last write, which the next write has to wait for
+		VkPipelineStageFlags readStages;
+		// Stages and accesses the last write has already been made visible to
+		VkPipelineStageFlags visibleStages;
+		VkAccessFlags visibleAccess;
+	};
+
+	struct PassBarriers {
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		VkMemoryBarrier memoryBarrier;
+		std::vector<VkImageMemoryBarrier> imageBarriers;
+		std::vector<VkBufferMemoryBarrier> bufferBarriers;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VmaAllocator allocator = VK_NULL_HANDLE;
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<TransientImage> transientImages;
+	std::vector<PassBarriers> passBarriers;
+	std::vector<TransientCache> transientCaches;
+	size_t frameIndex = 0;
+	bool transientImagesRecreated = false;
+
+	RenderGraphStats stats{};
+
+	void cullPasses();
+	void realiseTransientImages();
+	void destroyTransientCache(TransientCache* cache);
+	void buildBarriers();
+
+public:
+	void initialise(VkDevice device, VmaAllocator allocator, size_t frameOverlap);
+	void cleanup();
+
+	// Starts a new graph. The transient images of the frame index must no longer be in use by the GPU
+	void reset(size_t frameIndex);
+
+	RenderGraphResource importImage(VkImage image, VkImageAspectFlags aspectMask, uint32_t mipLevels, VkImageLayout currentLayout);
+	RenderGraphResource importBuffer(VkBuffer buffer);
+	// Memory is only guaranteed between the first and last pass using it, contents never survive the frame
+	RenderGraphResource createImage(const RenderGraphImageInfo& info);
+	// The resource is used after the graph, so passes writing it are kept
+	void exportResource(RenderGraphResource resource);
+
+	// Passes run in the order they are added
+	uint32_t addPass(const char* name, std::function<void(VkCommandBuffer)>&& execute);
+	void read(uint32_t pass, RenderGraphResource resource, RenderGraphAccess access);
+	void write(uint32_t pass, RenderGraphResource resource, RenderGraphAccess access);
+	// Keeps a pass whose results leave the graph some other way, such as a copy the CPU reads back
+	void setSideEffects(uint32_t pass);
+
+	void compile();
+	void execute(VkCommandBuffer cmd);
+
+	// Valid once compiled
+	VkImage getImage(RenderGraphResource resource) const;
+	VkImageView getImageView(RenderGraphResource resource) const;
+	// Transient images only, a view of a single mip level
+	VkImageView getImageLevelView(RenderGraphResource resource, uint32_t level) const;
+	// Whether the last compile replaced the transient images of its frame index, so descriptors using them are stale
+	bool recreatedTransientImages() const;
+	const RenderGraphStats* getStats();
+};
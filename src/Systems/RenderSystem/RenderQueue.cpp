@@ -0,0 +1,89 @@
+#include "RenderQueue.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+constexpr uint32_t RADIX_BITS = 8;
+constexpr uint32_t RADIX_BUCKETS = 1 << RADIX_BITS;
+constexpr uint32_t RADIX_PASSES = 64 / RADIX_BITS;
+
+uint64_t RenderQueue::makeKey(uint32_t pipelineId, uint32_t materialId, uint32_t geometryId, float depth) {
+	// Positive floats order the same as their bit patterns, dropping the low bits keeps the order at lower precision
+	float clampedDepth = std::max(depth, 0.0f);
+	uint32_t depthBits;
+	std::memcpy(&depthBits, &clampedDepth, sizeof(float));
+	depthBits >>= 31 - SORT_KEY_DEPTH_BITS;
+
+	uint64_t key = static_cast<uint64_t>(pipelineId & ((1u << SORT_KEY_PIPELINE_BITS) - 1));
+	key = (key << SORT_KEY_MATERIAL_BITS) | (materialId & ((1u << SORT_KEY_MATERIAL_BITS) - 1));
+	key = (key << SORT_KEY_GEOMETRY_BITS) | (geometryId & ((1u << SORT_KEY_GEOMETRY_BITS) - 1));
+	key = (key << SORT_KEY_DEPTH_BITS) | depthBits;
+
+	return key;
+}
+
+void RenderQueue::clear() {
+	this->entries.clear();
+}
+
+void RenderQueue::push(uint64_t key, uint32_t drawIndex) {
+	this->entries.push_back({ key, drawIndex });
+}
+
+void RenderQueue::sort() {
+	size_t count = this->entries.size();
+
+	if (count < 2) {
+		return;
+	}
+
+	this->scratch.resize(count);
+
+	// Every digit is counted in one read of the keys
+	std::array<std::array<uint32_t, RADIX_BUCKETS>, RADIX_PASSES> histograms{};
+
+	for (auto& entry : this->entries) {
+		for (uint32_t pass = 0; pass < RADIX_PASSES; pass++) {
+			histograms[pass][(entry.key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+		}
+	}
+
+	RenderQueueEntry* source = this->entries.data();
+	RenderQueueEntry* destination = this->scratch.data();
+
+	for (uint32_t pass = 0; pass < RADIX_PASSES; pass++) {
+		uint32_t shift = pass * RADIX_BITS;
+		auto& histogram = histograms[pass];
+
+		// Every key has the same digit, the pass would only copy
+		if (histogram[(source[0].key >> shift) & (RADIX_BUCKETS - 1)] == count) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+
+		for (auto& bucket : histogram) {
+			uint32_t bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			destination[histogram[(source[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = source[i];
+		}
+
+		std::swap(source, destination);
+	}
+
+	if (source != this->entries.data()) {
+		this->entries.swap(this->scratch);
+	}
+}
+
+const std::vector<RenderQueueEntry>& RenderQueue::getEntries() const {
+	return this->entries;
+}
+
+size_t RenderQueue::size() const {
+	return this->entries.size();
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Widths of the sort key fields, highest first. Draws order by pipeline, then material, then geometry, then front to back
+constexpr uint32_t SORT_KEY_PIPELINE_BITS = 8;
+constexpr uint32_t SORT_KEY_MATERIAL_BITS = 16;
+constexpr uint32_t SORT_KEY_GEOMETRY_BITS = 16;
+constexpr uint32_t SORT_KEY_DEPTH_BITS = 24;
+
+struct RenderQueueEntry {
+	uint64_t key;
+	uint32_t drawIndex;
+};
+
+// Visible draws ordered by a packed 64 bit key, so consecutive draws share as much bound state as possible
+class RenderQueue {
+	std::vector<RenderQueueEntry> entries;
+	// Other half of the radix sort ping pong
+	std::vector<RenderQueueEntry> scratch;
+
+public:
+	// Ids wider than their field wrap, which only loosens the grouping. Depth is the view space distance
+	static uint64_t makeKey(uint32_t pipelineId, uint32_t materialId, uint32_t geometryId, float depth);
+
+	void clear();
+	void push(uint64_t key, uint32_t drawIndex);
+	// Stable LSD radix sort on 8 bit digits. Digits every key shares are skipped
+	void sort();
+
+	const std::vector<RenderQueueEntry>& getEntries() const;
+	size_t size() const;
+};
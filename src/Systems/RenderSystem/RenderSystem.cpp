@@ -1,20 +1,16 @@
 #include "RenderSystem.hpp"
-void RenderSystem::initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window) {
-	return this->vulkanRenderer.initialise(vulkanDetails, graphicsQueue, transferQueue, imageTransferQueue, window);
+void RenderSystem::initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window, JobSystem* jobSystem) {
+	return this->vulkanRenderer.initialise(vulkanDetails, graphicsQueue, transferQueue, imageTransferQueue, window, jobSystem);
 }
 
-void RenderSystem::render(std::vector<ModelRenderComponents>* models, std::vector<ModelResource>* modelResourceIds, Camera* camera) {
-	vulkanRenderer.draw(models, modelResourceIds, &this->renderableIds, camera);
+void RenderSystem::render(std::vector<ModelRenderComponents>* models, const GeometryPool* geometryPool, std::vector<RenderObject>* renderObjects, Camera* camera) {
+	vulkanRenderer.draw(models, geometryPool, renderObjects, camera);
 }
 
 void RenderSystem::cleanup() {
 	vulkanRenderer.cleanup();
 }
 
-void RenderSystem::addEntity(size_t id) {
-	this->renderableIds.push_back(id);
-}
-
 void RenderSystem::uploadModel(ModelComponent model) {
 
 }
@@ -26,3 +22,35 @@ size_t RenderSystem::uploadModelMaterials(std::vector<MaterialInfo>* materials)
 VmaAllocator RenderSystem::getVmaAllocator() {
 	return this->vulkanRenderer.getVmaAllocator();
 }
+
+const StagingRingBufferStats* RenderSystem::getStagingStats() {
+	return this->vulkanRenderer.getStagingStats();
+}
+
+const FrameArenaStats* RenderSystem::getFrameArenaStats() {
+	return this->vulkanRenderer.getFrameArenaStats();
+}
+
+const RenderStats* RenderSystem::getRenderStats() {
+	return this->vulkanRenderer.getRenderStats();
+}
+
+const RenderGraphStats* RenderSystem::getRenderGraphStats() {
+	return this->vulkanRenderer.getRenderGraphStats();
+}
+
+void RenderSystem::setGPUDrivenRendering(bool enabled) {
+	this->vulkanRenderer.setGPUDrivenRendering(enabled);
+}
+
+void RenderSystem::setCompactGBuffer(bool enabled) {
+	this->vulkanRenderer.setCompactGBuffer(enabled);
+}
+
+void RenderSystem::setGPULightClustering(bool enabled) {
+	this->vulkanRenderer.setGPULightClustering(enabled);
+}
+
+void RenderSystem::setDrawIndirectCount(bool enabled) {
+	this->vulkanRenderer.setDrawIndirectCount(enabled);
+}
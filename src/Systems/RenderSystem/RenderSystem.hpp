@@ -8,14 +8,19 @@
 class RenderSystem {
 	VulkanRenderer vulkanRenderer;
 
-	std::vector<size_t> renderableIds;
-
 public:
-	void initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window);
-	void render(std::vector<ModelRenderComponents>* models, std::vector<ModelResource>* modelResourceIds, Camera* camera);
+	void initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window, JobSystem* jobSystem);
+	void render(std::vector<ModelRenderComponents>* models, const GeometryPool* geometryPool, std::vector<RenderObject>* renderObjects, Camera* camera);
 	void cleanup();
-	void addEntity(size_t id);
 	void uploadModel(ModelComponent model);
 	size_t uploadModelMaterials(std::vector<MaterialInfo>* materials);
 	VmaAllocator getVmaAllocator();
+	const StagingRingBufferStats* getStagingStats();
+	const FrameArenaStats* getFrameArenaStats();
+	const RenderStats* getRenderStats();
+	const RenderGraphStats* getRenderGraphStats();
+	void setGPUDrivenRendering(bool enabled);
+	void setCompactGBuffer(bool enabled);
+	void setGPULightClustering(bool enabled);
+	void setDrawIndirectCount(bool enabled);
 };
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "StagingRingBuffer.hpp"
+#include <iostream>
+
+void StagingRingBuffer::initialise(VmaAllocator allocator, StagingRingBufferCreateInfo createInfo) {
+	this->capacity = createInfo.size;
+	this->perFrameBudget = createInfo.perFrameBudget;
+	this->frameUsage.resize(createInfo.frameOverlap);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+
+	bufferInfo.size = this->capacity;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	// Keep the buffer mapped for its whole lifetime
+	VmaAllocationCreateInfo vmaAllocInfo{};
+	vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	VmaAllocationInfo allocationInfo{};
+	VkResult result = vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo, &this->buffer.buffer, &this->buffer.allocation, &allocationInfo);
+
+	if (result) {
+		std::cout << "Couldn't create staging ring buffer: " << result << std::endl;
+		abort();
+	}
+
+	this->buffer.size = this->capacity;
+	this->mappedData = static_cast<uint8_t*>(allocationInfo.pMappedData);
+}
+
+void StagingRingBuffer::cleanup(VmaAllocator allocator) {
+	vmaDestroyBuffer(allocator, this->buffer.buffer, this->buffer.allocation);
+	this->mappedData = nullptr;
+	this->pendingUploads.clear();
+}
+
+void StagingRingBuffer::beginFrame(size_t frameIndex) {
+	// The GPU has finished the last frame that used this index, so everything it staged is free again
+	this->usedBytes -= this->frameUsage[frameIndex];
+	this->frameUsage[frameIndex] = 0;
+
+	this->currentFrame = frameIndex;
+	this->bytesStagedThisFrame = 0;
+}
+
+bool StagingRingBuffer::allocate(size_t size, size_t alignment, StagingAllocation* allocation) {
+	if (this->bytesStagedThisFrame > 0 && this->bytesStagedThisFrame + size > this->perFrameBudget) {
+		this->stats.budgetDeferrals += 1;
+		return false;
+	}
+
+	size_t offset = (this->head + alignment - 1) & ~(alignment - 1);
+	size_t padding = offset - this->head;
+	bool wrapped = false;
+
+	if (offset + size > this->capacity) {
+		// Skip the remainder of the buffer and continue from the start
+		padding = this->capacity - this->head;
+		offset = 0;
+		wrapped = true;
+	}
+
+	// Free space is contiguous (modulo the wrap) starting at the head
+	if (this->usedBytes + padding + size > this->capacity) {
+		this->stats.stalls += 1;
+		return false;
+	}
+
+	if (wrapped) {
+		this->stats.wraparounds += 1;
+	}
+
+	this->head = (offset + size) % this->capacity;
+	this->usedBytes += padding + size;
+	this->frameUsage[this->currentFrame] += padding + size;
+	this->bytesStagedThisFrame += size;
+	this->stats.bytesStaged += size;
+
+	allocation->buffer = this->buffer.buffer;
+	allocation->offset = offset;
+	allocation->data = this->mappedData + offset;
+	allocation->size = size;
+
+	return true;
+}
+
+void StagingRingBuffer::queueUpload(StagingUpload&& upload) {
+	upload.placeholderRecorded = false;
+	this->pendingUploads.push_back(std::move(upload));
+	this->stats.pendingUploads = static_cast<uint32_t>(this->pendingUploads.size());
+}
+
+void StagingRingBuffer::recordQueuedUploads(VkCommandBuffer cmd) {
+	// Staged in the order they were queued, so a large upload is not starved by smaller ones behind it
+	while (!this->pendingUploads.empty()) {
+		StagingUpload* upload = &this->pendingUploads.front();
+		StagingAllocation allocation{};
+
+		if (!this->allocate(upload->size, upload->alignment, &allocation)) {
+			break;
+		}
+
+		upload->write(allocation.data);
+		upload->record(cmd, allocation.buffer, allocation.offset);
+		this->pendingUploads.pop_front();
+	}
+
+	for (auto& upload : this->pendingUploads) {
+		if (!upload.placeholderRecorded && upload.recordPlaceholder) {
+			upload.recordPlaceholder(cmd);
+		}
+
+		upload.placeholderRecorded = true;
+	}
+
+	this->stats.pendingUploads = static_cast<uint32_t>(this->pendingUploads.size());
+}
+
+void StagingRingBuffer::addDedicatedUpload() {
+	this->stats.dedicatedUploads += 1;
+}
+
+size_t StagingRingBuffer::getCapacity() const {
+	return this->capacity;
+}
+
+const StagingRingBufferStats* StagingRingBuffer::getStats() {
+	return &this->stats;
+}
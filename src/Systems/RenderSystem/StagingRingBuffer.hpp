@@ -0,0 +1,88 @@
+#pragma once
+#include <vk_mem_alloc.h>
+#include <deque>
+#include <functional>
+#include <vector>
+#include "VulkanTypes.hpp"
+
+struct StagingRingBufferCreateInfo {
+	size_t size;
+	// Maximum number of bytes that can be staged during a single frame
+	size_t perFrameBudget;
+	size_t frameOverlap;
+};
+
+struct StagingAllocation {
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	void* data;
+	size_t size;
+};
+
+// Upload waiting for space in the ring
+struct StagingUpload {
+	size_t size;
+	size_t alignment;
+	// Fills the staging memory
+	std::function<void(void* data)> write;
+	// Records the copies out of the staging memory into the destination
+	std::function<void(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset)> record;
+	// Optional. Recorded once if the upload has to wait for a later frame, so the destination can be used meanwhile
+	std::function<void(VkCommandBuffer cmd)> recordPlaceholder;
+	bool placeholderRecorded;
+};
+
+struct StagingRingBufferStats {
+	uint64_t bytesStaged;
+	// Allocations refused because the ring was full of data still in use by frames in flight
+	uint64_t stalls;
+	// Allocations refused because the frame budget was used up
+	uint64_t budgetDeferrals;
+	uint64_t wraparounds;
+	// Uploads larger than the whole ring, which need a staging buffer of their own
+	uint64_t dedicatedUploads;
+	// Queued uploads still waiting for space after the last frame
+	uint32_t pendingUploads;
+};
+
+// Persistently mapped staging memory shared by all uploads. Space used during a frame is
+// reclaimed when that frame index comes around again, after its render fence has been waited on.
+// Uploads that do not fit in the ring or the frame budget are queued and staged on later frames in order
+class StagingRingBuffer {
+	AllocatedBuffer buffer{};
+	uint8_t* mappedData = nullptr;
+	size_t capacity = 0;
+	size_t perFrameBudget = 0;
+
+	size_t head = 0;
+	size_t usedBytes = 0;
+	// Bytes consumed (including alignment and wraparound padding) by each frame in flight
+	std::vector<size_t> frameUsage;
+	size_t currentFrame = 0;
+	size_t bytesStagedThisFrame = 0;
+
+	std::deque<StagingUpload> pendingUploads;
+
+	StagingRingBufferStats stats{};
+
+public:
+	void initialise(VmaAllocator allocator, StagingRingBufferCreateInfo createInfo);
+	void cleanup(VmaAllocator allocator);
+
+	// Must be called after the fence of the frame has been waited on
+	void beginFrame(size_t frameIndex);
+	// Returns false if the request does not fit in the ring or the frame budget. A request larger than the budget is
+	// allowed once nothing else has been staged that frame
+	bool allocate(size_t size, size_t alignment, StagingAllocation* allocation);
+
+	// The upload must fit in the ring, larger ones need a dedicated staging buffer
+	void queueUpload(StagingUpload&& upload);
+	// Stages as many queued uploads as the ring and the frame budget allow and records their copies. Must be called
+	// once per frame, after beginFrame
+	void recordQueuedUploads(VkCommandBuffer cmd);
+	// Counts an upload that bypassed the ring because it is larger than it
+	void addDedicatedUpload();
+	size_t getCapacity() const;
+
+	const StagingRingBufferStats* getStats();
+};
@@ -8,6 +8,9 @@
 #include <sstream>
 #include <fstream>
 #include <array>
+#include <algorithm>
+#include <cmath>
+#include <memory>
 #include <VulkanTypes.hpp>
 #include "../../Components/ModelComponent.h"
 #include <glm/gtx/transform.hpp>
@@ -18,23 +21,67 @@
 
 constexpr int WIDTH = 1920;
 constexpr int HEIGHT = 1080;
-constexpr size_t POSITION_ATTACHMENT_INDEX = 0;
-constexpr size_t NORMAL_ATTACHMENT_INDEX = 1;
-constexpr size_t ALBEDO_ATTACHMENT_INDEX = 2;
-constexpr size_t DEPTH_ATTACHMENT_INDEX = 3;
+// Deferred framebuffer attachments. Only the full G-buffer layout stores world positions, so they come last
+constexpr size_t NORMAL_ATTACHMENT_INDEX = 0;
+constexpr size_t ALBEDO_ATTACHMENT_INDEX = 1;
+constexpr size_t DEPTH_ATTACHMENT_INDEX = 2;
+constexpr size_t SWAPCHAIN_ATTACHMENT_INDEX = 3;
+constexpr size_t POSITION_ATTACHMENT_INDEX = 4;
+// G-buffer formats. The compact layout rebuilds world positions from depth and stores octahedral normals
+constexpr GBufferFormats FULL_GBUFFER_FORMATS = { VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_R16G16B16A16_SFLOAT };
+constexpr GBufferFormats COMPACT_GBUFFER_FORMATS = { VK_FORMAT_R16G16_SNORM, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_D32_SFLOAT, VK_FORMAT_UNDEFINED };
+// Subpasses of the deferred render pass
+constexpr uint32_t GBUFFER_SUBPASS = 0;
+constexpr uint32_t LIGHTING_SUBPASS = 1;
+// Staging ring buffer configuration
+constexpr size_t STAGING_RING_BUFFER_SIZE = 64 * 1024 * 1024;
+constexpr size_t STAGING_FRAME_BUDGET = 8 * 1024 * 1024;
+constexpr size_t STAGING_ALIGNMENT = 16;
+// Uniform and storage data each frame in flight can allocate from the frame arena
+constexpr size_t FRAME_ARENA_SIZE = 1024 * 1024;
+// Spheres culled per job
+constexpr size_t CULL_BATCH_SIZE = 4096;
+// Capacity of the GPU driven path per frame, anything larger is drawn by the CPU path
+constexpr uint32_t MAX_GPU_DRIVEN_DRAWS = 64 * 1024;
+constexpr uint32_t MAX_GPU_DRIVEN_BATCHES = 1024;
+// Instance transforms each frame starts with room for, grown on demand
+constexpr uint32_t INITIAL_INSTANCE_CAPACITY = 1024;
+// Fewer instanced draws than this per slot are not worth another secondary command buffer
+constexpr size_t MIN_RUNS_PER_RECORDING_SLOT = 64;
+// Meshes per model that get their own geometry id in the sort key
+constexpr uint32_t SORT_KEY_MESH_BITS = 6;
+// Objects whose visibility is remembered between frames
+constexpr uint32_t MAX_VISIBILITY_IDS = 64 * 1024;
+// Must match local_size_x in cull.comp
+constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+// Totals at the start of the count buffer, must match cull.comp
+constexpr uint32_t CULL_COUNT_TOTALS = 4;
+constexpr uint32_t CULL_PHASE_COUNT = 2;
+// Must match local_size_x and local_size_y in depth_reduce.comp
+constexpr uint32_t DEPTH_REDUCE_WORKGROUP_SIZE = 8;
+// Must match local_size_x in light_cluster.comp
+constexpr uint32_t LIGHT_CLUSTER_WORKGROUP_SIZE = 64;
+// Timestamps written each frame around the G-buffer passes and the lighting subpass
+constexpr uint32_t TIMESTAMP_FIRST_PHASE_BEGIN = 0;
+constexpr uint32_t TIMESTAMP_FIRST_PHASE_END = 1;
+constexpr uint32_t TIMESTAMP_SHADING_BEGIN = 2;
+constexpr uint32_t TIMESTAMP_LIGHTING_BEGIN = 3;
+constexpr uint32_t TIMESTAMP_SHADING_END = 4;
+constexpr uint32_t TIMESTAMP_COUNT = 5;
 
 void VulkanRenderer::initialiseFramedataStructures() {
 	this->framedata.commandPools.resize(FRAME_OVERLAP);
-	this->framedata.deferredMainCommandBuffers.resize(FRAME_OVERLAP);
-	this->framedata.lightingMainCommandBuffers.resize(FRAME_OVERLAP);
+	this->framedata.mainCommandBuffers.resize(FRAME_OVERLAP);
+	this->framedata.recordingCommandPools.resize(FRAME_OVERLAP);
+	this->framedata.recordingCommandBuffers.resize(FRAME_OVERLAP);
 	this->framedata.presentSemaphores.resize(FRAME_OVERLAP);
 	this->framedata.renderSemaphores.resize(FRAME_OVERLAP);
-	this->framedata.deferredSemaphores.resize(FRAME_OVERLAP);
 	this->framedata.renderFences.resize(FRAME_OVERLAP);
 	this->framedata.depthImages.resize(FRAME_OVERLAP);
 	this->framedata.depthImageViews.resize(FRAME_OVERLAP);
-	this->framedata.cameraBuffers.resize(FRAME_OVERLAP);
 	this->framedata.globalDescriptors.resize(FRAME_OVERLAP);
+	this->framedata.timestampQueryPools.resize(FRAME_OVERLAP, VK_NULL_HANDLE);
+	this->framedata.timestampsWritten.resize(FRAME_OVERLAP, false);
 }
 
 void VulkanRenderer::initialiseSwapchain() {
@@ -99,22 +146,48 @@ void VulkanRenderer::initialiseCommands() {
 		// Commands will come from the main graphics queue
 		VkCommandBufferAllocateInfo cmdAllocInfo = VulkanUtility::commandBufferAllocateInfo(this->framedata.commandPools[i], 1);
 
-		result = vkAllocateCommandBuffers(this->device, &cmdAllocInfo, &this->framedata.deferredMainCommandBuffers[i]);
+		result = vkAllocateCommandBuffers(this->device, &cmdAllocInfo, &this->framedata.mainCommandBuffers[i]);
 
 		if (result) {
 			std::cout << "Detected Vulkan error while creating main graphics command buffer: " << result << std::endl;
 			abort();
 		}
 
-		result = vkAllocateCommandBuffers(this->device, &cmdAllocInfo, &this->framedata.lightingMainCommandBuffers[i]);
+		this->mainDeletionQueue.pushFunction([=]() {
+			vkDestroyCommandPool(this->device, this->framedata.commandPools[i], nullptr);
+		});
+	}
 
-		if (result) {
-			std::cout << "Detected Vulkan error while creating main graphics command buffer: " << result << std::endl;
-			abort();
+	// The thread recording the main command buffer takes a slot as well
+	this->recordingSlotCount = this->jobSystem->getWorkerCount() + 1;
+
+	for (auto i = 0; i < FRAME_OVERLAP; i++) {
+		this->framedata.recordingCommandPools[i].resize(this->recordingSlotCount);
+		this->framedata.recordingCommandBuffers[i].resize(this->recordingSlotCount);
+
+		for (size_t slot = 0; slot < this->recordingSlotCount; slot++) {
+			VkResult result = vkCreateCommandPool(this->device, &commandPoolInfo, nullptr, &this->framedata.recordingCommandPools[i][slot]);
+
+			if (result) {
+				std::cout << "Detected Vulkan error while creating recording command pool: " << result << std::endl;
+				abort();
+			}
+
+			VkCommandBufferAllocateInfo cmdAllocInfo = VulkanUtility::commandBufferAllocateInfo(this->framedata.recordingCommandPools[i][slot], 1);
+			cmdAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+			result = vkAllocateCommandBuffers(this->device, &cmdAllocInfo, &this->framedata.recordingCommandBuffers[i][slot]);
+
+			if (result) {
+				std::cout << "Detected Vulkan error while creating secondary command buffer: " << result << std::endl;
+				abort();
+			}
 		}
 
 		this->mainDeletionQueue.pushFunction([=]() {
-			vkDestroyCommandPool(this->device, this->framedata.commandPools[i], nullptr);
+			for (auto commandPool : this->framedata.recordingCommandPools[i]) {
+				vkDestroyCommandPool(this->device, commandPool, nullptr);
+			}
 		});
 	}
 
@@ -299,15 +372,7 @@ void VulkanRenderer::initialiseSyncStructures() {
 			abort();
 		}
 
-		result = vkCreateSemaphore(this->device, &semaphoreCreateInfo, nullptr, &this->framedata.deferredSemaphores[i]);
-
-		if (result) {
-			std::cout << "Detected Vulkan error while creating deferred semaphore: " << result << std::endl;
-			abort();
-		}
-
 		this->mainDeletionQueue.pushFunction([=]() {
-			vkDestroySemaphore(this->device, this->framedata.deferredSemaphores[i], nullptr);
 			vkDestroySemaphore(this->device, this->framedata.presentSemaphores[i], nullptr);
 			vkDestroySemaphore(this->device, this->framedata.renderSemaphores[i], nullptr);
 		});
@@ -335,25 +400,12 @@ void VulkanRenderer::initialiseSyncStructures() {
 }
 
 void VulkanRenderer::initialisePipelines() {
-	VkSamplerCreateInfo samplerCreateInfo{};
-	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerCreateInfo.pNext = nullptr;
-	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
-	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
-	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-	samplerCreateInfo.mipLodBias = 0.0f;
-	samplerCreateInfo.maxAnisotropy = 1.0f;
-	samplerCreateInfo.minLod = 0.0f;
-	samplerCreateInfo.maxLod = 1.0f;
-	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-
-	vkCreateSampler(device, &samplerCreateInfo, nullptr, &this->framebufferAttachmentSampler);
-
+	this->initialiseGPUDrivenResources();
+	this->initialiseInstanceBuffers();
 	this->initialiseDeferredPipeline();
+	this->initialiseDepthPyramid();
 	this->initialisePhongPipeline();
+	this->initialiseLightClusterPipeline();
 
 	// Create default sampler
 	VkSamplerCreateInfo samplerInfo = VulkanUtility::samplerCreateInfo(VK_FILTER_LINEAR);
@@ -437,12 +489,84 @@ void VulkanRenderer::initialiseImgui() {
 	});
 }
 
+void VulkanRenderer::initialiseStagingRingBuffer() {
+	StagingRingBufferCreateInfo createInfo{};
+	createInfo.size = STAGING_RING_BUFFER_SIZE;
+	createInfo.perFrameBudget = STAGING_FRAME_BUDGET;
+	createInfo.frameOverlap = FRAME_OVERLAP;
+
+	this->stagingRingBuffer.initialise(this->allocator, createInfo);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		this->stagingRingBuffer.cleanup(this->allocator);
+	});
+}
+
+void VulkanRenderer::initialiseFrameArena() {
+	FrameArenaCreateInfo createInfo{};
+	createInfo.sizePerFrame = FRAME_ARENA_SIZE;
+	createInfo.frameOverlap = FRAME_OVERLAP;
+	createInfo.minUniformBufferOffsetAlignment = this->gpuProperties.limits.minUniformBufferOffsetAlignment;
+	createInfo.minStorageBufferOffsetAlignment = this->gpuProperties.limits.minStorageBufferOffsetAlignment;
+
+	this->frameArena.initialise(this->allocator, createInfo);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		this->frameArena.cleanup(this->allocator);
+	});
+}
+
+void VulkanRenderer::initialiseRenderGraph() {
+	this->renderGraph.initialise(this->device, this->allocator, FRAME_OVERLAP);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		this->renderGraph.cleanup();
+	});
+}
+
+void VulkanRenderer::initialiseTimestampQueries() {
+	if (!this->gpuProperties.limits.timestampComputeAndGraphics) {
+		std::cout << "Timestamps are not supported on the graphics queue, G-buffer timings are unavailable" << std::endl;
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.pNext = nullptr;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = TIMESTAMP_COUNT;
+
+	for (auto i = 0; i < FRAME_OVERLAP; i++) {
+		VkResult result = vkCreateQueryPool(this->device, &queryPoolInfo, nullptr, &this->framedata.timestampQueryPools[i]);
+
+		if (result) {
+			std::cout << "Detected Vulkan error while creating timestamp query pool: " << result << std::endl;
+			abort();
+		}
+
+		this->mainDeletionQueue.pushFunction([=]() {
+			vkDestroyQueryPool(this->device, this->framedata.timestampQueryPools[i], nullptr);
+		});
+	}
+}
+
+void VulkanRenderer::initialiseLightClusters() {
+	this->lightClusters.initialise(this->allocator, FRAME_OVERLAP);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		this->lightClusters.cleanup(this->allocator);
+	});
+}
+
 void VulkanRenderer::initialiseGlobalDescriptors() {
 	std::vector<VkDescriptorSetLayoutBinding> globalDescriptorSetLayoutBindings{};
-	// Camera Buffer binding
-	globalDescriptorSetLayoutBindings.push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0));
+	// Camera Buffer binding, allocated from the frame arena every frame
+	// The lighting subpass rebuilds world positions with the camera of the compact G-buffer
+	// and the light cluster shader builds its froxels from it
+	globalDescriptorSetLayoutBindings.push_back(VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 0));
 	// Add lighting system sets to global layout
 	this->lightingSystem.addLightingSystemToDescriptorSet(&globalDescriptorSetLayoutBindings);
+	this->lightClusters.addLightClustersToDescriptorSet(&globalDescriptorSetLayoutBindings);
 
 	VkDescriptorSetLayoutCreateInfo setInfo{};
 	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -456,8 +580,10 @@ void VulkanRenderer::initialiseGlobalDescriptors() {
 
 	std::vector<VkDescriptorPoolSize> sizes = {
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 100 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 100 },
 		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 100 },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 100 }
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 100 },
+		{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 100 }
 	};
 
 	VkDescriptorPoolCreateInfo poolInfo{};
@@ -481,8 +607,6 @@ void VulkanRenderer::initialiseGlobalDescriptors() {
 
 
 	for (auto i = 0; i < FRAME_OVERLAP; i++) {
-		this->framedata.cameraBuffers[i] = VulkanUtility::createBuffer(this->allocator, sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
 		VkDescriptorSetAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 		allocInfo.pNext = nullptr;
@@ -494,84 +618,517 @@ void VulkanRenderer::initialiseGlobalDescriptors() {
 		vkAllocateDescriptorSets(this->device, &allocInfo, &this->framedata.globalDescriptors[i]);
 
 		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = this->framedata.cameraBuffers[i].buffer;
+		bufferInfo.buffer = this->frameArena.getBuffer(i);
 		bufferInfo.offset = 0;
 		bufferInfo.range = sizeof(GPUCameraData);
 
-		VkWriteDescriptorSet cameraSetWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, this->framedata.globalDescriptors[i], &bufferInfo, 0);
+		VkWriteDescriptorSet cameraSetWrite = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, this->framedata.globalDescriptors[i], &bufferInfo, 0);
 
 		vkUpdateDescriptorSets(this->device, 1, &cameraSetWrite, 0, nullptr);
 
-		this->mainDeletionQueue.pushFunction([=]() {
-			vmaDestroyBuffer(this->allocator, this->framedata.cameraBuffers[i].buffer, this->framedata.cameraBuffers[i].allocation);
-		});
+		this->lightClusters.writeDescriptors(this->device, i, this->framedata.globalDescriptors[i]);
 	}
 }
 
-void VulkanRenderer::drawObjects(VkCommandBuffer cmd, std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<ModelResource>* modelResourceIds, 
-								 std::vector<size_t>* ids, Camera* camera) {
-	static float count = 0;
-
+GPUCameraData VulkanRenderer::updateCameraBuffer(Camera* camera) {
 	glm::mat4 view = camera->generateView();
-	glm::mat4 proj = glm::perspective(glm::radians(70.0f), static_cast<float>(WIDTH) / static_cast<float>(HEIGHT), 0.1f, 200.0f);
-	proj[1][1] *= -1;
+	glm::mat4 proj = camera->generateProjection(static_cast<float>(WIDTH) / static_cast<float>(HEIGHT));
 
 	GPUCameraData cameraData{};
 	cameraData.proj = proj;
 	cameraData.view = view;
 	cameraData.viewProj = proj * view;
+	cameraData.inverseViewProj = glm::inverse(cameraData.viewProj);
+	cameraData.clipPlanes = { camera->getNearPlane(), camera->getFarPlane(), 0.0f, 0.0f };
 
-	void* data;
-	vmaMapMemory(this->allocator, this->framedata.cameraBuffers[this->getCurrentFrameIndex()].allocation, &data);
-	memcpy(data, &cameraData, sizeof(GPUCameraData));
-	vmaUnmapMemory(this->allocator, this->framedata.cameraBuffers[this->getCurrentFrameIndex()].allocation);
+	// The arena is empty at this point of the frame, so the camera always fits
+	FrameArenaAllocation allocation{};
+	this->frameArena.allocate(sizeof(GPUCameraData), &allocation);
+	memcpy(allocation.data, &cameraData, sizeof(GPUCameraData));
+	this->cameraOffset = allocation.offset;
 
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipeline.pipeline);
-	
-	std::array<VkDescriptorSet, 1> sceneDescriptorSets = {
-		this->framedata.globalDescriptors[this->getCurrentFrameIndex()]
-	};
+	return cameraData;
+}
+
+void VulkanRenderer::drawObjects(VkCommandBuffer cmd, std::vector<ModelRenderComponents>* modelRenderComponents, const GeometryPool* geometryPool, std::vector<RenderObject>* renderObjects, const glm::mat4& viewProj) {
+	this->cullDraws(modelRenderComponents, renderObjects, viewProj);
+	this->sortVisibleDraws(renderObjects, viewProj);
+
+	InstanceFrame* instanceFrame = &this->instanceFrames[this->getCurrentFrameIndex()];
+	this->reserveInstances(instanceFrame, static_cast<uint32_t>(this->renderQueue.size()));
+
+	auto& entries = this->renderQueue.getEntries();
+	this->instanceRuns.clear();
+
+	// Sorted draws of the same mesh and material are next to each other, each run becomes one instanced draw. Instances
+	// keep the queue order, so a run's first instance is its first entry
+	for (size_t first = 0; first < entries.size();) {
+		DrawCandidate* draw = &this->drawCandidates[entries[first].drawIndex];
+		auto* resourceId = &renderObjects->at(draw->objectIndex).modelResource;
+		size_t materialId = this->modelMaterials.at(resourceId->materialGroupId).at(draw->meshIndex);
+		size_t last = first;
+
+		for (; last < entries.size(); last++) {
+			DrawCandidate* instance = &this->drawCandidates[entries[last].drawIndex];
+			RenderObject* renderObject = &renderObjects->at(instance->objectIndex);
+			auto* instanceResourceId = &renderObject->modelResource;
+
+			if (instance->meshIndex != draw->meshIndex || instanceResourceId->modelRenderComponentId != resourceId->modelRenderComponentId || this->modelMaterials.at(instanceResourceId->materialGroupId).at(instance->meshIndex) != materialId) {
+				break;
+			}
+
+			instanceFrame->transforms[last] = renderObject->transform * modelRenderComponents->at(instanceResourceId->modelRenderComponentId).meshTransforms[instance->meshIndex];
+		}
+
+		auto& range = modelRenderComponents->at(resourceId->modelRenderComponentId).meshRanges[draw->meshIndex];
+
+		InstanceRun run{};
+		run.materialDescriptorSet = this->materials.at(materialId).materialDescriptorSet;
+		run.firstInstance = static_cast<uint32_t>(first);
+		run.instanceCount = static_cast<uint32_t>(last - first);
+		run.indexCount = range.indexCount;
+		run.firstIndex = range.firstIndex;
+		run.vertexOffset = range.vertexOffset;
+		this->instanceRuns.push_back(run);
+
+		first = last;
+	}
+
+	// Runs are split into contiguous ranges so the sorted order, and most of the bind elimination, survives
+	size_t runCount = this->instanceRuns.size();
+	size_t slotCount = std::clamp<size_t>((runCount + MIN_RUNS_PER_RECORDING_SLOT - 1) / MIN_RUNS_PER_RECORDING_SLOT, 1, this->recordingSlotCount);
+	size_t runsPerSlot = (runCount + slotCount - 1) / slotCount;
+
+	this->recordingStats.assign(slotCount, {});
+
+	this->jobSystem->parallelFor(slotCount, 1, [&](size_t begin, size_t end) {
+		for (size_t slot = begin; slot < end; slot++) {
+			size_t firstRun = std::min(slot * runsPerSlot, runCount);
+			size_t lastRun = std::min(firstRun + runsPerSlot, runCount);
+
+			this->recordDrawSlot(geometryPool, slot, firstRun, lastRun);
+		}
+	});
+
+	vkCmdExecuteCommands(cmd, static_cast<uint32_t>(slotCount), this->framedata.recordingCommandBuffers[this->getCurrentFrameIndex()].data());
+
+	uint32_t drawCalls = 0;
+	uint32_t materialBinds = 0;
+
+	for (auto& stats : this->recordingStats) {
+		drawCalls += stats.drawCalls;
+		materialBinds += stats.materialBinds;
+	}
+
+	this->renderStats.drawCalls = drawCalls;
+	this->renderStats.materialBinds = materialBinds;
+	this->renderStats.materialBindsAvoided = drawCalls - materialBinds;
+}
+
+void VulkanRenderer::recordDrawSlot(const GeometryPool* geometryPool, size_t slot, size_t firstRun, size_t lastRun) {
+	size_t index = this->getCurrentFrameIndex();
+	VkCommandBuffer cmd = this->framedata.recordingCommandBuffers[index][slot];
+
+	// The frame's fence has been waited on, so nothing recorded from this pool is still in use
+	VkResult result = vkResetCommandPool(this->device, this->framedata.recordingCommandPools[index][slot], 0);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while resetting recording command pool: " << result << std::endl;
+		abort();
+	}
+
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.pNext = nullptr;
+	inheritanceInfo.renderPass = this->deferredPipeline.framebuffer.renderPass;
+	inheritanceInfo.subpass = GBUFFER_SUBPASS;
+	inheritanceInfo.framebuffer = this->deferredFramebuffer;
 
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 0, sceneDescriptorSets.size(), sceneDescriptorSets.data(), 0, nullptr);
+	VkCommandBufferBeginInfo cmdBeginInfo = VulkanUtility::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+	cmdBeginInfo.pInheritanceInfo = &inheritanceInfo;
 
-	glm::vec3 modelPos = glm::vec3{ 0, 0, 0};
-	glm::mat4 meshMatrix = glm::translate(glm::mat4{1.0f}, modelPos);
+	result = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
 
-	PushConstants pushConstants{};
-	pushConstants.renderMatrix = meshMatrix;
+	if (result) {
+		std::cout << "Detected Vulkan error while beginning secondary command buffer: " << result << std::endl;
+		abort();
+	}
 
-	vkCmdPushConstants(cmd, this->deferredPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pushConstants);
+	// Secondary command buffers start without any bound state
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipeline.pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 0, 1, &this->framedata.globalDescriptors[index], 1, &this->cameraOffset);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 2, 1, &this->instanceFrames[index].descriptor, 0, nullptr);
 
+	// Every mesh lives in the geometry pool, so it is bound once and meshes are drawn by offset
 	VkDeviceSize offset = 0;
-	std::array<VkDeviceSize, 3> offsets = {
-		offset,
-		offset,
-		offset
-	};
+	vkCmdBindVertexBuffers(cmd, 0, 1, &geometryPool->vertexBuffer.buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, geometryPool->indexBuffer.buffer, offset, VK_INDEX_TYPE_UINT32);
+
+	RecordingStats* stats = &this->recordingStats[slot];
+	VkDescriptorSet currentMaterial = VK_NULL_HANDLE;
 
-	for (auto id : *ids) {
-		auto& resourceId = modelResourceIds->at(id);
+	for (size_t runIndex = firstRun; runIndex < lastRun; runIndex++) {
+		InstanceRun* run = &this->instanceRuns[runIndex];
 
-		auto& model = modelRenderComponents->at(resourceId.modelComponentId);
+		if (run->materialDescriptorSet != currentMaterial) {
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 1, 1, &run->materialDescriptorSet, 0, nullptr);
+			currentMaterial = run->materialDescriptorSet;
+			stats->materialBinds++;
+		}
+
+		vkCmdDrawIndexed(cmd, run->indexCount, run->instanceCount, run->firstIndex, run->vertexOffset, run->firstInstance);
+		stats->drawCalls++;
+	}
 
-		auto* materialIds = &this->modelMaterials.at(resourceId.materialGroupId);
+	result = vkEndCommandBuffer(cmd);
 
-		for (size_t i = 0; i < model.VertexPositionBuffers.size(); i++) {
-			std::array<VkBuffer, 3> vertexBuffers = {
-				model.VertexPositionBuffers[i].buffer,
-				model.TextureCoordBuffers[i].buffer,
-				model.NormalBuffers[i].buffer
-			};
+	if (result) {
+		std::cout << "Detected Vulkan error while ending secondary command buffer: " << result << std::endl;
+		abort();
+	}
+}
+
+void VulkanRenderer::sortVisibleDraws(std::vector<RenderObject>* renderObjects, const glm::mat4& viewProj) {
+	this->renderQueue.clear();
+
+	// Clip space w is the view space depth
+	glm::vec4 depthRow = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+	for (uint32_t drawIndex : this->visibleDraws) {
+		DrawCandidate* draw = &this->drawCandidates[drawIndex];
+		auto* resourceId = &renderObjects->at(draw->objectIndex).modelResource;
+
+		uint32_t materialId = static_cast<uint32_t>(this->modelMaterials.at(resourceId->materialGroupId).at(draw->meshIndex));
+		// Every mesh of a model gets its own id so instances of it sort next to each other
+		uint32_t geometryId = (static_cast<uint32_t>(resourceId->modelRenderComponentId) << SORT_KEY_MESH_BITS) | (draw->meshIndex & ((1u << SORT_KEY_MESH_BITS) - 1));
+		glm::vec3 center = glm::vec3(this->candidateSpheres.centerX[drawIndex], this->candidateSpheres.centerY[drawIndex], this->candidateSpheres.centerZ[drawIndex]);
+		float depth = glm::dot(glm::vec3(depthRow), center) + depthRow.w;
+
+		// Only the deferred pipeline draws on this path
+		this->renderQueue.push(RenderQueue::makeKey(0, materialId, geometryId, depth), drawIndex);
+	}
+
+	this->renderQueue.sort();
+}
+
+void VulkanRenderer::cullDraws(std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<RenderObject>* renderObjects, const glm::mat4& viewProj) {
+	this->drawCandidates.clear();
+	this->candidateSpheres.clear();
+
+	// Move every mesh bounding sphere into world space through the object and mesh transforms. Scaling grows the radius
+	// by the largest axis scale
+	for (size_t objectIndex = 0; objectIndex < renderObjects->size(); objectIndex++) {
+		RenderObject* renderObject = &renderObjects->at(objectIndex);
+
+		if (renderObject->modelResource.flags & (ModelResourceFlags::ErrorLoadingModel | ModelResourceFlags::ErrorCreatingBuffers)) {
+			continue;
+		}
+
+		auto& model = modelRenderComponents->at(renderObject->modelResource.modelRenderComponentId);
+
+		for (size_t meshIndex = 0; meshIndex < model.meshRanges.size(); meshIndex++) {
+			const MeshBounds* bounds = &model.meshBounds[meshIndex];
+			glm::mat4 transform = renderObject->transform * model.meshTransforms[meshIndex];
+
+			float largestScaleSquared = std::max({ glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])), glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])) });
+			float largestScale = std::sqrt(largestScaleSquared);
+			glm::vec3 center = glm::vec3(transform * glm::vec4(bounds->sphereCenter, 1.0f));
+
+			this->drawCandidates.push_back({ static_cast<uint32_t>(objectIndex), static_cast<uint32_t>(meshIndex) });
+			this->candidateSpheres.push_back(center, bounds->sphereRadius * largestScale);
+		}
+	}
+
+	Frustum frustum = FrustumCulling::extractPlanes(viewProj);
+	size_t candidateCount = this->drawCandidates.size();
+	size_t batchCount = (candidateCount + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE;
+
+	this->visibleDraws.resize(candidateCount);
+	this->cullBatchCounts.resize(batchCount);
+
+	// Each batch writes its visible indices at its own offset, they are packed together afterwards
+	this->jobSystem->parallelFor(batchCount, 1, [&](size_t begin, size_t end) {
+		for (size_t batch = begin; batch < end; batch++) {
+			size_t first = batch * CULL_BATCH_SIZE;
+			size_t last = std::min(first + CULL_BATCH_SIZE, candidateCount);
+
+			this->cullBatchCounts[batch] = FrustumCulling::cullSpheres(&frustum, &this->candidateSpheres, first, last, &this->visibleDraws[first]);
+		}
+	});
+
+	size_t visibleCount = 0;
+
+	for (size_t batch = 0; batch < batchCount; batch++) {
+		size_t first = batch * CULL_BATCH_SIZE;
+
+		if (first != visibleCount) {
+			std::copy(this->visibleDraws.begin() + first, this->visibleDraws.begin() + first + this->cullBatchCounts[batch], this->visibleDraws.begin() + visibleCount);
+		}
+
+		visibleCount += this->cullBatchCounts[batch];
+	}
+
+	this->visibleDraws.resize(visibleCount);
+
+	this->renderStats.drawsSubmitted = static_cast<uint32_t>(visibleCount);
+	this->renderStats.drawsCulled = static_cast<uint32_t>(candidateCount - visibleCount);
+	this->renderStats.drawsOccluded = 0;
+}
+
+bool VulkanRenderer::prepareGPUDrivenDraws(std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<RenderObject>* renderObjects) {
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[this->getCurrentFrameIndex()];
+	this->drawCandidates.clear();
+	this->indirectBatches.clear();
+	this->materialBatches.resize(this->materials.size(), UINT32_MAX);
+	bool fits = true;
+
+	// Count the draws of each material first so every batch gets a contiguous range of commands
+	for (size_t objectIndex = 0; objectIndex < renderObjects->size(); objectIndex++) {
+		RenderObject* renderObject = &renderObjects->at(objectIndex);
+
+		if (renderObject->modelResource.flags & (ModelResourceFlags::ErrorLoadingModel | ModelResourceFlags::ErrorCreatingBuffers)) {
+			continue;
+		}
+
+		if (renderObject->visibilityId >= MAX_VISIBILITY_IDS) {
+			fits = false;
+		}
+
+		auto& model = modelRenderComponents->at(renderObject->modelResource.modelRenderComponentId);
+		auto& modelMaterialIds = this->modelMaterials.at(renderObject->modelResource.materialGroupId);
+
+		for (size_t meshIndex = 0; meshIndex < model.meshRanges.size(); meshIndex++) {
+			uint32_t materialId = static_cast<uint32_t>(modelMaterialIds.at(meshIndex));
+			uint32_t* batchIndex = &this->materialBatches[materialId];
+
+			if (*batchIndex == UINT32_MAX) {
+				*batchIndex = static_cast<uint32_t>(this->indirectBatches.size());
+				this->indirectBatches.push_back({ materialId, 0, 0 });
+			}
+
+			this->indirectBatches[*batchIndex].drawCount++;
+			this->drawCandidates.push_back({ static_cast<uint32_t>(objectIndex), static_cast<uint32_t>(meshIndex) });
+		}
+	}
+
+	size_t drawCount = this->drawCandidates.size();
+	fits = fits && drawCount > 0 && drawCount <= MAX_GPU_DRIVEN_DRAWS && this->indirectBatches.size() <= MAX_GPU_DRIVEN_BATCHES;
+	uint32_t firstCommand = 0;
+
+	for (size_t batchIndex = 0; batchIndex < this->indirectBatches.size(); batchIndex++) {
+		IndirectBatch* batch = &this->indirectBatches[batchIndex];
+		batch->firstCommand = firstCommand;
+		firstCommand += batch->drawCount;
+		// Counted back up as the draws are written
+		batch->drawCount = 0;
+
+		if (fits) {
+			frame->batchFirstCommands[batchIndex] = batch->firstCommand;
+		}
+	}
+
+	if (fits) {
+		for (auto& candidate : this->drawCandidates) {
+			RenderObject* renderObject = &renderObjects->at(candidate.objectIndex);
+			auto& model = modelRenderComponents->at(renderObject->modelResource.modelRenderComponentId);
+			auto& range = model.meshRanges[candidate.meshIndex];
+			const MeshBounds* bounds = &model.meshBounds[candidate.meshIndex];
+			uint32_t materialId = static_cast<uint32_t>(this->modelMaterials.at(renderObject->modelResource.materialGroupId).at(candidate.meshIndex));
+			uint32_t batchIndex = this->materialBatches[materialId];
+			IndirectBatch* batch = &this->indirectBatches[batchIndex];
+
+			GPUDrawData* draw = &frame->draws[batch->firstCommand + batch->drawCount];
+			draw->transform = renderObject->transform * model.meshTransforms[candidate.meshIndex];
+			draw->boundingSphere = glm::vec4(bounds->sphereCenter, bounds->sphereRadius);
+			draw->indexCount = range.indexCount;
+			draw->firstIndex = range.firstIndex;
+			draw->vertexOffset = range.vertexOffset;
+			draw->batchIndex = batchIndex;
+			draw->visibilityId = renderObject->visibilityId;
+
+			batch->drawCount++;
+		}
+
+		frame->drawCount = static_cast<uint32_t>(drawCount);
+	}
+
+	for (auto& batch : this->indirectBatches) {
+		this->materialBatches[batch.materialId] = UINT32_MAX;
+	}
+
+	return fits;
+}
+
+void VulkanRenderer::recordCullDispatch(VkCommandBuffer cmd, const glm::mat4& viewProj, uint32_t phase) {
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[this->getCurrentFrameIndex()];
+
+	if (phase == 0) {
+		// Totals and batch counts of both phases start from zero every frame
+		vkCmdFillBuffer(cmd, frame->countBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+	}
+
+	// Covers the count reset, the first phase draw flags and the visibility written by the frame before
+	VkMemoryBarrier cullInputBarrier{};
+	cullInputBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullInputBarrier.pNext = nullptr;
+	cullInputBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	cullInputBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &cullInputBarrier, 0, nullptr, 0, nullptr);
+
+	GPUCullPushConstants pushConstants{};
+	pushConstants.planes = FrustumCulling::extractPlanes(viewProj).planes;
+	pushConstants.drawCount = frame->drawCount;
+	// Without a count buffer every draw keeps its command and culled ones are drawn with no instances
+	pushConstants.compact = this->useDrawIndirectCount() ? 1 : 0;
+	pushConstants.phase = phase;
+	// Starts above zero so the cleared visibility buffer never matches the previous frame
+	pushConstants.visibilityStamp = static_cast<uint32_t>(this->framenumber) + 2;
+	pushConstants.batchStride = MAX_GPU_DRIVEN_BATCHES;
+	pushConstants.commandStride = MAX_GPU_DRIVEN_DRAWS;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->cullPipelineLayout, 0, 1, &frame->descriptor, 1, &this->cameraOffset);
+	vkCmdPushConstants(cmd, this->cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullPushConstants), &pushConstants);
+	vkCmdDispatch(cmd, (frame->drawCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+}
+
+void VulkanRenderer::recordDepthPyramid(VkCommandBuffer cmd, VkImage depthPyramid) {
+	size_t index = this->getCurrentFrameIndex();
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[index];
+	uint32_t levelCount = static_cast<uint32_t>(this->depthPyramidExtents.size());
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->depthReducePipeline);
+
+	// Each level is reduced from the one before it, the first from the depth attachment
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkExtent2D extent = this->depthPyramidExtents[level];
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->depthReducePipelineLayout, 0, 1, &frame->depthReduceDescriptors[level], 0, nullptr);
+		vkCmdDispatch(cmd, (extent.width + DEPTH_REDUCE_WORKGROUP_SIZE - 1) / DEPTH_REDUCE_WORKGROUP_SIZE, (extent.height + DEPTH_REDUCE_WORKGROUP_SIZE - 1) / DEPTH_REDUCE_WORKGROUP_SIZE, 1);
+
+		VkImageMemoryBarrier levelBarrier{};
+		levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		levelBarrier.pNext = nullptr;
+		levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		levelBarrier.image = depthPyramid;
+		levelBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		levelBarrier.subresourceRange.baseMipLevel = level;
+		levelBarrier.subresourceRange.levelCount = 1;
+		levelBarrier.subresourceRange.baseArrayLayer = 0;
+		levelBarrier.subresourceRange.layerCount = 1;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+	}
+}
+
+void VulkanRenderer::recordLightClusterDispatch(VkCommandBuffer cmd) {
+	size_t index = this->getCurrentFrameIndex();
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->lightClusterPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, this->lightClusterPipelineLayout, 0, 1, &this->framedata.globalDescriptors[index], 1, &this->cameraOffset);
+	vkCmdDispatch(cmd, (CLUSTER_COUNT + LIGHT_CLUSTER_WORKGROUP_SIZE - 1) / LIGHT_CLUSTER_WORKGROUP_SIZE, 1, 1);
+}
+
+void VulkanRenderer::recordLightingSubpass(VkCommandBuffer cmd) {
+	size_t index = this->getCurrentFrameIndex();
+
+	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	// Written once the G-buffer subpass is done, it may have been recorded into secondary command buffers
+	this->writeTimestamp(cmd, TIMESTAMP_LIGHTING_BEGIN);
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 0, 1, &this->framedata.globalDescriptors[index], 1, &this->cameraOffset);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->phongPipelineLayout, 1, 1, &this->phongPipeline.pipelineDescriptors[index], 0, nullptr);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->phongPipeline.pipeline);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+}
 
-			auto* material = &this->materials.at(materialIds->at(i));
+void VulkanRenderer::drawObjectsIndirect(VkCommandBuffer cmd, const GeometryPool* geometryPool, uint32_t phase) {
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[this->getCurrentFrameIndex()];
 
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 1, 1, &material->materialDescriptorSet, 0, nullptr);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredIndirectPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredIndirectPipelineLayout, 0, 1, &this->framedata.globalDescriptors[this->getCurrentFrameIndex()], 1, &this->cameraOffset);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredIndirectPipelineLayout, 2, 1, &frame->descriptor, 1, &this->cameraOffset);
 
-			vkCmdBindIndexBuffer(cmd, model.IndexBuffers[i].buffer, offset, VK_INDEX_TYPE_UINT32);
-			vkCmdBindVertexBuffers(cmd, 0, vertexBuffers.size(), vertexBuffers.data(), offsets.data());
-			vkCmdDrawIndexed(cmd, model.IndexBuffers[i].size, 1, 0, 0, 0);
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &geometryPool->vertexBuffer.buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, geometryPool->indexBuffer.buffer, offset, VK_INDEX_TYPE_UINT32);
+
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	// One indirect draw per material
+	for (size_t batchIndex = 0; batchIndex < this->indirectBatches.size(); batchIndex++) {
+		IndirectBatch* batch = &this->indirectBatches[batchIndex];
+		auto* material = &this->materials.at(batch->materialId);
+		VkDeviceSize commandOffset = (static_cast<VkDeviceSize>(phase) * MAX_GPU_DRIVEN_DRAWS + batch->firstCommand) * stride;
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredIndirectPipelineLayout, 1, 1, &material->materialDescriptorSet, 0, nullptr);
+
+		if (this->useDrawIndirectCount()) {
+			// Only the draws packed at the start of the batch are read
+			VkDeviceSize countOffset = (CULL_COUNT_TOTALS + (phase * MAX_GPU_DRIVEN_BATCHES) + batchIndex) * sizeof(uint32_t);
+			this->cmdDrawIndexedIndirectCount(cmd, frame->commandBuffer.buffer, commandOffset, frame->countBuffer.buffer, countOffset, batch->drawCount, stride);
+		} else {
+			// Culled draws were written with no instances, so the whole batch is drawn in one call
+			vkCmdDrawIndexedIndirect(cmd, frame->commandBuffer.buffer, commandOffset, batch->drawCount, stride);
 		}
 	}
+
+	// Batches are already one per material, so there is nothing to skip
+	uint32_t batchCount = static_cast<uint32_t>(this->indirectBatches.size());
+	this->renderStats.drawCalls = phase == 0 ? batchCount : this->renderStats.drawCalls + batchCount;
+	this->renderStats.materialBinds = phase == 0 ? batchCount : this->renderStats.materialBinds + batchCount;
+	this->renderStats.materialBindsAvoided = 0;
+}
+
+void VulkanRenderer::writeTimestamp(VkCommandBuffer cmd, uint32_t query) {
+	VkQueryPool queryPool = this->framedata.timestampQueryPools[this->getCurrentFrameIndex()];
+
+	if (queryPool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query);
+	}
+}
+
+void VulkanRenderer::readTimestamps(size_t frameIndex) {
+	if (!this->framedata.timestampsWritten[frameIndex]) {
+		return;
+	}
+
+	// The frame's fence has been waited on, so every timestamp is available
+	std::array<uint64_t, TIMESTAMP_COUNT> timestamps{};
+	VkResult result = vkGetQueryPoolResults(this->device, this->framedata.timestampQueryPools[frameIndex], 0, TIMESTAMP_COUNT, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (result != VK_SUCCESS) {
+		return;
+	}
+
+	double millisecondsPerTick = this->gpuProperties.limits.timestampPeriod / 1000000.0;
+	uint64_t gBufferTicks = (timestamps[TIMESTAMP_FIRST_PHASE_END] - timestamps[TIMESTAMP_FIRST_PHASE_BEGIN]) + (timestamps[TIMESTAMP_LIGHTING_BEGIN] - timestamps[TIMESTAMP_SHADING_BEGIN]);
+	uint64_t lightingTicks = timestamps[TIMESTAMP_SHADING_END] - timestamps[TIMESTAMP_LIGHTING_BEGIN];
+
+	this->renderStats.gBufferMilliseconds = static_cast<float>(gBufferTicks * millisecondsPerTick);
+	this->renderStats.lightingMilliseconds = static_cast<float>(lightingTicks * millisecondsPerTick);
+}
+
+void VulkanRenderer::readGPUDrivenStats(size_t frameIndex) {
+	if (this->gpuDrivenFrames.empty() || this->gpuDrivenFrames[frameIndex].drawCount == 0) {
+		return;
+	}
+
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[frameIndex];
+	vmaInvalidateAllocation(this->allocator, frame->readbackBuffer.allocation, 0, VK_WHOLE_SIZE);
+
+	uint32_t drawnCount = frame->readbackCounts[0] + frame->readbackCounts[1];
+	this->renderStats.drawsSubmitted = drawnCount;
+	this->renderStats.drawsCulled = frame->drawCount - drawnCount;
+	this->renderStats.drawsOccluded = frame->readbackCounts[2];
+
+	frame->drawCount = 0;
 }
 
 size_t VulkanRenderer::addMaterial(Material&& material, std::vector<AllocatedImage>* images) {
@@ -603,52 +1160,42 @@ size_t VulkanRenderer::addMaterial(Material&& material, std::vector<AllocatedIma
 	return id;
 }
 
-size_t VulkanRenderer::createImageFromFile(std::string& file) {
-	auto material = this->materialMap.find(file);
-
-	if (material == this->materialMap.end()) {
-		int texWidth, texHeight, texChannels;
-		stbi_uc* pixels = stbi_load(file.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-		if (!pixels) {
-			std::cout << "Failed to load texture file: " << file << " -> " << stbi_failure_reason() << std::endl;
-			return -1;
-		}
-
-		void* pixel_ptr = pixels;
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-		AllocatedBuffer stagingBuffer{};
-		size_t bufferSize = imageSize;
+bool VulkanRenderer::decodeImageFile(const std::string& file, DecodedImage* image) {
+	int channels;
+	image->pixels = stbi_load(file.c_str(), &image->width, &image->height, &channels, STBI_rgb_alpha);
 
-		VkBufferCreateInfo stagingBufferInfo{};
-		stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		stagingBufferInfo.pNext = nullptr;
+	if (!image->pixels) {
+		std::cout << "Failed to load texture file: " << file << " -> " << stbi_failure_reason() << std::endl;
+		return false;
+	}
 
-		stagingBufferInfo.size = bufferSize;
-		stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	return true;
+}
 
-		// Let VMA know this data should be in CPU RAM
-		VmaAllocationCreateInfo vmaAllocInfo{};
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+size_t VulkanRenderer::createImageFromFile(std::string& file, DecodedImage* decodedImage) {
+	auto material = this->materialMap.find(file);
 
-		VkResult result = vmaCreateBuffer(this->allocator, &stagingBufferInfo, &vmaAllocInfo, &stagingBuffer.buffer, &stagingBuffer.allocation, nullptr);
+	if (material == this->materialMap.end()) {
+		DecodedImage decoded{};
 
-		if (result) {
-			std::cout << "Couldn't create staging buffer: " << result << std::endl;
-			abort();
+		if (decodedImage != nullptr) {
+			decoded = *decodedImage;
+			decodedImage->pixels = nullptr;
+		} else {
+			VulkanRenderer::decodeImageFile(file, &decoded);
 		}
 
-		void* data{};
-		vmaMapMemory(this->allocator, stagingBuffer.allocation, &data);
-		memcpy(data, pixel_ptr, static_cast<size_t>(imageSize));
-		vmaUnmapMemory(this->allocator, stagingBuffer.allocation);
+		if (!decoded.pixels) {
+			return -1;
+		}
 
-		stbi_image_free(pixels);
+		// Freed once the pixels have been staged
+		std::shared_ptr<stbi_uc> pixels(decoded.pixels, stbi_image_free);
+		size_t imageSize = static_cast<size_t>(decoded.width) * static_cast<size_t>(decoded.height) * 4;
 
 		VkExtent3D imageExtent{};
-		imageExtent.width = static_cast<uint32_t>(texWidth);
-		imageExtent.height = static_cast<uint32_t>(texHeight);
+		imageExtent.width = static_cast<uint32_t>(decoded.width);
+		imageExtent.height = static_cast<uint32_t>(decoded.height);
 		imageExtent.depth = 1;
 
 		VkImageCreateInfo imageInfo = VulkanUtility::imageCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
@@ -659,30 +1206,39 @@ size_t VulkanRenderer::createImageFromFile(std::string& file) {
 
 		vmaCreateImage(this->allocator, &imageInfo, &imageAllocInfo, &image.image, &image.allocation, nullptr);
 
-		VulkanUtility::immediateSubmit(this->device, this->imageTransferQueue, this->imageTransferContext, [=](VkCommandBuffer cmd) {
-			VkImageSubresourceRange range{};
-			range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			range.baseMipLevel = 0;
-			range.levelCount = 1;
-			range.baseArrayLayer = 0;
-			range.layerCount = 1;
-
-			VkImageMemoryBarrier imageBarrierToTransfer{};
-			imageBarrierToTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			imageBarrierToTransfer.pNext = nullptr;
-
-			imageBarrierToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			imageBarrierToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			imageBarrierToTransfer.image = image.image;
-			imageBarrierToTransfer.subresourceRange = range;
-
-			imageBarrierToTransfer.srcAccessMask = 0;
-			imageBarrierToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToTransfer);
+		VkImageSubresourceRange range{};
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = 1;
+		range.baseArrayLayer = 0;
+		range.layerCount = 1;
+
+		VkImageMemoryBarrier imageBarrierToTransfer{};
+		imageBarrierToTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrierToTransfer.pNext = nullptr;
+
+		// Whatever the image held is overwritten, including the placeholder earlier frames may still be sampling
+		imageBarrierToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageBarrierToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrierToTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrierToTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrierToTransfer.image = image.image;
+		imageBarrierToTransfer.subresourceRange = range;
+
+		imageBarrierToTransfer.srcAccessMask = 0;
+		imageBarrierToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		VkImageMemoryBarrier imageBarrierToReadable = imageBarrierToTransfer;
+		imageBarrierToReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrierToReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageBarrierToReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageBarrierToReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		auto recordCopy = [=](VkCommandBuffer cmd, VkBuffer stagingBuffer, VkDeviceSize stagingOffset) {
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToTransfer);
 
 			VkBufferImageCopy copyRegion{};
-			copyRegion.bufferOffset = 0;
+			copyRegion.bufferOffset = stagingOffset;
 			copyRegion.bufferRowLength = 0;
 			copyRegion.bufferImageHeight = 0;
 
@@ -692,16 +1248,41 @@ size_t VulkanRenderer::createImageFromFile(std::string& file) {
 			copyRegion.imageSubresource.layerCount = 1;
 			copyRegion.imageExtent = imageExtent;
 
-			vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+			vkCmdCopyBufferToImage(cmd, stagingBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToReadable);
+		};
 
-			VkImageMemoryBarrier imageBarrierToReadable = imageBarrierToTransfer;
-			imageBarrierToReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			imageBarrierToReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageBarrierToReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			imageBarrierToReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		if (imageSize > this->stagingRingBuffer.getCapacity()) {
+			// Can never fit in the ring, staged through a buffer of its own
+			AllocatedBuffer stagingBuffer = VulkanUtility::createBuffer(this->allocator, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+			VulkanUtility::copyToBuffer<stbi_uc>(this->allocator, &stagingBuffer, pixels.get(), imageSize);
+
+			VulkanUtility::immediateSubmit(this->device, this->imageTransferQueue, this->imageTransferContext, [=](VkCommandBuffer cmd) {
+				recordCopy(cmd, stagingBuffer.buffer, 0);
+			});
+
+			vmaDestroyBuffer(this->allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+			this->stagingRingBuffer.addDedicatedUpload();
+		} else {
+			// Copied by the frames as the staging budget allows, the texture reads as grey until then
+			StagingUpload upload{};
+			upload.size = imageSize;
+			upload.alignment = STAGING_ALIGNMENT;
+			upload.write = [pixels, imageSize](void* data) {
+				memcpy(data, pixels.get(), imageSize);
+			};
+			upload.record = recordCopy;
+			upload.recordPlaceholder = [=](VkCommandBuffer cmd) {
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToTransfer);
 
-			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToReadable);
-		});
+				VkClearColorValue placeholderColour = { { 0.5f, 0.5f, 0.5f, 1.0f } };
+				vkCmdClearColorImage(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &placeholderColour, 1, &range);
+
+				vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrierToReadable);
+			};
+
+			this->stagingRingBuffer.queueUpload(std::move(upload));
+		}
 
 		VkImageViewCreateInfo imageViewInfo = VulkanUtility::imageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
 		vkCreateImageView(this->device, &imageViewInfo, nullptr, &image.imageView);
@@ -721,7 +1302,8 @@ size_t VulkanRenderer::getCurrentFrameIndex() {
 	return this->framenumber % FRAME_OVERLAP;
 }
 
-void VulkanRenderer::initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window) {
+void VulkanRenderer::initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window, JobSystem* jobSystem) {
+	this->jobSystem = jobSystem;
 	this->device = vulkanDetails->device;
 	this->instance = vulkanDetails->instance;
 	this->debugMessenger = vulkanDetails->debugMessenger;
@@ -735,6 +1317,16 @@ void VulkanRenderer::initialise(const VulkanDetails* vulkanDetails, QueueDetails
 	this->imageTransferQueue = imageTransferQueue.queue;
 	this->imageTransferQueueFamily = imageTransferQueue.family;
 	this->window = window;
+	this->gpuProperties = vulkanDetails->gpuProperties;
+	// Draw indices reach the vertex shader through the first instance, and each batch is a single multi draw
+	this->gpuDrivenSupported = vulkanDetails->drawIndirectFirstInstance && vulkanDetails->multiDrawIndirect;
+
+	if (this->gpuDrivenEnabled && !this->gpuDrivenSupported) {
+		std::cout << "GPU driven rendering is not supported by this device, using the CPU path" << std::endl;
+	}
+
+	this->gpuDrivenEnabled = this->gpuDrivenEnabled && this->gpuDrivenSupported;
+	this->drawIndirectCountSupported = vulkanDetails->drawIndirectCount;
 
 	this->initialiseFramedataStructures();
 	this->initialiseSwapchain();
@@ -742,9 +1334,17 @@ void VulkanRenderer::initialise(const VulkanDetails* vulkanDetails, QueueDetails
 	//this->initialiseDefaultRenderpass();
 	//this->initialiseFramebuffers();
 	this->initialiseSyncStructures();
+	this->initialiseStagingRingBuffer();
+	this->initialiseFrameArena();
+	this->initialiseRenderGraph();
+	this->initialiseTimestampQueries();
 
 	this->lightingSystem.initialise(FRAME_OVERLAP);
 
+	this->mainDeletionQueue.pushFunction([=]() {
+		this->lightingSystem.cleanup(this->allocator);
+	});
+
 	// Add light
 	PointLightCreateInfo pointLightCreateInfo{};
 	pointLightCreateInfo.attenuationFactors = { 0, 0, 0 };
@@ -758,12 +1358,13 @@ void VulkanRenderer::initialise(const VulkanDetails* vulkanDetails, QueueDetails
 	directionalLightCreateInfo.direction = { 0.0, 0.0, 1.0, 0.0 }; 
 	this->lightingSystem.addDirectionLight(directionalLightCreateInfo);
 
+	this->initialiseLightClusters();
 	this->initialiseGlobalDescriptors();
 	this->initialisePipelines();
 	//this->initialiseImgui();
 }
 
-void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<ModelResource>* modelResourceIds, std::vector<size_t>* ids, Camera* camera) {
+void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderComponents, const GeometryPool* geometryPool, std::vector<RenderObject>* renderObjects, Camera* camera) {
 	size_t index = this->getCurrentFrameIndex();
 
 	// Wait for GPU to finish rendering the last frame. Timeout after 1 second
@@ -781,8 +1382,22 @@ void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderCompone
 		abort();
 	}
 
+	// Staging space used the last time this frame index was rendered can now be reused
+	this->stagingRingBuffer.beginFrame(index);
+	this->frameArena.beginFrame(index);
+	this->readGPUDrivenStats(index);
+	this->readTimestamps(index);
+
+	GPUCameraData cameraData = this->updateCameraBuffer(camera);
+	glm::mat4 viewProj = cameraData.viewProj;
+
+	// Only point lights touching the frustum are uploaded
+	this->lightingSystem.cullPointLights(viewProj);
+	this->renderStats.pointLightsVisible = this->lightingSystem.getStats()->visiblePointLights;
+	this->renderStats.pointLightsCulled = this->lightingSystem.getStats()->culledPointLights;
+
 	// Update light system
-	this->lightingSystem.updateLightingSystemBuffers(this->device, this->transferQueue, this->uploadContext, this->allocator, index, this->framedata.globalDescriptors[index]);
+	this->lightingSystem.updateLightingSystemBuffers(this->device, this->allocator, index, this->framedata.globalDescriptors[index]);
 
 	uint32_t swapchainImageIndex;
 	result = vkAcquireNextImageKHR(this->device, this->swapchain, 1000000000, this->framedata.presentSemaphores[index], nullptr, &swapchainImageIndex);
@@ -793,7 +1408,7 @@ void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderCompone
 	}
 
 	// We are sure command buffer is finished executing as previous frame finished processing. We can result the command buffer
-	result = vkResetCommandBuffer(this->framedata.deferredMainCommandBuffers[index], 0);
+	result = vkResetCommandBuffer(this->framedata.mainCommandBuffers[index], 0);
 
 	if (result) {
 		std::cout << "Detected Vulkan error while resetting the main command buffer: " << result << std::endl;
@@ -802,16 +1417,29 @@ void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderCompone
 
 	//ImGui::Render();
 
-	VkCommandBuffer deferredCmd = this->framedata.deferredMainCommandBuffers[index];
+	VkCommandBuffer cmd = this->framedata.mainCommandBuffers[index];
 	VkCommandBufferBeginInfo cmdBeginInfo = VulkanUtility::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	
-	result = vkBeginCommandBuffer(deferredCmd, &cmdBeginInfo);
+	result = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
 
 	if (result) {
 		std::cout << "Detected Vulkan error while beginning command buffer in draw function: " << result << std::endl;
 		abort();
 	}
 
+	if (this->framedata.timestampQueryPools[index] != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(cmd, this->framedata.timestampQueryPools[index], 0, TIMESTAMP_COUNT);
+		this->framedata.timestampsWritten[index] = true;
+	}
+
+	bool gpuDriven = this->gpuDrivenEnabled && this->prepareGPUDrivenDraws(modelRenderComponents, renderObjects);
+
+	// The compute shader bins the lights if the CPU assignment is off or could not be staged
+	bool gpuLightClustering = this->gpuLightClusteringEnabled || !this->lightClusters.assignLights(cameraData.view, cameraData.proj, cameraData.clipPlanes.x, cameraData.clipPlanes.y,
+		this->lightingSystem.getPointLightPositions(), this->lightingSystem.getPointLightCount(), &this->stagingRingBuffer, index);
+	this->renderStats.clusterLightIndices = gpuLightClustering ? 0 : this->lightClusters.getStats()->lightIndices;
+	this->renderStats.clusterLightsDropped = gpuLightClustering ? 0 : this->lightClusters.getStats()->droppedLights;
+
 	VkClearValue clearValue{};
 	//float flash = std::abs(std::sin(static_cast<float>(this->framenumber) / 120.0f));
 	clearValue.color = { {0.0f, 0.0f, 0.0f, 1.0f} };
@@ -829,115 +1457,230 @@ void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderCompone
 	// Offset of x = 0 & y = 0
 	renderPassInfo.renderArea.offset = { 0, 0 };
 	renderPassInfo.renderArea.extent = { this->deferredPipeline.framebuffer.width, this->deferredPipeline.framebuffer.height };
-	renderPassInfo.framebuffer = this->deferredPipeline.framebuffer.framebuffer[index];
+	// Images are not acquired in frame order, so the framebuffer is the one of this frame and the acquired image
+	this->deferredFramebuffer = this->deferredPipeline.framebuffer.framebuffer[index * this->deferredPipeline.framebuffer.imageCount + swapchainImageIndex];
+	renderPassInfo.framebuffer = this->deferredFramebuffer;
 
-	std::array<VkClearValue, 4> clearValues = {
-		clearValue, clearValue, clearValue, depthClear
+	// In attachment order, the position clear value is only used by the full G-buffer layout
+	std::array<VkClearValue, 5> clearValues = {
+		clearValue, clearValue, depthClear, clearValue, clearValue
 	};
 
 	// Connect clear values
 	renderPassInfo.clearValueCount = clearValues.size();
 	renderPassInfo.pClearValues = clearValues.data();
 
-	vkCmdBeginRenderPass(deferredCmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-	this->drawObjects(deferredCmd, modelRenderComponents, modelResourceIds, ids, camera);
-
-	/*glm::vec3 camPos = {0.0f, 0.0f, -2.0f};
-	glm::mat4 view = glm::translate(glm::mat4(1.0f), camPos);
-	glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1920.0f / 1080.0f, 0.1f, 200.0f);
-	projection[1][1] *= -1;*/
+	// The frame is declared as a graph, which works out the barriers between passes
+	this->renderGraph.reset(index);
 
-	//ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+	// Queued uploads go first, as far as the staging budget left after the light clusters allows. They record their own barriers
+	uint32_t uploadPass = this->renderGraph.addPass("Staging uploads", [&](VkCommandBuffer cmd) {
+		this->stagingRingBuffer.recordQueuedUploads(cmd);
+	});
+	this->renderGraph.setSideEffects(uploadPass);
 
-	vkCmdEndRenderPass(deferredCmd);
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[index];
+	auto& deferredAttachments = this->deferredPipeline.framebuffer.framebufferAttachments;
 
-	result = vkEndCommandBuffer(deferredCmd);
+	std::vector<RenderGraphResource> gBuffer{};
 
-	if (result) {
-		std::cout << "Detected Vulkan error while ending command buffer in draw function: " << result << std::endl;
-		abort();
+	for (auto attachment : this->gBufferAttachments) {
+		gBuffer.push_back(this->renderGraph.importImage(deferredAttachments[attachment][index].image.image, VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_LAYOUT_UNDEFINED));
 	}
 
-	// Prepare to submit the command buffer to the graphcis queue
-	VkSubmitInfo submit = VulkanUtility::submitInfo(&deferredCmd);
-	VkPipelineStageFlags waitState = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	submit.pWaitDstStageMask = &waitState;
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &this->framedata.presentSemaphores[index];
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &this->framedata.deferredSemaphores[index];
-	submit.commandBufferCount = 1;
-	submit.pCommandBuffers = &deferredCmd;
-	vkQueueSubmit(this->graphicsQueue, 1, &submit, VK_NULL_HANDLE);
-
-	// Draw to actual framebuffers
-	result = vkResetCommandBuffer(this->framedata.lightingMainCommandBuffers[index], 0);
+	FramebufferAttachment* depthAttachment = &deferredAttachments[DEPTH_ATTACHMENT_INDEX][index];
+	RenderGraphResource depth = this->renderGraph.importImage(depthAttachment->image.image, depthAttachment->aspectMask, 1, VK_IMAGE_LAYOUT_UNDEFINED);
+	RenderGraphResource swapchainImage = this->renderGraph.importImage(this->swapchainImages[swapchainImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_LAYOUT_UNDEFINED);
+	this->renderGraph.exportResource(swapchainImage);
+
+	RenderGraphResource drawCommands = this->renderGraph.importBuffer(frame->commandBuffer.buffer);
+	RenderGraphResource drawCounts = this->renderGraph.importBuffer(frame->countBuffer.buffer);
+	RenderGraphResource clusterGrid = this->renderGraph.importBuffer(this->lightClusters.getGridBuffer(index));
+	RenderGraphResource clusterLightIndices = this->renderGraph.importBuffer(this->lightClusters.getLightIndexBuffer(index));
+
+	// Render passes do their own layout transitions, so the graph only orders them
+	const RenderGraphAccess colourAttachmentWrite = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true };
+	const RenderGraphAccess depthAttachmentWrite = { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+	const RenderGraphAccess indirectRead = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, false };
+	const RenderGraphAccess cullWrite = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, false };
+
+	// Rebuilt every frame, first so the lighting subpass is unlikely to wait on it
+	if (gpuLightClustering) {
+		uint32_t lightClusterPass = this->renderGraph.addPass("Light clusters", [&](VkCommandBuffer cmd) {
+			this->recordLightClusterDispatch(cmd);
+		});
+		this->renderGraph.write(lightClusterPass, clusterGrid, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, true });
+		this->renderGraph.write(lightClusterPass, clusterLightIndices, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, true });
+	} else {
+		uint32_t lightClusterPass = this->renderGraph.addPass("Light cluster upload", [&](VkCommandBuffer cmd) {
+			this->lightClusters.recordUpload(cmd, index);
+		});
+		this->renderGraph.write(lightClusterPass, clusterGrid, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, true });
+		this->renderGraph.write(lightClusterPass, clusterLightIndices, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, true });
+	}
 
-	if (result) {
-		std::cout << "Detected Vulkan error while resetting the main command buffer: " << result << std::endl;
-		abort();
+	if (gpuDriven) {
+		// First phase draws what was visible last frame
+		uint32_t cullPass = this->renderGraph.addPass("Cull first phase", [&](VkCommandBuffer cmd) {
+			this->recordCullDispatch(cmd, viewProj, 0);
+		});
+		this->renderGraph.write(cullPass, drawCommands, cullWrite);
+		// Counts are cleared before the dispatch
+		this->renderGraph.write(cullPass, drawCounts, { VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, true });
 	}
 
-	//ImGui::Render();
+	RenderGraphResource depthPyramid{};
 
-	VkCommandBuffer lightingCmd = this->framedata.lightingMainCommandBuffers[index];
-	cmdBeginInfo = VulkanUtility::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	if (gpuDriven) {
+		// Keeps the G-buffer for the second phase, the lighting subpass is left empty
+		uint32_t gBufferPass = this->renderGraph.addPass("G-buffer first phase", [&](VkCommandBuffer cmd) {
+			VkRenderPassBeginInfo firstPhaseInfo = renderPassInfo;
+			firstPhaseInfo.renderPass = this->deferredFirstPhaseRenderPass;
 
-	result = vkBeginCommandBuffer(lightingCmd, &cmdBeginInfo);
+			this->writeTimestamp(cmd, TIMESTAMP_FIRST_PHASE_BEGIN);
+			vkCmdBeginRenderPass(cmd, &firstPhaseInfo, VK_SUBPASS_CONTENTS_INLINE);
+			this->drawObjectsIndirect(cmd, geometryPool, 0);
+			vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdEndRenderPass(cmd);
+			this->writeTimestamp(cmd, TIMESTAMP_FIRST_PHASE_END);
+		});
 
-	if (result) {
-		std::cout << "Detected Vulkan error while beginning command buffer in draw function: " << result << std::endl;
-		abort();
+		for (auto attachment : gBuffer) {
+			this->renderGraph.write(gBufferPass, attachment, colourAttachmentWrite);
+		}
+
+		this->renderGraph.write(gBufferPass, depth, depthAttachmentWrite);
+		this->renderGraph.write(gBufferPass, swapchainImage, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true });
+		this->renderGraph.read(gBufferPass, drawCommands, indirectRead);
+		this->renderGraph.read(gBufferPass, drawCounts, indirectRead);
+
+		// Second phase tests everything else against the depth of the first and draws on top of it. The pyramid is only
+		// needed until then, so its memory can be shared with other transient images
+		RenderGraphImageInfo pyramidInfo{};
+		pyramidInfo.format = VK_FORMAT_R32_SFLOAT;
+		pyramidInfo.extent = { WIDTH, HEIGHT, 1 };
+		pyramidInfo.mipLevels = static_cast<uint32_t>(this->depthPyramidExtents.size());
+		pyramidInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		pyramidInfo.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		depthPyramid = this->renderGraph.createImage(pyramidInfo);
+
+		uint32_t pyramidPass = this->renderGraph.addPass("Depth pyramid", [&](VkCommandBuffer cmd) {
+			this->recordDepthPyramid(cmd, this->renderGraph.getImage(depthPyramid));
+		});
+		this->renderGraph.read(pyramidPass, depth, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_UNDEFINED, false });
+		// Rebuilt from scratch every frame
+		this->renderGraph.write(pyramidPass, depthPyramid, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_UNDEFINED, true });
+
+		uint32_t cullPass = this->renderGraph.addPass("Cull second phase", [&](VkCommandBuffer cmd) {
+			this->recordCullDispatch(cmd, viewProj, 1);
+		});
+		this->renderGraph.read(cullPass, depthPyramid, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_UNDEFINED, false });
+		this->renderGraph.write(cullPass, drawCommands, cullWrite);
+		this->renderGraph.write(cullPass, drawCounts, cullWrite);
 	}
-	
-	VkRenderPassBeginInfo lightingRenderPassInfo{};
-	lightingRenderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	lightingRenderPassInfo.pNext = nullptr;
 
-	lightingRenderPassInfo.renderPass = this->phongPipeline.framebuffer.renderPass;
-	// Offset of x = 0 & y = 0
-	lightingRenderPassInfo.renderArea.offset = { 0, 0 };
-	lightingRenderPassInfo.renderArea.extent = { this->phongPipeline.framebuffer.width, this->phongPipeline.framebuffer.height };
-	lightingRenderPassInfo.framebuffer = this->phongPipeline.framebuffer.framebuffer[index];
+	// G-buffer and lighting in one render pass, the lighting subpass reads the G-buffer straight from the attachments
+	uint32_t shadingPass = this->renderGraph.addPass("Deferred shading", [&](VkCommandBuffer cmd) {
+		if (!gpuDriven) {
+			// There is no first phase, so it takes no time
+			this->writeTimestamp(cmd, TIMESTAMP_FIRST_PHASE_BEGIN);
+			this->writeTimestamp(cmd, TIMESTAMP_FIRST_PHASE_END);
+		}
 
-	std::array<VkClearValue, 2> lightingClearValues = {
-		clearValue, depthClear
-	};
+		this->writeTimestamp(cmd, TIMESTAMP_SHADING_BEGIN);
 
-	// Connect clear values
-	lightingRenderPassInfo.clearValueCount = lightingClearValues.size();
-	lightingRenderPassInfo.pClearValues = lightingClearValues.data();
+		if (gpuDriven) {
+			VkRenderPassBeginInfo loadPassInfo = renderPassInfo;
+			loadPassInfo.renderPass = this->deferredLoadRenderPass;
 
-	std::array<VkDescriptorSet, 1> sceneDescriptorSets = {
-		this->framedata.globalDescriptors[this->getCurrentFrameIndex()]
-	};
+			vkCmdBeginRenderPass(cmd, &loadPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+			this->drawObjectsIndirect(cmd, geometryPool, 1);
+		} else {
+			// The CPU path records its draws into secondary command buffers on the job system
+			vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			this->drawObjects(cmd, modelRenderComponents, geometryPool, renderObjects, viewProj);
+		}
+
+		this->recordLightingSubpass(cmd);
+
+		//ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+
+		vkCmdEndRenderPass(cmd);
+		this->writeTimestamp(cmd, TIMESTAMP_SHADING_END);
+	});
+
+	this->renderGraph.write(shadingPass, swapchainImage, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, true });
+	this->renderGraph.read(shadingPass, clusterGrid, { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, false });
+	this->renderGraph.read(shadingPass, clusterLightIndices, { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, false });
+
+	if (gpuDriven) {
+		this->renderGraph.read(shadingPass, drawCommands, indirectRead);
+		this->renderGraph.read(shadingPass, drawCounts, indirectRead);
+
+		// Loaded attachments start in the layout the first phase left them in
+		for (auto attachment : gBuffer) {
+			this->renderGraph.write(shadingPass, attachment, { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_UNDEFINED, false });
+		}
+
+		this->renderGraph.write(shadingPass, depth, { depthAttachmentWrite.stages, depthAttachmentWrite.access, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_UNDEFINED, false });
+
+		// Read on the CPU once this frame index comes round again
+		RenderGraphResource readback = this->renderGraph.importBuffer(frame->readbackBuffer.buffer);
+
+		uint32_t readbackPass = this->renderGraph.addPass("Cull stats readback", [&](VkCommandBuffer cmd) {
+			VkBufferCopy copy{};
+			copy.srcOffset = 0;
+			copy.dstOffset = 0;
+			copy.size = CULL_COUNT_TOTALS * sizeof(uint32_t);
+			vkCmdCopyBuffer(cmd, frame->countBuffer.buffer, frame->readbackBuffer.buffer, 1, &copy);
+
+			VkMemoryBarrier readbackBarrier{};
+			readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			readbackBarrier.pNext = nullptr;
+			readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+		});
+		this->renderGraph.read(readbackPass, drawCounts, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, false });
+		this->renderGraph.write(readbackPass, readback, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, true });
+		this->renderGraph.setSideEffects(readbackPass);
+	} else {
+		for (auto attachment : gBuffer) {
+			this->renderGraph.write(shadingPass, attachment, colourAttachmentWrite);
+		}
+
+		this->renderGraph.write(shadingPass, depth, depthAttachmentWrite);
+	}
+
+	this->renderGraph.compile();
 
-	vkCmdBeginRenderPass(lightingCmd, &lightingRenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindDescriptorSets(lightingCmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->deferredPipelineLayout, 0, sceneDescriptorSets.size(), sceneDescriptorSets.data(), 0, nullptr);
-	vkCmdBindDescriptorSets(lightingCmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->phongPipelineLayout, 1, 1, &this->phongPipeline.pipelineDescriptors[index], 0, nullptr);
-	vkCmdBindPipeline(lightingCmd, VK_PIPELINE_BIND_POINT_GRAPHICS, this->phongPipeline.pipeline);
-	vkCmdDraw(lightingCmd, 3, 1, 0, 0);
+	// Nothing is recorded before execute, so the descriptors can still be pointed at new images
+	if (gpuDriven && this->renderGraph.recreatedTransientImages()) {
+		this->writeDepthPyramidDescriptors(depthPyramid);
+	}
 
-	vkCmdEndRenderPass(lightingCmd);
+	this->renderGraph.execute(cmd);
 
-	result = vkEndCommandBuffer(lightingCmd);
+	result = vkEndCommandBuffer(cmd);
 
 	if (result) {
 		std::cout << "Detected Vulkan error while ending command buffer in draw function: " << result << std::endl;
 		abort();
 	}
 
-	// Prepare to submit the command buffer to the graphcis queue
-	submit = VulkanUtility::submitInfo(&lightingCmd);
-
-	waitState = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	// The whole frame goes to the graphics queue in one submission, waiting on the swapchain image before writing it
+	VkSubmitInfo submit = VulkanUtility::submitInfo(&cmd);
+	VkPipelineStageFlags waitState = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	submit.pWaitDstStageMask = &waitState;
 	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &this->framedata.deferredSemaphores[index];
+	submit.pWaitSemaphores = &this->framedata.presentSemaphores[index];
 	submit.signalSemaphoreCount = 1;
 	submit.pSignalSemaphores = &this->framedata.renderSemaphores[index];
 
+	// Everything the frame allocated from the arena has been written by now
+	this->frameArena.flush(this->allocator);
+
 	// Submit the command buffer to the queue
 	result = vkQueueSubmit(this->graphicsQueue, 1, &submit, this->framedata.renderFences[index]);
 
@@ -967,13 +1710,13 @@ void VulkanRenderer::draw(std::vector<ModelRenderComponents>* modelRenderCompone
 }
 
 // ASSUME ONLY ONE TEXTURE OF EACH TYPE
-size_t VulkanRenderer::uploadMaterial(MaterialInfo materialInfo) {
+size_t VulkanRenderer::uploadMaterial(MaterialInfo materialInfo, DecodedImage* decodedDiffuse) {
 	Material material{};
 
 	aiString a;
 	std::string path = materialInfo.diffusePath;
 	std::cout << "Loading material: " + path << std::endl;
-	material.diffuseTextureId = this->createImageFromFile(path);
+	material.diffuseTextureId = this->createImageFromFile(path, decodedDiffuse);
 
 	auto id = this->addMaterial(std::move(material), &this->materialImages);
 
@@ -984,8 +1727,31 @@ size_t VulkanRenderer::uploadModelMaterials(std::vector<MaterialInfo>* materials
 	std::vector<size_t> materialIds;
 	materialIds.resize(materials->size());
 
+	// Decoding dominates texture loading, so decode every texture not yet loaded in parallel first
+	std::map<std::string, size_t> decodeIndices;
+	std::vector<std::string> decodePaths;
+
+	for (auto& materialInfo : *materials) {
+		if (this->materialMap.find(materialInfo.diffusePath) == this->materialMap.end() && decodeIndices.find(materialInfo.diffusePath) == decodeIndices.end()) {
+			decodeIndices[materialInfo.diffusePath] = decodePaths.size();
+			decodePaths.push_back(materialInfo.diffusePath);
+		}
+	}
+
+	std::vector<DecodedImage> decodedImages(decodePaths.size());
+
+	this->jobSystem->parallelFor(decodePaths.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			VulkanRenderer::decodeImageFile(decodePaths[i], &decodedImages[i]);
+		}
+	});
+
+	// Vulkan uploads stay on this thread. Each decoded image is consumed by the first material using it
 	for (size_t i = 0; i < materials->size(); i++) {
-		materialIds[i] = this->uploadMaterial(materials->at(i));
+		auto decodeIndex = decodeIndices.find(materials->at(i).diffusePath);
+		DecodedImage* decodedDiffuse = decodeIndex != decodeIndices.end() ? &decodedImages[decodeIndex->second] : nullptr;
+
+		materialIds[i] = this->uploadMaterial(materials->at(i), decodedDiffuse);
 	}
 	
 	size_t id = modelMaterials.size();
@@ -1007,6 +1773,7 @@ void VulkanRenderer::initialisePhongPipeline() {
 	shaderInfo.flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 	shaderInfo.vertexShaderPath = "resources/shaders/phong.vert";
 	shaderInfo.fragmentShaderPath = "resources/shaders/phong.frag";
+	shaderInfo.definitions = this->getGBufferDefinitions();
 
 	PipelineBuilder pipelineBuilder;
 	pipelineBuilder.addShaders(this->device, &shaderInfo);
@@ -1027,25 +1794,18 @@ void VulkanRenderer::initialisePhongPipeline() {
 	pipelineBuilder.multisampling = VulkanUtility::multisamplingStateCreateInfo();
 	pipelineBuilder.colorBlendAttachment = VulkanUtility::colorBlendAttachmentState();
 
-	pipelineBuilder.setupFramebuffer({ .width = WIDTH, .height = HEIGHT });
+	// Runs as the second subpass of the deferred render pass and writes the swapchain image
+	pipelineBuilder.subpass = LIGHTING_SUBPASS;
 
 	// Setup descriptor sets and push constrants
 	// Must create pipeline set layout with builder before creating pipeline layout
-	VkExtent3D extent{};
-	extent.depth = 1;
-	extent.width = WIDTH;
-	extent.height = HEIGHT;
-
-	// Setup framebuffer and depth buffer
-	pipelineBuilder.addFramebufferAttachment(this->device, this->swapchainImageViews, this->swapchainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, extent, FRAME_OVERLAP);
-	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, extent, FRAME_OVERLAP);
 
-	// Position texture
-	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	// Normal texture
-	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	// Albedo texture
-	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Normal input attachment
+	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Albedo input attachment
+	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT);
+	// Depth input attachment for the compact layout, position for the full one
+	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT);
 
 	auto pipelineSetLayout = pipelineBuilder.createPipelineSetLayout(this->device, FRAME_OVERLAP, this->descriptorPool);
 	
@@ -1078,35 +1838,37 @@ void VulkanRenderer::initialisePhongPipeline() {
 	pipelineBuilder.rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
 	pipelineBuilder.rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 
-	VkPipelineDepthStencilStateCreateInfo depthStencil = VulkanUtility::depthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+	// The lighting subpass has no depth attachment
+	VkPipelineDepthStencilStateCreateInfo depthStencil = VulkanUtility::depthStencilCreateInfo(false, false, VK_COMPARE_OP_ALWAYS);
 	pipelineBuilder.depthStencil = depthStencil;
 
-	this->phongPipeline = pipelineBuilder.buildPipeline(this->device, PipelineUsage::LightingPipelineUsage, FRAME_OVERLAP);
+	this->phongPipeline = pipelineBuilder.buildSubpassPipeline(this->device, &this->deferredPipeline);
 
 	this->mainDeletionQueue.pushFunction([=]() {
 		vkDestroyPipeline(this->device, this->phongPipeline.pipeline, nullptr);
 		vkDestroyPipelineLayout(this->device, this->phongPipelineLayout, nullptr);
 	});
 
-	// Update image descriptor sets to connect deferred framebuffer images to input
+	// Update image descriptor sets to connect deferred framebuffer images to the lighting subpass inputs
 
 	for (auto i = 0; i < FRAME_OVERLAP; i++) {
-		// Position
-		auto* positionImage = &this->deferredPipeline.framebuffer.framebufferAttachments[POSITION_ATTACHMENT_INDEX][i].image;
-		VkDescriptorImageInfo positionImageInfo = VulkanUtility::descriptorimageInfo(this->framebufferAttachmentSampler, positionImage->imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		// Normal
 		auto* normalImage = &this->deferredPipeline.framebuffer.framebufferAttachments[NORMAL_ATTACHMENT_INDEX][i].image;
-		VkDescriptorImageInfo normalImageInfo = VulkanUtility::descriptorimageInfo(this->framebufferAttachmentSampler, normalImage->imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		VkDescriptorImageInfo normalImageInfo = VulkanUtility::descriptorimageInfo(VK_NULL_HANDLE, normalImage->imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		// Albedo
 		auto* albedoImage = &this->deferredPipeline.framebuffer.framebufferAttachments[ALBEDO_ATTACHMENT_INDEX][i].image;
-		VkDescriptorImageInfo albedoImageInfo = VulkanUtility::descriptorimageInfo(this->framebufferAttachmentSampler, albedoImage->imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		VkDescriptorImageInfo albedoImageInfo = VulkanUtility::descriptorimageInfo(VK_NULL_HANDLE, albedoImage->imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		// Depth or position
+		size_t positionSource = this->compactGBuffer ? DEPTH_ATTACHMENT_INDEX : POSITION_ATTACHMENT_INDEX;
+		auto* positionImage = &this->deferredPipeline.framebuffer.framebufferAttachments[positionSource][i].image;
+		VkDescriptorImageInfo positionImageInfo = VulkanUtility::descriptorimageInfo(VK_NULL_HANDLE, positionImage->imageView, this->compactGBuffer ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	
 		auto descriptor = this->phongPipeline.pipelineDescriptors[i];
 
 		std::array<VkWriteDescriptorSet, 3> writes = {
-			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptor, &positionImageInfo, POSITION_ATTACHMENT_INDEX),
-			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptor, &normalImageInfo, NORMAL_ATTACHMENT_INDEX),
-			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptor, &albedoImageInfo, ALBEDO_ATTACHMENT_INDEX)
+			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, descriptor, &normalImageInfo, 0),
+			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, descriptor, &albedoImageInfo, 1),
+			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, descriptor, &positionImageInfo, 2)
 		};
 
 		vkUpdateDescriptorSets(this->device, writes.size(), writes.data(), 0, nullptr);
@@ -1119,6 +1881,7 @@ void VulkanRenderer::initialiseDeferredPipeline() {
 	shaderInfo.flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 	shaderInfo.vertexShaderPath = "resources/shaders/deferred.vert";
 	shaderInfo.fragmentShaderPath = "resources/shaders/deferred.frag";
+	shaderInfo.definitions = this->getGBufferDefinitions();
 
 	PipelineBuilder pipelineBuilder;
 	pipelineBuilder.addShaders(this->device, &shaderInfo);
@@ -1148,14 +1911,49 @@ void VulkanRenderer::initialiseDeferredPipeline() {
 	extent.width = WIDTH;
 	extent.height = HEIGHT;
 
-	// Position
-	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, extent, FRAME_OVERLAP);
+	GBufferFormats formats = this->compactGBuffer ? COMPACT_GBUFFER_FORMATS : FULL_GBUFFER_FORMATS;
+
+	// Half floats always work as colour attachments, signed normalised formats do on nearly every desktop GPU
+	VkFormatProperties normalFormatProperties;
+	vkGetPhysicalDeviceFormatProperties(this->chosenGPU, formats.normal, &normalFormatProperties);
+
+	if (!(normalFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)) {
+		formats.normal = VK_FORMAT_R16G16_SFLOAT;
+	}
+
+	// The CPU path only reads the G-buffer in the lighting subpass, so it never has to leave tile memory. The GPU driven
+	// path stores it after its first occlusion phase and loads it again for the second, so it needs real memory
+	VkImageUsageFlags gBufferUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+	if (!this->gpuDrivenEnabled) {
+		gBufferUsage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+	}
+	// Sampled by the depth pyramid, and read by the lighting subpass of the compact layout
+	VkImageUsageFlags depthUsage = this->compactGBuffer ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
 	// Normals
-	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, extent, FRAME_OVERLAP);
+	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, formats.normal, gBufferUsage, extent, FRAME_OVERLAP);
 	// Albedo
-	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, extent, FRAME_OVERLAP);
+	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, formats.albedo, gBufferUsage, extent, FRAME_OVERLAP);
 	// Depth
-	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, extent, FRAME_OVERLAP);
+	pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, formats.depth, depthUsage, extent, FRAME_OVERLAP);
+	// Lit output
+	pipelineBuilder.addFramebufferAttachment(this->device, this->swapchainImageViews, this->swapchainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, extent);
+
+	this->gBufferAttachments = { NORMAL_ATTACHMENT_INDEX, ALBEDO_ATTACHMENT_INDEX };
+	std::vector<uint32_t> lightingInputs = { NORMAL_ATTACHMENT_INDEX, ALBEDO_ATTACHMENT_INDEX, DEPTH_ATTACHMENT_INDEX };
+
+	if (!this->compactGBuffer) {
+		// Position
+		pipelineBuilder.addFramebufferAttachment(this->device, this->allocator, formats.position, gBufferUsage, extent, FRAME_OVERLAP);
+
+		this->gBufferAttachments.push_back(POSITION_ATTACHMENT_INDEX);
+		lightingInputs.back() = POSITION_ATTACHMENT_INDEX;
+	}
+
+	pipelineBuilder.addSubpass(this->gBufferAttachments, {}, true);
+	pipelineBuilder.addSubpass({ SWAPCHAIN_ATTACHMENT_INDEX }, lightingInputs, false);
+	pipelineBuilder.subpass = GBUFFER_SUBPASS;
 
 	// Albedo texture from model
 	pipelineBuilder.addPipelineDescriptorBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
@@ -1164,19 +1962,13 @@ void VulkanRenderer::initialiseDeferredPipeline() {
 
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = VulkanUtility::pipelineLayoutCreateInfo();
 
-	std::array<VkDescriptorSetLayout, 2> setLayouts = {
+	// Transforms come from the instance buffer
+	std::array<VkDescriptorSetLayout, 3> setLayouts = {
 		this->sceneSetLayout,
-		pipelineSetLayout
+		pipelineSetLayout,
+		this->instanceSetLayout
 	};
 
-	VkPushConstantRange pushConstant{};
-	pushConstant.offset = 0;
-	pushConstant.size = sizeof(PushConstants);
-	pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstant;
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-
 	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
 	pipelineLayoutCreateInfo.setLayoutCount = setLayouts.size();
 
@@ -1204,12 +1996,582 @@ void VulkanRenderer::initialiseDeferredPipeline() {
 
 	this->deferredPipeline = pipelineBuilder.buildPipeline(this->device, PipelineUsage::DeferredPipelineUsage, FRAME_OVERLAP);
 
+	// Measured from the allocations of one frame in flight. Lazily allocated attachments count their whole size,
+	// the device may commit less
+	this->renderStats.gBufferBytes = 0;
+
+	for (size_t attachment = 0; attachment < this->deferredPipeline.framebuffer.framebufferAttachments.size(); attachment++) {
+		if (attachment == SWAPCHAIN_ATTACHMENT_INDEX) {
+			continue;
+		}
+
+		VmaAllocationInfo allocationInfo{};
+		vmaGetAllocationInfo(this->allocator, this->deferredPipeline.framebuffer.framebufferAttachments[attachment][0].image.allocation, &allocationInfo);
+		this->renderStats.gBufferBytes += allocationInfo.size;
+	}
+
 	this->mainDeletionQueue.pushFunction([=]() {
 		vkDestroyPipeline(this->device, this->deferredPipeline.pipeline, nullptr);
 		vkDestroyPipelineLayout(this->device, this->deferredPipelineLayout, nullptr);
 	});
+
+	this->initialiseDeferredIndirectPipeline(&pipelineBuilder);
+}
+
+void VulkanRenderer::initialiseDeferredIndirectPipeline(PipelineBuilder* pipelineBuilder) {
+	if (!this->gpuDrivenSupported) {
+		return;
+	}
+
+	// Same fragment shader, the vertex shader takes its transform from the draw data instead of the instance buffer
+	ShaderInfo shaderInfo{};
+	shaderInfo.flags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderInfo.vertexShaderPath = "resources/shaders/deferred_indirect.vert";
+	shaderInfo.fragmentShaderPath = "resources/shaders/deferred.frag";
+	shaderInfo.definitions = this->getGBufferDefinitions();
+
+	pipelineBuilder->addShaders(this->device, &shaderInfo);
+
+	std::array<VkDescriptorSetLayout, 3> setLayouts = {
+		this->sceneSetLayout,
+		this->deferredPipeline.pipelineSetLayout,
+		this->gpuDrivenSetLayout
+	};
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = VulkanUtility::pipelineLayoutCreateInfo();
+	pipelineLayoutCreateInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutCreateInfo.setLayoutCount = setLayouts.size();
+
+	VkResult result = vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->deferredIndirectPipelineLayout);
+	if (result) {
+		std::cout << "Detected Vulkan error while creating deferred indirect pipeline layout: " << result << std::endl;
+		abort();
+	}
+
+	pipelineBuilder->pipelineLayout = this->deferredIndirectPipelineLayout;
+	this->deferredIndirectPipeline = pipelineBuilder->buildPipelineForRenderPass(this->device, &this->deferredPipeline);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyPipeline(this->device, this->deferredIndirectPipeline, nullptr);
+		vkDestroyPipelineLayout(this->device, this->deferredIndirectPipelineLayout, nullptr);
+	});
+}
+
+void VulkanRenderer::initialiseGPUDrivenResources() {
+	if (!this->gpuDrivenSupported) {
+		std::cout << "drawIndirectFirstInstance or multiDrawIndirect is not supported, GPU driven rendering is unavailable" << std::endl;
+		return;
+	}
+
+	if (this->drawIndirectCountSupported) {
+		this->cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(vkGetDeviceProcAddr(this->device, "vkCmdDrawIndexedIndirectCountKHR"));
+	}
+
+	this->drawIndirectCountSupported = this->cmdDrawIndexedIndirectCount != nullptr;
+
+	// Draw data is read by both the cull shader and the indirect vertex shader
+	std::array<VkDescriptorSetLayoutBinding, 8> bindings = {
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 5),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 6),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 7)
+	};
+
+	VkDescriptorSetLayoutCreateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.pNext = nullptr;
+	setInfo.flags = 0;
+	setInfo.bindingCount = bindings.size();
+	setInfo.pBindings = bindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(this->device, &setInfo, nullptr, &this->gpuDrivenSetLayout);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating GPU driven descriptor set layout: " << result << std::endl;
+		abort();
+	}
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyDescriptorSetLayout(this->device, this->gpuDrivenSetLayout, nullptr);
+	});
+
+	// Stamp of the last frame each object passed the occlusion test in, shared by every frame in flight
+	this->visibilityBuffer = VulkanUtility::createBuffer(this->allocator, MAX_VISIBILITY_IDS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	this->visibilityBuffer.size = MAX_VISIBILITY_IDS * sizeof(uint32_t);
+
+	VulkanUtility::immediateSubmit(this->device, this->imageTransferQueue, this->imageTransferContext, [=](VkCommandBuffer cmd) {
+		vkCmdFillBuffer(cmd, this->visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+	});
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vmaDestroyBuffer(this->allocator, this->visibilityBuffer.buffer, this->visibilityBuffer.allocation);
+	});
+
+	this->gpuDrivenFrames.resize(FRAME_OVERLAP);
+
+	for (auto i = 0; i < FRAME_OVERLAP; i++) {
+		GPUDrivenFrame* frame = &this->gpuDrivenFrames[i];
+
+		frame->drawBuffer = VulkanUtility::createBuffer(this->allocator, MAX_GPU_DRIVEN_DRAWS * sizeof(GPUDrawData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		frame->drawBuffer.size = MAX_GPU_DRIVEN_DRAWS * sizeof(GPUDrawData);
+		frame->batchBuffer = VulkanUtility::createBuffer(this->allocator, MAX_GPU_DRIVEN_BATCHES * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		frame->batchBuffer.size = MAX_GPU_DRIVEN_BATCHES * sizeof(uint32_t);
+		// Each phase has its own commands and counts
+		frame->commandBuffer = VulkanUtility::createBuffer(this->allocator, CULL_PHASE_COUNT * MAX_GPU_DRIVEN_DRAWS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		frame->commandBuffer.size = CULL_PHASE_COUNT * MAX_GPU_DRIVEN_DRAWS * sizeof(VkDrawIndexedIndirectCommand);
+		frame->countBuffer = VulkanUtility::createBuffer(this->allocator, (CULL_COUNT_TOTALS + (CULL_PHASE_COUNT * MAX_GPU_DRIVEN_BATCHES)) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		frame->countBuffer.size = (CULL_COUNT_TOTALS + (CULL_PHASE_COUNT * MAX_GPU_DRIVEN_BATCHES)) * sizeof(uint32_t);
+		frame->drawFlagBuffer = VulkanUtility::createBuffer(this->allocator, MAX_GPU_DRIVEN_DRAWS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		frame->drawFlagBuffer.size = MAX_GPU_DRIVEN_DRAWS * sizeof(uint32_t);
+		frame->readbackBuffer = VulkanUtility::createBuffer(this->allocator, CULL_COUNT_TOTALS * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+		frame->readbackBuffer.size = CULL_COUNT_TOTALS * sizeof(uint32_t);
+		frame->drawCount = 0;
+
+		// Written every frame, so they stay mapped
+		void* data;
+		vmaMapMemory(this->allocator, frame->drawBuffer.allocation, &data);
+		frame->draws = static_cast<GPUDrawData*>(data);
+		vmaMapMemory(this->allocator, frame->batchBuffer.allocation, &data);
+		frame->batchFirstCommands = static_cast<uint32_t*>(data);
+		vmaMapMemory(this->allocator, frame->readbackBuffer.allocation, &data);
+		frame->readbackCounts = static_cast<uint32_t*>(data);
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.descriptorPool = this->descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &this->gpuDrivenSetLayout;
+
+		result = vkAllocateDescriptorSets(this->device, &allocInfo, &frame->descriptor);
+
+		if (result) {
+			std::cout << "Detected Vulkan error while allocating GPU driven descriptor set: " << result << std::endl;
+			abort();
+		}
+
+		// The depth pyramid at binding 7 is written once it exists
+		// The camera at binding 4 lives in the frame arena and is selected with its dynamic offset
+		std::array<AllocatedBuffer*, 7> buffers = { &frame->drawBuffer, &frame->batchBuffer, &frame->commandBuffer, &frame->countBuffer, nullptr, &frame->drawFlagBuffer, &this->visibilityBuffer };
+		std::array<VkDescriptorBufferInfo, 7> bufferInfos{};
+		std::array<VkWriteDescriptorSet, 7> writes{};
+
+		for (uint32_t binding = 0; binding < buffers.size(); binding++) {
+			VkDescriptorType type = binding == 4 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+			bufferInfos[binding].buffer = binding == 4 ? this->frameArena.getBuffer(i) : buffers[binding]->buffer;
+			bufferInfos[binding].offset = 0;
+			bufferInfos[binding].range = binding == 4 ? sizeof(GPUCameraData) : buffers[binding]->size;
+
+			writes[binding] = VulkanUtility::writeDescriptorBuffer(type, frame->descriptor, &bufferInfos[binding], binding);
+		}
+
+		vkUpdateDescriptorSets(this->device, writes.size(), writes.data(), 0, nullptr);
+
+		this->mainDeletionQueue.pushFunction([=]() {
+			vmaUnmapMemory(this->allocator, frame->drawBuffer.allocation);
+			vmaUnmapMemory(this->allocator, frame->batchBuffer.allocation);
+			vmaUnmapMemory(this->allocator, frame->readbackBuffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->drawBuffer.buffer, frame->drawBuffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->batchBuffer.buffer, frame->batchBuffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->commandBuffer.buffer, frame->commandBuffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->countBuffer.buffer, frame->countBuffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->drawFlagBuffer.buffer, frame->drawFlagBuffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->readbackBuffer.buffer, frame->readbackBuffer.allocation);
+		});
+	}
+
+	// Cull pipeline
+	ShaderInfo shaderInfo{};
+	shaderInfo.flags = VK_SHADER_STAGE_COMPUTE_BIT;
+	shaderInfo.computeShaderPath = "resources/shaders/cull.comp";
+
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.addShaders(this->device, &shaderInfo);
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(GPUCullPushConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = VulkanUtility::pipelineLayoutCreateInfo();
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstant;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &this->gpuDrivenSetLayout;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+
+	result = vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->cullPipelineLayout);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating cull pipeline layout: " << result << std::endl;
+		abort();
+	}
+
+	pipelineBuilder.pipelineLayout = this->cullPipelineLayout;
+	this->cullPipeline = pipelineBuilder.buildComputePipeline(this->device);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyPipeline(this->device, this->cullPipeline, nullptr);
+		vkDestroyPipelineLayout(this->device, this->cullPipelineLayout, nullptr);
+	});
+}
+
+void VulkanRenderer::initialiseInstanceBuffers() {
+	VkDescriptorSetLayoutBinding binding = VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0);
+
+	VkDescriptorSetLayoutCreateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.pNext = nullptr;
+	setInfo.flags = 0;
+	setInfo.bindingCount = 1;
+	setInfo.pBindings = &binding;
+
+	VkResult result = vkCreateDescriptorSetLayout(this->device, &setInfo, nullptr, &this->instanceSetLayout);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating instance descriptor set layout: " << result << std::endl;
+		abort();
+	}
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyDescriptorSetLayout(this->device, this->instanceSetLayout, nullptr);
+	});
+
+	this->instanceFrames.resize(FRAME_OVERLAP);
+
+	for (auto i = 0; i < FRAME_OVERLAP; i++) {
+		InstanceFrame* frame = &this->instanceFrames[i];
+		frame->capacity = 0;
+		frame->transforms = nullptr;
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.descriptorPool = this->descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &this->instanceSetLayout;
+
+		result = vkAllocateDescriptorSets(this->device, &allocInfo, &frame->descriptor);
+
+		if (result) {
+			std::cout << "Detected Vulkan error while allocating instance descriptor set: " << result << std::endl;
+			abort();
+		}
+
+		this->reserveInstances(frame, INITIAL_INSTANCE_CAPACITY);
+
+		// Frees whichever buffer the frame has grown to by then
+		this->mainDeletionQueue.pushFunction([=]() {
+			vmaUnmapMemory(this->allocator, frame->buffer.allocation);
+			vmaDestroyBuffer(this->allocator, frame->buffer.buffer, frame->buffer.allocation);
+		});
+	}
+}
+
+void VulkanRenderer::reserveInstances(InstanceFrame* frame, uint32_t count) {
+	if (count <= frame->capacity) {
+		return;
+	}
+
+	if (frame->transforms != nullptr) {
+		vmaUnmapMemory(this->allocator, frame->buffer.allocation);
+		vmaDestroyBuffer(this->allocator, frame->buffer.buffer, frame->buffer.allocation);
+	}
+
+	frame->capacity = std::max(count, frame->capacity * 2);
+
+	frame->buffer = VulkanUtility::createBuffer(this->allocator, frame->capacity * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	frame->buffer.size = frame->capacity * sizeof(glm::mat4);
+
+	// Written every frame, so it stays mapped
+	void* data;
+	vmaMapMemory(this->allocator, frame->buffer.allocation, &data);
+	frame->transforms = static_cast<glm::mat4*>(data);
+
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = frame->buffer.buffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = frame->buffer.size;
+
+	VkWriteDescriptorSet write = VulkanUtility::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame->descriptor, &bufferInfo, 0);
+	vkUpdateDescriptorSets(this->device, 1, &write, 0, nullptr);
+}
+
+void VulkanRenderer::initialiseDepthPyramid() {
+	if (!this->gpuDrivenSupported) {
+		return;
+	}
+
+	// Both phases share the subpasses of the deferred render pass so its pipelines stay compatible. The depth pyramid
+	// runs between them, so the first phase has to store the G-buffer and skips the lighting subpass. Nothing reads the
+	// G-buffer after the second phase has shaded it
+	std::vector<VkAttachmentDescription> firstPhaseAttachments = this->deferredPipeline.framebuffer.framebufferAttachmentDescriptions;
+	std::vector<VkAttachmentDescription> loadAttachments = this->deferredPipeline.framebuffer.framebufferAttachmentDescriptions;
+
+	for (size_t i = 0; i < firstPhaseAttachments.size(); i++) {
+		if (i == SWAPCHAIN_ATTACHMENT_INDEX) {
+			continue;
+		}
+
+		firstPhaseAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+		loadAttachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		loadAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		loadAttachments[i].initialLayout = loadAttachments[i].finalLayout;
+	}
+
+	firstPhaseAttachments[SWAPCHAIN_ATTACHMENT_INDEX].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	firstPhaseAttachments[SWAPCHAIN_ATTACHMENT_INDEX].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	firstPhaseAttachments[SWAPCHAIN_ATTACHMENT_INDEX].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	PipelineBuilder renderPassBuilder;
+	this->deferredFirstPhaseRenderPass = renderPassBuilder.buildRenderPass(this->device, &this->deferredPipeline, &firstPhaseAttachments);
+	this->deferredLoadRenderPass = renderPassBuilder.buildRenderPass(this->device, &this->deferredPipeline, &loadAttachments);
+
+	// Halved down to a single texel, the first level matches the depth attachment
+	this->depthPyramidExtents.clear();
+	VkExtent2D extent = { WIDTH, HEIGHT };
+	this->depthPyramidExtents.push_back(extent);
+
+	while (extent.width > 1 || extent.height > 1) {
+		extent.width = std::max(extent.width / 2, 1u);
+		extent.height = std::max(extent.height / 2, 1u);
+		this->depthPyramidExtents.push_back(extent);
+	}
+
+	uint32_t levelCount = static_cast<uint32_t>(this->depthPyramidExtents.size());
+
+	VkSamplerCreateInfo samplerInfo = VulkanUtility::samplerCreateInfo(VK_FILTER_NEAREST);
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	VkResult result = vkCreateSampler(this->device, &samplerInfo, nullptr, &this->depthPyramidSampler);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating depth pyramid sampler: " << result << std::endl;
+		abort();
+	}
+
+	// Reads one level and writes the next
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		VulkanUtility::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1)
+	};
+
+	VkDescriptorSetLayoutCreateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.pNext = nullptr;
+	setInfo.flags = 0;
+	setInfo.bindingCount = bindings.size();
+	setInfo.pBindings = bindings.data();
+
+	result = vkCreateDescriptorSetLayout(this->device, &setInfo, nullptr, &this->depthReduceSetLayout);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating depth reduce descriptor set layout: " << result << std::endl;
+		abort();
+	}
+
+	std::vector<VkDescriptorPoolSize> sizes = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, FRAME_OVERLAP * levelCount },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, FRAME_OVERLAP * levelCount }
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.flags = 0;
+	poolInfo.maxSets = FRAME_OVERLAP * levelCount;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+	poolInfo.pPoolSizes = sizes.data();
+
+	result = vkCreateDescriptorPool(this->device, &poolInfo, nullptr, &this->depthPyramidDescriptorPool);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating depth pyramid descriptor pool: " << result << std::endl;
+		abort();
+	}
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyRenderPass(this->device, this->deferredFirstPhaseRenderPass, nullptr);
+		vkDestroyRenderPass(this->device, this->deferredLoadRenderPass, nullptr);
+		vkDestroySampler(this->device, this->depthPyramidSampler, nullptr);
+		vkDestroyDescriptorSetLayout(this->device, this->depthReduceSetLayout, nullptr);
+		vkDestroyDescriptorPool(this->device, this->depthPyramidDescriptorPool, nullptr);
+	});
+
+	// The pyramid images themselves come from the render graph, their descriptors are written once it has placed them
+	for (auto i = 0; i < FRAME_OVERLAP; i++) {
+		GPUDrivenFrame* frame = &this->gpuDrivenFrames[i];
+
+		// Stencil cannot be sampled alongside depth
+		VkImage depthImage = this->deferredPipeline.framebuffer.framebufferAttachments[DEPTH_ATTACHMENT_INDEX][i].image.image;
+		VkImageViewCreateInfo depthViewInfo = VulkanUtility::imageViewCreateInfo(this->deferredPipeline.framebuffer.framebufferAttachments[DEPTH_ATTACHMENT_INDEX][i].format, depthImage, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+		result = vkCreateImageView(this->device, &depthViewInfo, nullptr, &frame->depthView);
+
+		if (result) {
+			std::cout << "Detected Vulkan error while creating depth attachment image view: " << result << std::endl;
+			abort();
+		}
+
+		std::vector<VkDescriptorSetLayout> setLayouts(levelCount, this->depthReduceSetLayout);
+		frame->depthReduceDescriptors.resize(levelCount);
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.descriptorPool = this->depthPyramidDescriptorPool;
+		allocInfo.descriptorSetCount = levelCount;
+		allocInfo.pSetLayouts = setLayouts.data();
+
+		result = vkAllocateDescriptorSets(this->device, &allocInfo, frame->depthReduceDescriptors.data());
+
+		if (result) {
+			std::cout << "Detected Vulkan error while allocating depth reduce descriptor sets: " << result << std::endl;
+			abort();
+		}
+
+		this->mainDeletionQueue.pushFunction([=]() {
+			vkDestroyImageView(this->device, frame->depthView, nullptr);
+		});
+	}
+
+	// Reduction pipeline
+	ShaderInfo shaderInfo{};
+	shaderInfo.flags = VK_SHADER_STAGE_COMPUTE_BIT;
+	shaderInfo.computeShaderPath = "resources/shaders/depth_reduce.comp";
+
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.addShaders(this->device, &shaderInfo);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = VulkanUtility::pipelineLayoutCreateInfo();
+	pipelineLayoutCreateInfo.pSetLayouts = &this->depthReduceSetLayout;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+
+	result = vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->depthReducePipelineLayout);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating depth reduce pipeline layout: " << result << std::endl;
+		abort();
+	}
+
+	pipelineBuilder.pipelineLayout = this->depthReducePipelineLayout;
+	this->depthReducePipeline = pipelineBuilder.buildComputePipeline(this->device);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyPipeline(this->device, this->depthReducePipeline, nullptr);
+		vkDestroyPipelineLayout(this->device, this->depthReducePipelineLayout, nullptr);
+	});
+}
+
+void VulkanRenderer::writeDepthPyramidDescriptors(RenderGraphResource depthPyramid) {
+	GPUDrivenFrame* frame = &this->gpuDrivenFrames[this->getCurrentFrameIndex()];
+	uint32_t levelCount = static_cast<uint32_t>(this->depthPyramidExtents.size());
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkDescriptorImageInfo sourceInfo = level == 0
+			? VulkanUtility::descriptorimageInfo(this->depthPyramidSampler, frame->depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+			: VulkanUtility::descriptorimageInfo(this->depthPyramidSampler, this->renderGraph.getImageLevelView(depthPyramid, level - 1), VK_IMAGE_LAYOUT_GENERAL);
+		VkDescriptorImageInfo destinationInfo = VulkanUtility::descriptorimageInfo(VK_NULL_HANDLE, this->renderGraph.getImageLevelView(depthPyramid, level), VK_IMAGE_LAYOUT_GENERAL);
+
+		std::array<VkWriteDescriptorSet, 2> writes = {
+			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frame->depthReduceDescriptors[level], &sourceInfo, 0),
+			VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, frame->depthReduceDescriptors[level], &destinationInfo, 1)
+		};
+
+		vkUpdateDescriptorSets(this->device, writes.size(), writes.data(), 0, nullptr);
+	}
+
+	// Whole pyramid for the cull shader
+	VkDescriptorImageInfo pyramidInfo = VulkanUtility::descriptorimageInfo(this->depthPyramidSampler, this->renderGraph.getImageView(depthPyramid), VK_IMAGE_LAYOUT_GENERAL);
+	VkWriteDescriptorSet pyramidWrite = VulkanUtility::writeDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frame->descriptor, &pyramidInfo, 7);
+
+	vkUpdateDescriptorSets(this->device, 1, &pyramidWrite, 0, nullptr);
+}
+
+void VulkanRenderer::initialiseLightClusterPipeline() {
+	ShaderInfo shaderInfo{};
+	shaderInfo.flags = VK_SHADER_STAGE_COMPUTE_BIT;
+	shaderInfo.computeShaderPath = "resources/shaders/light_cluster.comp";
+
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder.addShaders(this->device, &shaderInfo);
+
+	// Reads the camera and point lights from the global set and writes the cluster lists into it
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = VulkanUtility::pipelineLayoutCreateInfo();
+	pipelineLayoutCreateInfo.pSetLayouts = &this->sceneSetLayout;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+
+	VkResult result = vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->lightClusterPipelineLayout);
+
+	if (result) {
+		std::cout << "Detected Vulkan error while creating light cluster pipeline layout: " << result << std::endl;
+		abort();
+	}
+
+	pipelineBuilder.pipelineLayout = this->lightClusterPipelineLayout;
+	this->lightClusterPipeline = pipelineBuilder.buildComputePipeline(this->device);
+
+	this->mainDeletionQueue.pushFunction([=]() {
+		vkDestroyPipeline(this->device, this->lightClusterPipeline, nullptr);
+		vkDestroyPipelineLayout(this->device, this->lightClusterPipelineLayout, nullptr);
+	});
 }
 
 VmaAllocator VulkanRenderer::getVmaAllocator() {
 	return this->allocator;
+}
+
+const StagingRingBufferStats* VulkanRenderer::getStagingStats() {
+	return this->stagingRingBuffer.getStats();
+}
+
+const FrameArenaStats* VulkanRenderer::getFrameArenaStats() {
+	return this->frameArena.getStats();
+}
+
+const RenderStats* VulkanRenderer::getRenderStats() {
+	return &this->renderStats;
+}
+
+const RenderGraphStats* VulkanRenderer::getRenderGraphStats() {
+	return this->renderGraph.getStats();
+}
+
+void VulkanRenderer::setCompactGBuffer(bool enabled) {
+	this->compactGBuffer = enabled;
+}
+
+std::vector<std::string> VulkanRenderer::getGBufferDefinitions() {
+	if (this->compactGBuffer) {
+		return { "COMPACT_GBUFFER" };
+	}
+
+	return {};
+}
+
+void VulkanRenderer::setGPUDrivenRendering(bool enabled) {
+	// Checked against the device in initialise
+	this->gpuDrivenEnabled = enabled;
+}
+
+void VulkanRenderer::setDrawIndirectCount(bool enabled) {
+	this->drawIndirectCountEnabled = enabled;
+}
+
+bool VulkanRenderer::useDrawIndirectCount() {
+	return this->drawIndirectCountSupported && this->drawIndirectCountEnabled;
+}
+
+void VulkanRenderer::setGPULightClustering(bool enabled) {
+	this->gpuLightClusteringEnabled = enabled;
 }
\ No newline at end of file
@@ -12,6 +12,13 @@
 #include "../../Components/RenderComponents/Material.hpp"
 #include "../../Components/RenderComponents/Camera.hpp"
 #include "LightingSystem.hpp"
+#include "LightClusters.hpp"
+#include "StagingRingBuffer.hpp"
+#include "FrameArena.hpp"
+#include "FrustumCulling.hpp"
+#include "RenderQueue.hpp"
+#include "RenderGraph.hpp"
+#include "../../Core/JobSystem.hpp"
 
 struct PushConstants {
 	glm::vec4 data;
@@ -22,20 +29,129 @@ struct GPUCameraData {
 	glm::mat4 view;
 	glm::mat4 proj;
 	glm::mat4 viewProj;
+	glm::mat4 inverseViewProj;
+	// x: near plane, y: far plane. Light clusters are sliced between them
+	glm::vec4 clipPlanes;
+};
+
+// Formats of the deferred attachments. position is VK_FORMAT_UNDEFINED when world positions are rebuilt from depth
+struct GBufferFormats {
+	VkFormat normal;
+	VkFormat albedo;
+	VkFormat depth;
+	VkFormat position;
 };
 
 struct Framedata {
 	std::vector<VkSemaphore> presentSemaphores;
 	std::vector<VkSemaphore> renderSemaphores;
-	std::vector<VkSemaphore> deferredSemaphores;
 	std::vector<VkCommandPool> commandPools;
-	std::vector<VkCommandBuffer> deferredMainCommandBuffers;
-	std::vector<VkCommandBuffer> lightingMainCommandBuffers;
+	std::vector<VkCommandBuffer> mainCommandBuffers;
+	// One pool and secondary command buffer per recording slot, so the slots of a frame can be recorded in parallel
+	std::vector<std::vector<VkCommandPool>> recordingCommandPools;
+	std::vector<std::vector<VkCommandBuffer>> recordingCommandBuffers;
 	std::vector<VkFence> renderFences;
 	std::vector<VkImageView> depthImageViews;
 	std::vector<AllocatedImage> depthImages;
-	std::vector<AllocatedBuffer> cameraBuffers;
 	std::vector<VkDescriptorSet> globalDescriptors;
+	// Null where the graphics queue cannot write timestamps
+	std::vector<VkQueryPool> timestampQueryPools;
+	// Queries are only valid once the pool has been reset by a frame
+	std::vector<bool> timestampsWritten;
+};
+
+// RGBA8 pixels from stb_image. Whoever ends up with the pixels frees them
+struct DecodedImage {
+	unsigned char* pixels;
+	int width;
+	int height;
+};
+
+// One mesh of one render object
+struct DrawCandidate {
+	uint32_t objectIndex;
+	uint32_t meshIndex;
+};
+
+// Consecutive sorted draws of one mesh and material, drawn with one instanced call
+struct InstanceRun {
+	VkDescriptorSet materialDescriptorSet;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+};
+
+// What one recording slot recorded
+struct RecordingStats {
+	uint32_t drawCalls;
+	uint32_t materialBinds;
+};
+
+// Transforms of the CPU path instances for one frame in flight, read through gl_InstanceIndex
+struct InstanceFrame {
+	AllocatedBuffer buffer;
+	glm::mat4* transforms;
+	uint32_t capacity;
+	VkDescriptorSet descriptor;
+};
+
+// Per draw input of the GPU driven path, matches DrawData in cull.comp and deferred_indirect.vert
+struct GPUDrawData {
+	glm::mat4 transform;
+	// Object space centre and radius
+	glm::vec4 boundingSphere;
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t batchIndex;
+	uint32_t visibilityId;
+	uint32_t padding[3];
+};
+
+struct GPUCullPushConstants {
+	std::array<glm::vec4, FRUSTUM_PLANE_COUNT> planes;
+	uint32_t drawCount;
+	uint32_t compact;
+	// 0 draws what was visible last frame, 1 draws the rest that passes the depth pyramid
+	uint32_t phase;
+	uint32_t visibilityStamp;
+	// Offsets of the second phase in the count and command buffers
+	uint32_t batchStride;
+	uint32_t commandStride;
+};
+
+// Draws sharing a material, given a contiguous range of the indirect command buffer
+struct IndirectBatch {
+	uint32_t materialId;
+	uint32_t firstCommand;
+	uint32_t drawCount;
+};
+
+// Buffers the GPU driven path needs for one frame in flight
+struct GPUDrivenFrame {
+	// Mapped, written by the CPU every frame
+	AllocatedBuffer drawBuffer;
+	GPUDrawData* draws;
+	AllocatedBuffer batchBuffer;
+	uint32_t* batchFirstCommands;
+	// Written by the cull shader, one region per phase
+	AllocatedBuffer commandBuffer;
+	// Draws per phase and occluded draws, followed by the visible draws of each batch of each phase
+	AllocatedBuffer countBuffer;
+	// Which draws the first phase drew
+	AllocatedBuffer drawFlagBuffer;
+	// Totals copied back once the frame has finished
+	AllocatedBuffer readbackBuffer;
+	uint32_t* readbackCounts;
+	VkDescriptorSet descriptor;
+	// Reduce the first phase depth into the max depth pyramid, a transient image of the render graph
+	std::vector<VkDescriptorSet> depthReduceDescriptors;
+	// Depth aspect of the deferred depth attachment
+	VkImageView depthView;
+	// Draws sent to the cull shader the last time this frame was recorded, zero when the CPU path was used
+	uint32_t drawCount;
 };
 
 constexpr size_t FRAME_OVERLAP = 3;
@@ -74,11 +190,45 @@ class VulkanRenderer {
 
 	VkPipelineLayout deferredPipelineLayout;
 	Pipeline deferredPipeline;
+	// Framebuffer of the frame being recorded, set once its swapchain image has been acquired
+	VkFramebuffer deferredFramebuffer = VK_NULL_HANDLE;
+	// Compact G-buffers store octahedral normals and albedo only, the lighting subpass reads positions back from depth
+	bool compactGBuffer = true;
+	// Colour attachments the G-buffer subpass writes
+	std::vector<uint32_t> gBufferAttachments;
+	VkDescriptorSetLayout instanceSetLayout;
+	std::vector<InstanceFrame> instanceFrames;
 
-	VkRenderPass imguiRenderPass;
+	// GPU driven path. Meshes are culled by a compute shader which writes the indirect draws of the deferred pass
+	bool gpuDrivenSupported = false;
+	bool gpuDrivenEnabled = false;
+	bool drawIndirectCountSupported = false;
+	// Without it every batch draws all of its commands and culled ones are skipped by their instance count
+	bool drawIndirectCountEnabled = true;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+	VkDescriptorSetLayout gpuDrivenSetLayout;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline cullPipeline;
+	VkPipelineLayout deferredIndirectPipelineLayout;
+	VkPipeline deferredIndirectPipeline;
+	std::vector<GPUDrivenFrame> gpuDrivenFrames;
+	std::vector<IndirectBatch> indirectBatches;
+	// Frame each object was last seen in, indexed by visibility id
+	AllocatedBuffer visibilityBuffer;
+	// Deferred render pass variants of the GPU driven path. The first phase stores the G-buffer for the depth pyramid,
+	// the second draws on top of it and runs the lighting subpass
+	VkRenderPass deferredFirstPhaseRenderPass;
+	VkRenderPass deferredLoadRenderPass;
+	std::vector<VkExtent2D> depthPyramidExtents;
+	VkSampler depthPyramidSampler;
+	VkDescriptorPool depthPyramidDescriptorPool;
+	VkDescriptorSetLayout depthReduceSetLayout;
+	VkPipelineLayout depthReducePipelineLayout;
+	VkPipeline depthReducePipeline;
+	// Batch of each material this frame, UINT32_MAX if it has none
+	std::vector<uint32_t> materialBatches;
 
-	// Framebuffer attachment sampler
-	VkSampler framebufferAttachmentSampler;
+	VkRenderPass imguiRenderPass;
 
 	// VMA
 	VmaAllocator allocator;
@@ -111,14 +261,38 @@ class VulkanRenderer {
 	UploadContext uploadContext;
 	VkQueue transferQueue;
 	uint32_t transferQueueFamily;
+	StagingRingBuffer stagingRingBuffer;
+	FrameArena frameArena;
+	// Dynamic offset of this frame's camera data in the frame arena
+	uint32_t cameraOffset = 0;
+	RenderGraph renderGraph;
 
 	// SDL
 	SDL_Window* window;
 
+	JobSystem* jobSystem;
+
 	size_t framenumber = 0;
 
 	// SubSystems
 	LightingSystem lightingSystem{};
+	// Point lights binned per cluster for the lighting subpass, by a compute shader unless it is turned off
+	LightClusters lightClusters;
+	bool gpuLightClusteringEnabled = true;
+	VkPipelineLayout lightClusterPipelineLayout;
+	VkPipeline lightClusterPipeline;
+
+	// Culling, kept between frames to reuse the allocations
+	std::vector<DrawCandidate> drawCandidates;
+	CullSpheres candidateSpheres;
+	std::vector<uint32_t> visibleDraws;
+	std::vector<size_t> cullBatchCounts;
+	RenderQueue renderQueue;
+	std::vector<InstanceRun> instanceRuns;
+	// Secondary command buffers each frame can record into at once
+	size_t recordingSlotCount;
+	std::vector<RecordingStats> recordingStats;
+	RenderStats renderStats{};
 
 	void initialiseFramedataStructures();
 	void initialiseSwapchain();
@@ -129,24 +303,91 @@ class VulkanRenderer {
 	void initialisePipelines();
 	void initialiseGlobalDescriptors();
 	void initialiseImgui();
+	void initialiseStagingRingBuffer();
+	void initialiseFrameArena();
+	void initialiseRenderGraph();
+	void initialiseTimestampQueries();
+	void initialiseLightClusters();
 
 	void initialiseDeferredPipeline();
 	void initialisePhongPipeline();
+	void initialiseGPUDrivenResources();
+	void initialiseInstanceBuffers();
+	// Built from the deferred pipeline builder so the fixed function state matches
+	void initialiseDeferredIndirectPipeline(PipelineBuilder* pipelineBuilder);
+	// Needs the deferred depth attachments
+	void initialiseDepthPyramid();
+	// Needs the global descriptor set layout
+	void initialiseLightClusterPipeline();
 
-	void drawObjects(VkCommandBuffer cmd, std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<ModelResource>* modelResourceIds, std::vector<size_t>* ids, Camera* camera);
+	// Returns the camera data of the frame
+	GPUCameraData updateCameraBuffer(Camera* camera);
+	void drawObjects(VkCommandBuffer cmd, std::vector<ModelRenderComponents>* modelRenderComponents, const GeometryPool* geometryPool, std::vector<RenderObject>* renderObjects, const glm::mat4& viewProj);
+	// Writes the draw data and material batches of every mesh for the cull shader. Returns false if they do not fit,
+	// in which case the frame is drawn with the CPU path
+	bool prepareGPUDrivenDraws(std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<RenderObject>* renderObjects);
+	// Recorded outside the render pass. Barriers against the passes around it come from the render graph
+	void recordCullDispatch(VkCommandBuffer cmd, const glm::mat4& viewProj, uint32_t phase);
+	// Whether draw counts come from the cull shader. Otherwise it writes every draw and empties the culled ones
+	bool useDrawIndirectCount();
+	// Reduces the depth of the first phase. Expects the depth readable and the pyramid in the general layout
+	void recordDepthPyramid(VkCommandBuffer cmd, VkImage depthPyramid);
+	// Points the reduction and the cull shader at the depth pyramid the render graph placed for this frame
+	void writeDepthPyramidDescriptors(RenderGraphResource depthPyramid);
+	void drawObjectsIndirect(VkCommandBuffer cmd, const GeometryPool* geometryPool, uint32_t phase);
+	// Bins the point lights into the clusters of this frame. Recorded outside the render pass
+	void recordLightClusterDispatch(VkCommandBuffer cmd);
+	// Moves the deferred render pass on to the lighting subpass and shades the G-buffer from its input attachments
+	void recordLightingSubpass(VkCommandBuffer cmd);
+	// Macros the deferred and lighting shaders are compiled with for the G-buffer layout
+	std::vector<std::string> getGBufferDefinitions();
+	// Does nothing where timestamps are unsupported
+	void writeTimestamp(VkCommandBuffer cmd, uint32_t query);
+	// G-buffer and lighting times of the last frame recorded with this index
+	void readTimestamps(size_t frameIndex);
+	void readGPUDrivenStats(size_t frameIndex);
+	// Fills visibleDraws with the draw candidates inside the frustum, in candidate order
+	void cullDraws(std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<RenderObject>* renderObjects, const glm::mat4& viewProj);
+	// Fills the render queue with the visible draws sorted by state, then front to back
+	void sortVisibleDraws(std::vector<RenderObject>* renderObjects, const glm::mat4& viewProj);
+	// Records the runs in [firstRun, lastRun) into the secondary command buffer of a slot. Slots are independent, so
+	// they can be recorded on different threads
+	void recordDrawSlot(const GeometryPool* geometryPool, size_t slot, size_t firstRun, size_t lastRun);
+	// Grows the instance buffer of a frame whose fence has already been waited on
+	void reserveInstances(InstanceFrame* frame, uint32_t count);
 
 	size_t addMaterial(Material&& material, std::vector<AllocatedImage>* images);
 
 	//AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
-	size_t createImageFromFile(std::string& file);
+	// Decoding is thread safe and can run on the job system
+	static bool decodeImageFile(const std::string& file, DecodedImage* image);
+	// Takes ownership of an already decoded image, otherwise decodes the file itself
+	size_t createImageFromFile(std::string& file, DecodedImage* decodedImage = nullptr);
 	//void immediateSubmit(UploadContext uploadContext, std::function<void(VkCommandBuffer cmd)>&& function);
 
 	size_t getCurrentFrameIndex();
 public:
-	void initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window);
-	void draw(std::vector<ModelRenderComponents>* modelRenderComponents, std::vector<ModelResource>* modelResourceIds, std::vector<size_t>* ids, Camera* camera);
+	void initialise(const VulkanDetails* vulkanDetails, QueueDetails graphicsQueue, QueueDetails transferQueue, QueueDetails imageTransferQueue, SDL_Window* window, JobSystem* jobSystem);
+	void draw(std::vector<ModelRenderComponents>* modelRenderComponents, const GeometryPool* geometryPool, std::vector<RenderObject>* renderObjects, Camera* camera);
 	void cleanup();
-	size_t uploadMaterial(MaterialInfo model);
+	size_t uploadMaterial(MaterialInfo model, DecodedImage* decodedDiffuse = nullptr);
+	// Textures are decoded in parallel, then uploaded from this thread
 	size_t uploadModelMaterials(std::vector<MaterialInfo>* materials);
 	VmaAllocator getVmaAllocator();
+	const StagingRingBufferStats* getStagingStats();
+	const FrameArenaStats* getFrameArenaStats();
+	// Counts of the last recorded frame
+	const RenderStats* getRenderStats();
+	// Passes, barriers and transient memory of the last recorded frame
+	const RenderGraphStats* getRenderGraphStats();
+	// Has to be called before initialise, the G-buffer only stays in tile memory without it. Falls back to the CPU path
+	// if the device lacks the features it needs. Stats of the GPU driven path lag a few frames
+	void setGPUDrivenRendering(bool enabled);
+	// Has to be called before initialise, the deferred pipelines are built for one layout
+	void setCompactGBuffer(bool enabled);
+	// Bins point lights on the CPU when disabled. The compute path still takes over on frames the staging ring is full
+	void setGPULightClustering(bool enabled);
+	// Disabling forces the multi draw indirect path, which every device running the GPU driven path has to take
+	// when VK_KHR_draw_indirect_count is missing
+	void setDrawIndirectCount(bool enabled);
 };
\ No newline at end of file
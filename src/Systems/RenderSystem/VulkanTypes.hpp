@@ -1,6 +1,8 @@
 #pragma once
 #include <vk_mem_alloc.h>
 #include <vector>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 
 struct AllocatedBuffer {
 	VkBuffer buffer;
@@ -14,6 +16,23 @@ struct AllocatedImage {
 	VkImageView imageView{};
 };
 
+// Interleaved vertex layout used by every mesh in the geometry pool
+struct Vertex {
+	glm::vec3 position;
+	glm::vec2 texCoord;
+	glm::vec3 normal;
+};
+
+// Device local vertex and index buffers shared by every mesh. Meshes are suballocated linearly and never freed
+struct GeometryPool {
+	AllocatedBuffer vertexBuffer;
+	AllocatedBuffer indexBuffer;
+	uint32_t vertexCapacity;
+	uint32_t vertexCount;
+	uint32_t indexCapacity;
+	uint32_t indexCount;
+};
+
 struct VertexInputDescription {
 	std::vector<VkVertexInputBindingDescription> bindings;
 	std::vector<VkVertexInputAttributeDescription> attributes;
@@ -30,6 +49,10 @@ struct VulkanDetails {
 	VkPhysicalDevice chosenGPU;
 	VkSurfaceKHR surface;
 	VkPhysicalDeviceProperties gpuProperties;
+	// Optional features the GPU driven path depends on
+	bool multiDrawIndirect;
+	bool drawIndirectFirstInstance;
+	bool drawIndirectCount;
 };
 
 struct QueueDetails {
@@ -42,6 +65,14 @@ struct UploadContext {
 	VkCommandPool commandPool;
 };
 
+// An in flight transfer submission. The staging buffer and command buffer are released once the fence signals
+struct UploadTicket {
+	uint64_t id;
+	VkFence fence;
+	VkCommandBuffer commandBuffer;
+	AllocatedBuffer stagingBuffer;
+};
+
 struct ModelVertexInputDescription : VertexInputDescription {
 	static VertexInputDescription getVertexDescription();
 };
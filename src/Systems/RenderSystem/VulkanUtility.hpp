@@ -4,8 +4,10 @@
 #include <deque>
 #include <functional>
 #include <iostream>
+#include <memory>
 
 #include "VulkanTypes.hpp"
+#include "StagingRingBuffer.hpp"
 
 struct DeletionQueue {
 	std::deque<std::function<void()>> deletors;
@@ -57,60 +59,56 @@ namespace VulkanUtility {
 	template<class T>
 	concept NotVec = !is_specialisation<T, std::vector>;
 
+	// The data is copied on the first frame the staging ring has room for it, so the buffer must not be read before
+	// then. Only data larger than the whole ring is staged through a buffer of its own with a blocking submit
 	template<NotVec T>
-	AllocatedBuffer allocateGPUOnlyBuffer(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator allocator, 
+	AllocatedBuffer allocateGPUOnlyBuffer(VkDevice device, VkQueue graphicsQueue, UploadContext uploadContext, VmaAllocator allocator, StagingRingBuffer* stagingRingBuffer,
 										  T* buffer, size_t size, VkBufferUsageFlags usageFlags) {
-		AllocatedBuffer allocatedBuffer{};
-		AllocatedBuffer stagingBuffer{};
-		size_t bufferSize = size;
-
-		VkBufferCreateInfo stagingBufferInfo{};
-		stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		stagingBufferInfo.pNext = nullptr;
-
-		stagingBufferInfo.size = bufferSize;
-		stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-
-		// Let VMA know this data should be in CPU RAM
-		VmaAllocationCreateInfo vmaAllocInfo{};
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-
-		VkResult result = vmaCreateBuffer(allocator, &stagingBufferInfo, &vmaAllocInfo, &stagingBuffer.buffer, &stagingBuffer.allocation, nullptr);
+		AllocatedBuffer allocatedBuffer = VulkanUtility::createBuffer(allocator, size, usageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		allocatedBuffer.size = size;
 
-		if (result) {
-			std::cout << "Couldn't create staging buffer: " << result << std::endl;
-			abort();
-		}
+		auto recordCopy = [=](VkCommandBuffer cmd, VkBuffer stagingBuffer, VkDeviceSize stagingOffset) {
+			VkBufferCopy copy{};
+			copy.dstOffset = 0;
+			copy.srcOffset = stagingOffset;
+			copy.size = size;
+			vkCmdCopyBuffer(cmd, stagingBuffer, allocatedBuffer.buffer, 1, &copy);
 
-		VulkanUtility::copyToBuffer<T>(allocator, &stagingBuffer, buffer, size);
+			VkMemoryBarrier copyBarrier{};
+			copyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			copyBarrier.pNext = nullptr;
+			copyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			copyBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 
-		VkBufferCreateInfo vertexBufferInfo{};
-		vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		vertexBufferInfo.pNext = nullptr;
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &copyBarrier, 0, nullptr, 0, nullptr);
+		};
 
-		vertexBufferInfo.size = bufferSize;
-		vertexBufferInfo.usage = usageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		if (size > stagingRingBuffer->getCapacity()) {
+			AllocatedBuffer stagingBuffer = VulkanUtility::createBuffer(allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+			VulkanUtility::copyToBuffer<T>(allocator, &stagingBuffer, buffer, size);
 
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			VulkanUtility::immediateSubmit(device, graphicsQueue, uploadContext, [=](VkCommandBuffer cmd) {
+				recordCopy(cmd, stagingBuffer.buffer, 0);
+			});
 
-		result = vmaCreateBuffer(allocator, &vertexBufferInfo, &vmaAllocInfo, &allocatedBuffer.buffer, &allocatedBuffer.allocation, nullptr);
+			vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+			stagingRingBuffer->addDedicatedUpload();
 
-		if (result) {
-			std::cout << "Couldn't create vertex buffer: " << result << std::endl;
-			abort();
+			return allocatedBuffer;
 		}
 
-		VulkanUtility::immediateSubmit(device, graphicsQueue, uploadContext, [=](VkCommandBuffer cmd) {
-			VkBufferCopy copy{};
-			copy.dstOffset = 0;
-			copy.srcOffset = 0;
-			copy.size = bufferSize;
-			vkCmdCopyBuffer(cmd, stagingBuffer.buffer, allocatedBuffer.buffer, 1, &copy);
-		});
+		// The caller's data may be gone by the time the upload is staged
+		auto data = std::make_shared<std::vector<uint8_t>>(reinterpret_cast<const uint8_t*>(buffer), reinterpret_cast<const uint8_t*>(buffer) + size);
 
-		vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+		StagingUpload upload{};
+		upload.size = size;
+		upload.alignment = 16;
+		upload.write = [data](void* staging) {
+			memcpy(staging, data->data(), data->size());
+		};
+		upload.record = recordCopy;
 
-		allocatedBuffer.size = size;
+		stagingRingBuffer->queueUpload(std::move(upload));
 
 		return allocatedBuffer;
 	}
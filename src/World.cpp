@@ -4,32 +4,309 @@
 #include <imgui_impl_sdl.h>
 #include <imgui_impl_vulkan.h>
 #include <imgui.h>
+#include <iostream>
 
-size_t World::addEntity(EntityCreateInfo* info) {
-	AddEntityInfo addEntityInfo{};
+constexpr float SYSTEM_TIMING_LOG_INTERVAL_SECONDS = 5.0f;
+// Cull and build draws on the GPU where the device supports it
+constexpr bool GPU_DRIVEN_RENDERING = true;
+// Read GPU driven draw counts from a buffer where VK_KHR_draw_indirect_count is available. Set to false to check the
+// multi draw fallback on a device that has the extension, e.g. lavapipe with
+// VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json
+constexpr bool GPU_DRIVEN_DRAW_INDIRECT_COUNT = true;
+// Rebuild world positions from depth and pack normals instead of storing both at full precision. The logged G-buffer
+// bytes and timings of a run with each setting compare the two layouts
+constexpr bool COMPACT_GBUFFER = true;
+// Bin point lights into clusters with a compute shader rather than on the CPU
+constexpr bool GPU_LIGHT_CLUSTERING = true;
 
-    // Create attributes
-    if ((info->flags & EntityCreateInfoFlags::HasModel) != 0) {
-        addEntityInfo.modelResource = this->resourceManager->loadModel(info->directory, info->model);
+static uint64_t packEntityHandle(EntityHandle handle) {
+	return (static_cast<uint64_t>(handle.generation) << 32) | handle.index;
+}
+
+static EntityHandle unpackEntityHandle(uint64_t packed) {
+	return { static_cast<uint32_t>(packed), static_cast<uint32_t>(packed >> 32) };
+}
+
+// Box around the transformed box, from the transformed centre and the absolute matrix applied to the extents
+static AABB transformBounds(const AABB& bounds, const glm::mat4& transform) {
+	glm::vec3 center = glm::vec3(transform * glm::vec4(bounds.center(), 1.0f));
+	glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+	glm::vec3 worldExtent{ 0.0f };
+
+	for (int column = 0; column < 3; column++) {
+		worldExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+	}
+
+	return { center - worldExtent, center + worldExtent };
+}
+
+EntityHandle World::addEntity(EntityCreateInfo* info) {
+	std::vector<EntityCreateInfo> infos = { *info };
+	return this->addEntities(&infos)[0];
+}
+
+std::vector<EntityHandle> World::addEntities(std::vector<EntityCreateInfo>* infos) {
+	// Gather every model first so they are imported in parallel
+	std::vector<ModelLoadRequest> modelRequests;
+
+	for (auto& info : *infos) {
+		if ((info.flags & EntityCreateInfoFlags::HasModel) != 0) {
+			ModelLoadRequest request{};
+			request.directory = info.directory;
+			request.modelFileName = info.model;
+			modelRequests.push_back(request);
+		}
+	}
+
+	std::vector<ModelResource> modelResources = this->resourceManager->loadModels(&modelRequests);
+	size_t nextModelResource = 0;
+
+	std::vector<EntityHandle> handles;
+	handles.reserve(infos->size());
+
+	for (auto& info : *infos) {
+		EntityHandle handle = this->entities.createEntity();
+
+		// Create attributes
+		if ((info.flags & (EntityCreateInfoFlags::HasModel | EntityCreateInfoFlags::HasPosition)) != 0) {
+			uint32_t parentNode = TRANSFORM_NO_PARENT;
+
+			if ((info.flags & EntityCreateInfoFlags::HasParent) != 0) {
+				TransformComponent* parentTransform = this->entities.getComponent<TransformComponent>(info.parent);
+
+				if (parentTransform != nullptr) {
+					parentNode = parentTransform->node;
+				}
+			}
+
+			TransformComponent transform{};
+			transform.node = this->transforms.create(info.position, glm::quat{ 1.0f, 0.0f, 0.0f, 0.0f }, glm::vec3{ 1.0f }, parentNode);
+
+			this->entities.addComponent(handle, transform);
+		}
+
+		if ((info.flags & EntityCreateInfoFlags::HasModel) != 0) {
+			ModelResource modelResource = modelResources[nextModelResource++];
+
+			auto* materials = &this->resourceManager->getModelComponents()->at(modelResource.modelComponentId).meshes.materials;
+			modelResource.materialGroupId = this->renderSystem->uploadModelMaterials(materials);
+
+			this->entities.addComponent(handle, modelResource);
+
+			const ModelComponent* model = &this->resourceManager->getModelComponents()->at(modelResource.modelComponentId);
+			bool loaded = (modelResource.flags & (ModelResourceFlags::ErrorLoadingModel | ModelResourceFlags::ErrorCreatingBuffers)) == 0;
+
+			if (loaded && !model->meshBounds.empty()) {
+				// Mesh bounds are in mesh space, the model bounds enclose them after their node transforms
+				const std::vector<glm::mat4>* meshMatrices = &this->resourceManager->getModelDetails()->at(modelResource.modelDetailsId).meshMatrices;
+				SpatialComponent spatial{};
+
+				for (size_t meshIndex = 0; meshIndex < model->meshBounds.size(); meshIndex++) {
+					AABB meshBounds = { model->meshBounds[meshIndex].aabbMin, model->meshBounds[meshIndex].aabbMax };
+
+					if (meshIndex < meshMatrices->size()) {
+						meshBounds = transformBounds(meshBounds, meshMatrices->at(meshIndex));
+					}
+
+					spatial.localBounds = meshIndex == 0 ? meshBounds : AABB::merge(spatial.localBounds, meshBounds);
+				}
+
+				// Inserted once the world transforms are known
+				spatial.proxy = BVH_NULL_NODE;
+
+				this->entities.addComponent(handle, spatial);
+			}
+		}
+
+		if ((info.flags & EntityCreateInfoFlags::Moves) != 0) {
+			this->entities.addComponent(handle, VelocityComponent{ info.velocity });
+		}
+
+		if ((info.flags & EntityCreateInfoFlags::Renderable) != 0) {
+			this->entities.addComponent(handle, RenderableComponent{ 1 });
+		}
+
+		handles.push_back(handle);
+	}
+
+	this->transforms.update();
+
+	for (EntityHandle handle : handles) {
+		SpatialComponent* spatial = this->entities.getComponent<SpatialComponent>(handle);
+		TransformComponent* transform = this->entities.getComponent<TransformComponent>(handle);
+
+		if (spatial != nullptr && transform != nullptr) {
+			AABB worldBounds = transformBounds(spatial->localBounds, this->transforms.getWorldMatrix(transform->node));
+			spatial->proxy = this->spatialIndex.insert(worldBounds, packEntityHandle(handle));
+		}
+	}
 
-		auto* materials = &this->resourceManager->getModelComponents()->at(addEntityInfo.modelResource.modelComponentId).meshes.materials;
-		addEntityInfo.modelResource.materialGroupId = this->renderSystem->uploadModelMaterials(materials);
-    }
+	return handles;
+}
+
+bool World::destroyEntity(EntityHandle handle) {
+	SpatialComponent* spatial = this->entities.getComponent<SpatialComponent>(handle);
+
+	if (spatial != nullptr) {
+		this->spatialIndex.remove(spatial->proxy);
+	}
+
+	TransformComponent* transform = this->entities.getComponent<TransformComponent>(handle);
+
+	// Children keep their local transform and become roots
+	if (transform != nullptr) {
+		this->transforms.destroy(transform->node);
+	}
+
+	return this->entities.destroyEntity(handle);
+}
+
+void World::registerSystems() {
+	// Non component state the systems share gets a bit through the same type ids as components
+	SystemDescription cameraSystem{};
+	cameraSystem.name = "Camera";
+	cameraSystem.writes = componentMask<Camera>();
+	cameraSystem.update = [this](float deltaS) {
+		this->camera.updateCamera(deltaS, this->currentKeyStates);
+	};
+	cameraSystem.mainThread = true;
+
+	SystemDescription movementSystem{};
+	movementSystem.name = "Movement";
+	movementSystem.reads = componentMask<VelocityComponent, TransformComponent>();
+	movementSystem.writes = componentMask<TransformHierarchy>();
+	movementSystem.update = [this](float deltaS) {
+		this->updateMovement(deltaS);
+	};
+
+	// Everything that moves entities runs before this, everything reading world matrices after it
+	SystemDescription transformSystem{};
+	transformSystem.name = "Transforms";
+	transformSystem.writes = componentMask<TransformHierarchy>();
+	transformSystem.update = [this](float deltaS) {
+		this->updateTransforms();
+	};
+
+	SystemDescription spatialIndexSystem{};
+	spatialIndexSystem.name = "Spatial index";
+	spatialIndexSystem.reads = componentMask<TransformComponent, TransformHierarchy, SpatialComponent>();
+	spatialIndexSystem.writes = componentMask<DynamicBVH>();
+	spatialIndexSystem.update = [this](float deltaS) {
+		this->updateSpatialIndex();
+	};
+
+	SystemDescription renderObjectSystem{};
+	renderObjectSystem.name = "Build render objects";
+	renderObjectSystem.reads = componentMask<RenderableComponent, ModelResource, TransformComponent, TransformHierarchy, DynamicBVH, Camera, ResourceManager>();
+	renderObjectSystem.writes = componentMask<RenderObject>();
+	renderObjectSystem.update = [this](float deltaS) {
+		this->buildRenderObjects();
+	};
+
+	SystemDescription renderingSystem{};
+	renderingSystem.name = "Render";
+	renderingSystem.reads = componentMask<RenderObject, Camera>();
+	renderingSystem.writes = componentMask<ResourceManager>();
+	renderingSystem.update = [this](float deltaS) {
+		this->resourceManager->retireCompletedUploads();
+		this->renderSystem->render(this->resourceManager->getModelRenderBuffers(), this->resourceManager->getGeometryPool(), &this->renderObjects, &this->camera);
+	};
+	renderingSystem.mainThread = true;
+
+	this->systemScheduler->addSystem(std::move(cameraSystem));
+	this->systemScheduler->addSystem(std::move(movementSystem));
+	this->systemScheduler->addSystem(std::move(transformSystem));
+	this->systemScheduler->addSystem(std::move(spatialIndexSystem));
+	this->systemScheduler->addSystem(std::move(renderObjectSystem));
+	this->systemScheduler->addSystem(std::move(renderingSystem));
+}
+
+void World::logSystemTimings() {
+	std::cout << "System timings (average ms):" << std::endl;
+
+	for (auto& timing : *this->systemScheduler->getTimings()) {
+		std::cout << "  " << timing.name << ": " << timing.averageMilliseconds << std::endl;
+	}
+
+	const RenderStats* renderStats = this->renderSystem->getRenderStats();
+	std::cout << "Draws submitted: " << renderStats->drawsSubmitted << ", culled: " << renderStats->drawsCulled << ", occluded: " << renderStats->drawsOccluded << std::endl;
+	std::cout << "Draw calls: " << renderStats->drawCalls << ", material binds: " << renderStats->materialBinds << ", avoided: " << renderStats->materialBindsAvoided << std::endl;
+	std::cout << "G-buffer bytes per frame: " << renderStats->gBufferBytes << ", G-buffer ms: " << renderStats->gBufferMilliseconds << ", lighting ms: " << renderStats->lightingMilliseconds << std::endl;
+	std::cout << "Point lights visible: " << renderStats->pointLightsVisible << ", culled: " << renderStats->pointLightsCulled << std::endl;
+	std::cout << "Cluster light indices: " << renderStats->clusterLightIndices << ", dropped: " << renderStats->clusterLightsDropped << std::endl;
+
+	const StagingRingBufferStats* stagingStats = this->renderSystem->getStagingStats();
+	std::cout << "Bytes staged: " << stagingStats->bytesStaged << ", stalls: " << stagingStats->stalls << ", budget deferrals: " << stagingStats->budgetDeferrals << ", wraparounds: " << stagingStats->wraparounds << std::endl;
+	std::cout << "Uploads pending: " << stagingStats->pendingUploads << ", dedicated: " << stagingStats->dedicatedUploads << std::endl;
+}
+
+void World::updateMovement(float deltaS) {
+	this->entities.forEachChunk<TransformComponent, VelocityComponent>([this, deltaS](uint32_t count, EntityHandle* entities, TransformComponent* transforms, VelocityComponent* velocities) {
+		for (uint32_t i = 0; i < count; i++) {
+			this->transforms.translate(transforms[i].node, velocities[i].linear * deltaS);
+		}
+	});
+}
 
-    // Store attributes
-    size_t id = this->entities.addEntity(&addEntityInfo);
+void World::updateTransforms() {
+	this->transforms.update();
+}
 
-    // Pass ids for atttributes
-    if ((info->flags & EntityCreateInfoFlags::Renderable) != 0) {
-        this->renderSystem->addEntity(id);
-    }
+void World::updateSpatialIndex() {
+	// Entities that did not move, directly or through a parent, keep their proxies as they are
+	this->entities.forEachChunk<TransformComponent, SpatialComponent>([this](uint32_t count, EntityHandle* entities, TransformComponent* transforms, SpatialComponent* spatials) {
+		for (uint32_t i = 0; i < count; i++) {
+			if (this->transforms.hasChanged(transforms[i].node)) {
+				this->spatialIndex.update(spatials[i].proxy, transformBounds(spatials[i].localBounds, this->transforms.getWorldMatrix(transforms[i].node)));
+			}
+		}
+	});
 
-    return id;
+	this->spatialIndex.optimise();
+}
+
+void World::buildRenderObjects() {
+	this->renderObjects.clear();
+
+	// Only entities whose bounds touch the view are visited, the renderer then culls their meshes
+	glm::mat4 viewProj = this->camera.generateProjection(static_cast<float>(WIDTH) / static_cast<float>(HEIGHT)) * this->camera.generateView();
+	Frustum frustum = FrustumCulling::extractPlanes(viewProj);
+
+	this->spatialIndex.queryFrustum(frustum.planes.data(), frustum.planes.size(), [this](uint64_t packedHandle) {
+		EntityHandle handle = unpackEntityHandle(packedHandle);
+		RenderableComponent* renderable = this->entities.getComponent<RenderableComponent>(handle);
+
+		if (renderable == nullptr || !renderable->visible) {
+			return;
+		}
+
+		ModelResource* modelResource = this->entities.getComponent<ModelResource>(handle);
+		TransformComponent* transform = this->entities.getComponent<TransformComponent>(handle);
+
+		if (modelResource == nullptr || transform == nullptr) {
+			return;
+		}
+
+		// Models that failed to load or upload have nothing to draw
+		if (modelResource->flags & (ModelResourceFlags::ErrorLoadingModel | ModelResourceFlags::ErrorCreatingBuffers)) {
+			return;
+		}
+
+		// Held back until the model buffers have finished uploading
+		if (!this->resourceManager->isUploadComplete(modelResource->uploadTicket)) {
+			return;
+		}
+
+		this->renderObjects.push_back({ *modelResource, this->transforms.getWorldMatrix(transform->node), handle.index });
+	});
 }
 
 void World::initialise() {
+	// Created on the main thread so it can take part in jobs
+	this->jobSystem = std::make_unique<JobSystem>();
 	this->renderSystem = std::make_unique<RenderSystem>();
-	this->resourceManager = std::make_unique<ResourceManager>();
+	this->resourceManager = std::make_unique<ResourceManager>(this->jobSystem.get());
+	this->systemScheduler = std::make_unique<SystemScheduler>(this->jobSystem.get());
 
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -45,14 +322,23 @@ void World::initialise() {
 	auto transferQueueDetails = this->resourceManager->createTransferQueue();
 	auto graphicsTransferQueueDetails = this->resourceManager->createGraphicsQueue();
 
-	this->renderSystem->initialise(vulkanDetails, graphicsQueueDetails, transferQueueDetails, graphicsTransferQueueDetails, this->window);
+	this->renderSystem->setCompactGBuffer(COMPACT_GBUFFER);
+	this->renderSystem->setGPUDrivenRendering(GPU_DRIVEN_RENDERING);
+	this->renderSystem->initialise(vulkanDetails, graphicsQueueDetails, transferQueueDetails, graphicsTransferQueueDetails, this->window, this->jobSystem.get());
+	this->renderSystem->setGPULightClustering(GPU_LIGHT_CLUSTERING);
+	this->renderSystem->setDrawIndirectCount(GPU_DRIVEN_DRAW_INDIRECT_COUNT);
+
+	std::vector<EntityCreateInfo> entityInfos(1);
+	entityInfos[0].directory = "resources/models/backpack";
+	entityInfos[0].model = "backpack.obj";
+	entityInfos[0].flags |= EntityCreateInfoFlags::HasModel | EntityCreateInfoFlags::Renderable;
 
-	EntityCreateInfo info{};
-	info.directory = "resources/models/backpack";
-	info.model = "backpack.obj";
-	info.flags |= EntityCreateInfoFlags::HasModel | EntityCreateInfoFlags::Renderable;
+	this->addEntities(&entityInfos);
 
-	this->addEntity(&info);
+	// Model buffers are uploaded asynchronously. Make sure they have landed before the first frame uses them
+	this->resourceManager->waitForUploads();
+
+	this->registerSystems();
 
 	// Eat mouse
 	SDL_SetRelativeMouseMode(SDL_TRUE);
@@ -62,8 +348,9 @@ void World::run() {
 	SDL_Event e;
 	bool exit = false;
 
-	Camera camera{};
-	camera.setPosition({ 0.0, 2.0, 10.0 });
+	float timeSinceTimingLog = 0.0f;
+
+	this->camera.setPosition({ 0.0, 2.0, 10.0 });
 
 	while (!exit) {
 		// Delta seconds
@@ -72,7 +359,7 @@ void World::run() {
 		float duration_seconds = std::chrono::duration<float>(current_time - time).count();
 		time = current_time;
 
-		const uint8_t* currentKeyStates = SDL_GetKeyboardState(NULL);
+		this->currentKeyStates = SDL_GetKeyboardState(NULL);
 
 		while (SDL_PollEvent(&e) != 0) {
 			//ImGui_ImplSDL2_ProcessEvent(&e);
@@ -98,13 +385,11 @@ void World::run() {
 					float pitchChange = sensitivity * e.motion.yrel;
 					//std::cout << e.motion.xrel << " - " << e.motion.yrel << "\n";
 					//auto rotation_matrix = glm::eulerAngleXY(glm::radians(this->camera_pitch), glm::radians(this->camera_yaw));
-					camera.updateLookDirection(pitchChange, yawChange);
+					this->camera.updateLookDirection(pitchChange, yawChange);
 				}
 			}
 		}
 
-		camera.updateCamera(duration_seconds, currentKeyStates);
-
 		//auto cameraPos = camera.getPosition();
 		//std::cout << "Camera pos X: " << cameraPos.x << " Y: " << cameraPos.y << " Z: " << cameraPos.z << std::endl;
 		/*ImGui_ImplVulkan_NewFrame();
@@ -113,7 +398,14 @@ void World::run() {
 
 		//ImGui::ShowDemoWindow();
 
-		this->renderSystem->render(this->resourceManager->getModelRenderBuffers(), this->entities.getModelResourceIds(), &camera);
+		this->systemScheduler->run(duration_seconds);
+
+		timeSinceTimingLog += duration_seconds;
+
+		if (timeSinceTimingLog >= SYSTEM_TIMING_LOG_INTERVAL_SECONDS) {
+			this->logSystemTimings();
+			timeSinceTimingLog = 0.0f;
+		}
 	}
 
 	renderSystem->cleanup();
@@ -1,9 +1,15 @@
 #pragma once
 #include "Systems/RenderSystem/RenderSystem.hpp"
 #include "Components/ModelComponent.h"
+#include "Components/TransformComponent.hpp"
+#include "Components/SpatialComponent.hpp"
 #include "Entities.hpp"
 
 #include <memory>
+#include <Core/JobSystem.hpp>
+#include <Core/SystemScheduler.hpp>
+#include <Core/DynamicBVH.hpp>
+#include <Core/TransformHierarchy.hpp>
 #include <Managers/ResourceManager.hpp>
 
 constexpr int WIDTH = 1920;
@@ -14,7 +20,8 @@ typedef enum EntityCreateInfoFlags {
 	HasModel = 1 << 1,
 	HasPosition = 1 << 2,
 	Moves = 1 << 3,
-	Physicalised = 1 << 4
+	Physicalised = 1 << 4,
+	HasParent = 1 << 5
 } EntityCreateInfoFlags;
 
 struct EntityCreateInfo {
@@ -22,17 +29,44 @@ struct EntityCreateInfo {
 	uint64_t physicaliseFlags;
 	std::string directory;
 	std::string model;
+	glm::vec3 position;
+	glm::vec3 velocity;
+	// Position is then relative to the parent, which must have a transform
+	EntityHandle parent;
 };
 
 class World {
+	// Declared first so it outlives everything that submits jobs
+	std::unique_ptr<JobSystem> jobSystem;
 	std::unique_ptr<RenderSystem> renderSystem;
 	std::unique_ptr<ResourceManager> resourceManager;
+	std::unique_ptr<SystemScheduler> systemScheduler;
 
 	Entities entities;
+	// Transforms of every entity with a TransformComponent. World matrices are only recomputed for moved subtrees
+	TransformHierarchy transforms;
+	// Bounds of every entity with a model, for visibility and proximity queries. Leaves hold packed entity handles
+	DynamicBVH spatialIndex;
+	// Rebuilt from the entities every frame
+	std::vector<RenderObject> renderObjects;
+
+	Camera camera{};
+	const uint8_t* currentKeyStates = nullptr;
 	
 	SDL_Window* window;
 
-	size_t addEntity(EntityCreateInfo* info);
+	EntityHandle addEntity(EntityCreateInfo* info);
+	// Models of all the entities are loaded together on worker threads
+	std::vector<EntityHandle> addEntities(std::vector<EntityCreateInfo>* infos);
+	// Stale handles are ignored and return false
+	bool destroyEntity(EntityHandle handle);
+
+	void registerSystems();
+	void logSystemTimings();
+	void updateMovement(float deltaS);
+	void updateTransforms();
+	void updateSpatialIndex();
+	void buildRenderObjects();
 
 public:
 	void initialise();